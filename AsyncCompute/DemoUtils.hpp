@@ -38,6 +38,7 @@
 #include <wrl.h>
 #include <locale>
 #include <codecvt>
+#include <vector>
 #include <shellapi.h>
 
 //---------------------------------------------------------------------------//
@@ -63,6 +64,7 @@ MAKE_SMART_COM_PTR(ID3D12DescriptorHeap);
 MAKE_SMART_COM_PTR(ID3D12Debug);
 MAKE_SMART_COM_PTR(ID3D12StateObject);
 MAKE_SMART_COM_PTR(ID3D12PipelineState);
+MAKE_SMART_COM_PTR(ID3D12QueryHeap);
 MAKE_SMART_COM_PTR(ID3D12RootSignature);
 MAKE_SMART_COM_PTR(ID3DBlob);
 MAKE_SMART_COM_PTR(IDxcBlobEncoding);
@@ -480,6 +482,9 @@ struct DemoInfo {
   // Adapter info
   bool m_UseWarpDevice;
 
+  // Command line (UTF-8, with the program name) for the demo's own options
+  std::vector<std::string> m_CmdArgs;
+
   // Root assets path
   std::wstring m_AssetsPath;
 
@@ -514,6 +519,10 @@ demoInit(DemoInfo* p_Demo, UINT p_Width, UINT p_Height, std::wstring p_Name) {
 //---------------------------------------------------------------------------//
 inline void demoParseCmdArgs(
     DemoInfo* p_Demo, _In_reads_(p_Argc) WCHAR* p_Argv[], int p_Argc) {
+  p_Demo->m_CmdArgs.clear();
+  for (int i = 0; i < p_Argc; ++i) {
+    p_Demo->m_CmdArgs.push_back(WideStrToStr(p_Argv[i]));
+  }
   for (int i = 1; i < p_Argc; ++i) {
     if (_wcsnicmp(p_Argv[i], L"-warp", wcslen(p_Argv[i])) == 0 ||
         _wcsnicmp(p_Argv[i], L"/warp", wcslen(p_Argv[i])) == 0) {
@@ -0,0 +1,586 @@
+#include "NBodyBarnesHut.hpp"
+#include "NBodySoa.hpp"
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+// Levels built by the calling thread, the subtrees below them (up to 8^3)
+// are independent tasks for the pool.
+static constexpr uint32_t NBodyTreeTopLevels = 3;
+// Targets per near field kernel call (stack scratch of nbodyOctreeForceLeaves)
+static constexpr uint32_t NBodyTreeChunk = 256;
+// Per accepted cell: center of mass, mass and the 6 quadrupole terms
+static constexpr uint32_t NBodyCellFloats = 10;
+
+namespace {
+struct TreeTask {
+  uint32_t m_Begin;
+  uint32_t m_End;
+  std::vector<NBodyTreeNode> m_Nodes;
+};
+
+// Interaction lists of one group walk, Structure-of-Arrays so that they can
+// be handed to the direct and cell kernels as is.
+struct GroupLists {
+  std::vector<float> m_Bodies[4]; // x, y, z, mass
+  std::vector<float> m_Cells[NBodyCellFloats];
+};
+
+struct BuildJob {
+  NBodyOctree* m_Tree;
+  const float* m_PosX;
+  const float* m_PosY;
+  const float* m_PosZ;
+  const float* m_Mass;
+  TreeTask* m_Tasks;
+};
+} // namespace
+
+//---------------------------------------------------------------------------//
+/// Local functions:
+//---------------------------------------------------------------------------//
+// Child (0..7) of the cell at p_Level that contains p_Key.
+static uint32_t _childDigit(uint64_t p_Key, uint32_t p_Level) {
+  return static_cast<uint32_t>(
+      (p_Key >> (3 * (NBodyMortonLevels - p_Level - 1))) & 7);
+}
+//---------------------------------------------------------------------------//
+// Splits the Morton range [p_Begin, p_End) of a cell at p_Level into its 8
+// children: child c owns [p_Bounds[c], p_Bounds[c + 1]).
+static void _splitCell(
+    const NBodyOctree* p_Tree,
+    uint32_t p_Begin,
+    uint32_t p_End,
+    uint32_t p_Level,
+    uint32_t* p_Bounds) {
+  const uint64_t* keys = p_Tree->m_Morton.m_Keys;
+  p_Bounds[0] = p_Begin;
+  for (uint32_t c = 0; c < 8; ++c) {
+    p_Bounds[c + 1] = static_cast<uint32_t>(
+        std::partition_point(
+            keys + p_Bounds[c],
+            keys + p_End,
+            [&](uint64_t k) { return _childDigit(k, p_Level) <= c; }) -
+        keys);
+  }
+}
+//---------------------------------------------------------------------------//
+static bool _isLeaf(const NBodyOctree* p_Tree, uint32_t p_Count, uint32_t p_Level) {
+  return p_Count <= p_Tree->m_LeafSize || p_Level == NBodyMortonLevels;
+}
+//---------------------------------------------------------------------------//
+// Modified Barnes criterion: the cell is accepted for bodies farther than
+// l / theta + delta from its center of mass, where delta is the offset of the
+// center of mass from the geometric center. Unlike the plain l / d < theta
+// test this stays safe for bodies inside a cell with an off-center mass.
+static float _openRadiusSqr(
+    const NBodyOctree* p_Tree, const NBodyTreeNode& p_Node, uint64_t p_Key) {
+  const NBodyMortonOrder& morton = p_Tree->m_Morton;
+  const float edge = morton.m_Size / float(1u << p_Node.m_Level);
+  const uint32_t shift = NBodyMortonLevels - p_Node.m_Level;
+  const float cx = morton.m_Min[0] +
+                   ((nbodyMortonCompact(p_Key >> 2) >> shift) + 0.5f) * edge;
+  const float cy = morton.m_Min[1] +
+                   ((nbodyMortonCompact(p_Key >> 1) >> shift) + 0.5f) * edge;
+  const float cz = morton.m_Min[2] +
+                   ((nbodyMortonCompact(p_Key) >> shift) + 0.5f) * edge;
+
+  const float dx = p_Node.m_ComX - cx;
+  const float dy = p_Node.m_ComY - cy;
+  const float dz = p_Node.m_ComZ - cz;
+  const float delta = sqrtf(dx * dx + dy * dy + dz * dz);
+
+  if (p_Tree->m_Theta <= 0.0f)
+    return INFINITY;
+  const float radius = edge / p_Tree->m_Theta + delta;
+  return radius * radius;
+}
+//---------------------------------------------------------------------------//
+static void _leafMoments(const NBodyOctree* p_Tree, NBodyTreeNode* p_Node) {
+  const float* x = p_Tree->m_SortedX;
+  const float* y = p_Tree->m_SortedY;
+  const float* z = p_Tree->m_SortedZ;
+  const float* m = p_Tree->m_SortedMass;
+
+  double mass = 0.0;
+  double com[3] = {0.0, 0.0, 0.0};
+  double mean[3] = {0.0, 0.0, 0.0};
+  for (uint32_t k = p_Node->m_Begin; k < p_Node->m_End; ++k) {
+    mass += m[k];
+    com[0] += double(m[k]) * x[k];
+    com[1] += double(m[k]) * y[k];
+    com[2] += double(m[k]) * z[k];
+    mean[0] += x[k];
+    mean[1] += y[k];
+    mean[2] += z[k];
+  }
+  for (int a = 0; a < 3; ++a) {
+    com[a] = mass > 0.0 ? com[a] / mass
+                        : mean[a] / (p_Node->m_End - p_Node->m_Begin);
+  }
+
+  double quad[6] = {};
+  for (uint32_t k = p_Node->m_Begin; k < p_Node->m_End; ++k) {
+    const double dx = x[k] - com[0];
+    const double dy = y[k] - com[1];
+    const double dz = z[k] - com[2];
+    const double d2 = dx * dx + dy * dy + dz * dz;
+    quad[0] += m[k] * (3.0 * dx * dx - d2);
+    quad[1] += m[k] * (3.0 * dy * dy - d2);
+    quad[2] += m[k] * (3.0 * dz * dz - d2);
+    quad[3] += m[k] * 3.0 * dx * dy;
+    quad[4] += m[k] * 3.0 * dx * dz;
+    quad[5] += m[k] * 3.0 * dy * dz;
+  }
+
+  p_Node->m_ComX = float(com[0]);
+  p_Node->m_ComY = float(com[1]);
+  p_Node->m_ComZ = float(com[2]);
+  p_Node->m_Mass = float(mass);
+  for (int q = 0; q < 6; ++q) {
+    p_Node->m_Quad[q] = float(quad[q]);
+  }
+}
+//---------------------------------------------------------------------------//
+// Moments of an inner node from its children, the node's m_Next must be set.
+// Quadrupoles are shifted to the parent's center of mass (parallel axis).
+static void _innerMoments(NBodyTreeNode* p_Nodes, uint32_t p_Index) {
+  NBodyTreeNode* node = &p_Nodes[p_Index];
+
+  double mass = 0.0;
+  double com[3] = {0.0, 0.0, 0.0};
+  double mean[3] = {0.0, 0.0, 0.0};
+  for (uint32_t c = p_Index + 1; c < node->m_Next; c = p_Nodes[c].m_Next) {
+    const NBodyTreeNode& child = p_Nodes[c];
+    mass += child.m_Mass;
+    com[0] += double(child.m_Mass) * child.m_ComX;
+    com[1] += double(child.m_Mass) * child.m_ComY;
+    com[2] += double(child.m_Mass) * child.m_ComZ;
+    mean[0] += child.m_ComX;
+    mean[1] += child.m_ComY;
+    mean[2] += child.m_ComZ;
+  }
+  for (int a = 0; a < 3; ++a) {
+    com[a] = mass > 0.0 ? com[a] / mass : mean[a] / node->m_ChildCount;
+  }
+
+  double quad[6] = {};
+  for (uint32_t c = p_Index + 1; c < node->m_Next; c = p_Nodes[c].m_Next) {
+    const NBodyTreeNode& child = p_Nodes[c];
+    const double dx = child.m_ComX - com[0];
+    const double dy = child.m_ComY - com[1];
+    const double dz = child.m_ComZ - com[2];
+    const double d2 = dx * dx + dy * dy + dz * dz;
+    const double m = child.m_Mass;
+    quad[0] += child.m_Quad[0] + m * (3.0 * dx * dx - d2);
+    quad[1] += child.m_Quad[1] + m * (3.0 * dy * dy - d2);
+    quad[2] += child.m_Quad[2] + m * (3.0 * dz * dz - d2);
+    quad[3] += child.m_Quad[3] + m * 3.0 * dx * dy;
+    quad[4] += child.m_Quad[4] + m * 3.0 * dx * dz;
+    quad[5] += child.m_Quad[5] + m * 3.0 * dy * dz;
+  }
+
+  node->m_ComX = float(com[0]);
+  node->m_ComY = float(com[1]);
+  node->m_ComZ = float(com[2]);
+  node->m_Mass = float(mass);
+  for (int q = 0; q < 6; ++q) {
+    node->m_Quad[q] = float(quad[q]);
+  }
+}
+//---------------------------------------------------------------------------//
+// Appends the subtree of the cell [p_Begin, p_End) at p_Level in depth-first
+// order, m_Next indices are relative to the start of p_Nodes.
+static void _buildSubtree(
+    const NBodyOctree* p_Tree,
+    uint32_t p_Begin,
+    uint32_t p_End,
+    uint32_t p_Level,
+    std::vector<NBodyTreeNode>& p_Nodes) {
+  const uint32_t index = static_cast<uint32_t>(p_Nodes.size());
+  p_Nodes.push_back(NBodyTreeNode());
+  p_Nodes[index].m_Begin = p_Begin;
+  p_Nodes[index].m_End = p_End;
+  p_Nodes[index].m_Level = p_Level;
+
+  uint32_t childCount = 0;
+  if (_isLeaf(p_Tree, p_End - p_Begin, p_Level)) {
+    _leafMoments(p_Tree, &p_Nodes[index]);
+  } else {
+    uint32_t bounds[9];
+    _splitCell(p_Tree, p_Begin, p_End, p_Level, bounds);
+    for (uint32_t c = 0; c < 8; ++c) {
+      if (bounds[c] == bounds[c + 1])
+        continue;
+      _buildSubtree(p_Tree, bounds[c], bounds[c + 1], p_Level + 1, p_Nodes);
+      childCount++;
+    }
+  }
+
+  NBodyTreeNode& node = p_Nodes[index];
+  node.m_Next = static_cast<uint32_t>(p_Nodes.size());
+  node.m_ChildCount = childCount;
+  if (childCount > 0)
+    _innerMoments(p_Nodes.data(), index);
+  node.m_OpenRadiusSqr =
+      _openRadiusSqr(p_Tree, node, p_Tree->m_Morton.m_Keys[p_Begin]);
+}
+//---------------------------------------------------------------------------//
+// Cells left to the pool: the inner cells at NBodyTreeTopLevels.
+static void _collectTasks(
+    const NBodyOctree* p_Tree,
+    uint32_t p_Begin,
+    uint32_t p_End,
+    uint32_t p_Level,
+    std::vector<TreeTask>& p_Tasks) {
+  if (_isLeaf(p_Tree, p_End - p_Begin, p_Level))
+    return;
+  if (p_Level == NBodyTreeTopLevels) {
+    p_Tasks.push_back(TreeTask());
+    p_Tasks.back().m_Begin = p_Begin;
+    p_Tasks.back().m_End = p_End;
+    return;
+  }
+
+  uint32_t bounds[9];
+  _splitCell(p_Tree, p_Begin, p_End, p_Level, bounds);
+  for (uint32_t c = 0; c < 8; ++c) {
+    if (bounds[c] != bounds[c + 1])
+      _collectTasks(p_Tree, bounds[c], bounds[c + 1], p_Level + 1, p_Tasks);
+  }
+}
+//---------------------------------------------------------------------------//
+// Same walk as _collectTasks, builds the top levels and splices the subtrees
+// of the tasks (in the same order) into p_Nodes.
+static void _buildTop(
+    const NBodyOctree* p_Tree,
+    uint32_t p_Begin,
+    uint32_t p_End,
+    uint32_t p_Level,
+    TreeTask** p_NextTask,
+    std::vector<NBodyTreeNode>& p_Nodes) {
+  if (_isLeaf(p_Tree, p_End - p_Begin, p_Level)) {
+    _buildSubtree(p_Tree, p_Begin, p_End, p_Level, p_Nodes);
+    return;
+  }
+  if (p_Level == NBodyTreeTopLevels) {
+    TreeTask* task = (*p_NextTask)++;
+    NBODY_ASSERT(task->m_Begin == p_Begin && task->m_End == p_End);
+    const uint32_t offset = static_cast<uint32_t>(p_Nodes.size());
+    for (NBodyTreeNode& node : task->m_Nodes) {
+      node.m_Next += offset;
+      p_Nodes.push_back(node);
+    }
+    return;
+  }
+
+  const uint32_t index = static_cast<uint32_t>(p_Nodes.size());
+  p_Nodes.push_back(NBodyTreeNode());
+  p_Nodes[index].m_Begin = p_Begin;
+  p_Nodes[index].m_End = p_End;
+  p_Nodes[index].m_Level = p_Level;
+
+  uint32_t bounds[9];
+  uint32_t childCount = 0;
+  _splitCell(p_Tree, p_Begin, p_End, p_Level, bounds);
+  for (uint32_t c = 0; c < 8; ++c) {
+    if (bounds[c] == bounds[c + 1])
+      continue;
+    _buildTop(
+        p_Tree, bounds[c], bounds[c + 1], p_Level + 1, p_NextTask, p_Nodes);
+    childCount++;
+  }
+
+  NBodyTreeNode& node = p_Nodes[index];
+  node.m_Next = static_cast<uint32_t>(p_Nodes.size());
+  node.m_ChildCount = childCount;
+  _innerMoments(p_Nodes.data(), index);
+  node.m_OpenRadiusSqr =
+      _openRadiusSqr(p_Tree, node, p_Tree->m_Morton.m_Keys[p_Begin]);
+}
+//---------------------------------------------------------------------------//
+// Pool jobs of nbodyOctreeBuild (NBodyRangeFunc):
+//---------------------------------------------------------------------------//
+static void
+_gatherJob(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  BuildJob* job = static_cast<BuildJob*>(p_User);
+  NBodyOctree* tree = job->m_Tree;
+  for (uint32_t k = p_Begin; k < p_End; ++k) {
+    const uint32_t i = tree->m_Morton.m_Order[k];
+    tree->m_SortedX[k] = job->m_PosX[i];
+    tree->m_SortedY[k] = job->m_PosY[i];
+    tree->m_SortedZ[k] = job->m_PosZ[i];
+    tree->m_SortedMass[k] = job->m_Mass[i];
+  }
+}
+//---------------------------------------------------------------------------//
+static void
+_subtreeJob(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  BuildJob* job = static_cast<BuildJob*>(p_User);
+  for (uint32_t t = p_Begin; t < p_End; ++t) {
+    TreeTask* task = &job->m_Tasks[t];
+    task->m_Nodes.clear();
+    _buildSubtree(
+        job->m_Tree,
+        task->m_Begin,
+        task->m_End,
+        NBodyTreeTopLevels,
+        task->m_Nodes);
+  }
+}
+//---------------------------------------------------------------------------//
+static void _reserve(NBodyOctree* p_Tree, uint32_t p_Count) {
+  if (p_Count <= p_Tree->m_Capacity)
+    return;
+
+  nbodyAlignedFree(p_Tree->m_SortedX);
+  nbodyAlignedFree(p_Tree->m_SortedY);
+  nbodyAlignedFree(p_Tree->m_SortedZ);
+  nbodyAlignedFree(p_Tree->m_SortedMass);
+  nbodyAlignedFree(p_Tree->m_Leaves);
+
+  const size_t capacity = nbodyPadCount(p_Count);
+  p_Tree->m_Capacity = static_cast<uint32_t>(capacity);
+  p_Tree->m_SortedX = static_cast<float*>(
+      nbodyAlignedAlloc(capacity * sizeof(float), NBodyAlignment));
+  p_Tree->m_SortedY = static_cast<float*>(
+      nbodyAlignedAlloc(capacity * sizeof(float), NBodyAlignment));
+  p_Tree->m_SortedZ = static_cast<float*>(
+      nbodyAlignedAlloc(capacity * sizeof(float), NBodyAlignment));
+  p_Tree->m_SortedMass = static_cast<float*>(
+      nbodyAlignedAlloc(capacity * sizeof(float), NBodyAlignment));
+  p_Tree->m_Leaves = static_cast<uint32_t*>(
+      nbodyAlignedAlloc(capacity * sizeof(uint32_t), NBodyAlignment));
+  NBODY_ASSERT(
+      p_Tree->m_SortedX != nullptr && p_Tree->m_SortedY != nullptr &&
+      p_Tree->m_SortedZ != nullptr && p_Tree->m_SortedMass != nullptr &&
+      p_Tree->m_Leaves != nullptr);
+}
+//---------------------------------------------------------------------------//
+// One walk for all the bodies of a leaf: a cell is accepted only if the
+// whole bounding sphere of the leaf lies outside its opening radius. Opened
+// leaves go to the body list, accepted cells to the cell list.
+static void _groupWalk(
+    const NBodyOctree* p_Tree,
+    const NBodyTreeNode& p_Group,
+    GroupLists* p_Lists) {
+  const float* x = p_Tree->m_SortedX;
+  const float* y = p_Tree->m_SortedY;
+  const float* z = p_Tree->m_SortedZ;
+  const float* m = p_Tree->m_SortedMass;
+
+  float boxMin[3] = {INFINITY, INFINITY, INFINITY};
+  float boxMax[3] = {-INFINITY, -INFINITY, -INFINITY};
+  for (uint32_t k = p_Group.m_Begin; k < p_Group.m_End; ++k) {
+    boxMin[0] = std::min(boxMin[0], x[k]);
+    boxMin[1] = std::min(boxMin[1], y[k]);
+    boxMin[2] = std::min(boxMin[2], z[k]);
+    boxMax[0] = std::max(boxMax[0], x[k]);
+    boxMax[1] = std::max(boxMax[1], y[k]);
+    boxMax[2] = std::max(boxMax[2], z[k]);
+  }
+  const float cx = 0.5f * (boxMin[0] + boxMax[0]);
+  const float cy = 0.5f * (boxMin[1] + boxMax[1]);
+  const float cz = 0.5f * (boxMin[2] + boxMax[2]);
+  const float ex = boxMax[0] - cx;
+  const float ey = boxMax[1] - cy;
+  const float ez = boxMax[2] - cz;
+  const float radius = sqrtf(ex * ex + ey * ey + ez * ez);
+
+  const NBodyTreeNode* nodes = p_Tree->m_Nodes;
+  uint32_t n = 0;
+  while (n < p_Tree->m_NodeCount) {
+    const NBodyTreeNode& node = nodes[n];
+    const float dx = node.m_ComX - cx;
+    const float dy = node.m_ComY - cy;
+    const float dz = node.m_ComZ - cz;
+    const float dist = sqrtf(dx * dx + dy * dy + dz * dz) - radius;
+
+    if (dist > 0.0f && dist * dist > node.m_OpenRadiusSqr) {
+      std::vector<float>* cells = p_Lists->m_Cells;
+      cells[0].push_back(node.m_ComX);
+      cells[1].push_back(node.m_ComY);
+      cells[2].push_back(node.m_ComZ);
+      cells[3].push_back(node.m_Mass);
+      for (int q = 0; q < 6; ++q) {
+        cells[4 + q].push_back(node.m_Quad[q]);
+      }
+      n = node.m_Next;
+    } else if (node.m_ChildCount == 0) {
+      std::vector<float>* bodies = p_Lists->m_Bodies;
+      bodies[0].insert(bodies[0].end(), x + node.m_Begin, x + node.m_End);
+      bodies[1].insert(bodies[1].end(), y + node.m_Begin, y + node.m_End);
+      bodies[2].insert(bodies[2].end(), z + node.m_Begin, z + node.m_End);
+      bodies[3].insert(bodies[3].end(), m + node.m_Begin, m + node.m_End);
+      n = node.m_Next;
+    } else {
+      n = n + 1;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Core functions:
+//---------------------------------------------------------------------------//
+void nbodyOctreeInit(
+    NBodyOctree* p_Tree, float p_Theta, bool p_Quadrupole, uint32_t p_LeafSize) {
+  memset(p_Tree, 0, sizeof(*p_Tree));
+  p_Tree->m_Theta = p_Theta;
+  p_Tree->m_Quadrupole = p_Quadrupole;
+  p_Tree->m_LeafSize = p_LeafSize > 0 ? p_LeafSize : 1;
+}
+//---------------------------------------------------------------------------//
+void nbodyOctreeDestroy(NBodyOctree* p_Tree) {
+  nbodyMortonDestroy(&p_Tree->m_Morton);
+  nbodyAlignedFree(p_Tree->m_SortedX);
+  nbodyAlignedFree(p_Tree->m_SortedY);
+  nbodyAlignedFree(p_Tree->m_SortedZ);
+  nbodyAlignedFree(p_Tree->m_SortedMass);
+  nbodyAlignedFree(p_Tree->m_Leaves);
+  nbodyAlignedFree(p_Tree->m_Nodes);
+  memset(p_Tree, 0, sizeof(*p_Tree));
+}
+//---------------------------------------------------------------------------//
+void nbodyOctreeBuild(
+    NBodyOctree* p_Tree,
+    const float* p_PosX,
+    const float* p_PosY,
+    const float* p_PosZ,
+    const float* p_Mass,
+    uint32_t p_Count,
+    NBodyThreadPool* p_Pool) {
+  static constexpr uint32_t Grain = 4096;
+
+  _reserve(p_Tree, p_Count);
+  p_Tree->m_Count = p_Count;
+  p_Tree->m_NodeCount = 0;
+  p_Tree->m_LeafCount = 0;
+  if (p_Count == 0)
+    return;
+
+  BuildJob job = {};
+  job.m_Tree = p_Tree;
+  job.m_PosX = p_PosX;
+  job.m_PosY = p_PosY;
+  job.m_PosZ = p_PosZ;
+  job.m_Mass = p_Mass;
+
+  // Morton order, then the positions and masses gathered along it
+  nbodyMortonSort(&p_Tree->m_Morton, p_PosX, p_PosY, p_PosZ, p_Count, p_Pool);
+  nbodyPoolParallelFor(p_Pool, p_Count, Grain, _gatherJob, &job);
+
+  // Subtrees below the top levels in parallel, then the top levels around
+  // them on this thread.
+  std::vector<TreeTask> tasks;
+  _collectTasks(p_Tree, 0, p_Count, 0, tasks);
+  job.m_Tasks = tasks.data();
+  nbodyPoolParallelFor(
+      p_Pool, static_cast<uint32_t>(tasks.size()), 1, _subtreeJob, &job);
+
+  std::vector<NBodyTreeNode> nodes;
+  size_t nodeEstimate = 0;
+  for (const TreeTask& task : tasks) {
+    nodeEstimate += task.m_Nodes.size();
+  }
+  nodes.reserve(nodeEstimate + 1024);
+  TreeTask* nextTask = tasks.data();
+  _buildTop(p_Tree, 0, p_Count, 0, &nextTask, nodes);
+
+  if (nodes.size() > p_Tree->m_NodeCapacity) {
+    nbodyAlignedFree(p_Tree->m_Nodes);
+    p_Tree->m_NodeCapacity = static_cast<uint32_t>(nodes.size() * 5 / 4);
+    p_Tree->m_Nodes = static_cast<NBodyTreeNode*>(nbodyAlignedAlloc(
+        p_Tree->m_NodeCapacity * sizeof(NBodyTreeNode), NBodyAlignment));
+    NBODY_ASSERT(p_Tree->m_Nodes != nullptr);
+  }
+  memcpy(p_Tree->m_Nodes, nodes.data(), nodes.size() * sizeof(NBodyTreeNode));
+  p_Tree->m_NodeCount = static_cast<uint32_t>(nodes.size());
+
+  // A leaf holds at least one particle, so m_Capacity bounds the leaf count.
+  p_Tree->m_LeafCount = 0;
+  for (uint32_t n = 0; n < p_Tree->m_NodeCount; ++n) {
+    if (p_Tree->m_Nodes[n].m_ChildCount == 0)
+      p_Tree->m_Leaves[p_Tree->m_LeafCount++] = n;
+  }
+}
+//---------------------------------------------------------------------------//
+void nbodyOctreeForceLeaves(
+    const NBodyOctree* p_Tree,
+    uint32_t p_LeafBegin,
+    uint32_t p_LeafEnd,
+    NBodyIsa p_Isa,
+    float p_G,
+    float* p_AccelX,
+    float* p_AccelY,
+    float* p_AccelZ) {
+  const NBodyForceKernel forceKernel = nbodyGetForceKernel(p_Isa);
+  const NBodyCellKernel cellKernel = nbodyGetCellKernel(p_Isa);
+  GroupLists lists;
+  float accel[3][NBodyTreeChunk];
+
+  for (uint32_t l = p_LeafBegin; l < p_LeafEnd; ++l) {
+    const NBodyTreeNode& group = p_Tree->m_Nodes[p_Tree->m_Leaves[l]];
+    for (std::vector<float>& list : lists.m_Bodies) {
+      list.clear();
+    }
+    for (std::vector<float>& list : lists.m_Cells) {
+      list.clear();
+    }
+    _groupWalk(p_Tree, group, &lists);
+    for (std::vector<float>& list : lists.m_Bodies) {
+      list.resize(nbodyPadCount(static_cast<uint32_t>(list.size())), 0.0f);
+    }
+
+    // Targets in chunks of the scratch size, only leaves at the deepest level
+    // can hold more than m_LeafSize bodies.
+    for (uint32_t first = group.m_Begin; first < group.m_End;
+         first += NBodyTreeChunk) {
+      const uint32_t count = std::min(group.m_End - first, NBodyTreeChunk);
+
+      // Near field: direct sum over the bodies of the opened leaves.
+      NBodyForceArgs args = {};
+      args.m_SrcX = lists.m_Bodies[0].data();
+      args.m_SrcY = lists.m_Bodies[1].data();
+      args.m_SrcZ = lists.m_Bodies[2].data();
+      args.m_SrcMass = lists.m_Bodies[3].data();
+      args.m_SrcCount = static_cast<uint32_t>(lists.m_Bodies[0].size());
+      args.m_DstX = p_Tree->m_SortedX + first;
+      args.m_DstY = p_Tree->m_SortedY + first;
+      args.m_DstZ = p_Tree->m_SortedZ + first;
+      args.m_DstBegin = 0;
+      args.m_DstEnd = count;
+      args.m_AccelX = accel[0];
+      args.m_AccelY = accel[1];
+      args.m_AccelZ = accel[2];
+      args.m_G = 1.0f;
+      forceKernel(&args);
+
+      // Far field: accepted cells, added on top.
+      NBodyCellArgs cellArgs = {};
+      cellArgs.m_ComX = lists.m_Cells[0].data();
+      cellArgs.m_ComY = lists.m_Cells[1].data();
+      cellArgs.m_ComZ = lists.m_Cells[2].data();
+      cellArgs.m_CellMass = lists.m_Cells[3].data();
+      for (int q = 0; q < 6; ++q) {
+        cellArgs.m_Quad[q] =
+            p_Tree->m_Quadrupole ? lists.m_Cells[4 + q].data() : nullptr;
+      }
+      cellArgs.m_CellCount = static_cast<uint32_t>(lists.m_Cells[0].size());
+      cellArgs.m_DstX = args.m_DstX;
+      cellArgs.m_DstY = args.m_DstY;
+      cellArgs.m_DstZ = args.m_DstZ;
+      cellArgs.m_DstCount = count;
+      cellArgs.m_AccelX = accel[0];
+      cellArgs.m_AccelY = accel[1];
+      cellArgs.m_AccelZ = accel[2];
+      cellKernel(&cellArgs);
+
+      for (uint32_t t = 0; t < count; ++t) {
+        const uint32_t i = p_Tree->m_Morton.m_Order[first + t];
+        p_AccelX[i] = accel[0][t] * p_G;
+        p_AccelY[i] = accel[1][t] * p_G;
+        p_AccelZ[i] = accel[2][t] * p_G;
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------//
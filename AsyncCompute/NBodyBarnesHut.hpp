@@ -0,0 +1,106 @@
+#pragma once
+
+/******************************************************************************
+ * \Barnes-Hut gravity solver for the CPU engine
+ * \a linearized octree built from Morton-sorted particles: nodes are stored in
+ * \depth-first order, so a subtree is a contiguous run of nodes and the walk
+ * \is a single forward scan that either descends (next node) or skips the
+ * \subtree (m_Next). Cells far enough away act as one body (monopole, plus an
+ * \optional quadrupole correction), which brings a step from O(N^2) down to
+ * \O(N log N). The engine walks once per leaf (group walk): the bodies of
+ * \the opened leaves form a SoA list fed to the direct SIMD kernels.
+ ******************************************************************************/
+
+#include "NBodyCommon.hpp"
+#include "NBodyKernels.hpp"
+#include "NBodyMorton.hpp"
+#include "NBodyThreadPool.hpp"
+
+// Opening angle, smaller is more accurate (0 degenerates to all-pairs).
+static constexpr float NBodyDefaultTheta = 0.5f;
+// Cells with at most that many particles are not split any further.
+static constexpr uint32_t NBodyDefaultLeafSize = 32;
+
+//---------------------------------------------------------------------------//
+// One cell, 64 bytes so that the walk touches a single cache line per node:
+//---------------------------------------------------------------------------//
+struct NBodyTreeNode {
+  // Monopole: center of mass and mass (sum of m_Position.w, the kernels
+  // scale it by NBodyForceArgs::m_G like they do for single bodies). Cells of
+  // massless bodies are centered on their mean position.
+  float m_ComX;
+  float m_ComY;
+  float m_ComZ;
+  float m_Mass;
+
+  // Traceless quadrupole around the center of mass: xx, yy, zz, xy, xz, yz
+  float m_Quad[6];
+
+  // Bodies closer than this (squared) to the center of mass open the cell,
+  // see _openRadiusSqr for the criterion.
+  float m_OpenRadiusSqr;
+
+  uint32_t m_Next;       // Node after this subtree (node count for the last)
+  uint32_t m_Begin;      // Particles [m_Begin, m_End) in Morton order
+  uint32_t m_End;
+  uint32_t m_ChildCount; // 0 for leaves
+  uint32_t m_Level;      // 0 for the root
+};
+static_assert(sizeof(NBodyTreeNode) == 64, "NBodyTreeNode must fit a line");
+
+//---------------------------------------------------------------------------//
+struct NBodyOctree {
+  float m_Theta;
+  bool m_Quadrupole;
+  uint32_t m_LeafSize;
+
+  // Particles in Morton order: sorted keys, original indices and bounding
+  // cube in m_Morton, positions and masses gathered along it.
+  NBodyMortonOrder m_Morton;
+  uint32_t m_Count;
+  uint32_t m_Capacity;
+  float* m_SortedX;
+  float* m_SortedY;
+  float* m_SortedZ;
+  float* m_SortedMass;
+
+  NBodyTreeNode* m_Nodes;
+  uint32_t m_NodeCount;
+  uint32_t m_NodeCapacity;
+
+  // Leaf node indices in Morton order, their particles tile [0, m_Count).
+  uint32_t* m_Leaves;
+  uint32_t m_LeafCount;
+};
+
+//---------------------------------------------------------------------------//
+void nbodyOctreeInit(
+    NBodyOctree* p_Tree, float p_Theta, bool p_Quadrupole, uint32_t p_LeafSize);
+//---------------------------------------------------------------------------//
+void nbodyOctreeDestroy(NBodyOctree* p_Tree);
+//---------------------------------------------------------------------------//
+// Rebuilds the tree over p_Count bodies. Keys, bounds and the subtrees
+// below the top levels are computed in parallel on p_Pool (may be nullptr).
+void nbodyOctreeBuild(
+    NBodyOctree* p_Tree,
+    const float* p_PosX,
+    const float* p_PosY,
+    const float* p_PosZ,
+    const float* p_Mass,
+    uint32_t p_Count,
+    NBodyThreadPool* p_Pool);
+//---------------------------------------------------------------------------//
+// Accelerations of the particles of the leaves [p_LeafBegin, p_LeafEnd),
+// written at their original index (see NBodyMortonOrder::m_Order). One walk
+// per leaf, both the near and far field run on the kernels of p_Isa and
+// p_G scales the result like NBodyForceArgs::m_G.
+void nbodyOctreeForceLeaves(
+    const NBodyOctree* p_Tree,
+    uint32_t p_LeafBegin,
+    uint32_t p_LeafEnd,
+    NBodyIsa p_Isa,
+    float p_G,
+    float* p_AccelX,
+    float* p_AccelY,
+    float* p_AccelZ);
+//---------------------------------------------------------------------------//
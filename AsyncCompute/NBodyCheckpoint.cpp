@@ -0,0 +1,663 @@
+#include "NBodyCheckpoint.hpp"
+#include "NBodyCpu.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const char s_CheckpointMagic[8] = {
+    'N', 'B', 'O', 'D', 'Y', 'C', 'K', 'P'};
+// A full checkpoint replaces the deltas once 1 / NBodyDeltaLimit or less of
+// the chunks are unchanged since the last one.
+static constexpr uint32_t NBodyDeltaLimit = 8;
+static constexpr uint64_t NBodyHashOffset = 14695981039346656037ull;
+static constexpr uint64_t NBodyHashPrime = 1099511628211ull;
+
+struct NBodyCheckpointImpl {
+  std::string m_Path;
+  std::string m_DeltaPath;
+  uint32_t m_Count;
+  uint32_t m_PaddedCount;
+  uint32_t m_Seed;
+  size_t m_ImageSize;
+  uint32_t m_ChunkCount;
+
+  // Staging image and its state, owned by the stepping thread while
+  // m_Busy is false and by the writer otherwise.
+  void* m_Image;
+  NBodyCheckpointState m_State;
+
+  std::thread m_Writer;
+  std::mutex m_Mutex;
+  std::condition_variable m_WakeUp; // Of the writer, m_Busy or m_Closing
+  std::condition_variable m_Idle;   // Of a forced capture, !m_Busy
+  bool m_Busy;
+  bool m_Closing;
+
+  // Writer side: chunk hashes of the image and of the last full checkpoint
+  // (empty before the first one), counters read once the writer stopped.
+  std::vector<uint64_t> m_Hashes;
+  std::vector<uint64_t> m_BaseHashes;
+  uint64_t m_BaseHash;
+  std::vector<uint32_t> m_Changed;
+  uint64_t m_Sequence;
+  uint64_t m_Full;
+  uint64_t m_Delta;
+  uint64_t m_FileBytes;
+  uint64_t m_LastStep;
+  double m_WriterSeconds;
+  bool m_Failed;
+
+  // Stepping thread side
+  uint64_t m_NextStep; // Next step due, UINT64_MAX before the first call
+  uint64_t m_CapturedStep; // Of the last capture, UINT64_MAX before
+  std::chrono::steady_clock::time_point m_LastCapture;
+  uint64_t m_Captured;
+  uint64_t m_Deferred;
+  double m_CaptureSeconds;
+};
+
+//---------------------------------------------------------------------------//
+/// Local functions:
+//---------------------------------------------------------------------------//
+// Same convention as the snapshots (NBodySnapshot.cpp).
+static bool _isLittleEndian() {
+  const uint32_t one = 1;
+  uint8_t first = 0;
+  memcpy(&first, &one, 1);
+  return first == 1;
+}
+//---------------------------------------------------------------------------//
+static size_t _arraySize(uint32_t p_PaddedCount) {
+  return size_t(p_PaddedCount) * sizeof(float);
+}
+//---------------------------------------------------------------------------//
+static uint32_t _chunkCount(size_t p_ImageSize) {
+  return uint32_t(
+      (p_ImageSize + NBodyCheckpointChunkSize - 1) / NBodyCheckpointChunkSize);
+}
+//---------------------------------------------------------------------------//
+static uint64_t _mix(uint64_t p_Hash, uint64_t p_Word) {
+  const uint64_t product = (p_Hash ^ p_Word) * NBodyHashPrime;
+  return product ^ (product >> 32);
+}
+//---------------------------------------------------------------------------//
+// Four independent lanes of 8-byte words keep the multiplies in flight,
+// p_Size is a multiple of 32 (the arrays are whole cache lines).
+static uint64_t _hashChunk(const uint8_t* p_Data, size_t p_Size) {
+  uint64_t lanes[4] = {
+      NBodyHashOffset,
+      NBodyHashOffset + 1,
+      NBodyHashOffset + 2,
+      NBodyHashOffset + 3};
+  for (size_t i = 0; i < p_Size; i += 32) {
+    for (uint32_t l = 0; l < 4; ++l) {
+      uint64_t word;
+      memcpy(&word, p_Data + i + 8 * l, sizeof(word));
+      lanes[l] = _mix(lanes[l], word);
+    }
+  }
+  uint64_t hash = NBodyHashOffset;
+  for (uint32_t l = 0; l < 4; ++l) {
+    hash = _mix(hash, lanes[l]);
+  }
+  return hash;
+}
+//---------------------------------------------------------------------------//
+// Hashes every chunk of p_Image into p_Hashes, returns that of the image.
+static uint64_t _hashImage(
+    const uint8_t* p_Image, size_t p_ImageSize, uint64_t* p_Hashes) {
+  const uint32_t chunkCount = _chunkCount(p_ImageSize);
+  uint64_t hash = NBodyHashOffset;
+  for (uint32_t c = 0; c < chunkCount; ++c) {
+    const size_t begin = size_t(c) * NBodyCheckpointChunkSize;
+    const size_t size =
+        std::min<size_t>(NBodyCheckpointChunkSize, p_ImageSize - begin);
+    p_Hashes[c] = _hashChunk(p_Image + begin, size);
+    hash = _mix(hash, p_Hashes[c]);
+  }
+  return hash;
+}
+//---------------------------------------------------------------------------//
+// Makes a rename durable: the directory entry is flushed too.
+static void _syncDirectory(const std::string& p_Path) {
+#if !defined(_WIN32)
+  const size_t slash = p_Path.rfind('/');
+  const std::string directory =
+      slash == std::string::npos ? "." : p_Path.substr(0, slash + 1);
+  const int file = open(directory.c_str(), O_RDONLY);
+  if (file >= 0) {
+    fsync(file);
+    close(file);
+  }
+#else
+  (void)p_Path;
+#endif
+}
+//---------------------------------------------------------------------------//
+// Flushes p_File (p_Path + ".tmp") to the disk, closes it and renames it
+// over p_Path: readers see either the previous file or the whole new one.
+static bool _commitFile(FILE* p_File, bool p_Ok, const std::string& p_Path) {
+  const std::string tmpPath = p_Path + ".tmp";
+  p_Ok = fflush(p_File) == 0 && p_Ok;
+#if defined(_WIN32)
+  p_Ok = p_Ok && _commit(_fileno(p_File)) == 0;
+#else
+  p_Ok = p_Ok && fsync(fileno(p_File)) == 0;
+#endif
+  p_Ok = fclose(p_File) == 0 && p_Ok;
+  if (!p_Ok) {
+    remove(tmpPath.c_str());
+    return false;
+  }
+#if defined(_WIN32)
+  // Unlike rename(), replaces an existing file in one step.
+  return MoveFileExA(
+             tmpPath.c_str(),
+             p_Path.c_str(),
+             MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+  if (rename(tmpPath.c_str(), p_Path.c_str()) != 0)
+    return false;
+  _syncDirectory(p_Path);
+  return true;
+#endif
+}
+//---------------------------------------------------------------------------//
+static void _fillHeader(
+    NBodyCheckpointHeader* p_Header,
+    NBodyCheckpointKind p_Kind,
+    uint32_t p_Count,
+    uint32_t p_ChunkCount) {
+  memset(p_Header, 0, sizeof(*p_Header));
+  memcpy(p_Header->m_Magic, s_CheckpointMagic, sizeof(s_CheckpointMagic));
+  p_Header->m_Version = NBodyCheckpointVersion;
+  p_Header->m_HeaderSize = sizeof(NBodyCheckpointHeader);
+  p_Header->m_Kind = p_Kind;
+  p_Header->m_ParticleCount = p_Count;
+  p_Header->m_PaddedCount = nbodyPadCount(p_Count);
+  p_Header->m_ChunkCount = p_ChunkCount;
+}
+//---------------------------------------------------------------------------//
+// Hashes the staged image and writes it whole, or the chunks that differ
+// from the last full checkpoint while they are few enough.
+static void _writeCheckpoint(NBodyCheckpointImpl* p_Impl) {
+  const uint8_t* image = static_cast<const uint8_t*>(p_Impl->m_Image);
+  const uint64_t imageHash =
+      _hashImage(image, p_Impl->m_ImageSize, p_Impl->m_Hashes.data());
+
+  std::vector<uint32_t>& changed = p_Impl->m_Changed;
+  changed.clear();
+  if (!p_Impl->m_BaseHashes.empty()) {
+    for (uint32_t c = 0; c < p_Impl->m_ChunkCount; ++c) {
+      if (p_Impl->m_Hashes[c] != p_Impl->m_BaseHashes[c])
+        changed.push_back(c);
+    }
+  }
+  const bool delta =
+      !p_Impl->m_BaseHashes.empty() &&
+      uint64_t(changed.size()) * NBodyDeltaLimit <
+          uint64_t(p_Impl->m_ChunkCount) * (NBodyDeltaLimit - 1);
+
+  NBodyCheckpointHeader header;
+  _fillHeader(
+      &header,
+      delta ? NBodyCheckpointDelta : NBodyCheckpointFull,
+      p_Impl->m_Count,
+      p_Impl->m_ChunkCount);
+  header.m_Sequence = p_Impl->m_Sequence;
+  header.m_ImageHash = imageHash;
+  header.m_State = p_Impl->m_State;
+
+  const std::string& path = delta ? p_Impl->m_DeltaPath : p_Impl->m_Path;
+  FILE* file = fopen((path + ".tmp").c_str(), "wb");
+  if (file == nullptr) {
+    p_Impl->m_Failed = true;
+    return;
+  }
+  uint64_t size = sizeof(header);
+  bool ok = true;
+  if (delta) {
+    header.m_DeltaChunks = uint32_t(changed.size());
+    header.m_BaseHash = p_Impl->m_BaseHash;
+    ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+         fwrite(changed.data(), sizeof(uint32_t), changed.size(), file) ==
+             changed.size();
+    size += changed.size() * sizeof(uint32_t);
+    for (const uint32_t c : changed) {
+      const size_t begin = size_t(c) * NBodyCheckpointChunkSize;
+      const size_t chunkSize = std::min<size_t>(
+          NBodyCheckpointChunkSize, p_Impl->m_ImageSize - begin);
+      ok = ok && fwrite(image + begin, 1, chunkSize, file) == chunkSize;
+      size += chunkSize;
+    }
+  } else {
+    ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+         fwrite(image, 1, p_Impl->m_ImageSize, file) == p_Impl->m_ImageSize;
+    size += p_Impl->m_ImageSize;
+  }
+  if (!_commitFile(file, ok, path)) {
+    p_Impl->m_Failed = true;
+    return;
+  }
+
+  if (delta) {
+    p_Impl->m_Delta++;
+  } else {
+    // The delta of the previous full checkpoint no longer applies (and
+    // would be ignored if removing it failed).
+    remove(p_Impl->m_DeltaPath.c_str());
+    p_Impl->m_BaseHashes = p_Impl->m_Hashes;
+    p_Impl->m_BaseHash = imageHash;
+    p_Impl->m_Full++;
+  }
+  p_Impl->m_Sequence++;
+  p_Impl->m_FileBytes += size;
+  p_Impl->m_LastStep = header.m_State.m_StepCount;
+}
+//---------------------------------------------------------------------------//
+static void _writerProc(NBodyCheckpointImpl* p_Impl) {
+  std::unique_lock<std::mutex> lock(p_Impl->m_Mutex);
+  for (;;) {
+    p_Impl->m_WakeUp.wait(
+        lock, [p_Impl] { return p_Impl->m_Busy || p_Impl->m_Closing; });
+    if (!p_Impl->m_Busy)
+      return; // Closing, the last image written
+    lock.unlock();
+
+    const auto start = std::chrono::steady_clock::now();
+    _writeCheckpoint(p_Impl);
+    p_Impl->m_WriterSeconds += std::chrono::duration<double>(
+                                   std::chrono::steady_clock::now() - start)
+                                   .count();
+
+    lock.lock();
+    p_Impl->m_Busy = false;
+    p_Impl->m_Idle.notify_all();
+  }
+}
+//---------------------------------------------------------------------------//
+static void _captureState(
+    const NBodyCpuCtx* p_Ctx,
+    uint32_t p_Seed,
+    double p_StepSeconds,
+    NBodyCheckpointState* p_State) {
+  memset(p_State, 0, sizeof(*p_State));
+  p_State->m_StepCount = p_Ctx->m_StepCount;
+  p_State->m_ForceEvalCount = p_Ctx->m_ForceEvalCount;
+  p_State->m_StepSeconds = p_StepSeconds;
+  p_State->m_DeltaTime = p_Ctx->m_Params.m_DeltaTime;
+  p_State->m_Damping = p_Ctx->m_Params.m_Damping;
+  p_State->m_Integrator = p_Ctx->m_Integrator;
+  p_State->m_Solver = p_Ctx->m_Solver;
+  p_State->m_Accumulation = p_Ctx->m_Accumulation;
+  p_State->m_PosFormat = p_Ctx->m_PosFormat;
+  p_State->m_Deterministic = p_Ctx->m_Deterministic;
+  p_State->m_ForcesValid = p_Ctx->m_ForcesValid;
+  p_State->m_JerkValid = p_Ctx->m_JerkValid;
+  p_State->m_ReorderInterval = p_Ctx->m_ReorderInterval;
+  p_State->m_BlockEta = p_Ctx->m_Blocks.m_Eta;
+  p_State->m_TreeTheta = p_Ctx->m_Tree.m_Theta;
+  p_State->m_TreeQuadrupole = p_Ctx->m_Tree.m_Quadrupole;
+  p_State->m_FmmOrder = p_Ctx->m_Fmm.m_Order;
+  p_State->m_FmmTheta = p_Ctx->m_Fmm.m_Theta;
+  p_State->m_Seed = p_Seed;
+}
+//---------------------------------------------------------------------------//
+// Accelerations then jerks, the last arrays of the image.
+static void _forceArrays(const NBodyCpuCtx* p_Ctx, float** p_Arrays) {
+  p_Arrays[0] = p_Ctx->m_AccelX;
+  p_Arrays[1] = p_Ctx->m_AccelY;
+  p_Arrays[2] = p_Ctx->m_AccelZ;
+  p_Arrays[3] = p_Ctx->m_JerkX;
+  p_Arrays[4] = p_Ctx->m_JerkY;
+  p_Arrays[5] = p_Ctx->m_JerkZ;
+}
+//---------------------------------------------------------------------------//
+static void _copyImage(
+    NBodyCpuCtx* p_Ctx, uint32_t p_PaddedCount, uint8_t* p_Image) {
+  const NBodyParticleStore& store = p_Ctx->m_Store;
+  const size_t arraySize = _arraySize(p_PaddedCount);
+  for (uint32_t a = 0; a < NBodyAttribCount; ++a) {
+    memcpy(p_Image + a * arraySize, store.m_Attribs[a], arraySize);
+  }
+  // The ids of the padding slots are not maintained, stored as 0.
+  uint8_t* ids = p_Image + NBodyAttribCount * arraySize;
+  const size_t idSize = store.m_Count * sizeof(uint32_t);
+  memcpy(ids, p_Ctx->m_Ids, idSize);
+  memset(ids + idSize, 0, arraySize - idSize);
+  float* forces[6];
+  _forceArrays(p_Ctx, forces);
+  for (uint32_t f = 0; f < 6; ++f) {
+    memcpy(
+        p_Image + (NBodyAttribCount + 1 + f) * arraySize,
+        forces[f],
+        arraySize);
+  }
+}
+//---------------------------------------------------------------------------//
+static const char* _readHeader(
+    FILE* p_File, NBodyCheckpointKind p_Kind, NBodyCheckpointHeader* p_Header) {
+  if (fread(p_Header, sizeof(*p_Header), 1, p_File) != 1)
+    return "not a checkpoint (too short)";
+  if (memcmp(p_Header->m_Magic, s_CheckpointMagic, sizeof(s_CheckpointMagic)) !=
+      0)
+    return "not a checkpoint";
+  if (p_Header->m_Version != NBodyCheckpointVersion)
+    return "unsupported checkpoint version";
+  const NBodyCheckpointState& state = p_Header->m_State;
+  const size_t imageSize =
+      NBodyCheckpointArrayCount * _arraySize(p_Header->m_PaddedCount);
+  if (p_Header->m_HeaderSize != sizeof(NBodyCheckpointHeader) ||
+      p_Header->m_Kind != p_Kind || p_Header->m_ParticleCount == 0 ||
+      p_Header->m_PaddedCount != nbodyPadCount(p_Header->m_ParticleCount) ||
+      p_Header->m_ChunkCount != _chunkCount(imageSize) ||
+      p_Header->m_DeltaChunks > p_Header->m_ChunkCount ||
+      state.m_Integrator >= NBodyIntegratorCount ||
+      state.m_Solver >= NBodySolverCount ||
+      state.m_Accumulation >= NBodyAccumCount ||
+      state.m_PosFormat >= NBodyPosFormatCount || state.m_FmmOrder == 0 ||
+      state.m_FmmOrder > NBodyFmmMaxOrder)
+    return "invalid checkpoint header";
+  return nullptr;
+}
+//---------------------------------------------------------------------------//
+// Applies p_Path's chunks to the image of p_Data if it is a delta of it. The
+// replaced chunks are swapped into the delta's buffer, and back if the
+// result doesn't hash to the delta's image: the image is left as it was.
+static bool
+_applyDelta(NBodyCheckpointData* p_Data, const std::string& p_Path) {
+  FILE* file = fopen(p_Path.c_str(), "rb");
+  if (file == nullptr)
+    return false;
+  const NBodyCheckpointHeader& full = p_Data->m_Header;
+  NBodyCheckpointHeader header;
+  std::vector<uint32_t> chunks;
+  std::vector<uint8_t> data;
+  const size_t imageSize =
+      NBodyCheckpointArrayCount * _arraySize(full.m_PaddedCount);
+  bool ok = _readHeader(file, NBodyCheckpointDelta, &header) == nullptr &&
+            header.m_ParticleCount == full.m_ParticleCount &&
+            header.m_BaseHash == full.m_ImageHash;
+  if (ok) {
+    chunks.resize(header.m_DeltaChunks);
+    ok = fread(chunks.data(), sizeof(uint32_t), chunks.size(), file) ==
+         chunks.size();
+    for (uint32_t k = 0; ok && k < chunks.size(); ++k) {
+      ok = chunks[k] < full.m_ChunkCount &&
+           (k == 0 || chunks[k - 1] < chunks[k]);
+    }
+  }
+  size_t dataSize = 0;
+  for (uint32_t k = 0; ok && k < chunks.size(); ++k) {
+    dataSize += std::min<size_t>(
+        NBodyCheckpointChunkSize,
+        imageSize - size_t(chunks[k]) * NBodyCheckpointChunkSize);
+  }
+  if (ok) {
+    data.resize(dataSize);
+    ok = fread(data.data(), 1, dataSize, file) == dataSize &&
+         fgetc(file) == EOF;
+  }
+  fclose(file);
+  if (!ok)
+    return false;
+
+  uint8_t* image = static_cast<uint8_t*>(p_Data->m_Image);
+  auto swapChunks = [&]() {
+    size_t offset = 0;
+    for (const uint32_t c : chunks) {
+      uint8_t* chunk = image + size_t(c) * NBodyCheckpointChunkSize;
+      const size_t size = std::min<size_t>(
+          NBodyCheckpointChunkSize,
+          imageSize - size_t(c) * NBodyCheckpointChunkSize);
+      std::swap_ranges(chunk, chunk + size, data.data() + offset);
+      offset += size;
+    }
+  };
+  swapChunks();
+  std::vector<uint64_t> hashes(full.m_ChunkCount);
+  if (_hashImage(image, imageSize, hashes.data()) != header.m_ImageHash) {
+    swapChunks();
+    return false;
+  }
+  p_Data->m_Header = header;
+  return true;
+}
+//---------------------------------------------------------------------------//
+// Core functions:
+//---------------------------------------------------------------------------//
+void nbodyCheckpointOpen(
+    NBodyCheckpoint* p_Checkpoint,
+    const char* p_Path,
+    uint32_t p_ParticleCount,
+    uint32_t p_Seed,
+    uint32_t p_StepInterval,
+    double p_SecondsInterval,
+    uint64_t p_Sequence) {
+  NBODY_ASSERT(_isLittleEndian());
+  NBodyCheckpointImpl* impl = new NBodyCheckpointImpl();
+  impl->m_Path = p_Path;
+  impl->m_DeltaPath = impl->m_Path + ".delta";
+  impl->m_Count = p_ParticleCount;
+  impl->m_PaddedCount = nbodyPadCount(p_ParticleCount);
+  impl->m_Seed = p_Seed;
+  impl->m_ImageSize =
+      NBodyCheckpointArrayCount * _arraySize(impl->m_PaddedCount);
+  impl->m_ChunkCount = _chunkCount(impl->m_ImageSize);
+  impl->m_Image = nbodyAlignedAlloc(impl->m_ImageSize, NBodyAlignment);
+  NBODY_ASSERT(impl->m_Image != nullptr);
+  impl->m_Hashes.resize(impl->m_ChunkCount);
+  impl->m_Sequence = p_Sequence;
+  impl->m_NextStep = UINT64_MAX;
+  impl->m_CapturedStep = UINT64_MAX;
+  impl->m_LastCapture = std::chrono::steady_clock::now();
+  impl->m_Writer = std::thread(_writerProc, impl);
+
+  p_Checkpoint->m_StepInterval = p_StepInterval;
+  p_Checkpoint->m_SecondsInterval = p_SecondsInterval;
+  p_Checkpoint->m_Impl = impl;
+}
+//---------------------------------------------------------------------------//
+bool nbodyCheckpointCapture(
+    NBodyCheckpoint* p_Checkpoint,
+    NBodyCpuCtx* p_Ctx,
+    double p_StepSeconds,
+    bool p_Force) {
+  NBodyCheckpointImpl* impl = p_Checkpoint->m_Impl;
+  NBODY_ASSERT(p_Ctx->m_Store.m_Count == impl->m_Count);
+  const uint64_t step = p_Ctx->m_StepCount;
+  const uint32_t interval = p_Checkpoint->m_StepInterval;
+  // Due on the multiples of the interval, counted from any first step.
+  if (interval > 0 && impl->m_NextStep == UINT64_MAX)
+    impl->m_NextStep = (step + interval - 1) / interval * interval;
+
+  const auto now = std::chrono::steady_clock::now();
+  if (step == impl->m_CapturedStep)
+    return false;
+  const bool due =
+      p_Force || (interval > 0 && step >= impl->m_NextStep) ||
+      (p_Checkpoint->m_SecondsInterval > 0.0 &&
+       std::chrono::duration<double>(now - impl->m_LastCapture).count() >=
+           p_Checkpoint->m_SecondsInterval);
+  if (!due)
+    return false;
+  {
+    std::unique_lock<std::mutex> lock(impl->m_Mutex);
+    if (impl->m_Busy && !p_Force) {
+      impl->m_Deferred++;
+      return false;
+    }
+    impl->m_Idle.wait(lock, [impl] { return !impl->m_Busy; });
+  }
+
+  // The writer is idle, the image is ours until m_Busy is set.
+  _copyImage(p_Ctx, impl->m_PaddedCount, static_cast<uint8_t*>(impl->m_Image));
+  _captureState(p_Ctx, impl->m_Seed, p_StepSeconds, &impl->m_State);
+  {
+    std::lock_guard<std::mutex> lock(impl->m_Mutex);
+    impl->m_Busy = true;
+  }
+  impl->m_WakeUp.notify_one();
+
+  if (interval > 0)
+    impl->m_NextStep = (step / interval + 1) * interval;
+  const auto end = std::chrono::steady_clock::now();
+  impl->m_LastCapture = end;
+  impl->m_CapturedStep = step;
+  impl->m_Captured++;
+  impl->m_CaptureSeconds += std::chrono::duration<double>(end - now).count();
+  return true;
+}
+//---------------------------------------------------------------------------//
+bool nbodyCheckpointClose(
+    NBodyCheckpoint* p_Checkpoint, NBodyCheckpointStats* p_Stats) {
+  NBodyCheckpointImpl* impl = p_Checkpoint->m_Impl;
+  {
+    std::lock_guard<std::mutex> lock(impl->m_Mutex);
+    impl->m_Closing = true;
+  }
+  impl->m_WakeUp.notify_one();
+  impl->m_Writer.join();
+
+  if (p_Stats != nullptr) {
+    NBodyCheckpointStats& stats = *p_Stats;
+    stats.m_Captured = impl->m_Captured;
+    stats.m_Deferred = impl->m_Deferred;
+    stats.m_Full = impl->m_Full;
+    stats.m_Delta = impl->m_Delta;
+    stats.m_ImageBytes = impl->m_Captured * impl->m_ImageSize;
+    stats.m_FileBytes = impl->m_FileBytes;
+    stats.m_LastStep = impl->m_LastStep;
+    stats.m_CaptureSeconds = impl->m_CaptureSeconds;
+    stats.m_WriterSeconds = impl->m_WriterSeconds;
+  }
+  const bool ok = !impl->m_Failed;
+  nbodyAlignedFree(impl->m_Image);
+  delete impl;
+  p_Checkpoint->m_Impl = nullptr;
+  return ok;
+}
+//---------------------------------------------------------------------------//
+const char*
+nbodyCheckpointRead(NBodyCheckpointData* p_Data, const char* p_Path) {
+  memset(p_Data, 0, sizeof(*p_Data));
+  if (!_isLittleEndian())
+    return "checkpoints need a little-endian host";
+  FILE* file = fopen(p_Path, "rb");
+  if (file == nullptr)
+    return "can't open the file";
+  NBodyCheckpointHeader& header = p_Data->m_Header;
+  const char* error = _readHeader(file, NBodyCheckpointFull, &header);
+  const size_t imageSize =
+      NBodyCheckpointArrayCount * _arraySize(header.m_PaddedCount);
+  if (error == nullptr) {
+    p_Data->m_Image = nbodyAlignedAlloc(imageSize, NBodyAlignment);
+    NBODY_ASSERT(p_Data->m_Image != nullptr);
+    std::vector<uint64_t> hashes(header.m_ChunkCount);
+    if (fread(p_Data->m_Image, 1, imageSize, file) != imageSize)
+      error = "truncated checkpoint";
+    else if (
+        _hashImage(
+            static_cast<const uint8_t*>(p_Data->m_Image),
+            imageSize,
+            hashes.data()) != header.m_ImageHash)
+      error = "damaged checkpoint";
+  }
+  fclose(file);
+
+  if (error == nullptr) {
+    p_Data->m_FromDelta = _applyDelta(p_Data, std::string(p_Path) + ".delta");
+    // The ids must be a permutation, nbodyCpuRestoreCheckpoint inverts them.
+    const uint32_t* ids = reinterpret_cast<const uint32_t*>(
+        static_cast<const uint8_t*>(p_Data->m_Image) +
+        NBodyAttribCount * _arraySize(header.m_PaddedCount));
+    std::vector<bool> seen(header.m_ParticleCount, false);
+    for (uint32_t slot = 0; slot < header.m_ParticleCount; ++slot) {
+      const uint32_t id = ids[slot];
+      if (id >= header.m_ParticleCount || seen[id]) {
+        error = "invalid checkpoint ids";
+        break;
+      }
+      seen[id] = true;
+    }
+  }
+  if (error != nullptr)
+    nbodyCheckpointFree(p_Data);
+  return error;
+}
+//---------------------------------------------------------------------------//
+void nbodyCheckpointFree(NBodyCheckpointData* p_Data) {
+  nbodyAlignedFree(p_Data->m_Image);
+  memset(p_Data, 0, sizeof(*p_Data));
+}
+//---------------------------------------------------------------------------//
+void nbodyCpuRestoreCheckpoint(
+    NBodyCpuCtx* p_Ctx, const NBodyCheckpointData* p_Data) {
+  const NBodyCheckpointHeader& header = p_Data->m_Header;
+  NBodyParticleStore* store = &p_Ctx->m_Store;
+  NBODY_ASSERT(header.m_ParticleCount == store->m_Count);
+  const uint8_t* image = static_cast<const uint8_t*>(p_Data->m_Image);
+  const size_t arraySize = _arraySize(header.m_PaddedCount);
+
+  // The padding of the image is not trusted, a NaN there would reach every
+  // force sum through its zero mass.
+  const size_t countSize = store->m_Count * sizeof(float);
+  for (uint32_t a = 0; a < NBodyAttribCount; ++a) {
+    memcpy(store->m_Attribs[a], image + a * arraySize, countSize);
+    memset(
+        reinterpret_cast<uint8_t*>(store->m_Attribs[a]) + countSize,
+        0,
+        arraySize - countSize);
+  }
+  const uint32_t* ids =
+      reinterpret_cast<const uint32_t*>(image + NBodyAttribCount * arraySize);
+  for (uint32_t slot = 0; slot < store->m_Count; ++slot) {
+    p_Ctx->m_Ids[slot] = ids[slot];
+    p_Ctx->m_Slots[ids[slot]] = slot;
+  }
+  float* forces[6];
+  _forceArrays(p_Ctx, forces);
+  for (uint32_t f = 0; f < 6; ++f) {
+    memcpy(
+        forces[f],
+        image + (NBodyAttribCount + 1 + f) * arraySize,
+        arraySize);
+  }
+
+  const NBodyCheckpointState& state = header.m_State;
+  p_Ctx->m_StepCount = state.m_StepCount;
+  p_Ctx->m_ForceEvalCount = state.m_ForceEvalCount;
+  p_Ctx->m_Params.m_DeltaTime = state.m_DeltaTime;
+  p_Ctx->m_Params.m_Damping = state.m_Damping;
+  p_Ctx->m_Integrator = NBodyIntegrator(state.m_Integrator);
+  p_Ctx->m_Solver = NBodySolver(state.m_Solver);
+  p_Ctx->m_Accumulation = NBodyAccumulation(state.m_Accumulation);
+  p_Ctx->m_PosFormat = NBodyPosFormat(state.m_PosFormat);
+  p_Ctx->m_Deterministic = state.m_Deterministic != 0;
+  p_Ctx->m_ForcesValid = state.m_ForcesValid != 0;
+  p_Ctx->m_JerkValid = state.m_JerkValid != 0;
+  p_Ctx->m_ReorderInterval = state.m_ReorderInterval;
+  p_Ctx->m_Blocks.m_Eta = state.m_BlockEta;
+  p_Ctx->m_Tree.m_Theta = state.m_TreeTheta;
+  p_Ctx->m_Tree.m_Quadrupole = state.m_TreeQuadrupole != 0;
+  p_Ctx->m_Fmm.m_Order = state.m_FmmOrder;
+  p_Ctx->m_Fmm.m_Theta = state.m_FmmTheta;
+}
+//---------------------------------------------------------------------------//
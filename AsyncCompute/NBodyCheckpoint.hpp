@@ -0,0 +1,158 @@
+#pragma once
+
+/******************************************************************************
+ * \checkpoints of the CPU engine, for restarting a run that died
+ * \every k steps or s seconds the whole state (store, ids, forces, step
+ * \count, settings, time spent) is copied into a staging image and handed to
+ * \a writer thread, the steps never wait for the disk. Files are written to
+ * \a temporary name, flushed to the disk and renamed over the previous one,
+ * \so a crash leaves either the old or the new checkpoint, never a torn one.
+ * \Checkpoints are incremental: after a full one only the chunks of the
+ * \image that changed since (masses, ids between two reorderings, unused
+ * \jerks stay put) go to a delta file next to it. Restarting from either
+ * \continues the run bitwise identically.
+ ******************************************************************************/
+
+#include "NBodyCommon.hpp"
+#include "NBodySoa.hpp"
+
+struct NBodyCpuCtx;
+struct NBodyCheckpointImpl;
+
+static constexpr uint32_t NBodyCheckpointVersion = 1;
+// Unit of the incremental checkpoints
+static constexpr uint32_t NBodyCheckpointChunkSize = 64 * 1024;
+// Image arrays of m_PaddedCount 4-byte values: the NBodyAttribute arrays,
+// the ids, then the accelerations and jerks (x, y, z each).
+static constexpr uint32_t NBodyCheckpointArrayCount = NBodyAttribCount + 7;
+
+//---------------------------------------------------------------------------//
+enum NBodyCheckpointKind : uint32_t {
+  NBodyCheckpointFull = 0, // The whole image
+  NBodyCheckpointDelta     // Chunk indices, then those chunks of the image
+};
+
+//---------------------------------------------------------------------------//
+// Everything but the arrays that a restart needs. The random numbers are
+// counter-based (NBodyRandom.hpp): the seed is their whole state.
+//---------------------------------------------------------------------------//
+struct NBodyCheckpointState {
+  uint64_t m_StepCount;
+  uint64_t m_ForceEvalCount;
+  double m_StepSeconds; // Spent stepping since the start of the run
+  float m_DeltaTime;
+  float m_Damping;
+  uint32_t m_Integrator;   // NBodyIntegrator
+  uint32_t m_Solver;       // NBodySolver
+  uint32_t m_Accumulation; // NBodyAccumulation
+  uint32_t m_PosFormat;    // NBodyPosFormat
+  uint32_t m_Deterministic;
+  uint32_t m_ForcesValid;
+  uint32_t m_JerkValid;
+  uint32_t m_ReorderInterval;
+  float m_BlockEta;
+  float m_TreeTheta;
+  uint32_t m_TreeQuadrupole;
+  uint32_t m_FmmOrder;
+  float m_FmmTheta;
+  uint32_t m_Seed; // Of the initial conditions
+};
+static_assert(sizeof(NBodyCheckpointState) == 88, "Fixed size state");
+
+//---------------------------------------------------------------------------//
+// File layout: this header then the payload of m_Kind, little-endian. A
+// delta (the full file's path + ".delta") only applies to the full file
+// whose image hashes to m_BaseHash.
+//---------------------------------------------------------------------------//
+struct NBodyCheckpointHeader {
+  char m_Magic[8];       // "NBODYCKP"
+  uint32_t m_Version;    // NBodyCheckpointVersion
+  uint32_t m_HeaderSize; // sizeof(NBodyCheckpointHeader)
+  uint32_t m_Kind;       // NBodyCheckpointKind
+  uint32_t m_ParticleCount;
+  uint32_t m_PaddedCount; // nbodyPadCount(m_ParticleCount), per array
+  uint32_t m_ChunkCount;  // Of the image
+  uint32_t m_DeltaChunks; // NBodyCheckpointDelta: chunks stored
+  uint32_t m_Reserved;
+  uint64_t m_Sequence;   // Checkpoints of the run before this one
+  uint64_t m_ImageHash;  // Of the whole image, checked on restart
+  uint64_t m_BaseHash;   // NBodyCheckpointDelta: m_ImageHash of the full
+  NBodyCheckpointState m_State;
+};
+static_assert(sizeof(NBodyCheckpointHeader) == 152, "Fixed size header");
+
+//---------------------------------------------------------------------------//
+struct NBodyCheckpointStats {
+  uint64_t m_Captured;     // Images copied by the stepping thread
+  uint64_t m_Deferred;     // Steps a checkpoint was due but the writer busy
+  uint64_t m_Full;         // Files written, whole images
+  uint64_t m_Delta;        // and changed chunks only
+  uint64_t m_ImageBytes;   // Captured
+  uint64_t m_FileBytes;    // Written
+  uint64_t m_LastStep;     // Of the last checkpoint on the disk
+  double m_CaptureSeconds; // Spent on the stepping thread
+  double m_WriterSeconds;  // Spent hashing, writing and syncing
+};
+
+//---------------------------------------------------------------------------//
+struct NBodyCheckpoint {
+  uint32_t m_StepInterval;  // 0: never by step count
+  double m_SecondsInterval; // 0: never by wall-clock time
+  NBodyCheckpointImpl* m_Impl;
+};
+
+//---------------------------------------------------------------------------//
+// Starts the writer thread of checkpoints of p_ParticleCount particles
+// generated from p_Seed to p_Path, due every p_StepInterval steps or
+// p_SecondsInterval seconds (either 0 to disable it). p_Sequence is the
+// number of checkpoints the run has already written, 0 unless restarted.
+void nbodyCheckpointOpen(
+    NBodyCheckpoint* p_Checkpoint,
+    const char* p_Path,
+    uint32_t p_ParticleCount,
+    uint32_t p_Seed,
+    uint32_t p_StepInterval,
+    double p_SecondsInterval,
+    uint64_t p_Sequence);
+//---------------------------------------------------------------------------//
+// Called after every step, copies the state of p_Ctx when a checkpoint is
+// due and the writer idle (otherwise it is retried on the next step).
+// p_StepSeconds is the time spent stepping since the start of the run.
+// p_Force waits for the writer instead, for a last checkpoint (unless this
+// step was captured already). True if the state was captured.
+bool nbodyCheckpointCapture(
+    NBodyCheckpoint* p_Checkpoint,
+    NBodyCpuCtx* p_Ctx,
+    double p_StepSeconds,
+    bool p_Force);
+//---------------------------------------------------------------------------//
+// Writes the captured image, stops the writer. False if any checkpoint
+// could not be written, p_Stats (optional) receives the final counters.
+bool nbodyCheckpointClose(
+    NBodyCheckpoint* p_Checkpoint, NBodyCheckpointStats* p_Stats);
+//---------------------------------------------------------------------------//
+
+//---------------------------------------------------------------------------//
+// A checkpoint read back for a restart: the header of the newest valid
+// file (the delta when it applies) and the image.
+//---------------------------------------------------------------------------//
+struct NBodyCheckpointData {
+  NBodyCheckpointHeader m_Header;
+  bool m_FromDelta;
+  void* m_Image; // NBodyCheckpointArrayCount arrays
+};
+
+//---------------------------------------------------------------------------//
+// Reads p_Path and its delta if any. A delta that is stale (of another
+// full checkpoint) or damaged is ignored, the full one is used alone.
+// Returns nullptr on success, otherwise why the checkpoint can't be used.
+const char*
+nbodyCheckpointRead(NBodyCheckpointData* p_Data, const char* p_Path);
+//---------------------------------------------------------------------------//
+void nbodyCheckpointFree(NBodyCheckpointData* p_Data);
+//---------------------------------------------------------------------------//
+// Restores the state and the settings of a checkpoint of p_Ctx's particle
+// count, the next step is the one the checkpointed run would have taken.
+void nbodyCpuRestoreCheckpoint(
+    NBodyCpuCtx* p_Ctx, const NBodyCheckpointData* p_Data);
+//---------------------------------------------------------------------------//
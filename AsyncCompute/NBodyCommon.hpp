@@ -0,0 +1,52 @@
+#pragma once
+
+/******************************************************************************
+ * \types and constants shared by the CPU n-body modules
+ ******************************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+//---------------------------------------------------------------------------//
+// Helper macros:
+//---------------------------------------------------------------------------//
+#if defined(_MSC_VER)
+#define NBODY_ASSERT(expr)                                                     \
+  if (!(expr)) {                                                               \
+    __debugbreak();                                                            \
+  }
+#else
+#define NBODY_ASSERT(expr)                                                     \
+  if (!(expr)) {                                                               \
+    __builtin_trap();                                                          \
+  }
+#endif
+
+//---------------------------------------------------------------------------//
+// Simulation constants (must match nBodyGravityCS.hlsl):
+//---------------------------------------------------------------------------//
+static constexpr float NBodySofteningSquared = 0.0012500000f * 0.0012500000f;
+static constexpr float NBodyG = 6.67300e-11f * 10000.0f;
+// m_Position.w of the demo particles, the forces weigh every body by its own.
+static constexpr float NBodyDefaultMass = 10000.0f * 10000.0f;
+// G times NBodyDefaultMass, the g_fParticleMass the shader used to assume
+static constexpr float NBodyParticleMass = NBodyG * NBodyDefaultMass;
+
+//---------------------------------------------------------------------------//
+// Particle data, binary compatible with ParticleSimCtx::ParticleMotion and
+// the PosVelo struct of the compute shader:
+//---------------------------------------------------------------------------//
+struct NBodyFloat4 {
+  float x;
+  float y;
+  float z;
+  float w;
+};
+
+struct NBodyParticle {
+  NBodyFloat4 m_Position;
+  NBodyFloat4 m_Velocity;
+};
+static_assert(sizeof(NBodyParticle) == 32, "Must match PosVelo (32 bytes)");
+//---------------------------------------------------------------------------//
@@ -0,0 +1,749 @@
+#include "NBodyCpu.hpp"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <utility>
+#include <vector>
+
+// Particles per pool block of the reordering gathers and the generators
+static constexpr uint32_t NBodyReorderGrain = 4096;
+
+namespace {
+struct EnergyJob {
+  NBodyCpuCtx* m_Ctx;
+  double* m_Kinetic;
+  double* m_Potential;
+};
+
+struct SphereJob {
+  NBodyParticle* m_Particles;
+  const float* m_Center;
+  NBodyFloat4 m_Velocity;
+  float m_Spread;
+  uint32_t m_Seed;
+  uint32_t m_FirstIndex;
+};
+
+struct ChecksumJob {
+  NBodyCpuCtx* m_Ctx;
+  uint64_t* m_Hashes; // Per NBodyReorderGrain ids
+};
+} // namespace
+
+static constexpr uint64_t NBodyFnvOffset = 14695981039346656037ull;
+static constexpr uint64_t NBodyFnvPrime = 1099511628211ull;
+
+//---------------------------------------------------------------------------//
+/// Local functions:
+//---------------------------------------------------------------------------//
+// Uniform sphere particles [p_Begin, p_End) by rejection from the cube, draw
+// d of a particle is its d-th candidate (NBodyRangeFunc).
+static void
+_sphereBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  const SphereJob* job = static_cast<const SphereJob*>(p_User);
+  const float spread = job->m_Spread;
+
+  for (uint32_t i = p_Begin; i < p_End; ++i) {
+    float delta[3] = {spread, spread, spread};
+    for (uint32_t draw = 0;
+         delta[0] * delta[0] + delta[1] * delta[1] + delta[2] * delta[2] >
+         spread * spread;
+         ++draw) {
+      uint32_t bits[4];
+      nbodyRandomBits(
+          job->m_Seed, job->m_FirstIndex + i, NBodyStreamPosition, draw, bits);
+      delta[0] = nbodyRandomSigned(bits[0]) * spread;
+      delta[1] = nbodyRandomSigned(bits[1]) * spread;
+      delta[2] = nbodyRandomSigned(bits[2]) * spread;
+    }
+
+    NBodyParticle* particle = &job->m_Particles[i];
+    particle->m_Position.x = job->m_Center[0] + delta[0];
+    particle->m_Position.y = job->m_Center[1] + delta[1];
+    particle->m_Position.z = job->m_Center[2] + delta[2];
+    particle->m_Position.w = NBodyDefaultMass;
+    particle->m_Velocity = job->m_Velocity;
+  }
+}
+//---------------------------------------------------------------------------//
+// Accelerations of the particles [p_Begin, p_End) from all particles, the
+// kernel streams the position arrays only (NBodyRangeFunc).
+static void
+_forceBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  NBodyCpuCtx* ctx = static_cast<NBodyCpuCtx*>(p_User);
+  NBodyParticleStore* store = &ctx->m_Store;
+
+  const float* posX = nbodyStoreAttrib(store, NBodyAttribPosX);
+  const float* posY = nbodyStoreAttrib(store, NBodyAttribPosY);
+  const float* posZ = nbodyStoreAttrib(store, NBodyAttribPosZ);
+
+  NBodyForceArgs args = {};
+  args.m_SrcX = posX;
+  args.m_SrcY = posY;
+  args.m_SrcZ = posZ;
+  args.m_SrcMass = nbodyStoreAttrib(store, NBodyAttribMass);
+  args.m_SrcCount = store->m_PaddedCount;
+  args.m_DstX = posX;
+  args.m_DstY = posY;
+  args.m_DstZ = posZ;
+  args.m_DstBegin = p_Begin;
+  args.m_DstEnd = p_End;
+  args.m_AccelX = ctx->m_AccelX;
+  args.m_AccelY = ctx->m_AccelY;
+  args.m_AccelZ = ctx->m_AccelZ;
+  args.m_G = NBodyG;
+  args.m_Accumulation = ctx->m_Accumulation;
+  args.m_PosFormat = ctx->m_PosFormat;
+  for (int c = 0; c < 3; ++c) {
+    args.m_SrcPacked[c] = ctx->m_PackedPos[c];
+  }
+  if (ctx->m_Deterministic)
+    nbodyGetDeterministicKernel(ctx->m_Isa)(&args);
+  else
+    nbodyGetForceKernel(ctx->m_Isa)(&args);
+}
+//---------------------------------------------------------------------------//
+// Converts the positions [p_Begin, p_End) of the store to m_PosFormat
+// (NBodyRangeFunc).
+static void
+_packBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  NBodyCpuCtx* ctx = static_cast<NBodyCpuCtx*>(p_User);
+  const NBodyAttribute attribs[3] = {
+      NBodyAttribPosX, NBodyAttribPosY, NBodyAttribPosZ};
+  for (int c = 0; c < 3; ++c) {
+    nbodyPackPositions(
+        nbodyStoreAttrib(&ctx->m_Store, attribs[c]) + p_Begin,
+        ctx->m_PackedPos[c] + p_Begin,
+        p_End - p_Begin,
+        ctx->m_PosFormat);
+  }
+}
+//---------------------------------------------------------------------------//
+// Packs the source positions (padding included) for the direct solver.
+static void _packPositions(NBodyCpuCtx* p_Ctx) {
+  const uint32_t paddedCount = p_Ctx->m_Store.m_PaddedCount;
+  if (p_Ctx->m_PackedMemory == nullptr) {
+    p_Ctx->m_PackedMemory = nbodyAlignedAlloc(
+        3 * size_t(paddedCount) * sizeof(uint16_t), NBodyAlignment);
+    NBODY_ASSERT(p_Ctx->m_PackedMemory != nullptr);
+    for (uint32_t c = 0; c < 3; ++c) {
+      p_Ctx->m_PackedPos[c] =
+          static_cast<uint16_t*>(p_Ctx->m_PackedMemory) + c * paddedCount;
+    }
+  }
+  nbodyPoolParallelFor(
+      p_Ctx->m_Pool, paddedCount, NBodyReorderGrain, _packBlock, p_Ctx);
+}
+//---------------------------------------------------------------------------//
+// Tile pairs [p_Begin, p_End) of the upper triangle, numbered row by row
+// (row I holds the pairs (I, I) .. (I, tiles - 1)), accumulated into the
+// acceleration buffer p_Buffer.
+static void _pairRange(
+    NBodyCpuCtx* p_Ctx, uint32_t p_Begin, uint32_t p_End, uint32_t p_Buffer) {
+  NBodyParticleStore* store = &p_Ctx->m_Store;
+  const uint32_t count = store->m_Count;
+  const uint32_t tiles = (count + NBodyPairTileSize - 1) / NBodyPairTileSize;
+  const size_t stride = size_t(store->m_PaddedCount);
+  float* accel = p_Ctx->m_PairAccel + 3 * stride * p_Buffer;
+
+  NBodyPairArgs args = {};
+  args.m_PosX = nbodyStoreAttrib(store, NBodyAttribPosX);
+  args.m_PosY = nbodyStoreAttrib(store, NBodyAttribPosY);
+  args.m_PosZ = nbodyStoreAttrib(store, NBodyAttribPosZ);
+  args.m_Mass = nbodyStoreAttrib(store, NBodyAttribMass);
+  args.m_AccelX = accel;
+  args.m_AccelY = accel + stride;
+  args.m_AccelZ = accel + 2 * stride;
+  const NBodyPairKernel kernel = p_Ctx->m_Deterministic
+                                     ? nbodyGetDeterministicPairKernel()
+                                     : nbodyGetPairKernel(p_Ctx->m_Isa);
+
+  uint32_t tileI = 0;
+  uint32_t rowBegin = 0;
+  while (rowBegin + (tiles - tileI) <= p_Begin) {
+    rowBegin += tiles - tileI;
+    tileI++;
+  }
+  uint32_t tileJ = tileI + (p_Begin - rowBegin);
+
+  for (uint32_t p = p_Begin; p < p_End; ++p) {
+    args.m_BeginI = tileI * NBodyPairTileSize;
+    args.m_EndI = std::min(args.m_BeginI + NBodyPairTileSize, count);
+    args.m_BeginJ = tileJ * NBodyPairTileSize;
+    args.m_EndJ = std::min(args.m_BeginJ + NBodyPairTileSize, count);
+    kernel(&args);
+
+    if (++tileJ == tiles) {
+      tileI++;
+      tileJ = tileI;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Tile pairs [p_Begin, p_End) into the buffer of p_Worker (NBodyRangeFunc).
+static void
+_pairBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t p_Worker) {
+  _pairRange(static_cast<NBodyCpuCtx*>(p_User), p_Begin, p_End, p_Worker);
+}
+//---------------------------------------------------------------------------//
+// Deterministic mode: slices [p_Begin, p_End) of the tile pairs, slice s
+// always covers the same pairs in the same order and owns buffer s
+// (NBodyRangeFunc).
+static void
+_pairSliceBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  NBodyCpuCtx* ctx = static_cast<NBodyCpuCtx*>(p_User);
+  const uint32_t tiles =
+      (ctx->m_Store.m_Count + NBodyPairTileSize - 1) / NBodyPairTileSize;
+  const uint64_t pairs = uint64_t(tiles) * (tiles + 1) / 2;
+  for (uint32_t s = p_Begin; s < p_End; ++s) {
+    _pairRange(
+        ctx,
+        uint32_t(pairs * s / NBodyDeterministicSlices),
+        uint32_t(pairs * (s + 1) / NBodyDeterministicSlices),
+        s);
+  }
+}
+//---------------------------------------------------------------------------//
+// Sums the per-worker (or per-slice) buffers of the particles [p_Begin,
+// p_End) in buffer order into m_AccelX/Y/Z and clears them for the next step
+// (NBodyRangeFunc).
+static void
+_pairReduceBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  NBodyCpuCtx* ctx = static_cast<NBodyCpuCtx*>(p_User);
+  const size_t stride = size_t(ctx->m_Store.m_PaddedCount);
+  float* out[3] = {ctx->m_AccelX, ctx->m_AccelY, ctx->m_AccelZ};
+  // Buffers past the slices are zero, but -0 + 0 would still flip a bit.
+  const uint32_t buffers = ctx->m_Deterministic ? NBodyDeterministicSlices
+                                                : ctx->m_PairBufferCount;
+
+  for (uint32_t c = 0; c < 3; ++c) {
+    float* first = ctx->m_PairAccel + c * stride;
+    for (uint32_t i = p_Begin; i < p_End; ++i) {
+      out[c][i] = first[i];
+      first[i] = 0.0f;
+    }
+    for (uint32_t b = 1; b < buffers; ++b) {
+      float* buffer = ctx->m_PairAccel + (3 * b + c) * stride;
+      for (uint32_t i = p_Begin; i < p_End; ++i) {
+        out[c][i] += buffer[i];
+        buffer[i] = 0.0f;
+      }
+    }
+    for (uint32_t i = p_Begin; i < p_End; ++i) {
+      out[c][i] *= NBodyG;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Barnes-Hut accelerations of the particles of the leaves [p_Begin, p_End).
+static void
+_treeForceBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  NBodyCpuCtx* ctx = static_cast<NBodyCpuCtx*>(p_User);
+  nbodyOctreeForceLeaves(
+      &ctx->m_Tree,
+      p_Begin,
+      p_End,
+      ctx->m_Isa,
+      NBodyG,
+      ctx->m_AccelX,
+      ctx->m_AccelY,
+      ctx->m_AccelZ);
+}
+//---------------------------------------------------------------------------//
+// Accelerations and jerks of the particles [p_Begin, p_End) from all
+// particles (NBodyRangeFunc).
+static void
+_jerkBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  NBodyCpuCtx* ctx = static_cast<NBodyCpuCtx*>(p_User);
+  NBodyParticleStore* store = &ctx->m_Store;
+
+  NBodyJerkArgs args = {};
+  for (uint32_t c = 0; c < 3; ++c) {
+    args.m_SrcPos[c] = args.m_DstPos[c] =
+        nbodyStoreAttrib(store, NBodyAttribute(NBodyAttribPosX + c));
+    args.m_SrcVel[c] = args.m_DstVel[c] =
+        nbodyStoreAttrib(store, NBodyAttribute(NBodyAttribVelX + c));
+  }
+  args.m_SrcMass = nbodyStoreAttrib(store, NBodyAttribMass);
+  args.m_SrcCount = store->m_PaddedCount;
+  args.m_DstBegin = p_Begin;
+  args.m_DstEnd = p_End;
+  args.m_Accel[0] = ctx->m_AccelX;
+  args.m_Accel[1] = ctx->m_AccelY;
+  args.m_Accel[2] = ctx->m_AccelZ;
+  args.m_Jerk[0] = ctx->m_JerkX;
+  args.m_Jerk[1] = ctx->m_JerkY;
+  args.m_Jerk[2] = ctx->m_JerkZ;
+  args.m_G = NBodyG;
+  if (ctx->m_Deterministic)
+    nbodyGetDeterministicJerkKernel()(&args);
+  else
+    nbodyGetJerkKernel(ctx->m_Isa)(&args);
+}
+//---------------------------------------------------------------------------//
+// Kinetic and potential energy of the particles [p_Begin, p_End), written
+// per particle so that the total does not depend on the pool
+// (NBodyRangeFunc).
+static void
+_energyBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  EnergyJob* job = static_cast<EnergyJob*>(p_User);
+  NBodyParticleStore* store = &job->m_Ctx->m_Store;
+  const float* pos[3];
+  const float* vel[3];
+  for (uint32_t c = 0; c < 3; ++c) {
+    pos[c] = nbodyStoreAttrib(store, NBodyAttribute(NBodyAttribPosX + c));
+    vel[c] = nbodyStoreAttrib(store, NBodyAttribute(NBodyAttribVelX + c));
+  }
+  const float* mass = nbodyStoreAttrib(store, NBodyAttribMass);
+
+  for (uint32_t i = p_Begin; i < p_End; ++i) {
+    double potential = 0.0;
+    for (uint32_t j = 0; j < store->m_Count; ++j) {
+      if (j == i)
+        continue;
+      const double dx = double(pos[0][j]) - pos[0][i];
+      const double dy = double(pos[1][j]) - pos[1][i];
+      const double dz = double(pos[2][j]) - pos[2][i];
+      potential -= mass[j] / sqrt(dx * dx + dy * dy + dz * dz +
+                                  double(NBodySofteningSquared));
+    }
+    // Every pair is seen from both ends.
+    const double weight = double(mass[i]) / NBodyDefaultMass;
+    job->m_Potential[i] = 0.5 * weight * double(NBodyG) * potential;
+    job->m_Kinetic[i] =
+        0.5 * weight *
+        (double(vel[0][i]) * vel[0][i] + double(vel[1][i]) * vel[1][i] +
+         double(vel[2][i]) * vel[2][i]);
+  }
+}
+//---------------------------------------------------------------------------//
+// FNV-1a of the positions of the ids [p_Begin * NBodyReorderGrain, p_End *
+// NBodyReorderGrain) into one hash per grain (NBodyRangeFunc).
+static void
+_checksumBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  ChecksumJob* job = static_cast<ChecksumJob*>(p_User);
+  NBodyParticleStore* store = &job->m_Ctx->m_Store;
+  const float* pos[3];
+  for (uint32_t c = 0; c < 3; ++c) {
+    pos[c] = nbodyStoreAttrib(store, NBodyAttribute(NBodyAttribPosX + c));
+  }
+
+  for (uint32_t g = p_Begin; g < p_End; ++g) {
+    const uint32_t end = std::min((g + 1) * NBodyReorderGrain, store->m_Count);
+    uint64_t hash = NBodyFnvOffset;
+    for (uint32_t id = g * NBodyReorderGrain; id < end; ++id) {
+      const uint32_t slot = job->m_Ctx->m_Slots[id];
+      for (uint32_t c = 0; c < 3; ++c) {
+        uint32_t bits;
+        memcpy(&bits, pos[c] + slot, sizeof(bits));
+        for (uint32_t b = 0; b < 4; ++b) {
+          hash = (hash ^ ((bits >> (8 * b)) & 0xff)) * NBodyFnvPrime;
+        }
+      }
+    }
+    job->m_Hashes[g] = hash;
+  }
+}
+//---------------------------------------------------------------------------//
+// Gathers the slots [p_Begin, p_End) of the scratch store and ids from their
+// Morton rank (NBodyRangeFunc).
+static void
+_reorderBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  NBodyCpuCtx* ctx = static_cast<NBodyCpuCtx*>(p_User);
+  const uint32_t* order = ctx->m_Morton.m_Order;
+
+  for (uint32_t a = 0; a < NBodyAttribCount; ++a) {
+    const float* src = ctx->m_Store.m_Attribs[a];
+    float* dst = ctx->m_Scratch.m_Attribs[a];
+    for (uint32_t k = p_Begin; k < p_End; ++k) {
+      dst[k] = src[order[k]];
+    }
+  }
+  for (uint32_t k = p_Begin; k < p_End; ++k) {
+    ctx->m_ScratchIds[k] = ctx->m_Ids[order[k]];
+  }
+
+  if (ctx->m_ForcesValid) {
+    const float* forces[6] = {
+        ctx->m_AccelX,
+        ctx->m_AccelY,
+        ctx->m_AccelZ,
+        ctx->m_JerkX,
+        ctx->m_JerkY,
+        ctx->m_JerkZ};
+    const uint32_t forceCount = ctx->m_JerkValid ? 6 : 3;
+    for (uint32_t f = 0; f < forceCount; ++f) {
+      float* dst = ctx->m_ScratchForces[f];
+      for (uint32_t k = p_Begin; k < p_End; ++k) {
+        dst[k] = forces[f][order[k]];
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Inverse map of the slots [p_Begin, p_End) (NBodyRangeFunc).
+static void
+_slotsBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  NBodyCpuCtx* ctx = static_cast<NBodyCpuCtx*>(p_User);
+  for (uint32_t k = p_Begin; k < p_End; ++k) {
+    ctx->m_Slots[ctx->m_Ids[k]] = k;
+  }
+}
+//---------------------------------------------------------------------------//
+// Core functions:
+//---------------------------------------------------------------------------//
+void nbodyLoadParticles(
+    NBodyParticle* p_Particles,
+    const float* p_Center,
+    const NBodyFloat4& p_Velocity,
+    float p_Spread,
+    uint32_t p_ParticleCount,
+    uint32_t p_Seed,
+    uint32_t p_FirstIndex,
+    NBodyThreadPool* p_Pool) {
+  SphereJob job = {
+      p_Particles, p_Center, p_Velocity, p_Spread, p_Seed, p_FirstIndex};
+  nbodyPoolParallelFor(
+      p_Pool, p_ParticleCount, NBodyReorderGrain, _sphereBlock, &job);
+}
+//---------------------------------------------------------------------------//
+void nbodyLoadTwoClusters(
+    NBodyParticle* p_Particles,
+    float p_Spread,
+    uint32_t p_ParticleCount,
+    uint32_t p_Seed,
+    NBodyThreadPool* p_Pool) {
+  float centerSpread = p_Spread * 0.50f;
+  const float center0[3] = {centerSpread, 0, 0};
+  const float center1[3] = {-centerSpread, 0, 0};
+  nbodyLoadParticles(
+      &p_Particles[0],
+      center0,
+      {0, 0, -20, 1 / 100000000.0f},
+      p_Spread,
+      p_ParticleCount / 2,
+      p_Seed,
+      0,
+      p_Pool);
+  nbodyLoadParticles(
+      &p_Particles[p_ParticleCount / 2],
+      center1,
+      {0, 0, 20, 1 / 100000000.0f},
+      p_Spread,
+      p_ParticleCount / 2,
+      p_Seed,
+      p_ParticleCount / 2,
+      p_Pool);
+}
+//---------------------------------------------------------------------------//
+void nbodyAssignPowerLawMasses(
+    NBodyParticle* p_Particles,
+    uint32_t p_ParticleCount,
+    float p_Range,
+    float p_Slope,
+    uint32_t p_Seed) {
+  // Inverse of the cumulative distribution over [1, p_Range]
+  const double exponent = 1.0 - double(p_Slope);
+  double total = 0.0;
+  for (uint32_t i = 0; i < p_ParticleCount; ++i) {
+    uint32_t bits[4];
+    nbodyRandomBits(p_Seed, i, NBodyStreamMass, 0, bits);
+    const double u = nbodyRandomUnit(bits[0]);
+    const double mass =
+        fabs(exponent) < 1e-6
+            ? pow(double(p_Range), u)
+            : pow(1.0 + u * (pow(double(p_Range), exponent) - 1.0),
+                  1.0 / exponent);
+    p_Particles[i].m_Position.w = float(mass);
+    total += mass;
+  }
+
+  const double scale = p_ParticleCount * double(NBodyDefaultMass) / total;
+  for (uint32_t i = 0; i < p_ParticleCount; ++i) {
+    p_Particles[i].m_Position.w = float(p_Particles[i].m_Position.w * scale);
+  }
+}
+//---------------------------------------------------------------------------//
+void nbodyCpuInit(NBodyCpuCtx* p_Ctx, const NBodyParams& p_Params) {
+  memset(p_Ctx, 0, sizeof(*p_Ctx));
+  p_Ctx->m_Params = p_Params;
+
+  p_Ctx->m_Isa = nbodyDetectIsa();
+  p_Ctx->m_BlockSize = NBodyDefaultBlockSize;
+  p_Ctx->m_Solver = NBodySolverDirect;
+  p_Ctx->m_Integrator = NBodyIntegratorEuler;
+  p_Ctx->m_Blocks.m_Eta = NBodyDefaultBlockEta;
+  p_Ctx->m_ReorderInterval = NBodyDefaultReorderInterval;
+  nbodyMortonInit(&p_Ctx->m_Morton);
+  nbodyOctreeInit(
+      &p_Ctx->m_Tree, NBodyDefaultTheta, true, NBodyDefaultLeafSize);
+  nbodyFmmInit(
+      &p_Ctx->m_Fmm,
+      NBodyDefaultFmmOrder,
+      NBodyDefaultFmmTheta,
+      NBodyDefaultFmmLeafSize);
+
+  nbodyStoreInit(&p_Ctx->m_Store, p_Params.m_ParticleCount);
+  nbodyStoreInit(&p_Ctx->m_Scratch, p_Params.m_ParticleCount);
+
+  const uint32_t count = p_Params.m_ParticleCount;
+  p_Ctx->m_IdMemory = nbodyAlignedAlloc(
+      3 * size_t(p_Ctx->m_Store.m_PaddedCount) * sizeof(uint32_t),
+      NBodyAlignment);
+  NBODY_ASSERT(p_Ctx->m_IdMemory != nullptr);
+  p_Ctx->m_Ids = static_cast<uint32_t*>(p_Ctx->m_IdMemory);
+  p_Ctx->m_Slots = p_Ctx->m_Ids + p_Ctx->m_Store.m_PaddedCount;
+  p_Ctx->m_ScratchIds = p_Ctx->m_Slots + p_Ctx->m_Store.m_PaddedCount;
+  for (uint32_t i = 0; i < count; ++i) {
+    p_Ctx->m_Ids[i] = p_Ctx->m_Slots[i] = i;
+  }
+
+  // Accelerations, jerks and their reordering scratch
+  const size_t paddedCount = p_Ctx->m_Store.m_PaddedCount;
+  const size_t accelSize = paddedCount * sizeof(float);
+  p_Ctx->m_AccelMemory = nbodyAlignedAlloc(12 * accelSize, NBodyAlignment);
+  NBODY_ASSERT(p_Ctx->m_AccelMemory != nullptr);
+  memset(p_Ctx->m_AccelMemory, 0, 12 * accelSize);
+  float* forces = static_cast<float*>(p_Ctx->m_AccelMemory);
+  p_Ctx->m_AccelX = forces;
+  p_Ctx->m_AccelY = forces + paddedCount;
+  p_Ctx->m_AccelZ = forces + 2 * paddedCount;
+  p_Ctx->m_JerkX = forces + 3 * paddedCount;
+  p_Ctx->m_JerkY = forces + 4 * paddedCount;
+  p_Ctx->m_JerkZ = forces + 5 * paddedCount;
+  for (uint32_t f = 0; f < 6; ++f) {
+    p_Ctx->m_ScratchForces[f] = forces + (6 + f) * paddedCount;
+  }
+}
+//---------------------------------------------------------------------------//
+void nbodyCpuDestroy(NBodyCpuCtx* p_Ctx) {
+  nbodyFmmDestroy(&p_Ctx->m_Fmm);
+  nbodyOctreeDestroy(&p_Ctx->m_Tree);
+  nbodyMortonDestroy(&p_Ctx->m_Morton);
+  nbodyStoreDestroy(&p_Ctx->m_Scratch);
+  nbodyStoreDestroy(&p_Ctx->m_Store);
+  nbodyAlignedFree(p_Ctx->m_IdMemory);
+  nbodyAlignedFree(p_Ctx->m_AccelMemory);
+  nbodyAlignedFree(p_Ctx->m_PairAccel);
+  nbodyAlignedFree(p_Ctx->m_TempMemory);
+  nbodyAlignedFree(p_Ctx->m_Blocks.m_Memory);
+  nbodyAlignedFree(p_Ctx->m_PackedMemory);
+  p_Ctx->m_IdMemory = nullptr;
+  p_Ctx->m_AccelMemory = nullptr;
+  p_Ctx->m_PairAccel = nullptr;
+  p_Ctx->m_TempMemory = nullptr;
+  p_Ctx->m_Blocks.m_Memory = nullptr;
+  p_Ctx->m_PackedMemory = nullptr;
+}
+//---------------------------------------------------------------------------//
+void nbodyCpuLoadParticles(
+    NBodyCpuCtx* p_Ctx, const NBodyParticle* p_Particles) {
+  nbodyStoreLoadAos(&p_Ctx->m_Store, p_Particles);
+  for (uint32_t i = 0; i < p_Ctx->m_Store.m_Count; ++i) {
+    p_Ctx->m_Ids[i] = p_Ctx->m_Slots[i] = i;
+  }
+  p_Ctx->m_ForcesValid = false;
+  p_Ctx->m_JerkValid = false;
+}
+//---------------------------------------------------------------------------//
+const char* nbodySolverName(NBodySolver p_Solver) {
+  static const char* s_Names[NBodySolverCount] = {
+      "direct", "symmetric", "barnes-hut", "fmm"};
+  NBODY_ASSERT(p_Solver < NBodySolverCount);
+  return s_Names[p_Solver];
+}
+//---------------------------------------------------------------------------//
+void nbodyCpuComputeForces(NBodyCpuCtx* p_Ctx) {
+  const uint32_t count = p_Ctx->m_Store.m_Count;
+  p_Ctx->m_ForcesValid = true;
+  p_Ctx->m_JerkValid = false;
+  p_Ctx->m_ForceEvalCount++;
+
+  if (p_Ctx->m_Solver == NBodySolverDirect) {
+    if (p_Ctx->m_PosFormat != NBodyPosFloat32 && !p_Ctx->m_Deterministic)
+      _packPositions(p_Ctx);
+    nbodyPoolParallelFor(
+        p_Ctx->m_Pool, count, p_Ctx->m_BlockSize, _forceBlock, p_Ctx);
+    return;
+  }
+
+  if (p_Ctx->m_Solver == NBodySolverSymmetric) {
+    const uint32_t buffers = p_Ctx->m_Deterministic
+                                 ? NBodyDeterministicSlices
+                                 : nbodyPoolWorkerCount(p_Ctx->m_Pool);
+    const size_t bufferSize =
+        3 * size_t(p_Ctx->m_Store.m_PaddedCount) * sizeof(float);
+    if (p_Ctx->m_PairBufferCount < buffers) {
+      nbodyAlignedFree(p_Ctx->m_PairAccel);
+      p_Ctx->m_PairAccel = static_cast<float*>(
+          nbodyAlignedAlloc(buffers * bufferSize, NBodyAlignment));
+      NBODY_ASSERT(p_Ctx->m_PairAccel != nullptr);
+      memset(p_Ctx->m_PairAccel, 0, buffers * bufferSize);
+      p_Ctx->m_PairBufferCount = buffers;
+    }
+
+    // Pairs of one row share their I tile, one pool block is a few of them.
+    const uint32_t tiles =
+        (count + NBodyPairTileSize - 1) / NBodyPairTileSize;
+    if (p_Ctx->m_Deterministic)
+      nbodyPoolParallelFor(
+          p_Ctx->m_Pool, NBodyDeterministicSlices, 1, _pairSliceBlock, p_Ctx);
+    else
+      nbodyPoolParallelFor(
+          p_Ctx->m_Pool, tiles * (tiles + 1) / 2, 4, _pairBlock, p_Ctx);
+    nbodyPoolParallelFor(
+        p_Ctx->m_Pool, count, p_Ctx->m_BlockSize, _pairReduceBlock, p_Ctx);
+    return;
+  }
+
+  NBodyOctree* tree = &p_Ctx->m_Tree;
+  nbodyOctreeBuild(
+      tree,
+      nbodyStoreAttrib(&p_Ctx->m_Store, NBodyAttribPosX),
+      nbodyStoreAttrib(&p_Ctx->m_Store, NBodyAttribPosY),
+      nbodyStoreAttrib(&p_Ctx->m_Store, NBodyAttribPosZ),
+      nbodyStoreAttrib(&p_Ctx->m_Store, NBodyAttribMass),
+      count,
+      p_Ctx->m_Pool);
+
+  if (p_Ctx->m_Solver == NBodySolverBarnesHut) {
+    // Blocks of leaves holding about m_BlockSize particles.
+    const uint32_t leafGrain =
+        std::max(1u, p_Ctx->m_BlockSize / tree->m_LeafSize);
+    nbodyPoolParallelFor(
+        p_Ctx->m_Pool, tree->m_LeafCount, leafGrain, _treeForceBlock, p_Ctx);
+  } else {
+    nbodyFmmEvaluate(
+        &p_Ctx->m_Fmm,
+        tree,
+        p_Ctx->m_Isa,
+        NBodyG,
+        p_Ctx->m_AccelX,
+        p_Ctx->m_AccelY,
+        p_Ctx->m_AccelZ,
+        p_Ctx->m_Pool);
+  }
+}
+//---------------------------------------------------------------------------//
+void nbodyCpuComputeForcesAndJerk(NBodyCpuCtx* p_Ctx) {
+  nbodyPoolParallelFor(
+      p_Ctx->m_Pool,
+      p_Ctx->m_Store.m_Count,
+      p_Ctx->m_BlockSize,
+      _jerkBlock,
+      p_Ctx);
+  p_Ctx->m_ForcesValid = true;
+  p_Ctx->m_JerkValid = true;
+  p_Ctx->m_ForceEvalCount++;
+}
+//---------------------------------------------------------------------------//
+NBodyEnergy nbodyCpuComputeEnergy(NBodyCpuCtx* p_Ctx) {
+  const uint32_t count = p_Ctx->m_Store.m_Count;
+  std::vector<double> kinetic(count);
+  std::vector<double> potential(count);
+  EnergyJob job = {p_Ctx, kinetic.data(), potential.data()};
+  nbodyPoolParallelFor(
+      p_Ctx->m_Pool, count, p_Ctx->m_BlockSize, _energyBlock, &job);
+
+  NBodyEnergy energy = {0.0, 0.0};
+  for (uint32_t i = 0; i < count; ++i) {
+    energy.m_Kinetic += kinetic[i];
+    energy.m_Potential += potential[i];
+  }
+  return energy;
+}
+//---------------------------------------------------------------------------//
+uint64_t nbodyCpuChecksum(NBodyCpuCtx* p_Ctx) {
+  const uint32_t grains =
+      (p_Ctx->m_Store.m_Count + NBodyReorderGrain - 1) / NBodyReorderGrain;
+  std::vector<uint64_t> hashes(grains);
+  ChecksumJob job = {p_Ctx, hashes.data()};
+  nbodyPoolParallelFor(p_Ctx->m_Pool, grains, 1, _checksumBlock, &job);
+
+  // The grain hashes are folded in id order, byte by byte like the bodies.
+  uint64_t hash = NBodyFnvOffset;
+  for (uint64_t grainHash : hashes) {
+    for (uint32_t b = 0; b < 8; ++b) {
+      hash = (hash ^ ((grainHash >> (8 * b)) & 0xff)) * NBodyFnvPrime;
+    }
+  }
+  return hash;
+}
+//---------------------------------------------------------------------------//
+void nbodyCpuReorder(NBodyCpuCtx* p_Ctx) {
+  NBodyParticleStore* store = &p_Ctx->m_Store;
+  nbodyMortonSort(
+      &p_Ctx->m_Morton,
+      nbodyStoreAttrib(store, NBodyAttribPosX),
+      nbodyStoreAttrib(store, NBodyAttribPosY),
+      nbodyStoreAttrib(store, NBodyAttribPosZ),
+      store->m_Count,
+      p_Ctx->m_Pool);
+  nbodyPoolParallelFor(
+      p_Ctx->m_Pool, store->m_Count, NBodyReorderGrain, _reorderBlock, p_Ctx);
+
+  std::swap(p_Ctx->m_Store, p_Ctx->m_Scratch);
+  std::swap(p_Ctx->m_Ids, p_Ctx->m_ScratchIds);
+  if (p_Ctx->m_ForcesValid) {
+    float** forces[6] = {
+        &p_Ctx->m_AccelX,
+        &p_Ctx->m_AccelY,
+        &p_Ctx->m_AccelZ,
+        &p_Ctx->m_JerkX,
+        &p_Ctx->m_JerkY,
+        &p_Ctx->m_JerkZ};
+    for (uint32_t f = 0; f < 6; ++f) {
+      std::swap(*forces[f], p_Ctx->m_ScratchForces[f]);
+    }
+  }
+  nbodyPoolParallelFor(
+      p_Ctx->m_Pool,
+      p_Ctx->m_Store.m_Count,
+      NBodyReorderGrain,
+      _slotsBlock,
+      p_Ctx);
+}
+//---------------------------------------------------------------------------//
+void nbodySortParticles(
+    NBodyParticle* p_Particles,
+    uint32_t* p_Ids,
+    uint32_t p_Count,
+    NBodyThreadPool* p_Pool) {
+  std::vector<float> pos[3];
+  for (int c = 0; c < 3; ++c) {
+    pos[c].resize(p_Count);
+  }
+  for (uint32_t i = 0; i < p_Count; ++i) {
+    pos[0][i] = p_Particles[i].m_Position.x;
+    pos[1][i] = p_Particles[i].m_Position.y;
+    pos[2][i] = p_Particles[i].m_Position.z;
+  }
+
+  NBodyMortonOrder morton;
+  nbodyMortonInit(&morton);
+  nbodyMortonSort(
+      &morton, pos[0].data(), pos[1].data(), pos[2].data(), p_Count, p_Pool);
+  std::vector<NBodyParticle> sorted(p_Count);
+  for (uint32_t k = 0; k < p_Count; ++k) {
+    sorted[k] = p_Particles[morton.m_Order[k]];
+  }
+  std::copy(sorted.begin(), sorted.end(), p_Particles);
+  if (p_Ids != nullptr) {
+    std::vector<uint32_t> ids(p_Count);
+    for (uint32_t k = 0; k < p_Count; ++k) {
+      ids[k] = p_Ids[morton.m_Order[k]];
+    }
+    std::copy(ids.begin(), ids.end(), p_Ids);
+  }
+  nbodyMortonDestroy(&morton);
+}
+//---------------------------------------------------------------------------//
+void nbodyCpuStep(NBodyCpuCtx* p_Ctx) {
+  if (p_Ctx->m_ReorderInterval > 0 &&
+      p_Ctx->m_StepCount % p_Ctx->m_ReorderInterval == 0)
+    nbodyCpuReorder(p_Ctx);
+
+  nbodyIntegratorStep(p_Ctx);
+  p_Ctx->m_StepCount++;
+}
+//---------------------------------------------------------------------------//
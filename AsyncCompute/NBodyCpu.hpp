@@ -0,0 +1,302 @@
+#pragma once
+
+/******************************************************************************
+ * \portable CPU n-body engine
+ * \mirrors CSMain in nBodyGravityCS.hlsl (same constants, same integration)
+ * \without any windows.h / d3d12 / DirectXMath dependency, so it can run
+ * \headless on any platform and serve as the reference for other backends.
+ ******************************************************************************/
+
+#include "NBodyBarnesHut.hpp"
+#include "NBodyCommon.hpp"
+#include "NBodyFmm.hpp"
+#include "NBodyIntegrator.hpp"
+#include "NBodyKernels.hpp"
+#include "NBodyMorton.hpp"
+#include "NBodyRandom.hpp"
+#include "NBodySoa.hpp"
+#include "NBodyThreadPool.hpp"
+
+// Default number of target particles per pool block (multiple of the SIMD
+// width, small enough to leave plenty of blocks to steal).
+static constexpr uint32_t NBodyDefaultBlockSize = 256;
+// Bodies per tile of the symmetric direct sum, two tiles of positions and
+// accelerations (6 KB) stay in L1.
+static constexpr uint32_t NBodyPairTileSize = 256;
+// Steps between two Morton reorderings of the store (0 disables them). The
+// particles drift slowly, a few dozen steps do not undo much of the locality.
+static constexpr uint32_t NBodyDefaultReorderInterval = 16;
+// Fixed pair ranges of NBodySolverSymmetric in deterministic mode, each with
+// its own acceleration buffer whatever the worker count.
+static constexpr uint32_t NBodyDeterministicSlices = 16;
+
+//---------------------------------------------------------------------------//
+// Per-step parameters, same meaning as ParticleSimCtx::CbufferCS:
+//---------------------------------------------------------------------------//
+struct NBodyParams {
+  uint32_t m_ParticleCount; // g_param.x
+  float m_DeltaTime;        // g_paramf.x
+  float m_Damping;          // g_paramf.y
+};
+
+//---------------------------------------------------------------------------//
+// Force solvers:
+//---------------------------------------------------------------------------//
+enum NBodySolver : uint32_t {
+  NBodySolverDirect = 0, // All pairs, same as CSMain (O(N^2))
+  NBodySolverSymmetric,  // Each pair once (N^2 / 2), see NBodyPairArgs
+  NBodySolverBarnesHut,  // Octree, see NBodyBarnesHut.hpp (O(N log N))
+  NBodySolverFmm,        // Multipoles on the same octree, see NBodyFmm.hpp
+  NBodySolverCount
+};
+
+//---------------------------------------------------------------------------//
+struct NBodyCpuCtx {
+  NBodyParams m_Params;
+
+  // Current state. Unlike m_ParticleBuffer0/1 on the GPU side no second copy
+  // is needed: all forces are computed before any particle is moved, so the
+  // integration can update the store in place.
+  NBodyParticleStore m_Store;
+
+  // Defaults to NBodyIntegratorEuler (same update as CSMain).
+  NBodyIntegrator m_Integrator;
+
+  // Force kernel, defaults to the fastest one the cpu supports.
+  NBodyIsa m_Isa;
+
+  // Precision of NBodySolverDirect, float32 by default like CSMain (the other
+  // solvers and the jerks always run in float32). 16-bit position formats are
+  // packed into m_PackedPos at the start of every direct force evaluation,
+  // m_PackedMemory is allocated on first use.
+  NBodyAccumulation m_Accumulation;
+  NBodyPosFormat m_PosFormat;
+  uint16_t* m_PackedPos[3];
+  void* m_PackedMemory;
+
+  // Bitwise reproducible steps (nbodyCpuSetDeterministic): the direct solver
+  // runs nbodyGetDeterministicKernel, the symmetric one sums its pairs in
+  // NBodyDeterministicSlices fixed ranges with nbodyGetDeterministicPairKernel
+  // and the Hermite integrators use nbodyGetDeterministicJerkKernel, so the
+  // results depend neither on the pool nor on the ISA. Off by default.
+  bool m_Deterministic;
+
+  // Defaults to NBodySolverDirect, m_Tree holds the Barnes-Hut settings
+  // (theta, quadrupole) and is rebuilt every step when either tree solver is
+  // used, m_Fmm holds the FMM settings (order, theta).
+  NBodySolver m_Solver;
+  NBodyOctree m_Tree;
+  NBodyFmm m_Fmm;
+
+  // Every m_ReorderInterval steps the store is permuted into Morton order
+  // (gathered into m_Scratch, then swapped) so that particles close in space
+  // are close in memory. m_Ids[slot] is the external id of the particle in a
+  // slot (its index in the buffer it was loaded from), m_Slots[id] the
+  // inverse.
+  uint32_t m_ReorderInterval;
+  NBodyMortonOrder m_Morton;
+  NBodyParticleStore m_Scratch;
+  uint32_t* m_Ids;
+  uint32_t* m_Slots;
+  uint32_t* m_ScratchIds;
+  void* m_IdMemory;
+
+  // Accelerations of the current step (padded like the store), and their
+  // time derivatives for NBodyIntegratorHermite. m_ForcesValid (and
+  // m_JerkValid) tell whether they still match the positions in the store,
+  // in which case the next step can reuse them. Reordering permutes them
+  // through m_ScratchForces (accel xyz, jerk xyz).
+  float* m_AccelX;
+  float* m_AccelY;
+  float* m_AccelZ;
+  float* m_JerkX;
+  float* m_JerkY;
+  float* m_JerkZ;
+  float* m_ScratchForces[6];
+  void* m_AccelMemory;
+  bool m_ForcesValid;
+  bool m_JerkValid;
+  uint64_t m_ForceEvalCount; // A block step substep counts as one
+
+  // Scratch of the multi-stage integrators, allocated on first use.
+  float* m_Temp[NBodyIntegratorTempCount];
+  void* m_TempMemory;
+  NBodyBlockSteps m_Blocks;
+
+  // NBodySolverSymmetric: one set of acceleration arrays per pool worker (a
+  // tile pair writes to both of its tiles, so blocks of targets no longer
+  // own their output), summed into m_AccelX/Y/Z after the pairs. Grown to
+  // the worker count of the pool on first use, 12 bytes per body and worker
+  // (per slice in deterministic mode).
+  float* m_PairAccel;
+  uint32_t m_PairBufferCount;
+
+  // Optional pool, owned by the caller: nullptr runs every step on the
+  // calling thread. Forces are split into blocks of m_BlockSize targets.
+  NBodyThreadPool* m_Pool;
+  uint32_t m_BlockSize;
+
+  uint64_t m_StepCount;
+};
+
+//---------------------------------------------------------------------------//
+// Body to body interaction, acceleration of the particle at position
+// p_Bi is updated by p_Bj of mass p_Bj.w (see bodyBodyInteraction in
+// nBodyGravityCS.hlsl).
+//---------------------------------------------------------------------------//
+inline void nbodyBodyBodyInteraction(
+    float* p_Accel,
+    const NBodyFloat4& p_Bj,
+    const NBodyFloat4& p_Bi,
+    float p_G,
+    int p_Particles) {
+  float r[3] = {p_Bj.x - p_Bi.x, p_Bj.y - p_Bi.y, p_Bj.z - p_Bi.z};
+
+  float distSqr = r[0] * r[0] + r[1] * r[1] + r[2] * r[2];
+  distSqr += NBodySofteningSquared;
+
+  float invDist = 1.0f / sqrtf(distSqr);
+  float invDistCube = invDist * invDist * invDist;
+
+  float s = p_G * p_Bj.w * invDistCube * p_Particles;
+
+  p_Accel[0] += r[0] * s;
+  p_Accel[1] += r[1] * s;
+  p_Accel[2] += r[2] * s;
+}
+//---------------------------------------------------------------------------//
+// Initial conditions, same as the GPU demo: a uniform sphere of particles
+// around p_Center, all moving with p_Velocity. Particle i is drawn from the
+// counter (p_Seed, p_FirstIndex + i) only (see NBodyRandom.hpp), so blocks
+// run on p_Pool (nullptr = calling thread) and a sub-range of a buffer can
+// be regenerated alone by passing its first index.
+void nbodyLoadParticles(
+    NBodyParticle* p_Particles,
+    const float* p_Center,
+    const NBodyFloat4& p_Velocity,
+    float p_Spread,
+    uint32_t p_ParticleCount,
+    uint32_t p_Seed,
+    uint32_t p_FirstIndex,
+    NBodyThreadPool* p_Pool);
+//---------------------------------------------------------------------------//
+// Splits the particles into two opposing clusters (the demo default),
+// particle i is the particle of index i of nbodyLoadParticles.
+void nbodyLoadTwoClusters(
+    NBodyParticle* p_Particles,
+    float p_Spread,
+    uint32_t p_ParticleCount,
+    uint32_t p_Seed,
+    NBodyThreadPool* p_Pool);
+//---------------------------------------------------------------------------//
+// Draws the masses (m_Position.w) from a power law dN/dm ~ m^-p_Slope over
+// [m0, p_Range m0] (2.35 for Salpeter's stellar spectrum), with m0 chosen so
+// that the total mass, hence the large scale dynamics, stays the same.
+// Particle i uses the NBodyStreamMass counter of index i.
+static constexpr float NBodySalpeterSlope = 2.35f;
+void nbodyAssignPowerLawMasses(
+    NBodyParticle* p_Particles,
+    uint32_t p_ParticleCount,
+    float p_Range,
+    float p_Slope,
+    uint32_t p_Seed);
+//---------------------------------------------------------------------------//
+void nbodyCpuInit(NBodyCpuCtx* p_Ctx, const NBodyParams& p_Params);
+//---------------------------------------------------------------------------//
+void nbodyCpuDestroy(NBodyCpuCtx* p_Ctx);
+//---------------------------------------------------------------------------//
+inline NBodyParticleStore* nbodyCpuGetStore(NBodyCpuCtx* p_Ctx) {
+  return &p_Ctx->m_Store;
+}
+//---------------------------------------------------------------------------//
+// Loads the store from p_Particles, particle i gets the external id i.
+void nbodyCpuLoadParticles(
+    NBodyCpuCtx* p_Ctx, const NBodyParticle* p_Particles);
+//---------------------------------------------------------------------------//
+// Slot of the store currently holding the particle with id p_Id.
+inline uint32_t nbodyCpuSlotOf(const NBodyCpuCtx* p_Ctx, uint32_t p_Id) {
+  return p_Ctx->m_Slots[p_Id];
+}
+//---------------------------------------------------------------------------//
+// Runs the next steps on p_Pool (nullptr = calling thread only).
+inline void nbodyCpuSetPool(NBodyCpuCtx* p_Ctx, NBodyThreadPool* p_Pool) {
+  p_Ctx->m_Pool = p_Pool;
+}
+//---------------------------------------------------------------------------//
+inline void nbodyCpuSetSolver(NBodyCpuCtx* p_Ctx, NBodySolver p_Solver) {
+  p_Ctx->m_Solver = p_Solver;
+}
+//---------------------------------------------------------------------------//
+inline void nbodyCpuSetPrecision(
+    NBodyCpuCtx* p_Ctx,
+    NBodyAccumulation p_Accumulation,
+    NBodyPosFormat p_Format) {
+  p_Ctx->m_Accumulation = p_Accumulation;
+  p_Ctx->m_PosFormat = p_Format;
+  p_Ctx->m_ForcesValid = false;
+}
+//---------------------------------------------------------------------------//
+// Makes the next steps independent of the pool size, the scheduling and the
+// ISA, at the cost of an exact 1/sqrt and no FMA. Only for the solvers of
+// nbodySolverDeterministic, with any integrator.
+inline void
+nbodyCpuSetDeterministic(NBodyCpuCtx* p_Ctx, bool p_Deterministic) {
+  p_Ctx->m_Deterministic = p_Deterministic;
+  p_Ctx->m_ForcesValid = false;
+}
+//---------------------------------------------------------------------------//
+inline void
+nbodyCpuSetIntegrator(NBodyCpuCtx* p_Ctx, NBodyIntegrator p_Integrator) {
+  p_Ctx->m_Integrator = p_Integrator;
+}
+//---------------------------------------------------------------------------//
+inline void nbodyCpuSetReorderInterval(NBodyCpuCtx* p_Ctx, uint32_t p_Steps) {
+  p_Ctx->m_ReorderInterval = p_Steps;
+}
+//---------------------------------------------------------------------------//
+const char* nbodySolverName(NBodySolver p_Solver);
+//---------------------------------------------------------------------------//
+// Solvers nbodyCpuSetDeterministic covers: the tree codes traverse and
+// evaluate their cells with the kernels of the ISA.
+inline bool nbodySolverDeterministic(NBodySolver p_Solver) {
+  return p_Solver == NBodySolverDirect || p_Solver == NBodySolverSymmetric;
+}
+//---------------------------------------------------------------------------//
+// Fills m_AccelX/Y/Z for the current positions with the selected solver.
+void nbodyCpuComputeForces(NBodyCpuCtx* p_Ctx);
+//---------------------------------------------------------------------------//
+// Fills m_AccelX/Y/Z and m_JerkX/Y/Z for the current positions and
+// velocities by direct summation, whatever the solver.
+void nbodyCpuComputeForcesAndJerk(NBodyCpuCtx* p_Ctx);
+//---------------------------------------------------------------------------//
+// Total energy in units of NBodyDefaultMass (per particle for equal masses),
+// with the softened potential the forces derive from. O(N^2) in double
+// precision, meant for diagnostics.
+struct NBodyEnergy {
+  double m_Kinetic;
+  double m_Potential;
+};
+NBodyEnergy nbodyCpuComputeEnergy(NBodyCpuCtx* p_Ctx);
+//---------------------------------------------------------------------------//
+// 64-bit FNV-1a hash of the bits of the positions in particle id order, so
+// that it can be compared between runs with different pools, reorderings
+// or machines. The same for every pool.
+uint64_t nbodyCpuChecksum(NBodyCpuCtx* p_Ctx);
+//---------------------------------------------------------------------------//
+// Permutes every attribute of the store (and the ids) into Morton order.
+void nbodyCpuReorder(NBodyCpuCtx* p_Ctx);
+//---------------------------------------------------------------------------//
+// Sorts an AoS buffer into Morton order in place, with p_Ids (when not null)
+// permuted alongside. The GPU demo sorts its buffers at creation and then
+// every NBodyDefaultReorderInterval steps from a readback.
+void nbodySortParticles(
+    NBodyParticle* p_Particles,
+    uint32_t* p_Ids,
+    uint32_t p_Count,
+    NBodyThreadPool* p_Pool);
+//---------------------------------------------------------------------------//
+// Advances the simulation by one step of m_Params.m_DeltaTime with the
+// selected integrator, reordering the store first when m_ReorderInterval
+// steps have passed.
+void nbodyCpuStep(NBodyCpuCtx* p_Ctx);
+//---------------------------------------------------------------------------//
@@ -0,0 +1,86 @@
+#include "NBodyDispatchTuner.hpp"
+#include "NBodyKernelTuner.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+//---------------------------------------------------------------------------//
+/// Local functions:
+//---------------------------------------------------------------------------//
+static std::string _cacheKey(const char* p_Adapter, uint32_t p_ParticleCount) {
+  // Tabs and line breaks would split the line, adapters don't use them anyway.
+  std::string key = p_Adapter;
+  for (char& c : key) {
+    if (c == '\t' || c == '\r' || c == '\n')
+      c = ' ';
+  }
+  return key + "\t" + std::to_string(p_ParticleCount) + "\t";
+}
+//---------------------------------------------------------------------------//
+// Index of the config recorded for the key, NBodyDispatchConfigCount if none.
+static uint32_t _findCached(const std::string& p_Key, const char* p_Path) {
+  char value[32];
+  if (!nbodyTuneCacheFind(p_Path, p_Key.c_str(), value, 32))
+    return NBodyDispatchConfigCount;
+  for (uint32_t c = 0; c < NBodyDispatchConfigCount; ++c) {
+    char name[32];
+    nbodyDispatchConfigName(NBodyDispatchConfigs[c], name, 32);
+    if (strcmp(name, value) == 0)
+      return c;
+  }
+  return NBodyDispatchConfigCount;
+}
+//---------------------------------------------------------------------------//
+// Core functions:
+//---------------------------------------------------------------------------//
+bool nbodyTuneDispatch(
+    const char* p_Adapter,
+    uint32_t p_ParticleCount,
+    NBodyDispatchTimer p_Timer,
+    void* p_User,
+    const char* p_CachePath,
+    NBodyDispatchTuneResult* p_Result) {
+  memset(p_Result, 0, sizeof(*p_Result));
+  p_Result->m_Config = NBodyDispatchConfigs[NBodyDefaultDispatchConfig];
+  const std::string key = _cacheKey(p_Adapter, p_ParticleCount);
+
+  if (p_CachePath != nullptr) {
+    const uint32_t cached = _findCached(key, p_CachePath);
+    if (cached < NBodyDispatchConfigCount) {
+      p_Result->m_Config = NBodyDispatchConfigs[cached];
+      p_Result->m_FromCache = true;
+      return true;
+    }
+  }
+
+  uint32_t best = NBodyDispatchConfigCount;
+  for (uint32_t c = 0; c < NBodyDispatchConfigCount; ++c) {
+    double seconds = 0.0;
+    if (!p_Timer(p_User, NBodyDispatchConfigs[c], &seconds)) {
+      p_Result->m_Seconds[c] = -1.0;
+      continue;
+    }
+    p_Result->m_Seconds[c] = seconds;
+    if (best == NBodyDispatchConfigCount || seconds < p_Result->m_Seconds[best])
+      best = c;
+  }
+  if (best == NBodyDispatchConfigCount)
+    return false;
+
+  p_Result->m_Config = NBodyDispatchConfigs[best];
+  if (p_CachePath == nullptr)
+    return true;
+  char value[32];
+  nbodyDispatchConfigName(p_Result->m_Config, value, 32);
+  return nbodyTuneCacheStore(p_CachePath, key.c_str(), value);
+}
+//---------------------------------------------------------------------------//
+void nbodyDispatchConfigName(
+    NBodyDispatchConfig p_Config, char* p_Name, size_t p_NameSize) {
+  if (p_Config.m_Unroll == 0)
+    snprintf(p_Name, p_NameSize, "%uxfull", p_Config.m_BlockSize);
+  else
+    snprintf(
+        p_Name, p_NameSize, "%ux%u", p_Config.m_BlockSize, p_Config.m_Unroll);
+}
+//---------------------------------------------------------------------------//
@@ -0,0 +1,77 @@
+#pragma once
+
+/******************************************************************************
+ * \autotuning of the CSMain dispatch (nBodyGravityCS.hlsl)
+ * \times the shader compiled with every candidate group size and unroll of
+ * \its j loop through a caller provided timer (D3D12 timestamps in the demo,
+ * \a model of a GPU in the headless driver) and persists the fastest per
+ * \adapter and particle count, so later runs start on it without timing.
+ ******************************************************************************/
+
+#include "NBodyCommon.hpp"
+
+// Same format as NBodyKernels.cache (see nbodyTuneCacheFind), one line per
+// adapter and particle count: "<adapter>\t<particles>\t<blocksize>x<unroll>"
+static constexpr const char* NBodyDefaultDispatchCache = "NBodyDispatch.cache";
+
+//---------------------------------------------------------------------------//
+struct NBodyDispatchConfig {
+  uint32_t m_BlockSize; // blocksize: threads per group and shared tile size
+  uint32_t m_Unroll;    // unrollcount: j loop unroll, 0 unrolls it fully
+};
+
+// Every group size with no, partial and full unroll. 128 fully unrolled is
+// the shader's default (the original CSMain).
+static constexpr uint32_t NBodyDispatchConfigCount = 12;
+static constexpr NBodyDispatchConfig
+    NBodyDispatchConfigs[NBodyDispatchConfigCount] = {
+        {64, 1},
+        {64, 8},
+        {64, 0},
+        {128, 1},
+        {128, 8},
+        {128, 0},
+        {256, 1},
+        {256, 8},
+        {256, 0},
+        {512, 1},
+        {512, 8},
+        {512, 0},
+};
+static constexpr uint32_t NBodyDefaultDispatchConfig = 5;
+// Buffers padded to it hold whole tiles of every candidate.
+static constexpr uint32_t NBodyDispatchMaxBlockSize = 512;
+
+//---------------------------------------------------------------------------//
+// Seconds of one CSMain step compiled and dispatched with p_Config, false
+// when the config can't run on the device (it is then skipped).
+typedef bool (*NBodyDispatchTimer)(
+    void* p_User, NBodyDispatchConfig p_Config, double* p_Seconds);
+
+struct NBodyDispatchTuneResult {
+  NBodyDispatchConfig m_Config;
+  bool m_FromCache;
+
+  // Per NBodyDispatchConfigs entry, only filled when the configs were timed,
+  // negative for the ones the timer rejected.
+  double m_Seconds[NBodyDispatchConfigCount];
+};
+
+//---------------------------------------------------------------------------//
+// Picks the dispatch of p_ParticleCount bodies on p_Adapter: the one
+// p_CachePath records if any, otherwise the fastest config by p_Timer, which
+// is then written back. A null p_CachePath always times and writes nothing.
+// Returns false (with the default config when nothing ran) if no config
+// could be timed or the cache could not be written.
+bool nbodyTuneDispatch(
+    const char* p_Adapter,
+    uint32_t p_ParticleCount,
+    NBodyDispatchTimer p_Timer,
+    void* p_User,
+    const char* p_CachePath,
+    NBodyDispatchTuneResult* p_Result);
+//---------------------------------------------------------------------------//
+// "<blocksize>x<unroll>", "full" for a complete unroll.
+void nbodyDispatchConfigName(
+    NBodyDispatchConfig p_Config, char* p_Name, size_t p_NameSize);
+//---------------------------------------------------------------------------//
@@ -0,0 +1,734 @@
+#include "NBodyFmm.hpp"
+#include "NBodySoa.hpp"
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+#include <vector>
+
+// Target cells above this level are split by the calling thread, the pairs
+// reaching it (or a leaf) are walked further as independent pool tasks.
+static constexpr uint32_t NBodyFmmTopLevels = 3;
+// Number of multi-indices (nx, ny, nz) with nx + ny + nz <= NBodyFmmMaxOrder
+static constexpr uint32_t NBodyFmmMaxTerms =
+    nbodyFmmCoefCount(NBodyFmmMaxOrder);
+static_assert(
+    NBodyFmmMaxOrder <= NBodyM2LMaxOrder, "every order needs an M2L kernel");
+static constexpr uint32_t NBodyFmmNoTerm = 0xffff;
+
+namespace {
+// One term of a translation: p_Out[m_Dst] += m_Coef * p_In[m_Src] * p_W[m_W]
+// where p_W holds the powers of a shift vector.
+struct Term {
+  uint16_t m_Dst;
+  uint16_t m_Src;
+  uint16_t m_W;
+  double m_Coef;
+};
+
+struct Cell {
+  double m_Center[3]; // Expansion center (the center of mass)
+  double m_Radius;    // Of the bodies around m_Center
+  double m_Min[3];    // Bounding box of the bodies
+  double m_Max[3];
+};
+
+struct CellPair {
+  uint32_t m_Target;
+  uint32_t m_Source;
+};
+
+struct WorkerScratch {
+  std::vector<CellPair> m_NearPairs;
+  std::vector<CellPair> m_FarPairs;
+  std::vector<float> m_Bodies[4]; // x, y, z, mass
+};
+} // namespace
+
+struct NBodyFmmImpl {
+  // Multi-index tables of m_TableOrder, terms are sorted by degree so that
+  // the terms of degree <= q are the first (q + 1)(q + 2)(q + 3) / 6.
+  uint32_t m_TableOrder;
+  uint32_t m_TermCount;
+  uint8_t m_Exponent[NBodyFmmMaxTerms][3];
+  uint8_t m_Degree[NBodyFmmMaxTerms];
+  uint16_t m_Lower[3][NBodyFmmMaxTerms]; // Term m - e_a or NBodyFmmNoTerm
+  uint8_t m_PowAxis[NBodyFmmMaxTerms];   // Any a with m_a > 0
+  double m_InvFactorial[NBodyFmmMaxTerms];
+  // The M2L terms are unrolled in the kernels (NBodyM2LKernel.hpp).
+  std::vector<Term> m_M2M;
+  std::vector<Term> m_L2L;
+  std::vector<Term> m_L2P; // m_Dst is the axis
+
+  // Per visited node (m_Slots maps node indices to them), m_TermCount
+  // coefficients each
+  std::vector<uint32_t> m_Slots;
+  std::vector<Cell> m_Cells;
+  std::vector<double> m_Multipoles;
+  std::vector<double> m_Locals;
+  std::vector<uint32_t> m_Parents;
+  std::vector<uint32_t> m_LevelNodes; // Node indices sorted by level
+  std::vector<uint32_t> m_LevelOffsets;
+  std::vector<uint32_t> m_Leaves; // See _isLeaf, they tile [0, m_Count)
+
+  // Target/source pairs left to the pool, sorted by target
+  std::vector<CellPair> m_Pairs;
+  std::vector<uint32_t> m_GroupOffsets;
+
+  // Near field in Morton order
+  std::vector<float> m_Near[3];
+
+  std::vector<WorkerScratch> m_Scratch;
+  std::atomic<uint64_t> m_M2LCount;
+  std::atomic<uint64_t> m_InteractionCount;
+};
+
+namespace {
+struct FmmJob {
+  NBodyFmmImpl* m_Impl;
+  const NBodyOctree* m_Tree;
+  float m_Theta;
+  uint32_t m_LeafSize;
+  NBodyIsa m_Isa;
+  float m_G;
+  float* m_AccelX;
+  float* m_AccelY;
+  float* m_AccelZ;
+  const uint32_t* m_Nodes; // Current level for the upward/downward jobs
+};
+} // namespace
+
+//---------------------------------------------------------------------------//
+/// Local functions:
+//---------------------------------------------------------------------------//
+static uint32_t _binomial(uint32_t p_N, uint32_t p_K) {
+  uint32_t ret = 1;
+  for (uint32_t i = 1; i <= p_K; ++i) {
+    ret = ret * (p_N - p_K + i) / i;
+  }
+  return ret;
+}
+//---------------------------------------------------------------------------//
+static void _buildTables(NBodyFmmImpl* p_Impl, uint32_t p_Order) {
+  uint16_t index[NBodyFmmMaxOrder + 1][NBodyFmmMaxOrder + 1]
+                [NBodyFmmMaxOrder + 1];
+  uint32_t termCount = 0;
+  for (uint32_t degree = 0; degree <= p_Order; ++degree) {
+    for (uint32_t x = degree + 1; x-- > 0;) {
+      for (uint32_t y = degree - x + 1; y-- > 0;) {
+        const uint32_t z = degree - x - y;
+        p_Impl->m_Exponent[termCount][0] = uint8_t(x);
+        p_Impl->m_Exponent[termCount][1] = uint8_t(y);
+        p_Impl->m_Exponent[termCount][2] = uint8_t(z);
+        p_Impl->m_Degree[termCount] = uint8_t(degree);
+        // Same order as the M2L kernels
+        NBODY_ASSERT(termCount == nbodyFmmCoefIndex(x, y, z));
+        index[x][y][z] = uint16_t(termCount++);
+      }
+    }
+  }
+  NBODY_ASSERT(termCount == nbodyFmmCoefCount(p_Order));
+  p_Impl->m_TableOrder = p_Order;
+  p_Impl->m_TermCount = termCount;
+
+  for (uint32_t m = 0; m < termCount; ++m) {
+    const uint8_t* e = p_Impl->m_Exponent[m];
+    double factorial = 1.0;
+    p_Impl->m_PowAxis[m] = 0;
+    for (uint32_t a = 0; a < 3; ++a) {
+      for (uint32_t f = 2; f <= e[a]; ++f) {
+        factorial *= f;
+      }
+      p_Impl->m_Lower[a][m] = NBodyFmmNoTerm;
+      if (e[a] > 0) {
+        uint32_t lower[3] = {e[0], e[1], e[2]};
+        lower[a]--;
+        p_Impl->m_Lower[a][m] = index[lower[0]][lower[1]][lower[2]];
+        p_Impl->m_PowAxis[m] = uint8_t(a);
+      }
+    }
+    p_Impl->m_InvFactorial[m] = 1.0 / factorial;
+  }
+
+  p_Impl->m_M2M.clear();
+  p_Impl->m_L2L.clear();
+  p_Impl->m_L2P.clear();
+  for (uint32_t n = 0; n < termCount; ++n) {
+    const uint8_t* en = p_Impl->m_Exponent[n];
+    for (uint32_t k = 0; k < termCount; ++k) {
+      const uint8_t* ek = p_Impl->m_Exponent[k];
+      const bool below = ek[0] <= en[0] && ek[1] <= en[1] && ek[2] <= en[2];
+
+      // M2M: M'_n = sum_k<=n M_k d^(n-k) / (n-k)!
+      // L2L: L'_k = sum_n>=k L_n C(n, k) d^(n-k), stored with dst = k
+      if (below) {
+        const uint16_t diff =
+            index[en[0] - ek[0]][en[1] - ek[1]][en[2] - ek[2]];
+        p_Impl->m_M2M.push_back(
+            {uint16_t(n), uint16_t(k), diff, p_Impl->m_InvFactorial[diff]});
+        const double binom = double(_binomial(en[0], ek[0])) *
+                             _binomial(en[1], ek[1]) * _binomial(en[2], ek[2]);
+        p_Impl->m_L2L.push_back({uint16_t(k), uint16_t(n), diff, binom});
+      }
+    }
+
+    // L2P: a_a = sum_n L_n n_a y^(n-e_a)
+    for (uint32_t a = 0; a < 3; ++a) {
+      if (en[a] > 0)
+        p_Impl->m_L2P.push_back(
+            {uint16_t(a), uint16_t(n), p_Impl->m_Lower[a][n], double(en[a])});
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// p_Out[m] = p_D^m for the first p_TermCount terms.
+static void _powers(
+    const NBodyFmmImpl* p_Impl,
+    const double* p_D,
+    uint32_t p_TermCount,
+    double* p_Out) {
+  p_Out[0] = 1.0;
+  for (uint32_t m = 1; m < p_TermCount; ++m) {
+    const uint32_t a = p_Impl->m_PowAxis[m];
+    p_Out[m] = p_Out[p_Impl->m_Lower[a][m]] * p_D[a];
+  }
+}
+//---------------------------------------------------------------------------//
+static void _translate(
+    const std::vector<Term>& p_Terms,
+    const double* p_In,
+    const double* p_W,
+    double* p_Out) {
+  for (const Term& t : p_Terms) {
+    p_Out[t.m_Dst] += t.m_Coef * p_In[t.m_Src] * p_W[t.m_W];
+  }
+}
+//---------------------------------------------------------------------------//
+// Expansion data of a visited node:
+static Cell& _cell(NBodyFmmImpl* p_Impl, uint32_t p_Node) {
+  return p_Impl->m_Cells[p_Impl->m_Slots[p_Node]];
+}
+static double* _multipole(NBodyFmmImpl* p_Impl, uint32_t p_Node) {
+  return &p_Impl->m_Multipoles[size_t(p_Impl->m_Slots[p_Node]) *
+                               p_Impl->m_TermCount];
+}
+static double* _local(NBodyFmmImpl* p_Impl, uint32_t p_Node) {
+  return &p_Impl->m_Locals[size_t(p_Impl->m_Slots[p_Node]) *
+                           p_Impl->m_TermCount];
+}
+//---------------------------------------------------------------------------//
+// Octree leaves and cells small enough for the direct kernels, the nodes
+// below the latter are never visited.
+static bool _isLeaf(const FmmJob* p_Job, const NBodyTreeNode& p_Node) {
+  return p_Node.m_ChildCount == 0 ||
+         p_Node.m_End - p_Node.m_Begin <= p_Job->m_LeafSize;
+}
+//---------------------------------------------------------------------------//
+// Radius of the bodies of p_Cell: the bound passed up from the children
+// (p_Bound) grows with every level, the farthest corner of the bounding box
+// does not.
+static double _cellRadius(const Cell& p_Cell, double p_Bound) {
+  double distSqr = 0.0;
+  for (uint32_t a = 0; a < 3; ++a) {
+    const double d = std::max(
+        p_Cell.m_Center[a] - p_Cell.m_Min[a],
+        p_Cell.m_Max[a] - p_Cell.m_Center[a]);
+    distSqr += d * d;
+  }
+  return std::min(p_Bound, sqrt(distSqr));
+}
+//---------------------------------------------------------------------------//
+// Upward pass (P2M for leaves, M2M otherwise) over one level (NBodyRangeFunc)
+static void
+_upwardJob(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  FmmJob* job = static_cast<FmmJob*>(p_User);
+  NBodyFmmImpl* impl = job->m_Impl;
+  const NBodyOctree* tree = job->m_Tree;
+  const uint32_t termCount = impl->m_TermCount;
+  double w[NBodyFmmMaxTerms];
+
+  for (uint32_t i = p_Begin; i < p_End; ++i) {
+    const uint32_t n = job->m_Nodes[i];
+    const NBodyTreeNode& node = tree->m_Nodes[n];
+    Cell& cell = _cell(impl, n);
+    double* multipole = _multipole(impl, n);
+    cell.m_Center[0] = node.m_ComX;
+    cell.m_Center[1] = node.m_ComY;
+    cell.m_Center[2] = node.m_ComZ;
+    cell.m_Radius = 0.0;
+    for (uint32_t a = 0; a < 3; ++a) {
+      cell.m_Min[a] = cell.m_Center[a];
+      cell.m_Max[a] = cell.m_Center[a];
+    }
+    memset(multipole, 0, termCount * sizeof(double));
+
+    if (_isLeaf(job, node)) {
+      for (uint32_t k = node.m_Begin; k < node.m_End; ++k) {
+        const double s[3] = {
+            tree->m_SortedX[k] - cell.m_Center[0],
+            tree->m_SortedY[k] - cell.m_Center[1],
+            tree->m_SortedZ[k] - cell.m_Center[2]};
+        _powers(impl, s, termCount, w);
+        const double mass = tree->m_SortedMass[k];
+        for (uint32_t m = 0; m < termCount; ++m) {
+          multipole[m] += mass * w[m] * impl->m_InvFactorial[m];
+        }
+        cell.m_Radius = std::max(
+            cell.m_Radius, sqrt(s[0] * s[0] + s[1] * s[1] + s[2] * s[2]));
+        for (uint32_t a = 0; a < 3; ++a) {
+          cell.m_Min[a] = std::min(cell.m_Min[a], cell.m_Center[a] + s[a]);
+          cell.m_Max[a] = std::max(cell.m_Max[a], cell.m_Center[a] + s[a]);
+        }
+      }
+      continue;
+    }
+
+    for (uint32_t c = n + 1; c < node.m_Next; c = tree->m_Nodes[c].m_Next) {
+      const Cell& child = _cell(impl, c);
+      const double d[3] = {
+          child.m_Center[0] - cell.m_Center[0],
+          child.m_Center[1] - cell.m_Center[1],
+          child.m_Center[2] - cell.m_Center[2]};
+      _powers(impl, d, termCount, w);
+      _translate(impl->m_M2M, _multipole(impl, c), w, multipole);
+      cell.m_Radius = std::max(
+          cell.m_Radius,
+          sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]) + child.m_Radius);
+      for (uint32_t a = 0; a < 3; ++a) {
+        cell.m_Min[a] = std::min(cell.m_Min[a], child.m_Min[a]);
+        cell.m_Max[a] = std::max(cell.m_Max[a], child.m_Max[a]);
+      }
+    }
+    cell.m_Radius = _cellRadius(cell, cell.m_Radius);
+  }
+}
+//---------------------------------------------------------------------------//
+// Downward pass (L2L from the parent) over one level (NBodyRangeFunc)
+static void
+_downwardJob(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  FmmJob* job = static_cast<FmmJob*>(p_User);
+  NBodyFmmImpl* impl = job->m_Impl;
+  const uint32_t termCount = impl->m_TermCount;
+  double w[NBodyFmmMaxTerms];
+
+  for (uint32_t i = p_Begin; i < p_End; ++i) {
+    const uint32_t n = job->m_Nodes[i];
+    const uint32_t parent = impl->m_Parents[n];
+    const Cell& cell = _cell(impl, n);
+    const Cell& parentCell = _cell(impl, parent);
+    const double d[3] = {
+        cell.m_Center[0] - parentCell.m_Center[0],
+        cell.m_Center[1] - parentCell.m_Center[1],
+        cell.m_Center[2] - parentCell.m_Center[2]};
+    _powers(impl, d, termCount, w);
+    _translate(impl->m_L2L, _local(impl, parent), w, _local(impl, n));
+  }
+}
+//---------------------------------------------------------------------------//
+// M2L of p_Pairs (sorted by target on return), NBodyM2LLanes sources of a
+// target per kernel call: the lanes are summed into the local of the target
+// once all its sources are done. The idle lanes of the last call of a target
+// run on a unit shift and a zero multipole.
+static void _m2lPairs(const FmmJob* p_Job, std::vector<CellPair>* p_Pairs) {
+  static constexpr uint32_t Lanes = NBodyM2LLanes;
+  NBodyFmmImpl* impl = p_Job->m_Impl;
+  const uint32_t termCount = impl->m_TermCount;
+  alignas(64) double r[3 * Lanes];
+  alignas(64) double multipoles[NBodyFmmMaxTerms * Lanes];
+  alignas(64) double locals[NBodyFmmMaxTerms * Lanes];
+
+  NBodyM2LArgs args = {};
+  args.m_R = r;
+  args.m_Multipoles = multipoles;
+  args.m_Locals = locals;
+  const NBodyM2LKernel kernel =
+      nbodyGetM2LKernel(p_Job->m_Isa, impl->m_TableOrder);
+
+  std::vector<CellPair>& pairs = *p_Pairs;
+  std::sort(
+      pairs.begin(), pairs.end(), [](const CellPair& a, const CellPair& b) {
+        return a.m_Target < b.m_Target;
+      });
+  for (size_t begin = 0, end = 0; begin < pairs.size(); begin = end) {
+    const uint32_t target = pairs[begin].m_Target;
+    while (end < pairs.size() && pairs[end].m_Target == target) {
+      ++end;
+    }
+    const Cell& targetCell = _cell(impl, target);
+    memset(locals, 0, termCount * Lanes * sizeof(double));
+
+    for (size_t first = begin; first < end; first += Lanes) {
+      for (uint32_t l = 0; l < Lanes; ++l) {
+        const size_t p = first + l;
+        if (p >= end) {
+          r[l] = 1.0;
+          r[Lanes + l] = 1.0;
+          r[2 * Lanes + l] = 1.0;
+          for (uint32_t m = 0; m < termCount; ++m) {
+            multipoles[m * Lanes + l] = 0.0;
+          }
+          continue;
+        }
+        const Cell& source = _cell(impl, pairs[p].m_Source);
+        for (uint32_t a = 0; a < 3; ++a) {
+          r[a * Lanes + l] = targetCell.m_Center[a] - source.m_Center[a];
+        }
+        const double* multipole = _multipole(impl, pairs[p].m_Source);
+        for (uint32_t m = 0; m < termCount; ++m) {
+          multipoles[m * Lanes + l] = multipole[m];
+        }
+      }
+      kernel(&args);
+    }
+    double* local = _local(impl, target);
+    for (uint32_t m = 0; m < termCount; ++m) {
+      double sum = 0.0;
+      for (uint32_t l = 0; l < Lanes; ++l) {
+        sum += locals[m * Lanes + l];
+      }
+      local[m] += sum;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Dual tree walk: well separated pairs are recorded in p_FarPairs (M2L),
+// pairs of leaves in p_NearPairs, otherwise the larger cell is split. Only
+// the target side is ever written, so walks of disjoint target subtrees are
+// independent. With p_Deferred set, pairs whose target reached
+// NBodyFmmTopLevels (or a leaf) are recorded there instead.
+static void _walk(
+    const FmmJob* p_Job,
+    uint32_t p_Target,
+    uint32_t p_Source,
+    std::vector<CellPair>* p_Deferred,
+    std::vector<CellPair>* p_NearPairs,
+    std::vector<CellPair>* p_FarPairs) {
+  const NBodyTreeNode* nodes = p_Job->m_Tree->m_Nodes;
+  const NBodyTreeNode& target = nodes[p_Target];
+  const NBodyTreeNode& source = nodes[p_Source];
+
+  if (p_Deferred != nullptr &&
+      (target.m_Level >= NBodyFmmTopLevels || _isLeaf(p_Job, target))) {
+    p_Deferred->push_back({p_Target, p_Source});
+    return;
+  }
+
+  const Cell& targetCell = _cell(p_Job->m_Impl, p_Target);
+  const Cell& sourceCell = _cell(p_Job->m_Impl, p_Source);
+  if (p_Target != p_Source) {
+    const double dx = targetCell.m_Center[0] - sourceCell.m_Center[0];
+    const double dy = targetCell.m_Center[1] - sourceCell.m_Center[1];
+    const double dz = targetCell.m_Center[2] - sourceCell.m_Center[2];
+    const double size = targetCell.m_Radius + sourceCell.m_Radius;
+    const double theta = p_Job->m_Theta;
+    if (size * size < theta * theta * (dx * dx + dy * dy + dz * dz)) {
+      p_FarPairs->push_back({p_Target, p_Source});
+      return;
+    }
+  }
+
+  const bool splitTarget =
+      !_isLeaf(p_Job, target) &&
+      (_isLeaf(p_Job, source) || p_Target == p_Source ||
+       targetCell.m_Radius >= sourceCell.m_Radius);
+  if (_isLeaf(p_Job, target) && _isLeaf(p_Job, source)) {
+    p_NearPairs->push_back({p_Target, p_Source});
+  } else if (p_Target == p_Source) {
+    for (uint32_t t = p_Target + 1; t < target.m_Next; t = nodes[t].m_Next) {
+      for (uint32_t s = p_Source + 1; s < source.m_Next; s = nodes[s].m_Next) {
+        _walk(p_Job, t, s, p_Deferred, p_NearPairs, p_FarPairs);
+      }
+    }
+  } else if (splitTarget) {
+    for (uint32_t t = p_Target + 1; t < target.m_Next; t = nodes[t].m_Next) {
+      _walk(p_Job, t, p_Source, p_Deferred, p_NearPairs, p_FarPairs);
+    }
+  } else {
+    for (uint32_t s = p_Source + 1; s < source.m_Next; s = nodes[s].m_Next) {
+      _walk(p_Job, p_Target, s, p_Deferred, p_NearPairs, p_FarPairs);
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Finishes the walks of the deferred pairs of targets [p_Begin, p_End) and
+// runs the near field of the leaves below them (NBodyRangeFunc).
+static void
+_groupJob(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t p_Worker) {
+  FmmJob* job = static_cast<FmmJob*>(p_User);
+  NBodyFmmImpl* impl = job->m_Impl;
+  const NBodyOctree* tree = job->m_Tree;
+  WorkerScratch& scratch = impl->m_Scratch[p_Worker];
+  const NBodyForceKernel forceKernel = nbodyGetForceKernel(job->m_Isa);
+  uint64_t m2lCount = 0;
+  uint64_t interactionCount = 0;
+
+  for (uint32_t g = p_Begin; g < p_End; ++g) {
+    std::vector<CellPair>& nearPairs = scratch.m_NearPairs;
+    std::vector<CellPair>& farPairs = scratch.m_FarPairs;
+    nearPairs.clear();
+    farPairs.clear();
+    for (uint32_t p = impl->m_GroupOffsets[g]; p < impl->m_GroupOffsets[g + 1];
+         ++p) {
+      const CellPair& pair = impl->m_Pairs[p];
+      _walk(job, pair.m_Target, pair.m_Source, nullptr, &nearPairs, &farPairs);
+    }
+    _m2lPairs(job, &farPairs);
+    m2lCount += farPairs.size();
+    std::sort(
+        nearPairs.begin(),
+        nearPairs.end(),
+        [](const CellPair& a, const CellPair& b) {
+          return a.m_Target != b.m_Target ? a.m_Target < b.m_Target
+                                          : a.m_Source < b.m_Source;
+        });
+
+    // One kernel call per target leaf over all its near sources. Every leaf
+    // has at least one pair (with itself), so the near field is complete.
+    for (size_t first = 0; first < nearPairs.size();) {
+      const uint32_t leaf = nearPairs[first].m_Target;
+      for (std::vector<float>& list : scratch.m_Bodies) {
+        list.clear();
+      }
+      size_t last = first;
+      for (; last < nearPairs.size() && nearPairs[last].m_Target == leaf;
+           ++last) {
+        const NBodyTreeNode& source = tree->m_Nodes[nearPairs[last].m_Source];
+        const float* sorted[4] = {
+            tree->m_SortedX,
+            tree->m_SortedY,
+            tree->m_SortedZ,
+            tree->m_SortedMass};
+        for (int a = 0; a < 4; ++a) {
+          scratch.m_Bodies[a].insert(
+              scratch.m_Bodies[a].end(),
+              sorted[a] + source.m_Begin,
+              sorted[a] + source.m_End);
+        }
+      }
+      first = last;
+      const uint32_t sourceCount =
+          static_cast<uint32_t>(scratch.m_Bodies[0].size());
+      for (std::vector<float>& list : scratch.m_Bodies) {
+        list.resize(nbodyPadCount(sourceCount), 0.0f);
+      }
+
+      const NBodyTreeNode& target = tree->m_Nodes[leaf];
+      NBodyForceArgs args = {};
+      args.m_SrcX = scratch.m_Bodies[0].data();
+      args.m_SrcY = scratch.m_Bodies[1].data();
+      args.m_SrcZ = scratch.m_Bodies[2].data();
+      args.m_SrcMass = scratch.m_Bodies[3].data();
+      args.m_SrcCount = nbodyPadCount(sourceCount);
+      args.m_DstX = tree->m_SortedX;
+      args.m_DstY = tree->m_SortedY;
+      args.m_DstZ = tree->m_SortedZ;
+      args.m_DstBegin = target.m_Begin;
+      args.m_DstEnd = target.m_End;
+      args.m_AccelX = impl->m_Near[0].data();
+      args.m_AccelY = impl->m_Near[1].data();
+      args.m_AccelZ = impl->m_Near[2].data();
+      args.m_G = 1.0f;
+      forceKernel(&args);
+      interactionCount +=
+          uint64_t(sourceCount) * (target.m_End - target.m_Begin);
+    }
+  }
+
+  impl->m_M2LCount += m2lCount;
+  impl->m_InteractionCount += interactionCount;
+}
+//---------------------------------------------------------------------------//
+// L2P for the particles of the leaves [p_Begin, p_End), added to the near
+// field and written at their original index (NBodyRangeFunc).
+static void
+_evaluateJob(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  FmmJob* job = static_cast<FmmJob*>(p_User);
+  NBodyFmmImpl* impl = job->m_Impl;
+  const NBodyOctree* tree = job->m_Tree;
+  // The gradient of a local expansion of order p only needs y^m, |m| < p.
+  const uint32_t powCount = nbodyFmmCoefCount(impl->m_TableOrder - 1);
+  double w[NBodyFmmMaxTerms];
+
+  for (uint32_t l = p_Begin; l < p_End; ++l) {
+    const uint32_t n = impl->m_Leaves[l];
+    const NBodyTreeNode& node = tree->m_Nodes[n];
+    const Cell& cell = _cell(impl, n);
+    const double* local = _local(impl, n);
+
+    for (uint32_t k = node.m_Begin; k < node.m_End; ++k) {
+      const double y[3] = {
+          tree->m_SortedX[k] - cell.m_Center[0],
+          tree->m_SortedY[k] - cell.m_Center[1],
+          tree->m_SortedZ[k] - cell.m_Center[2]};
+      _powers(impl, y, powCount, w);
+      double far[3] = {0.0, 0.0, 0.0};
+      _translate(impl->m_L2P, local, w, far);
+
+      const uint32_t i = tree->m_Morton.m_Order[k];
+      job->m_AccelX[i] = float(impl->m_Near[0][k] + far[0]) * job->m_G;
+      job->m_AccelY[i] = float(impl->m_Near[1][k] + far[1]) * job->m_G;
+      job->m_AccelZ[i] = float(impl->m_Near[2][k] + far[2]) * job->m_G;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Runs p_Func over every level of the tree, from the root down or from the
+// deepest level up, each level being a parallel-for over its nodes.
+static void _forEachLevel(
+    FmmJob* p_Job,
+    NBodyThreadPool* p_Pool,
+    bool p_BottomUp,
+    uint32_t p_FirstLevel,
+    NBodyRangeFunc p_Func) {
+  static constexpr uint32_t Grain = 64;
+  const NBodyFmmImpl* impl = p_Job->m_Impl;
+  const uint32_t levelCount =
+      static_cast<uint32_t>(impl->m_LevelOffsets.size() - 1);
+
+  for (uint32_t l = p_FirstLevel; l < levelCount; ++l) {
+    const uint32_t level = p_BottomUp ? levelCount - 1 - l : l;
+    const uint32_t begin = impl->m_LevelOffsets[level];
+    p_Job->m_Nodes = &impl->m_LevelNodes[begin];
+    nbodyPoolParallelFor(
+        p_Pool, impl->m_LevelOffsets[level + 1] - begin, Grain, p_Func, p_Job);
+  }
+}
+//---------------------------------------------------------------------------//
+// Core functions:
+//---------------------------------------------------------------------------//
+void nbodyFmmInit(
+    NBodyFmm* p_Fmm, uint32_t p_Order, float p_Theta, uint32_t p_LeafSize) {
+  p_Fmm->m_Order = p_Order;
+  p_Fmm->m_Theta = p_Theta;
+  p_Fmm->m_LeafSize = p_LeafSize;
+  p_Fmm->m_Impl = new NBodyFmmImpl();
+  p_Fmm->m_Impl->m_TableOrder = 0;
+}
+//---------------------------------------------------------------------------//
+void nbodyFmmDestroy(NBodyFmm* p_Fmm) {
+  delete p_Fmm->m_Impl;
+  p_Fmm->m_Impl = nullptr;
+}
+//---------------------------------------------------------------------------//
+void nbodyFmmEvaluate(
+    NBodyFmm* p_Fmm,
+    const NBodyOctree* p_Tree,
+    NBodyIsa p_Isa,
+    float p_G,
+    float* p_AccelX,
+    float* p_AccelY,
+    float* p_AccelZ,
+    NBodyThreadPool* p_Pool) {
+  NBodyFmmImpl* impl = p_Fmm->m_Impl;
+  impl->m_M2LCount = 0;
+  impl->m_InteractionCount = 0;
+  if (p_Tree->m_NodeCount == 0)
+    return;
+
+  NBODY_ASSERT(p_Fmm->m_Order >= 1 && p_Fmm->m_Order <= NBodyFmmMaxOrder);
+  if (impl->m_TableOrder != p_Fmm->m_Order)
+    _buildTables(impl, p_Fmm->m_Order);
+
+  FmmJob job = {};
+  job.m_Impl = impl;
+  job.m_Tree = p_Tree;
+  job.m_Theta = p_Fmm->m_Theta;
+  job.m_LeafSize = p_Fmm->m_LeafSize;
+  job.m_Isa = p_Isa;
+  job.m_G = p_G;
+  job.m_AccelX = p_AccelX;
+  job.m_AccelY = p_AccelY;
+  job.m_AccelZ = p_AccelZ;
+
+  // Parents, leaves and nodes per level, skipping the subtrees of the leaves
+  const uint32_t nodeCount = p_Tree->m_NodeCount;
+  const NBodyTreeNode* nodes = p_Tree->m_Nodes;
+  uint32_t levelCount = 0;
+  impl->m_Parents.resize(nodeCount);
+  impl->m_Parents[0] = 0;
+  impl->m_Leaves.clear();
+  std::vector<uint32_t> visited;
+  impl->m_Slots.resize(nodeCount);
+  for (uint32_t n = 0; n < nodeCount;) {
+    impl->m_Slots[n] = static_cast<uint32_t>(visited.size());
+    visited.push_back(n);
+    levelCount = std::max(levelCount, nodes[n].m_Level + 1);
+    if (_isLeaf(&job, nodes[n])) {
+      impl->m_Leaves.push_back(n);
+      n = nodes[n].m_Next;
+      continue;
+    }
+    for (uint32_t c = n + 1; c < nodes[n].m_Next; c = nodes[c].m_Next) {
+      impl->m_Parents[c] = n;
+    }
+    n++;
+  }
+  impl->m_LevelOffsets.assign(levelCount + 1, 0);
+  for (uint32_t n : visited) {
+    impl->m_LevelOffsets[nodes[n].m_Level + 1]++;
+  }
+  for (uint32_t l = 0; l < levelCount; ++l) {
+    impl->m_LevelOffsets[l + 1] += impl->m_LevelOffsets[l];
+  }
+  impl->m_LevelNodes.resize(visited.size());
+  std::vector<uint32_t> cursor(
+      impl->m_LevelOffsets.begin(), impl->m_LevelOffsets.end() - 1);
+  for (uint32_t n : visited) {
+    impl->m_LevelNodes[cursor[nodes[n].m_Level]++] = n;
+  }
+
+  const size_t coefCount = visited.size() * impl->m_TermCount;
+  impl->m_Cells.resize(visited.size());
+  impl->m_Multipoles.resize(coefCount);
+  impl->m_Locals.assign(coefCount, 0.0);
+  for (std::vector<float>& near : impl->m_Near) {
+    near.resize(p_Tree->m_Count);
+  }
+  impl->m_Scratch.resize(nbodyPoolWorkerCount(p_Pool));
+
+  // Upward pass
+  _forEachLevel(&job, p_Pool, true, 0, _upwardJob);
+
+  // Interactions: the top of the walk on this thread, then one task per
+  // target cell (all its pairs, so a task owns its subtree).
+  impl->m_Pairs.clear();
+  std::vector<CellPair> farPairs;
+  _walk(&job, 0, 0, &impl->m_Pairs, nullptr, &farPairs);
+  _m2lPairs(&job, &farPairs);
+  impl->m_M2LCount += farPairs.size();
+  std::stable_sort(
+      impl->m_Pairs.begin(),
+      impl->m_Pairs.end(),
+      [](const CellPair& a, const CellPair& b) {
+        return a.m_Target < b.m_Target;
+      });
+  impl->m_GroupOffsets.clear();
+  for (uint32_t p = 0; p < impl->m_Pairs.size(); ++p) {
+    if (p == 0 || impl->m_Pairs[p].m_Target != impl->m_Pairs[p - 1].m_Target)
+      impl->m_GroupOffsets.push_back(p);
+  }
+  impl->m_GroupOffsets.push_back(static_cast<uint32_t>(impl->m_Pairs.size()));
+  nbodyPoolParallelFor(
+      p_Pool,
+      static_cast<uint32_t>(impl->m_GroupOffsets.size() - 1),
+      1,
+      _groupJob,
+      &job);
+
+  // Downward pass (the root has no parent) and evaluation at the leaves
+  _forEachLevel(&job, p_Pool, false, 1, _downwardJob);
+  nbodyPoolParallelFor(
+      p_Pool,
+      static_cast<uint32_t>(impl->m_Leaves.size()),
+      4,
+      _evaluateJob,
+      &job);
+}
+//---------------------------------------------------------------------------//
+NBodyFmmStats nbodyFmmGetStats(const NBodyFmm* p_Fmm) {
+  NBodyFmmStats stats = {};
+  stats.m_Leaves = static_cast<uint32_t>(p_Fmm->m_Impl->m_Leaves.size());
+  stats.m_M2L = p_Fmm->m_Impl->m_M2LCount;
+  stats.m_Interactions = p_Fmm->m_Impl->m_InteractionCount;
+  return stats;
+}
+//---------------------------------------------------------------------------//
@@ -0,0 +1,72 @@
+#pragma once
+
+/******************************************************************************
+ * \Fast Multipole Method solver for the CPU engine
+ * \Cartesian Taylor expansions of configurable order p on the Barnes-Hut
+ * \octree (see NBodyBarnesHut.hpp): multipoles are built bottom-up (P2M, M2M),
+ * \a dual tree walk turns well separated cell pairs into local expansions
+ * \(M2L) and close leaf pairs into direct sums (P2P), and the locals are then
+ * \pushed down to the particles (L2L, L2P). Every pass runs on the pool. The
+ * \M2L and P2P counts per body stay bounded as N grows (`fmm` prints them
+ * \from 1e4 to 1e6 bodies), the time per body still grows with the working
+ * \set and the leaf occupancy, so this is no measured O(N).
+ ******************************************************************************/
+
+#include "NBodyBarnesHut.hpp"
+#include "NBodyCommon.hpp"
+#include "NBodyKernels.hpp"
+#include "NBodyThreadPool.hpp"
+
+// Expansion order, error falls roughly like theta^(p + 1).
+static constexpr uint32_t NBodyDefaultFmmOrder = 4;
+static constexpr uint32_t NBodyFmmMaxOrder = 8;
+// Cells A and B interact through M2L when (r_A + r_B) < theta * |z_A - z_B|,
+// r being the radius of a cell around its expansion center z.
+static constexpr float NBodyDefaultFmmTheta = 0.5f;
+// Cells with at most that many particles are treated as leaves even if the
+// octree splits them further: the direct kernels are cheap enough that a
+// coarser tree with fewer M2L is faster.
+static constexpr uint32_t NBodyDefaultFmmLeafSize = 128;
+
+struct NBodyFmmImpl;
+
+//---------------------------------------------------------------------------//
+struct NBodyFmm {
+  // Can be changed between two evaluations, the expansion tables are rebuilt
+  // when the order changes.
+  uint32_t m_Order; // [1, NBodyFmmMaxOrder]
+  float m_Theta;    // [0, 1), 0 degenerates to all-pairs
+  uint32_t m_LeafSize;
+
+  NBodyFmmImpl* m_Impl;
+};
+
+//---------------------------------------------------------------------------//
+// Work done by the last evaluation:
+struct NBodyFmmStats {
+  uint32_t m_Leaves;       // See NBodyFmm::m_LeafSize
+  uint64_t m_M2L;          // Cell-cell interactions
+  uint64_t m_Interactions; // Body-body interactions of the near field
+};
+
+//---------------------------------------------------------------------------//
+void nbodyFmmInit(
+    NBodyFmm* p_Fmm, uint32_t p_Order, float p_Theta, uint32_t p_LeafSize);
+//---------------------------------------------------------------------------//
+void nbodyFmmDestroy(NBodyFmm* p_Fmm);
+//---------------------------------------------------------------------------//
+// Accelerations of the p_Tree->m_Count particles the tree was last built
+// over, written at their original index. The near field runs on the direct
+// kernel of p_Isa and p_G scales the result like NBodyForceArgs::m_G.
+void nbodyFmmEvaluate(
+    NBodyFmm* p_Fmm,
+    const NBodyOctree* p_Tree,
+    NBodyIsa p_Isa,
+    float p_G,
+    float* p_AccelX,
+    float* p_AccelY,
+    float* p_AccelZ,
+    NBodyThreadPool* p_Pool);
+//---------------------------------------------------------------------------//
+NBodyFmmStats nbodyFmmGetStats(const NBodyFmm* p_Fmm);
+//---------------------------------------------------------------------------//
@@ -0,0 +1,2250 @@
+/******************************************************************************
+ * \headless driver for the portable CPU n-body engine (no window, no GPU)
+ * \usage: NBodyHeadless [particles] [steps]
+ * \       [bench|scaling|symmetric|tree|fmm|reorder|integrators|blocks|
+ * \       masses|dispatch|deterministic|models|trajectory|timeline]
+ * \       [threads]
+ * \       or the named options of NBodyOptions.hpp (--particles, --mode...)
+ * \build (Linux): g++ -O3 -std=c++17 -pthread NBody*.cpp -o NBodyHeadless
+ ******************************************************************************/
+
+#include "NBodyCheckpoint.hpp"
+#include "NBodyCpu.hpp"
+#include "NBodyDispatchTuner.hpp"
+#include "NBodyInitialConditions.hpp"
+#include "NBodyKernelTuner.hpp"
+#include "NBodyOptions.hpp"
+#include "NBodySnapshot.hpp"
+#include "NBodyTimeline.hpp"
+#include "NBodyTrajectory.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <utility>
+#include <vector>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//---------------------------------------------------------------------------//
+static double _secondsSince(std::chrono::steady_clock::time_point p_Start) {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now() - p_Start)
+      .count();
+}
+//---------------------------------------------------------------------------//
+// Counts the last level cache misses of the calling thread and of the threads
+// it creates afterwards, -1 when the platform (or its settings, e.g.
+// perf_event_paranoid) does not allow it.
+static int _openCacheMissCounter() {
+#if defined(__linux__)
+  perf_event_attr attr = {};
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+  return -1;
+#endif
+}
+//---------------------------------------------------------------------------//
+// Reads and closes a counter of _openCacheMissCounter, the threads it was
+// inherited by must have exited.
+static bool _closeCacheMissCounter(int p_Counter, uint64_t* p_Misses) {
+#if defined(__linux__)
+  if (p_Counter < 0)
+    return false;
+  const bool ok = read(p_Counter, p_Misses, sizeof(*p_Misses)) ==
+                  static_cast<ssize_t>(sizeof(*p_Misses));
+  close(p_Counter);
+  return ok;
+#else
+  (void)p_Counter;
+  (void)p_Misses;
+  return false;
+#endif
+}
+//---------------------------------------------------------------------------//
+// Acceleration of the body at p_Pos from the whole store, in float64 with an
+// exact 1/sqrt: the reference of the precision matrix.
+static void _directSumDouble(
+    NBodyParticleStore* p_Store, const double* p_Pos, double* p_Accel) {
+  const float* pos[3] = {
+      nbodyStoreAttrib(p_Store, NBodyAttribPosX),
+      nbodyStoreAttrib(p_Store, NBodyAttribPosY),
+      nbodyStoreAttrib(p_Store, NBodyAttribPosZ)};
+  const float* mass = nbodyStoreAttrib(p_Store, NBodyAttribMass);
+  p_Accel[0] = p_Accel[1] = p_Accel[2] = 0.0;
+  for (uint32_t j = 0; j < p_Store->m_Count; ++j) {
+    const double r[3] = {
+        pos[0][j] - p_Pos[0], pos[1][j] - p_Pos[1], pos[2][j] - p_Pos[2]};
+    const double distSqr =
+        r[0] * r[0] + r[1] * r[1] + r[2] * r[2] + NBodySofteningSquared;
+    const double s = mass[j] / (distSqr * sqrt(distSqr));
+    for (int c = 0; c < 3; ++c) {
+      p_Accel[c] += r[c] * s;
+    }
+  }
+  for (int c = 0; c < 3; ++c) {
+    p_Accel[c] *= NBodyG;
+  }
+}
+//---------------------------------------------------------------------------//
+// Accuracy / throughput matrix of the tuned kernel: every accumulation with
+// every position format, errors against a float64 direct sum on (up to) 2048
+// evenly spaced targets.
+static void _benchPrecision(
+    NBodyParticleStore* p_Store, uint32_t p_Repeats, NBodyIsa p_Isa) {
+  static constexpr uint32_t MaxSamples = 2048;
+  const uint32_t particleCount = p_Store->m_Count;
+  const uint32_t paddedCount = p_Store->m_PaddedCount;
+  const uint32_t sampleCount = std::min(particleCount, MaxSamples);
+  const uint32_t stride = particleCount / sampleCount;
+  const float* pos[3] = {
+      nbodyStoreAttrib(p_Store, NBodyAttribPosX),
+      nbodyStoreAttrib(p_Store, NBodyAttribPosY),
+      nbodyStoreAttrib(p_Store, NBodyAttribPosZ)};
+
+  std::vector<double> reference(3 * size_t(sampleCount));
+  for (uint32_t s = 0; s < sampleCount; ++s) {
+    const uint32_t i = s * stride;
+    const double target[3] = {pos[0][i], pos[1][i], pos[2][i]};
+    _directSumDouble(p_Store, target, &reference[3 * size_t(s)]);
+  }
+
+  std::vector<uint16_t> packed[NBodyPosFormatCount][3];
+  std::vector<float> accel[3];
+  for (int c = 0; c < 3; ++c) {
+    accel[c].resize(particleCount);
+    for (uint32_t f = NBodyPosFloat16; f < NBodyPosFormatCount; ++f) {
+      packed[f][c].resize(paddedCount);
+      nbodyPackPositions(
+          pos[c], packed[f][c].data(), paddedCount, NBodyPosFormat(f));
+    }
+  }
+
+  NBodyForceArgs args = {};
+  args.m_SrcX = pos[0];
+  args.m_SrcY = pos[1];
+  args.m_SrcZ = pos[2];
+  args.m_SrcMass = nbodyStoreAttrib(p_Store, NBodyAttribMass);
+  args.m_SrcCount = paddedCount;
+  args.m_DstX = pos[0];
+  args.m_DstY = pos[1];
+  args.m_DstZ = pos[2];
+  args.m_DstBegin = 0;
+  args.m_DstEnd = particleCount;
+  args.m_AccelX = accel[0].data();
+  args.m_AccelY = accel[1].data();
+  args.m_AccelZ = accel[2].data();
+  args.m_G = NBodyG;
+
+  const uint32_t variant = nbodySelectedForceVariant(p_Isa);
+  printf(
+      "precision of %s %ux%u against a float64 direct sum (%u targets):\n"
+      "accum   positions   ms/eval   GFLOP/s   rms err   max err\n",
+      nbodyIsaName(p_Isa),
+      NBodyForceVariants[variant].m_Targets,
+      NBodyForceVariants[variant].m_Unroll,
+      sampleCount);
+  const NBodyForceKernel kernel = nbodyGetForceKernel(p_Isa);
+  for (uint32_t a = 0; a < NBodyAccumCount; ++a) {
+    for (uint32_t f = 0; f < NBodyPosFormatCount; ++f) {
+      args.m_Accumulation = NBodyAccumulation(a);
+      args.m_PosFormat = NBodyPosFormat(f);
+      for (int c = 0; c < 3; ++c) {
+        args.m_SrcPacked[c] = packed[f][c].data();
+      }
+
+      auto start = std::chrono::steady_clock::now();
+      for (uint32_t r = 0; r < p_Repeats; ++r) {
+        kernel(&args);
+      }
+      const double seconds = _secondsSince(start);
+
+      double sumSqr = 0.0;
+      double maxError = 0.0;
+      for (uint32_t s = 0; s < sampleCount; ++s) {
+        const double* ref = &reference[3 * size_t(s)];
+        const uint32_t i = s * stride;
+        const double dx = accel[0][i] - ref[0];
+        const double dy = accel[1][i] - ref[1];
+        const double dz = accel[2][i] - ref[2];
+        const double err = sqrt(dx * dx + dy * dy + dz * dz) /
+                           (sqrt(ref[0] * ref[0] + ref[1] * ref[1] +
+                                 ref[2] * ref[2]) +
+                            1e-30);
+        sumSqr += err * err;
+        maxError = std::max(maxError, err);
+      }
+
+      const double interactions =
+          double(particleCount) * particleCount * p_Repeats;
+      printf(
+          "%-6s  %-9s  %8.3f  %8.2f  %.2e  %.2e\n",
+          nbodyAccumulationName(NBodyAccumulation(a)),
+          nbodyPosFormatName(NBodyPosFormat(f)),
+          1000.0 * seconds / p_Repeats,
+          interactions * NBodyFlopsPerInteraction / seconds * 1e-9,
+          sqrt(sumSqr / sampleCount),
+          maxError);
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Times every force kernel variant the cpu supports on the same positions and
+// reports GFLOP/s and the worst relative error against the scalar reference.
+// The variant picked by the tuner for the fastest ISA is marked with a *,
+// its precision modes follow (_benchPrecision).
+static void _benchKernels(NBodyParticleStore* p_Store, uint32_t p_Repeats) {
+  const uint32_t particleCount = p_Store->m_Count;
+  std::vector<float> accel[3];
+  std::vector<float> reference[3];
+  for (int c = 0; c < 3; ++c) {
+    accel[c].resize(particleCount);
+    reference[c].resize(particleCount);
+  }
+  const float* posX = nbodyStoreAttrib(p_Store, NBodyAttribPosX);
+  const float* posY = nbodyStoreAttrib(p_Store, NBodyAttribPosY);
+  const float* posZ = nbodyStoreAttrib(p_Store, NBodyAttribPosZ);
+
+  NBodyForceArgs args = {};
+  args.m_SrcX = posX;
+  args.m_SrcY = posY;
+  args.m_SrcZ = posZ;
+  args.m_SrcMass = nbodyStoreAttrib(p_Store, NBodyAttribMass);
+  args.m_SrcCount = p_Store->m_PaddedCount;
+  args.m_DstX = posX;
+  args.m_DstY = posY;
+  args.m_DstZ = posZ;
+  args.m_DstBegin = 0;
+  args.m_DstEnd = particleCount;
+  args.m_G = NBodyG;
+
+  NBodyTuneResult tune;
+  nbodyTuneForceKernel(nbodyDetectIsa(), nullptr, &tune);
+
+  // Every (ISA, variant) the cpu supports, the scalar reference first.
+  std::vector<std::pair<NBodyIsa, uint32_t>> kernels;
+  for (uint32_t isa = 0; isa < NBodyIsaCount; ++isa) {
+    if (!nbodyIsaSupported(static_cast<NBodyIsa>(isa)))
+      continue;
+    for (uint32_t v = 0; v < nbodyForceVariantCount(NBodyIsa(isa)); ++v) {
+      kernels.push_back({static_cast<NBodyIsa>(isa), v});
+    }
+  }
+
+  for (const auto& [isa, variant] : kernels) {
+    std::vector<float>* out = isa == NBodyIsaScalar ? reference : accel;
+    args.m_AccelX = out[0].data();
+    args.m_AccelY = out[1].data();
+    args.m_AccelZ = out[2].data();
+
+    NBodyForceKernel kernel = nbodyGetForceVariant(isa, variant);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < p_Repeats; ++r) {
+      kernel(&args);
+    }
+    double seconds = _secondsSince(start);
+
+    double maxError = 0.0;
+    if (isa != NBodyIsaScalar) {
+      for (uint32_t i = 0; i < particleCount; ++i) {
+        double dx = accel[0][i] - reference[0][i];
+        double dy = accel[1][i] - reference[1][i];
+        double dz = accel[2][i] - reference[2][i];
+        double ref = sqrt(
+            double(reference[0][i]) * reference[0][i] +
+            double(reference[1][i]) * reference[1][i] +
+            double(reference[2][i]) * reference[2][i]);
+        double err = sqrt(dx * dx + dy * dy + dz * dz) / (ref + 1e-30);
+        maxError = err > maxError ? err : maxError;
+      }
+    }
+
+    double interactions = double(particleCount) * particleCount * p_Repeats;
+    printf(
+        "kernel %-9s %ux%u%s: %8.3f ms/eval, %8.2f GFLOP/s, max rel error "
+        "%.2e\n",
+        nbodyIsaName(isa),
+        NBodyForceVariants[variant].m_Targets,
+        NBodyForceVariants[variant].m_Unroll,
+        isa == tune.m_Isa && variant == tune.m_Variant ? "*" : " ",
+        1000.0 * seconds / p_Repeats,
+        interactions * NBodyFlopsPerInteraction / seconds * 1e-9,
+        maxError);
+  }
+
+  _benchPrecision(p_Store, p_Repeats, tune.m_Isa);
+}
+//---------------------------------------------------------------------------//
+// Runs p_StepCount steps from the same initial state on 1, 2, 4, ... and
+// finally p_MaxThreads pinned workers and reports the speedup over 1 thread.
+static void _reportScaling(
+    NBodyCpuCtx* p_Ctx,
+    const std::vector<NBodyParticle>& p_Initial,
+    uint32_t p_StepCount,
+    uint32_t p_MaxThreads) {
+  const uint32_t particleCount = p_Ctx->m_Store.m_Count;
+  const double interactions =
+      static_cast<double>(particleCount) * particleCount * p_StepCount;
+  double baseSeconds = 0.0;
+
+  printf(
+      "particles: %u, steps: %u, kernel: %s, block size: %u\n",
+      particleCount,
+      p_StepCount,
+      nbodyIsaName(p_Ctx->m_Isa),
+      p_Ctx->m_BlockSize);
+  printf("threads  steps/s  GFLOP/s  speedup  efficiency  steals\n");
+
+  for (uint32_t threads = 1; threads <= p_MaxThreads;) {
+    NBodyThreadPool pool;
+    nbodyPoolInit(&pool, threads, true);
+    nbodyCpuLoadParticles(p_Ctx, p_Initial.data());
+    nbodyCpuSetPool(p_Ctx, &pool);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t step = 0; step < p_StepCount; ++step) {
+      nbodyCpuStep(p_Ctx);
+    }
+    double seconds = _secondsSince(start);
+    if (threads == 1)
+      baseSeconds = seconds;
+
+    const double speedup = baseSeconds / seconds;
+    printf(
+        "%7u  %7.2f  %7.2f  %7.2f  %9.1f%%  %6llu\n",
+        threads,
+        p_StepCount / seconds,
+        interactions * NBodyFlopsPerInteraction / seconds * 1e-9,
+        speedup,
+        100.0 * speedup / threads,
+        static_cast<unsigned long long>(nbodyPoolGetStats(&pool).m_Steals));
+
+    nbodyCpuSetPool(p_Ctx, nullptr);
+    nbodyPoolDestroy(&pool);
+
+    if (threads == p_MaxThreads)
+      break;
+    threads = threads * 2 < p_MaxThreads ? threads * 2 : p_MaxThreads;
+  }
+}
+//---------------------------------------------------------------------------//
+// Compares the symmetric direct sum to the plain one: accelerations of the
+// initial state (worst relative error) and the rate of p_StepCount steps.
+static void _reportSymmetric(
+    NBodyCpuCtx* p_Ctx,
+    const std::vector<NBodyParticle>& p_Initial,
+    uint32_t p_StepCount,
+    uint32_t p_ThreadCount) {
+  static const NBodySolver s_Solvers[] = {
+      NBodySolverDirect, NBodySolverSymmetric};
+  const uint32_t particleCount = p_Ctx->m_Store.m_Count;
+  const double interactions =
+      static_cast<double>(particleCount) * particleCount * p_StepCount;
+  std::vector<float> reference[3];
+  double baseSeconds = 0.0;
+
+  NBodyThreadPool pool;
+  nbodyPoolInit(&pool, p_ThreadCount, false);
+  nbodyCpuSetPool(p_Ctx, &pool);
+  printf(
+      "particles: %u, steps: %u, kernel: %s, threads: %u\n",
+      particleCount,
+      p_StepCount,
+      nbodyIsaName(p_Ctx->m_Isa),
+      p_ThreadCount);
+  printf("solver     steps/s  GFLOP/s (effective)  speedup  max err\n");
+
+  for (NBodySolver solver : s_Solvers) {
+    nbodyCpuLoadParticles(p_Ctx, p_Initial.data());
+    nbodyCpuSetSolver(p_Ctx, solver);
+    nbodyCpuComputeForces(p_Ctx);
+    const float* accel[3] = {p_Ctx->m_AccelX, p_Ctx->m_AccelY, p_Ctx->m_AccelZ};
+    double maxError = 0.0;
+    if (solver == NBodySolverDirect) {
+      for (int c = 0; c < 3; ++c) {
+        reference[c].assign(accel[c], accel[c] + particleCount);
+      }
+    } else {
+      for (uint32_t i = 0; i < particleCount; ++i) {
+        double dx = accel[0][i] - reference[0][i];
+        double dy = accel[1][i] - reference[1][i];
+        double dz = accel[2][i] - reference[2][i];
+        double ref = sqrt(
+            double(reference[0][i]) * reference[0][i] +
+            double(reference[1][i]) * reference[1][i] +
+            double(reference[2][i]) * reference[2][i]);
+        double err = sqrt(dx * dx + dy * dy + dz * dz) / (ref + 1e-30);
+        maxError = err > maxError ? err : maxError;
+      }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t step = 0; step < p_StepCount; ++step) {
+      nbodyCpuStep(p_Ctx);
+    }
+    double seconds = _secondsSince(start);
+    if (solver == NBodySolverDirect)
+      baseSeconds = seconds;
+
+    printf(
+        "%-9s  %7.2f  %19.2f  %7.2f  %.2e\n",
+        nbodySolverName(solver),
+        p_StepCount / seconds,
+        interactions * NBodyFlopsPerInteraction / seconds * 1e-9,
+        baseSeconds / seconds,
+        maxError);
+  }
+
+  nbodyCpuSetSolver(p_Ctx, NBodySolverDirect);
+  nbodyCpuSetPool(p_Ctx, nullptr);
+  nbodyPoolDestroy(&pool);
+}
+//---------------------------------------------------------------------------//
+// Integrates p_Initial over the same span of time (p_StepCount steps of
+// p_DeltaTime) with every integrator and steps 1 to 64 times larger, and
+// reports the relative energy error at the end.
+static void _integratorTable(
+    NBodyCpuCtx* p_Ctx,
+    const NBodyParticle* p_Initial,
+    float p_DeltaTime,
+    uint32_t p_StepCount) {
+  static const uint32_t s_StepScales[] = {1, 4, 16, 64};
+
+  nbodyCpuLoadParticles(p_Ctx, p_Initial);
+  const NBodyEnergy initial = nbodyCpuComputeEnergy(p_Ctx);
+  const double initialTotal = initial.m_Kinetic + initial.m_Potential;
+  printf(
+      "particles: %u, time span: %.2f, solver: %s, energy: %.6e\n",
+      p_Ctx->m_Store.m_Count,
+      p_DeltaTime * p_StepCount,
+      nbodySolverName(p_Ctx->m_Solver),
+      initialTotal);
+  printf(
+      "integrator     delta t  steps  evaluations  time s  energy err\n");
+
+  for (uint32_t integrator = 0; integrator < NBodyIntegratorCount;
+       ++integrator) {
+    for (uint32_t scale : s_StepScales) {
+      const uint32_t stepCount = p_StepCount / scale;
+      if (stepCount == 0)
+        continue;
+
+      nbodyCpuLoadParticles(p_Ctx, p_Initial);
+      nbodyCpuSetIntegrator(p_Ctx, static_cast<NBodyIntegrator>(integrator));
+      p_Ctx->m_Params.m_DeltaTime = p_DeltaTime * scale;
+      const uint64_t evalCount = p_Ctx->m_ForceEvalCount;
+
+      auto start = std::chrono::steady_clock::now();
+      for (uint32_t step = 0; step < stepCount; ++step) {
+        nbodyCpuStep(p_Ctx);
+      }
+      double seconds = _secondsSince(start);
+
+      const NBodyEnergy energy = nbodyCpuComputeEnergy(p_Ctx);
+      const double total = energy.m_Kinetic + energy.m_Potential;
+      printf(
+          "%-13s  %7.3f  %5u  %11llu  %6.2f  %.3e\n",
+          nbodyIntegratorName(static_cast<NBodyIntegrator>(integrator)),
+          p_Ctx->m_Params.m_DeltaTime,
+          stepCount,
+          static_cast<unsigned long long>(p_Ctx->m_ForceEvalCount - evalCount),
+          seconds,
+          fabs((total - initialTotal) / initialTotal));
+    }
+  }
+  nbodyCpuSetIntegrator(p_Ctx, NBodyIntegratorEuler);
+}
+//---------------------------------------------------------------------------//
+// Integrator comparison on the demo clusters, whose error is dominated by
+// close encounters (the softening is tiny next to the particle mass), then
+// on an eccentric binary where only the integration scheme matters.
+static void _reportIntegrators(
+    NBodyCpuCtx* p_Ctx,
+    const std::vector<NBodyParticle>& p_Initial,
+    uint32_t p_StepCount,
+    uint32_t p_ThreadCount) {
+  const float deltaTime = p_Ctx->m_Params.m_DeltaTime;
+  NBodyThreadPool pool;
+  nbodyPoolInit(&pool, p_ThreadCount, false);
+  nbodyCpuSetPool(p_Ctx, &pool);
+  _integratorTable(p_Ctx, p_Initial.data(), deltaTime, p_StepCount);
+  p_Ctx->m_Params.m_DeltaTime = deltaTime;
+  nbodyCpuSetPool(p_Ctx, nullptr);
+  nbodyPoolDestroy(&pool);
+
+  // Separation 400, apocenter speed 0.6 of the circular one, about half an
+  // orbit in 4096 steps.
+  NBodyParams params = p_Ctx->m_Params;
+  params.m_ParticleCount = 2;
+  NBodyCpuCtx binary;
+  nbodyCpuInit(&binary, params);
+  const float speed = 0.6f * sqrtf(NBodyParticleMass / 800.0f);
+  const NBodyParticle bodies[2] = {
+      {{200.0f, 0.0f, 0.0f, NBodyDefaultMass}, {0.0f, speed, 0.0f, 0.0f}},
+      {{-200.0f, 0.0f, 0.0f, NBodyDefaultMass}, {0.0f, -speed, 0.0f, 0.0f}}};
+  printf("\n");
+  _integratorTable(&binary, bodies, deltaTime, 4096);
+  nbodyCpuDestroy(&binary);
+}
+//---------------------------------------------------------------------------//
+// Block steps against the shared step Hermite scheme: per step substeps,
+// finest level, fraction of the particles corrected per substep and the
+// cost in full force evaluations, then the totals of both schemes and the
+// cost of shared steps as short as the finest block.
+static void _reportBlocks(
+    NBodyCpuCtx* p_Ctx,
+    const std::vector<NBodyParticle>& p_Initial,
+    uint32_t p_StepCount,
+    uint32_t p_ThreadCount) {
+  static const NBodyIntegrator s_Integrators[] = {
+      NBodyIntegratorHermite, NBodyIntegratorHermiteBlock};
+  const uint32_t count = p_Ctx->m_Store.m_Count;
+  NBodyThreadPool pool;
+  nbodyPoolInit(&pool, p_ThreadCount, false);
+  nbodyCpuSetPool(p_Ctx, &pool);
+
+  printf(
+      "particles: %u, steps: %u, delta t: %.3f, eta: %.3f, threads: %u\n",
+      count,
+      p_StepCount,
+      p_Ctx->m_Params.m_DeltaTime,
+      p_Ctx->m_Blocks.m_Eta,
+      p_ThreadCount);
+
+  for (NBodyIntegrator integrator : s_Integrators) {
+    const bool block = integrator == NBodyIntegratorHermiteBlock;
+    nbodyCpuLoadParticles(p_Ctx, p_Initial.data());
+    nbodyCpuSetIntegrator(p_Ctx, integrator);
+    const NBodyEnergy initial = nbodyCpuComputeEnergy(p_Ctx);
+    const double initialTotal = initial.m_Kinetic + initial.m_Potential;
+    double evaluations = 0.0;
+    double finestEvaluations = 0.0;
+    double seconds = 0.0;
+    if (block)
+      printf("step  substeps  max level  active  evaluations  energy err\n");
+
+    for (uint32_t step = 0; step < p_StepCount; ++step) {
+      const uint64_t evalCount = p_Ctx->m_ForceEvalCount;
+      auto start = std::chrono::steady_clock::now();
+      nbodyCpuStep(p_Ctx);
+      seconds += _secondsSince(start);
+      if (!block) {
+        evaluations += double(p_Ctx->m_ForceEvalCount - evalCount);
+        continue;
+      }
+
+      // Includes the first evaluation of the whole set, if any
+      const NBodyBlockSteps& blocks = p_Ctx->m_Blocks;
+      const uint32_t fullCount =
+          uint32_t(p_Ctx->m_ForceEvalCount - evalCount) - blocks.m_Substeps;
+      const double stepEvaluations =
+          fullCount + double(blocks.m_Updates) / count;
+      evaluations += stepEvaluations;
+      finestEvaluations += double(1u << blocks.m_MaxLevel);
+      const NBodyEnergy energy = nbodyCpuComputeEnergy(p_Ctx);
+      const double total = energy.m_Kinetic + energy.m_Potential;
+      printf(
+          "%4u  %8u  %9u  %6.4f  %11.2f  %.3e\n",
+          step,
+          blocks.m_Substeps,
+          blocks.m_MaxLevel,
+          double(blocks.m_Updates) / (double(count) * blocks.m_Substeps),
+          stepEvaluations,
+          fabs((total - initialTotal) / initialTotal));
+    }
+
+    const NBodyEnergy energy = nbodyCpuComputeEnergy(p_Ctx);
+    const double total = energy.m_Kinetic + energy.m_Potential;
+    printf(
+        "%-13s  evaluations: %8.2f, time: %.3f s, energy err: %.3e\n",
+        nbodyIntegratorName(integrator),
+        evaluations,
+        seconds,
+        fabs((total - initialTotal) / initialTotal));
+    if (block)
+      printf(
+          "hermite at the finest block step: %.0f evaluations\n",
+          finestEvaluations);
+  }
+
+  nbodyCpuSetIntegrator(p_Ctx, NBodyIntegratorEuler);
+  nbodyCpuSetPool(p_Ctx, nullptr);
+  nbodyPoolDestroy(&pool);
+}
+//---------------------------------------------------------------------------//
+// A made-up cache standing in for the hardware counters, which sandboxes and
+// most VMs don't expose: 1 MB, 16 ways of 64-byte lines, LRU.
+struct SimulatedCache {
+  static constexpr uint32_t LineShift = 6;
+  static constexpr uint32_t Ways = 16;
+  static constexpr uint32_t Sets = (1u << 20) / (Ways << LineShift);
+  uint64_t m_Lines[Sets][Ways]; // Most recent first, ~0 when empty
+  uint64_t m_Accesses;
+  uint64_t m_Misses;
+};
+//---------------------------------------------------------------------------//
+static void _cacheAccess(SimulatedCache* p_Cache, const void* p_Address) {
+  const uint64_t line =
+      reinterpret_cast<uintptr_t>(p_Address) >> SimulatedCache::LineShift;
+  uint64_t* ways = p_Cache->m_Lines[line % SimulatedCache::Sets];
+  uint32_t way = 0;
+  while (way < SimulatedCache::Ways - 1 && ways[way] != line)
+    ++way;
+  p_Cache->m_Accesses++;
+  if (ways[way] != line)
+    p_Cache->m_Misses++;
+  std::copy_backward(ways, ways + way, ways + way + 1);
+  ways[0] = line;
+}
+//---------------------------------------------------------------------------//
+// Replays the accesses to the store whose order depends on the particle
+// order: the gather of the tree build (nbodyOctreeBuild) and the scatter of
+// the accelerations, both at m_Order[k] for k = 0, 1, ... The force loops
+// read the sorted copies, in the same order with or without reordering, and
+// are left out: the replay bounds what reordering saves, it is not the miss
+// count of a step (only the hardware counter is).
+static void _replayTreeAccesses(NBodyCpuCtx* p_Ctx, SimulatedCache* p_Cache) {
+  const uint32_t* order = p_Ctx->m_Tree.m_Morton.m_Order;
+  const float* attribs[7] = {
+      nbodyStoreAttrib(&p_Ctx->m_Store, NBodyAttribPosX),
+      nbodyStoreAttrib(&p_Ctx->m_Store, NBodyAttribPosY),
+      nbodyStoreAttrib(&p_Ctx->m_Store, NBodyAttribPosZ),
+      nbodyStoreAttrib(&p_Ctx->m_Store, NBodyAttribMass),
+      p_Ctx->m_AccelX,
+      p_Ctx->m_AccelY,
+      p_Ctx->m_AccelZ};
+  for (uint32_t k = 0; k < p_Ctx->m_Store.m_Count; ++k) {
+    for (const float* attrib : attribs) {
+      _cacheAccess(p_Cache, attrib + order[k]);
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Runs p_StepCount steps of both tree solvers from the same initial state
+// with and without the periodic Morton reordering of the store and reports
+// the step rate and the cache misses per step, counted by the cpu when it
+// allows it, and the misses of the gather and scatter (_replayTreeAccesses)
+// in SimulatedCache.
+static void _reportReorder(
+    NBodyCpuCtx* p_Ctx,
+    const std::vector<NBodyParticle>& p_Initial,
+    uint32_t p_StepCount,
+    uint32_t p_ThreadCount) {
+  static const NBodySolver s_Solvers[] = {
+      NBodySolverBarnesHut, NBodySolverFmm};
+
+  printf(
+      "particles: %u, steps: %u, threads: %u, reorder interval: %u\n",
+      p_Ctx->m_Store.m_Count,
+      p_StepCount,
+      p_ThreadCount,
+      NBodyDefaultReorderInterval);
+  printf(
+      "solver      reorder  steps/s  speedup  cache misses/step  "
+      "gather misses/step (simulated)\n");
+
+  std::unique_ptr<SimulatedCache> cache(new SimulatedCache);
+  for (NBodySolver solver : s_Solvers) {
+    double baseSeconds = 0.0;
+    for (int reorder = 0; reorder < 2; ++reorder) {
+      nbodyCpuLoadParticles(p_Ctx, p_Initial.data());
+      nbodyCpuSetSolver(p_Ctx, solver);
+      nbodyCpuSetReorderInterval(
+          p_Ctx, reorder ? NBodyDefaultReorderInterval : 0);
+      p_Ctx->m_StepCount = 0;
+
+      // The pool is created after the counter so that its workers inherit it
+      const int counter = _openCacheMissCounter();
+      NBodyThreadPool pool;
+      nbodyPoolInit(&pool, p_ThreadCount, false);
+      nbodyCpuSetPool(p_Ctx, &pool);
+
+      memset(cache->m_Lines, 0xff, sizeof(cache->m_Lines));
+      cache->m_Accesses = 0;
+      cache->m_Misses = 0;
+      double seconds = 0.0;
+      for (uint32_t step = 0; step < p_StepCount; ++step) {
+        auto start = std::chrono::steady_clock::now();
+        nbodyCpuStep(p_Ctx);
+        seconds += _secondsSince(start);
+        _replayTreeAccesses(p_Ctx, cache.get());
+      }
+      if (!reorder)
+        baseSeconds = seconds;
+
+      nbodyCpuSetPool(p_Ctx, nullptr);
+      nbodyPoolDestroy(&pool);
+      uint64_t misses = 0;
+      char missText[32] = "n/a";
+      if (_closeCacheMissCounter(counter, &misses))
+        snprintf(
+            missText, sizeof(missText), "%.3e", double(misses) / p_StepCount);
+
+      printf(
+          "%-10s  %-7s  %7.2f  %7.2f  %17s  %10.3e (%4.1f%%)\n",
+          nbodySolverName(solver),
+          reorder ? "on" : "off",
+          p_StepCount / seconds,
+          baseSeconds / seconds,
+          missText,
+          double(cache->m_Misses) / p_StepCount,
+          100.0 * cache->m_Misses / std::max<uint64_t>(cache->m_Accesses, 1));
+    }
+  }
+  nbodyCpuSetSolver(p_Ctx, NBodySolverDirect);
+  nbodyCpuSetReorderInterval(p_Ctx, NBodyDefaultReorderInterval);
+}
+//---------------------------------------------------------------------------//
+// All-pairs accelerations of an evenly strided sample of targets, used as the
+// reference for the approximate solvers (fastest direct kernel). The cost of
+// a full direct evaluation is extrapolated from the sample.
+struct ReferenceSample {
+  uint32_t m_Count;
+  uint32_t m_Stride;
+  std::vector<float> m_Accel[3];
+  double m_DirectSeconds;
+};
+//---------------------------------------------------------------------------//
+static void _sampleReference(NBodyCpuCtx* p_Ctx, ReferenceSample* p_Sample) {
+  static constexpr uint32_t MaxSamples = 2048;
+
+  NBodyParticleStore* store = nbodyCpuGetStore(p_Ctx);
+  const uint32_t particleCount = store->m_Count;
+  p_Sample->m_Count = std::min(particleCount, MaxSamples);
+  p_Sample->m_Stride = particleCount / p_Sample->m_Count;
+  const float* posX = nbodyStoreAttrib(store, NBodyAttribPosX);
+  const float* posY = nbodyStoreAttrib(store, NBodyAttribPosY);
+  const float* posZ = nbodyStoreAttrib(store, NBodyAttribPosZ);
+
+  std::vector<float> samplePos[3];
+  for (int c = 0; c < 3; ++c) {
+    samplePos[c].resize(p_Sample->m_Count);
+    p_Sample->m_Accel[c].resize(p_Sample->m_Count);
+  }
+  for (uint32_t s = 0; s < p_Sample->m_Count; ++s) {
+    samplePos[0][s] = posX[s * p_Sample->m_Stride];
+    samplePos[1][s] = posY[s * p_Sample->m_Stride];
+    samplePos[2][s] = posZ[s * p_Sample->m_Stride];
+  }
+
+  NBodyForceArgs args = {};
+  args.m_SrcX = posX;
+  args.m_SrcY = posY;
+  args.m_SrcZ = posZ;
+  args.m_SrcMass = nbodyStoreAttrib(store, NBodyAttribMass);
+  args.m_SrcCount = store->m_PaddedCount;
+  args.m_DstX = samplePos[0].data();
+  args.m_DstY = samplePos[1].data();
+  args.m_DstZ = samplePos[2].data();
+  args.m_DstBegin = 0;
+  args.m_DstEnd = p_Sample->m_Count;
+  args.m_AccelX = p_Sample->m_Accel[0].data();
+  args.m_AccelY = p_Sample->m_Accel[1].data();
+  args.m_AccelZ = p_Sample->m_Accel[2].data();
+  args.m_G = NBodyG;
+
+  auto start = std::chrono::steady_clock::now();
+  nbodyGetForceKernel(p_Ctx->m_Isa)(&args);
+  p_Sample->m_DirectSeconds = _secondsSince(start) * particleCount /
+                              p_Sample->m_Count /
+                              nbodyPoolWorkerCount(p_Ctx->m_Pool);
+}
+//---------------------------------------------------------------------------//
+static void
+_printReference(const NBodyCpuCtx* p_Ctx, const ReferenceSample& p_Sample) {
+  printf(
+      "particles: %u, samples: %u, threads: %u, direct (%s, estimated): "
+      "%.3f s/eval\n",
+      p_Ctx->m_Store.m_Count,
+      p_Sample.m_Count,
+      nbodyPoolWorkerCount(p_Ctx->m_Pool),
+      nbodyIsaName(p_Ctx->m_Isa),
+      p_Sample.m_DirectSeconds);
+}
+//---------------------------------------------------------------------------//
+// Relative error of m_AccelX/Y/Z against the sample: rms, p99 and max.
+static void _sampleErrors(
+    const NBodyCpuCtx* p_Ctx,
+    const ReferenceSample& p_Sample,
+    double* p_Errors) {
+  const std::vector<float>* reference = p_Sample.m_Accel;
+  std::vector<double> errors(p_Sample.m_Count);
+  double sumSqr = 0.0;
+  for (uint32_t s = 0; s < p_Sample.m_Count; ++s) {
+    const uint32_t i = s * p_Sample.m_Stride;
+    const double dx = p_Ctx->m_AccelX[i] - reference[0][s];
+    const double dy = p_Ctx->m_AccelY[i] - reference[1][s];
+    const double dz = p_Ctx->m_AccelZ[i] - reference[2][s];
+    const double ref = sqrt(
+        double(reference[0][s]) * reference[0][s] +
+        double(reference[1][s]) * reference[1][s] +
+        double(reference[2][s]) * reference[2][s]);
+    errors[s] = sqrt(dx * dx + dy * dy + dz * dz) / (ref + 1e-30);
+    sumSqr += errors[s] * errors[s];
+  }
+  std::sort(errors.begin(), errors.end());
+
+  p_Errors[0] = sqrt(sumSqr / p_Sample.m_Count);
+  p_Errors[1] = errors[size_t(0.99 * (p_Sample.m_Count - 1))];
+  p_Errors[2] = errors.back();
+}
+//---------------------------------------------------------------------------//
+// Builds the tree and times the tree build and the force evaluation of the
+// current solver separately.
+static void _timeTreeSolver(
+    NBodyCpuCtx* p_Ctx, double* p_BuildSeconds, double* p_ForceSeconds) {
+  NBodyParticleStore* store = nbodyCpuGetStore(p_Ctx);
+  auto start = std::chrono::steady_clock::now();
+  nbodyOctreeBuild(
+      &p_Ctx->m_Tree,
+      nbodyStoreAttrib(store, NBodyAttribPosX),
+      nbodyStoreAttrib(store, NBodyAttribPosY),
+      nbodyStoreAttrib(store, NBodyAttribPosZ),
+      nbodyStoreAttrib(store, NBodyAttribMass),
+      store->m_Count,
+      p_Ctx->m_Pool);
+  *p_BuildSeconds = _secondsSince(start);
+  start = std::chrono::steady_clock::now();
+  nbodyCpuComputeForces(p_Ctx); // Rebuilds the tree, not timed twice
+  *p_ForceSeconds = _secondsSince(start) - *p_BuildSeconds;
+}
+//---------------------------------------------------------------------------//
+// Barnes-Hut accuracy and cost for a range of opening angles.
+static void _reportTree(NBodyCpuCtx* p_Ctx) {
+  static const float s_Thetas[] = {0.3f, 0.5f, 0.7f, 1.0f};
+
+  ReferenceSample sample;
+  _sampleReference(p_Ctx, &sample);
+  _printReference(p_Ctx, sample);
+  printf(
+      "theta  moments     build ms  force ms  speedup  "
+      "rms err   p99 err   max err\n");
+
+  nbodyCpuSetSolver(p_Ctx, NBodySolverBarnesHut);
+  for (float theta : s_Thetas) {
+    for (int quadrupole = 0; quadrupole < 2; ++quadrupole) {
+      p_Ctx->m_Tree.m_Theta = theta;
+      p_Ctx->m_Tree.m_Quadrupole = quadrupole != 0;
+
+      double buildSeconds = 0.0;
+      double forceSeconds = 0.0;
+      _timeTreeSolver(p_Ctx, &buildSeconds, &forceSeconds);
+      double errors[3];
+      _sampleErrors(p_Ctx, sample, errors);
+
+      printf(
+          "%5.2f  %-10s  %8.2f  %8.2f  %7.1f  %.2e  %.2e  %.2e\n",
+          theta,
+          quadrupole ? "quadrupole" : "monopole",
+          1000.0 * buildSeconds,
+          1000.0 * forceSeconds,
+          sample.m_DirectSeconds / (buildSeconds + forceSeconds),
+          errors[0],
+          errors[1],
+          errors[2]);
+    }
+  }
+  nbodyCpuSetSolver(p_Ctx, NBodySolverDirect);
+}
+//---------------------------------------------------------------------------//
+// FMM accuracy and cost for a range of expansion orders and opening angles.
+static void _reportFmm(NBodyCpuCtx* p_Ctx) {
+  static const uint32_t s_Orders[] = {2, 4, 6, 8};
+  static const float s_Thetas[] = {0.3f, 0.5f, 0.7f};
+
+  ReferenceSample sample;
+  _sampleReference(p_Ctx, &sample);
+  _printReference(p_Ctx, sample);
+  printf(
+      "order  theta  build ms  force ms  speedup       M2L   P2P/body  "
+      "rms err   p99 err   max err\n");
+
+  nbodyCpuSetSolver(p_Ctx, NBodySolverFmm);
+  for (uint32_t order : s_Orders) {
+    for (float theta : s_Thetas) {
+      p_Ctx->m_Fmm.m_Order = order;
+      p_Ctx->m_Fmm.m_Theta = theta;
+
+      double buildSeconds = 0.0;
+      double forceSeconds = 0.0;
+      _timeTreeSolver(p_Ctx, &buildSeconds, &forceSeconds);
+      double errors[3];
+      _sampleErrors(p_Ctx, sample, errors);
+      const NBodyFmmStats stats = nbodyFmmGetStats(&p_Ctx->m_Fmm);
+
+      printf(
+          "%5u  %5.2f  %8.2f  %8.2f  %7.1f  %8llu  %9.1f  %.2e  %.2e  %.2e\n",
+          order,
+          theta,
+          1000.0 * buildSeconds,
+          1000.0 * forceSeconds,
+          sample.m_DirectSeconds / (buildSeconds + forceSeconds),
+          static_cast<unsigned long long>(stats.m_M2L),
+          double(stats.m_Interactions) / nbodyCpuGetStore(p_Ctx)->m_Count,
+          errors[0],
+          errors[1],
+          errors[2]);
+    }
+  }
+  p_Ctx->m_Fmm.m_Order = NBodyDefaultFmmOrder;
+  p_Ctx->m_Fmm.m_Theta = NBodyDefaultFmmTheta;
+  nbodyCpuSetSolver(p_Ctx, NBodySolverDirect);
+}
+//---------------------------------------------------------------------------//
+// FMM cost per body from 1e4 to 1e6 particles of the same model at the
+// default order and opening angle: the M2L and P2P counts per body should
+// stay flat and the time per body with them.
+static void _reportFmmScaling(
+    const NBodyCpuCtx* p_Ctx,
+    NBodyModelParams p_Model,
+    NBodyThreadPool* p_Pool) {
+  static const uint32_t s_Counts[] = {
+      10000, 30000, 100000, 300000, 1000000};
+
+  printf(
+      "\nparticles  leaves  bodies/leaf  force ms  ns/body  speedup  "
+      "M2L/body  P2P/body  rms err\n");
+  for (uint32_t count : s_Counts) {
+    NBodyParams params = p_Ctx->m_Params;
+    params.m_ParticleCount = count;
+    NBodyCpuCtx ctx;
+    nbodyCpuInit(&ctx, params);
+    nbodyCpuSetPrecision(&ctx, p_Ctx->m_Accumulation, p_Ctx->m_PosFormat);
+    nbodyCpuSetPool(&ctx, p_Pool);
+    std::vector<NBodyParticle> particles(count);
+    p_Model.m_ParticleCount = count;
+    nbodyGenerateModel(&p_Model, 0, count, particles.data(), p_Pool);
+    nbodyCpuLoadParticles(&ctx, particles.data());
+
+    ReferenceSample sample;
+    _sampleReference(&ctx, &sample);
+    nbodyCpuSetSolver(&ctx, NBodySolverFmm);
+    double buildSeconds = 0.0;
+    double forceSeconds = 0.0;
+    _timeTreeSolver(&ctx, &buildSeconds, &forceSeconds);
+    double errors[3];
+    _sampleErrors(&ctx, sample, errors);
+    const NBodyFmmStats stats = nbodyFmmGetStats(&ctx.m_Fmm);
+
+    printf(
+        "%9u  %6u  %11.1f  %8.2f  %7.0f  %7.1f  %8.2f  %8.1f  %.2e\n",
+        count,
+        stats.m_Leaves,
+        double(count) / stats.m_Leaves,
+        1000.0 * forceSeconds,
+        1e9 * forceSeconds / count,
+        sample.m_DirectSeconds / (buildSeconds + forceSeconds),
+        double(stats.m_M2L) / count,
+        double(stats.m_Interactions) / count,
+        errors[0]);
+    nbodyCpuDestroy(&ctx);
+  }
+}
+//---------------------------------------------------------------------------//
+// Salpeter masses over two decades, every solver against the direct sum.
+static void _reportMasses(
+    NBodyCpuCtx* p_Ctx,
+    std::vector<NBodyParticle> p_Particles,
+    uint32_t p_Seed) {
+  static const NBodySolver s_Solvers[] = {
+      NBodySolverSymmetric, NBodySolverBarnesHut, NBodySolverFmm};
+  static constexpr float Range = 100.0f;
+
+  nbodyAssignPowerLawMasses(
+      p_Particles.data(),
+      static_cast<uint32_t>(p_Particles.size()),
+      Range,
+      NBodySalpeterSlope,
+      p_Seed);
+  float minMass = INFINITY;
+  float maxMass = 0.0f;
+  for (const NBodyParticle& particle : p_Particles) {
+    minMass = std::min(minMass, particle.m_Position.w);
+    maxMass = std::max(maxMass, particle.m_Position.w);
+  }
+  nbodyCpuLoadParticles(p_Ctx, p_Particles.data());
+  printf(
+      "masses: salpeter (slope %.2f), min %.3e, max %.3e, mean %.3e\n",
+      NBodySalpeterSlope,
+      minMass,
+      maxMass,
+      NBodyDefaultMass);
+
+  ReferenceSample sample;
+  _sampleReference(p_Ctx, &sample);
+  _printReference(p_Ctx, sample);
+  printf("solver      rms err   p99 err   max err\n");
+  for (NBodySolver solver : s_Solvers) {
+    nbodyCpuSetSolver(p_Ctx, solver);
+    nbodyCpuComputeForces(p_Ctx);
+    double errors[3];
+    _sampleErrors(p_Ctx, sample, errors);
+    printf(
+        "%-10s  %.2e  %.2e  %.2e\n",
+        nbodySolverName(solver),
+        errors[0],
+        errors[1],
+        errors[2]);
+  }
+  nbodyCpuSetSolver(p_Ctx, NBodySolverDirect);
+}
+//---------------------------------------------------------------------------//
+// A made-up GPU standing in for D3D12 timestamps, so that the dispatch tuner
+// (search and cache) runs here: 16 compute units of 64 lanes at 1.5 GHz, each
+// holding up to 1024 threads and 32 KB of shared memory.
+struct SimulatedGpu {
+  uint32_t m_ParticleCount;
+  uint32_t m_Calls; // Configs timed so far
+};
+//---------------------------------------------------------------------------//
+static bool _simulateDispatch(
+    void* p_User, NBodyDispatchConfig p_Config, double* p_Seconds) {
+  static constexpr uint32_t ComputeUnits = 16;
+  static constexpr uint32_t Lanes = 64;
+  static constexpr uint32_t MaxThreads = 1024;
+  static constexpr uint32_t SharedBytes = 32 * 1024;
+  static constexpr double Clock = 1.5e9;
+  static constexpr double BarrierCycles = 100.0;
+
+  SimulatedGpu* gpu = static_cast<SimulatedGpu*>(p_User);
+  ++gpu->m_Calls;
+  const uint32_t block = p_Config.m_BlockSize;
+  const uint32_t tileBytes = block * uint32_t(sizeof(NBodyFloat4));
+  const uint32_t resident =
+      std::min(MaxThreads / block, SharedBytes / tileBytes);
+  if (resident == 0)
+    return false;
+
+  // One group per tile, in waves of every resident group of every unit.
+  const uint32_t tiles = (gpu->m_ParticleCount + block - 1) / block;
+  const uint32_t waves =
+      (tiles + ComputeUnits * resident - 1) / (ComputeUnits * resident);
+  const uint32_t active =
+      std::min(resident, (tiles + ComputeUnits - 1) / ComputeUnits);
+
+  // An interaction costs 20 lane cycles plus the loop overhead the unroll
+  // amortizes, full unrolls of large tiles overflow the instruction cache.
+  const double unroll = p_Config.m_Unroll == 0 ? block : p_Config.m_Unroll;
+  double cycles = 20.0 + 8.0 / unroll;
+  if (p_Config.m_Unroll == 0 && block > 128)
+    cycles *= 1.0 + (block - 128) / 512.0;
+
+  // The active threads share the lanes, and need 4 per lane to hide latency.
+  // Barriers stall a group, the other active groups fill in.
+  const double threads = std::max(double(active * block), 4.0 * Lanes);
+  const double tileCycles =
+      threads / Lanes * block * cycles + 2.0 * BarrierCycles / active;
+  *p_Seconds = double(waves) * tiles * tileCycles / Clock;
+  return true;
+}
+//---------------------------------------------------------------------------//
+// Every CSMain config on the simulated GPU, then the tuner through the cache
+// as the demo's --tune does it.
+static void _reportDispatch(uint32_t p_ParticleCount) {
+  static constexpr const char* Adapter = "Simulated GPU (NBodyHeadless)";
+
+  SimulatedGpu gpu = {p_ParticleCount, 0};
+  NBodyDispatchTuneResult timed;
+  nbodyTuneDispatch(
+      Adapter, p_ParticleCount, _simulateDispatch, &gpu, nullptr, &timed);
+  printf(
+      "dispatch: %u particles, %s\nconfig     ms/step   GFLOP/s\n",
+      p_ParticleCount,
+      Adapter);
+  const double interactions = double(p_ParticleCount) * p_ParticleCount;
+  for (uint32_t c = 0; c < NBodyDispatchConfigCount; ++c) {
+    const NBodyDispatchConfig config = NBodyDispatchConfigs[c];
+    char name[32];
+    nbodyDispatchConfigName(config, name, 32);
+    const bool chosen = config.m_BlockSize == timed.m_Config.m_BlockSize &&
+                        config.m_Unroll == timed.m_Config.m_Unroll;
+    if (timed.m_Seconds[c] < 0.0) {
+      printf("%-9s%s  does not run\n", name, chosen ? "*" : " ");
+      continue;
+    }
+    printf(
+        "%-9s%s %8.3f  %8.1f\n",
+        name,
+        chosen ? "*" : " ",
+        timed.m_Seconds[c] * 1e3,
+        interactions * NBodyFlopsPerInteraction / timed.m_Seconds[c] * 1e-9);
+  }
+
+  gpu.m_Calls = 0;
+  NBodyDispatchTuneResult cached;
+  const bool stored = nbodyTuneDispatch(
+      Adapter,
+      p_ParticleCount,
+      _simulateDispatch,
+      &gpu,
+      NBodyDefaultDispatchCache,
+      &cached);
+  char name[32];
+  nbodyDispatchConfigName(cached.m_Config, name, 32);
+  printf(
+      "%s: %s (%s, %u configs timed)\n",
+      NBodyDefaultDispatchCache,
+      name,
+      cached.m_FromCache ? "cached" : "tuned",
+      gpu.m_Calls);
+  if (!stored)
+    fprintf(stderr, "warning: could not write %s\n", NBodyDefaultDispatchCache);
+}
+//---------------------------------------------------------------------------//
+// Runs p_StepCount deterministic steps from the same initial state with 1, 2,
+// 4 and p_ThreadCount workers on every ISA of this cpu and compares the
+// checksums of the final positions: each solver and integrator pair must give
+// the same one everywhere.
+static void _reportDeterministic(
+    NBodyCpuCtx* p_Ctx,
+    const std::vector<NBodyParticle>& p_Initial,
+    uint32_t p_StepCount,
+    uint32_t p_ThreadCount) {
+  struct Config {
+    NBodySolver m_Solver;
+    NBodyIntegrator m_Integrator;
+  };
+  // The given integrator, and Hermite for its jerk kernel.
+  const Config configs[] = {
+      {NBodySolverDirect, p_Ctx->m_Integrator},
+      {NBodySolverSymmetric, p_Ctx->m_Integrator},
+      {NBodySolverDirect, NBodyIntegratorHermite}};
+  const uint32_t configCount =
+      p_Ctx->m_Integrator == NBodyIntegratorHermite ? 2 : 3;
+  const NBodyIntegrator integrator = p_Ctx->m_Integrator;
+  std::vector<uint32_t> threadCounts = {1, 2, 4};
+  if (std::find(threadCounts.begin(), threadCounts.end(), p_ThreadCount) ==
+      threadCounts.end())
+    threadCounts.push_back(p_ThreadCount);
+  const NBodyIsa bestIsa = p_Ctx->m_Isa;
+  printf(
+      "particles: %u, steps: %u\n", p_Ctx->m_Store.m_Count, p_StepCount);
+  printf(
+      "solver     integrator     kernel    threads  steps/s  checksum"
+      "          same\n");
+
+  nbodyCpuSetDeterministic(p_Ctx, true);
+  bool consistent = true;
+  for (uint32_t c = 0; c < configCount; ++c) {
+    nbodyCpuSetSolver(p_Ctx, configs[c].m_Solver);
+    nbodyCpuSetIntegrator(p_Ctx, configs[c].m_Integrator);
+    uint64_t reference = 0;
+    for (uint32_t isa = 0; isa < NBodyIsaCount; ++isa) {
+      if (!nbodyIsaSupported(NBodyIsa(isa)))
+        continue;
+      p_Ctx->m_Isa = NBodyIsa(isa);
+      for (uint32_t threads : threadCounts) {
+        NBodyThreadPool pool;
+        nbodyPoolInit(&pool, threads, false);
+        nbodyCpuSetPool(p_Ctx, &pool);
+        nbodyCpuLoadParticles(p_Ctx, p_Initial.data());
+        p_Ctx->m_StepCount = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t step = 0; step < p_StepCount; ++step) {
+          nbodyCpuStep(p_Ctx);
+        }
+        const double seconds = _secondsSince(start);
+        const uint64_t checksum = nbodyCpuChecksum(p_Ctx);
+        if (reference == 0)
+          reference = checksum;
+        consistent = consistent && checksum == reference;
+        printf(
+            "%-9s  %-13s  %-8s  %7u  %7.2f  %016llx  %s\n",
+            nbodySolverName(configs[c].m_Solver),
+            nbodyIntegratorName(configs[c].m_Integrator),
+            nbodyIsaName(NBodyIsa(isa)),
+            threads,
+            p_StepCount / seconds,
+            static_cast<unsigned long long>(checksum),
+            checksum == reference ? "yes" : "NO");
+
+        nbodyCpuSetPool(p_Ctx, nullptr);
+        nbodyPoolDestroy(&pool);
+      }
+    }
+  }
+  printf("deterministic: %s\n", consistent ? "ok" : "MISMATCH");
+
+  p_Ctx->m_Isa = bestIsa;
+  nbodyCpuSetSolver(p_Ctx, NBodySolverDirect);
+  nbodyCpuSetIntegrator(p_Ctx, integrator);
+  nbodyCpuSetDeterministic(p_Ctx, false);
+}
+//---------------------------------------------------------------------------//
+static void _printTrajectoryStats(const NBodyTrajectoryStats& p_Stats) {
+  printf(
+      "trajectory: %llu frames, %llu dropped, queue depth <= %u, %.1f MB "
+      "(%.2fx), capture %.3f ms/frame, writer %.0f MB/s\n",
+      static_cast<unsigned long long>(p_Stats.m_Written),
+      static_cast<unsigned long long>(p_Stats.m_Dropped),
+      p_Stats.m_MaxQueueDepth,
+      p_Stats.m_FileBytes * 1e-6,
+      double(p_Stats.m_RawBytes) / p_Stats.m_FileBytes,
+      p_Stats.m_CaptureSeconds * 1e3 /
+          std::max<uint64_t>(1, p_Stats.m_Captured),
+      p_Stats.m_FileBytes * 1e-6 / std::max(p_Stats.m_WriterSeconds, 1e-9));
+}
+//---------------------------------------------------------------------------//
+static void _printCheckpointStats(const NBodyCheckpointStats& p_Stats) {
+  printf(
+      "checkpoints: %llu full, %llu delta, %llu deferred, last at step "
+      "%llu, %.1f MB of %.1f MB captured, capture %.3f ms, writer %.0f MB/s\n",
+      static_cast<unsigned long long>(p_Stats.m_Full),
+      static_cast<unsigned long long>(p_Stats.m_Delta),
+      static_cast<unsigned long long>(p_Stats.m_Deferred),
+      static_cast<unsigned long long>(p_Stats.m_LastStep),
+      p_Stats.m_FileBytes * 1e-6,
+      p_Stats.m_ImageBytes * 1e-6,
+      p_Stats.m_CaptureSeconds * 1e3 /
+          std::max<uint64_t>(1, p_Stats.m_Captured),
+      p_Stats.m_FileBytes * 1e-6 / std::max(p_Stats.m_WriterSeconds, 1e-9));
+}
+//---------------------------------------------------------------------------//
+// Largest side of the bounding box of a frame (x, y then z arrays).
+static double _frameExtent(const float* p_Frame, uint32_t p_Count) {
+  double extent = 0.0;
+  for (uint32_t c = 0; c < 3; ++c) {
+    const float* values = p_Frame + size_t(c) * p_Count;
+    const auto range = std::minmax_element(values, values + p_Count);
+    extent = std::max(extent, double(*range.second) - *range.first);
+  }
+  return extent;
+}
+//---------------------------------------------------------------------------//
+static bool _isKeyframe(const uint8_t* p_Payload, size_t p_Size) {
+  NBodyQuantHeader header = {};
+  if (p_Size >= sizeof(header))
+    memcpy(&header, p_Payload, sizeof(header));
+  return header.m_Keyframe != 0;
+}
+//---------------------------------------------------------------------------//
+// GB/s of positions over p_Seconds, "-" without frames.
+static void _printRate(double p_Bytes, double p_Seconds) {
+  if (p_Bytes > 0.0)
+    printf("  %10.2f", p_Bytes * 1e-9 / std::max(p_Seconds, 1e-9));
+  else
+    printf("  %10s", "-");
+}
+//---------------------------------------------------------------------------//
+// The quant codec alone on the recorded frames, in memory, with the kernels
+// of every ISA: all of them must produce the same bytes. Keyframes (the
+// Morton sort of the ids) and the frames predicted from them are timed
+// apart, a group is NBodyQuantGroupSize frames.
+static void _reportQuantCodec(
+    const std::vector<float>& p_Frames,
+    uint32_t p_Count,
+    uint32_t p_FrameCount,
+    float p_ErrorBound) {
+  printf("\nquant codec in memory, %u frames\n", p_FrameCount);
+  printf(
+      "isa       keyframes  key encode  key decode      encode      decode  "
+      " sustained  same bytes\n");
+  const size_t maxSize = nbodyQuantMaxSize(p_Count);
+  std::vector<uint8_t> reference;
+  std::vector<uint8_t> encoded(maxSize * p_FrameCount);
+  std::vector<size_t> sizes(p_FrameCount);
+  std::vector<float> decoded(3 * size_t(p_Count));
+  float* positions[3] = {
+      decoded.data(), decoded.data() + p_Count, decoded.data() + 2 * p_Count};
+  const double frameBytes = 3.0 * sizeof(float) * p_Count;
+
+  for (uint32_t isa = 0; isa < NBodyIsaCount; ++isa) {
+    if (!nbodyIsaSupported(NBodyIsa(isa)))
+      continue;
+    // Index 1 for the keyframes, 0 for the other frames.
+    double encodeSeconds[2] = {0.0, 0.0};
+    double decodeSeconds[2] = {0.0, 0.0};
+    uint32_t keyframes = 0;
+    NBodyQuantCoder* encoder =
+        nbodyQuantCreate(p_Count, p_ErrorBound, NBodyIsa(isa));
+    size_t total = 0;
+    for (uint32_t f = 0; f < p_FrameCount; ++f) {
+      const float* frame = &p_Frames[size_t(f) * 3 * p_Count];
+      const float* axes[3] = {frame, frame + p_Count, frame + 2 * p_Count};
+      const auto start = std::chrono::steady_clock::now();
+      sizes[f] = nbodyQuantEncode(encoder, axes, encoded.data() + total);
+      const double seconds = _secondsSince(start);
+      const bool keyframe = _isKeyframe(encoded.data() + total, sizes[f]);
+      encodeSeconds[keyframe] += seconds;
+      keyframes += keyframe;
+      total += sizes[f];
+    }
+    nbodyQuantDestroy(encoder);
+
+    NBodyQuantCoder* decoder =
+        nbodyQuantCreate(p_Count, p_ErrorBound, NBodyIsa(isa));
+    bool valid = true;
+    size_t offset = 0;
+    for (uint32_t f = 0; f < p_FrameCount; ++f) {
+      const uint8_t* payload = encoded.data() + offset;
+      const auto start = std::chrono::steady_clock::now();
+      valid = valid && nbodyQuantDecode(decoder, payload, sizes[f], positions);
+      decodeSeconds[_isKeyframe(payload, sizes[f])] += _secondsSince(start);
+      offset += sizes[f];
+    }
+    nbodyQuantDestroy(decoder);
+
+    encoded.resize(total);
+    if (reference.empty())
+      reference = encoded;
+    const double keyBytes = frameBytes * keyframes;
+    const double otherBytes = frameBytes * (p_FrameCount - keyframes);
+    printf("%-8s  %9u", nbodyIsaName(NBodyIsa(isa)), keyframes);
+    _printRate(keyBytes, encodeSeconds[1]);
+    _printRate(keyBytes, decodeSeconds[1]);
+    _printRate(otherBytes, encodeSeconds[0]);
+    _printRate(otherBytes, decodeSeconds[0]);
+    _printRate(keyBytes + otherBytes, encodeSeconds[0] + encodeSeconds[1]);
+    printf(
+        "  %s\n", !valid ? "INVALID" : encoded == reference ? "yes" : "NO");
+    encoded.resize(maxSize * p_FrameCount);
+  }
+}
+//---------------------------------------------------------------------------//
+// Records every step with each codec through the background writer, then
+// reads the file back and compares it with the positions of every step: the
+// largest error, and its ratio to the quant bound times the frame's extent.
+static void _reportTrajectory(
+    NBodyCpuCtx* p_Ctx,
+    const std::vector<NBodyParticle>& p_Initial,
+    uint32_t p_StepCount,
+    uint32_t p_ThreadCount,
+    float p_ErrorBound) {
+  static const char* s_Path = "NBodyTrajectory.tmp";
+  const uint32_t count = p_Ctx->m_Store.m_Count;
+  NBodyThreadPool pool;
+  nbodyPoolInit(&pool, p_ThreadCount, false);
+  nbodyCpuSetPool(p_Ctx, &pool);
+  printf(
+      "particles: %u, steps: %u, threads: %u, frame buffers: %u, "
+      "error bound: %g\n",
+      count,
+      p_StepCount,
+      pool.m_WorkerCount,
+      NBodyDefaultTrajectoryBuffers,
+      p_ErrorBound);
+  printf(
+      "codec  bytes/particle  ratio  capture ms  writer MB/s  dropped  "
+      "max error  / bound\n");
+
+  std::vector<float> expected(size_t(p_StepCount) * 3 * count);
+  for (uint32_t codec = 0; codec < NBodyCodecCount; ++codec) {
+    nbodyCpuLoadParticles(p_Ctx, p_Initial.data());
+    p_Ctx->m_StepCount = 0;
+    NBodyTrajectory trajectory;
+    if (!nbodyTrajectoryOpen(
+            &trajectory,
+            s_Path,
+            count,
+            1,
+            NBodyDefaultTrajectoryBuffers,
+            NBodyFrameCodec(codec),
+            p_ErrorBound)) {
+      printf("could not create %s\n", s_Path);
+      break;
+    }
+    for (uint32_t step = 0; step < p_StepCount; ++step) {
+      nbodyCpuStep(p_Ctx);
+      nbodyTrajectoryCapture(&trajectory, p_Ctx);
+      // Reordering swaps the store's arrays.
+      NBodyColumns p = nbodyStoreColumns(nbodyCpuGetStore(p_Ctx));
+      for (uint32_t c = 0; c < 3; ++c) {
+        float* dst = &expected[(size_t(step) * 3 + c) * count];
+        const NBodyAttribute attrib = NBodyAttribute(NBodyAttribPosX + c);
+        for (uint32_t id = 0; id < count; ++id) {
+          dst[id] = nbodyColumnAt(p, attrib, nbodyCpuSlotOf(p_Ctx, id));
+        }
+      }
+    }
+    NBodyTrajectoryStats stats;
+    const bool written = nbodyTrajectoryClose(&trajectory, &stats);
+
+    // Frames are stamped with their step, dropped ones are just missing.
+    NBodyTrajectoryReader reader;
+    uint64_t frames = 0;
+    double maxError = 0.0;
+    double maxRatio = 0.0;
+    if (written && nbodyTrajectoryReaderOpen(&reader, s_Path)) {
+      while (nbodyTrajectoryReadFrame(&reader)) {
+        const float* ref = &expected[(reader.m_Step - 1) * 3 * count];
+        double frameError = 0.0;
+        for (uint32_t c = 0; c < 3; ++c) {
+          for (uint32_t id = 0; id < count; ++id) {
+            const double error =
+                fabs(double(reader.m_Positions[c][id]) - ref[c * count + id]);
+            frameError = std::max(frameError, error);
+          }
+        }
+        maxError = std::max(maxError, frameError);
+        maxRatio = std::max(
+            maxRatio, frameError / (p_ErrorBound * _frameExtent(ref, count)));
+        frames++;
+      }
+      nbodyTrajectoryReaderClose(&reader);
+    }
+    printf(
+        "%-5s  %14.2f  %5.2f  %10.3f  %11.0f  %7llu  ",
+        nbodyCodecName(NBodyFrameCodec(codec)),
+        double(stats.m_FileBytes) / std::max<uint64_t>(1, stats.m_Written) /
+            count,
+        double(stats.m_RawBytes) / stats.m_FileBytes,
+        stats.m_CaptureSeconds * 1e3 / std::max<uint64_t>(1, stats.m_Captured),
+        stats.m_RawBytes * 1e-6 / std::max(stats.m_WriterSeconds, 1e-9),
+        static_cast<unsigned long long>(stats.m_Dropped));
+    if (frames != stats.m_Written)
+      printf(
+          "LOST %llu FRAMES\n",
+          static_cast<unsigned long long>(stats.m_Written - frames));
+    else
+      printf("%9.3g  %7.3f\n", maxError, maxRatio);
+  }
+  remove(s_Path);
+  _reportQuantCodec(expected, count, p_StepCount, p_ErrorBound);
+
+  nbodyCpuSetPool(p_Ctx, nullptr);
+  nbodyPoolDestroy(&pool);
+}
+//---------------------------------------------------------------------------//
+// Round trips of two threads handing a value back and forth, in ns per
+// handoff (on one core every handoff is a sleep and a wake-up).
+static double _timelinePingPong(uint32_t p_Rounds) {
+  NBodyTimeline* ping = nbodyTimelineCreate(0);
+  NBodyTimeline* pong = nbodyTimelineCreate(0);
+  std::thread other([=] {
+    for (uint64_t round = 1; round <= p_Rounds; ++round) {
+      nbodyTimelineWait(ping, round, NBodyTimelineInfinite);
+      nbodyTimelineSignal(pong, round);
+    }
+  });
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t round = 1; round <= p_Rounds; ++round) {
+    nbodyTimelineSignal(ping, round);
+    nbodyTimelineWait(pong, round, NBodyTimelineInfinite);
+  }
+  const double seconds = _secondsSince(start);
+  other.join();
+  nbodyTimelineDestroy(ping);
+  nbodyTimelineDestroy(pong);
+  return seconds * 1e9 / (2.0 * p_Rounds);
+}
+//---------------------------------------------------------------------------//
+// Waiters on random values ahead of the timeline with random timeouts while
+// it advances by random increments: a wait must never return true before
+// its value, nor false without a timeout. Returns the errors, the hangs
+// are caught by the watchdog.
+static uint64_t _timelineWaiters(
+    uint32_t p_WaiterCount,
+    uint64_t p_FinalValue,
+    NBodyTimelineStats* p_Stats) {
+  NBodyTimeline* timeline = nbodyTimelineCreate(0);
+  NBodyTimeline* finished = nbodyTimelineCreate(0);
+  std::atomic<uint64_t> errors(0);
+  std::vector<std::thread> waiters;
+  for (uint32_t w = 0; w < p_WaiterCount; ++w) {
+    waiters.emplace_back([=, &errors] {
+      uint32_t draw = 0;
+      uint64_t seen = 0;
+      while (seen < p_FinalValue) {
+        uint32_t bits[4];
+        nbodyRandomBits(
+            NBodyDefaultSeed, w, NBodyRandomStream(0), draw++, bits);
+        const uint64_t target =
+            std::min(p_FinalValue, seen + 1 + bits[0] % 4);
+        const uint32_t timeouts[3] = {0, 1, NBodyTimelineInfinite};
+        const uint32_t timeout = timeouts[bits[1] % 3];
+        const bool reached = nbodyTimelineWait(timeline, target, timeout);
+        const uint64_t value = nbodyTimelineValue(timeline);
+        if (reached ? value < target : timeout == NBodyTimelineInfinite)
+          errors.fetch_add(1);
+        seen = value;
+      }
+      nbodyTimelineSignal(finished, nbodyTimelineValue(finished) + 1);
+    });
+  }
+  // The signals come in bursts with yields in between, so that the waiters
+  // see both reached and pending values.
+  uint32_t draw = 0;
+  uint64_t value = 0;
+  while (value < p_FinalValue) {
+    uint32_t bits[4];
+    nbodyRandomBits(
+        NBodyDefaultSeed, p_WaiterCount, NBodyRandomStream(0), draw++, bits);
+    value = std::min(p_FinalValue, value + 1 + bits[0] % 3);
+    nbodyTimelineSignal(timeline, value);
+    if (bits[1] % 8 == 0)
+      std::this_thread::yield();
+  }
+  // Every waiter eventually waits for p_FinalValue without a timeout.
+  for (uint32_t w = 0; w < p_WaiterCount; ++w) {
+    if (!nbodyTimelineWait(finished, w + 1, 10000)) {
+      printf("HANG: waiters never woke up\n");
+      fflush(stdout);
+      abort();
+    }
+  }
+  for (std::thread& waiter : waiters)
+    waiter.join();
+  *p_Stats = nbodyTimelineGetStats(timeline);
+  nbodyTimelineDestroy(timeline);
+  nbodyTimelineDestroy(finished);
+  return errors.load();
+}
+//---------------------------------------------------------------------------//
+// Frames the renderer may have in flight, the demo's FRAME_COUNT
+static constexpr uint64_t NBodyPipelineFrames = 3;
+// Frames of a consumer's pattern of holds
+static constexpr uint32_t NBodyPipelineHolds = 8;
+
+// The demo's compute/render handshake (ParticleSimulation.cpp) with the CPU
+// engine as the compute queue and a checksum as the draw, both on
+// NBodyQueues and through a NBodyStateRing. Buffer k % K holds step k,
+// stamped 2k - 1 while written and 2k once done: a draw that sees another
+// stamp raced with the step. A draw also holds its buffer for a while, as
+// the GPU and the display would, without taking the CPU from the steps.
+struct TimelinePipeline {
+  NBodyCpuCtx* m_Ctx;
+  NBodyQueue* m_ComputeQueue;
+  NBodyQueue* m_RenderQueue;
+  NBodyTimeline* m_Steps;  // Steps done by the compute queue
+  NBodyTimeline* m_Frames; // Frames done by the render queue
+  NBodyStateRing m_Ring;
+
+  std::vector<float> m_Buffers[NBodyMaxStateBuffers];
+  std::atomic<uint64_t> m_Stamps[NBodyMaxStateBuffers];
+  std::vector<uint64_t> m_Checksums; // Of every step, by the producer
+  uint64_t m_DrawSteps[NBodyPipelineFrames];
+  uint64_t m_DrawnFrames;            // Render queue side
+  double m_Holds[NBodyPipelineHolds]; // Seconds, of frame f % Holds
+  uint64_t m_Violations;
+  uint64_t m_Stalls; // Steps queued behind a frame
+};
+//---------------------------------------------------------------------------//
+static uint64_t _bufferChecksum(const std::vector<float>& p_Buffer) {
+  uint64_t hash = 0;
+  for (float value : p_Buffer) {
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    hash = hash * 0x100000001b3ull + bits;
+  }
+  return hash;
+}
+//---------------------------------------------------------------------------//
+static void _pipelineStep(void* p_User) {
+  TimelinePipeline* pipe = static_cast<TimelinePipeline*>(p_User);
+  nbodyCpuStep(pipe->m_Ctx);
+  const uint64_t step = pipe->m_Ctx->m_StepCount;
+  const uint32_t count = pipe->m_Ctx->m_Store.m_Count;
+  const uint32_t slot = nbodyRingSlot(&pipe->m_Ring, step);
+  std::vector<float>& buffer = pipe->m_Buffers[slot];
+  std::atomic<uint64_t>& stamp = pipe->m_Stamps[slot];
+  stamp.store(2 * step - 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  NBodyColumns p = nbodyStoreColumns(nbodyCpuGetStore(pipe->m_Ctx));
+  for (uint32_t c = 0; c < 3; ++c) {
+    const NBodyAttribute attrib = NBodyAttribute(NBodyAttribPosX + c);
+    for (uint32_t i = 0; i < count; ++i)
+      buffer[size_t(c) * count + i] = nbodyColumnAt(p, attrib, i);
+  }
+  pipe->m_Checksums[step] = _bufferChecksum(buffer);
+  stamp.store(2 * step, std::memory_order_release);
+}
+//---------------------------------------------------------------------------//
+static void _pipelineDraw(void* p_User) {
+  TimelinePipeline* pipe = static_cast<TimelinePipeline*>(p_User);
+  const uint64_t frame = ++pipe->m_DrawnFrames;
+  const uint64_t step = pipe->m_DrawSteps[frame % NBodyPipelineFrames];
+  const uint32_t slot = nbodyRingSlot(&pipe->m_Ring, step);
+  const std::atomic<uint64_t>& stamp = pipe->m_Stamps[slot];
+  const uint64_t before = stamp.load(std::memory_order_acquire);
+  const double hold = pipe->m_Holds[frame % NBodyPipelineHolds];
+  if (hold > 0.0)
+    std::this_thread::sleep_for(std::chrono::duration<double>(hold));
+  const uint64_t checksum = _bufferChecksum(pipe->m_Buffers[slot]);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const uint64_t after = stamp.load(std::memory_order_relaxed);
+  if (before != 2 * step || after != 2 * step ||
+      checksum != pipe->m_Checksums[step])
+    pipe->m_Violations++;
+}
+//---------------------------------------------------------------------------//
+// Runs p_StepCount steps through the pipeline, returns the frames drawn.
+static uint64_t _runPipeline(TimelinePipeline* p_Pipe, uint32_t p_StepCount) {
+  std::thread compute([p_Pipe, p_StepCount] {
+    for (uint64_t step = 1; step <= p_StepCount; ++step) {
+      // The buffer of this step was last read by the frame the ring keeps
+      // for it: the queue waits for it, the thread goes on.
+      const uint64_t read = nbodyRingWriteFrame(&p_Pipe->m_Ring, step);
+      if (nbodyTimelineValue(p_Pipe->m_Frames) < read)
+        p_Pipe->m_Stalls++;
+      nbodyQueueWait(p_Pipe->m_ComputeQueue, p_Pipe->m_Frames, read);
+      nbodyQueueExecute(p_Pipe->m_ComputeQueue, _pipelineStep, p_Pipe);
+      nbodyQueueSignal(p_Pipe->m_ComputeQueue, p_Pipe->m_Steps, step);
+      // As the demo, which resets its command allocator then
+      nbodyTimelineWait(p_Pipe->m_Steps, step, NBodyTimelineInfinite);
+    }
+  });
+  // The renderer draws the newest step, one frame per new step, with as
+  // many frames in flight as the ring leaves it.
+  uint64_t frame = 0;
+  uint64_t drawn = 0;
+  while (drawn < p_StepCount) {
+    nbodyTimelineWait(p_Pipe->m_Steps, drawn + 1, NBodyTimelineInfinite);
+    ++frame;
+    nbodyTimelineWait(
+        p_Pipe->m_Frames,
+        nbodyRingFrameToWait(&p_Pipe->m_Ring, frame),
+        NBodyTimelineInfinite);
+    drawn = nbodyRingAcquire(&p_Pipe->m_Ring, frame);
+    p_Pipe->m_DrawSteps[frame % NBodyPipelineFrames] = drawn;
+    nbodyQueueWait(p_Pipe->m_RenderQueue, p_Pipe->m_Steps, drawn);
+    nbodyQueueExecute(p_Pipe->m_RenderQueue, _pipelineDraw, p_Pipe);
+    nbodyQueueSignal(p_Pipe->m_RenderQueue, p_Pipe->m_Frames, frame);
+  }
+  nbodyTimelineWait(p_Pipe->m_Frames, frame, NBodyTimelineInfinite);
+  compute.join();
+  return frame;
+}
+//---------------------------------------------------------------------------//
+static void _reportTimeline(
+    NBodyCpuCtx* p_Ctx,
+    const std::vector<NBodyParticle>& p_Initial,
+    uint32_t p_StepCount,
+    uint32_t p_ThreadCount) {
+  const uint32_t count = p_Ctx->m_Store.m_Count;
+  printf(
+      "timeline handoff: %.0f ns\n",
+      _timelinePingPong(std::max<uint32_t>(1000, 100 * p_StepCount)));
+
+  bool failed = false;
+  const uint32_t waiterCounts[3] = {1, 4, 16};
+  for (uint32_t waiterCount : waiterCounts) {
+    NBodyTimelineStats stats;
+    const uint64_t errors =
+        _timelineWaiters(waiterCount, 200 * uint64_t(p_StepCount), &stats);
+    printf(
+        "%2u waiters: %llu signals, %llu sleeps, %llu timeouts, %llu "
+        "errors\n",
+        waiterCount,
+        static_cast<unsigned long long>(stats.m_Signals),
+        static_cast<unsigned long long>(stats.m_Sleeps),
+        static_cast<unsigned long long>(stats.m_Timeouts),
+        static_cast<unsigned long long>(errors));
+    failed |= errors > 0;
+  }
+
+  NBodyThreadPool pool;
+  nbodyPoolInit(&pool, p_ThreadCount, false);
+  nbodyCpuSetPool(p_Ctx, &pool);
+  // The first step also evaluates the initial forces, the holds are scaled
+  // by the ones after it. A sleep overshoots by a scheduler tick or so,
+  // taken off every hold.
+  nbodyCpuLoadParticles(p_Ctx, p_Initial.data());
+  nbodyCpuStep(p_Ctx);
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t step = 0; step < 4; ++step)
+    nbodyCpuStep(p_Ctx);
+  const double stepSeconds = _secondsSince(start) / 4;
+  static constexpr double SleepProbe = 100e-6;
+  start = std::chrono::steady_clock::now();
+  for (uint32_t sleep = 0; sleep < 16; ++sleep)
+    std::this_thread::sleep_for(std::chrono::duration<double>(SleepProbe));
+  const double sleepSlack =
+      std::max(0.0, _secondsSince(start) / 16 - SleepProbe);
+  printf(
+      "pipeline: %u particles, %u steps, %.3f ms/step\n",
+      count,
+      p_StepCount,
+      stepSeconds * 1e3);
+  // Draws held for a fraction of a step (steady), or mostly short with
+  // every 8th one held for 6 steps (bursty, e.g. a hitch of the display):
+  // the renderer keeps up on average, the bursts stall a short ring.
+  struct Consumer {
+    const char* m_Name;
+    double m_Short; // Steps held by the draws
+    double m_Long;  // and by every NBodyPipelineHolds-th one
+  };
+  const Consumer consumers[2] = {{"steady", 0.5, 0.5}, {"bursty", 0.1, 6.0}};
+  const uint32_t slotCounts[4] = {2, 3, 4, NBodyMaxStateBuffers};
+  printf(
+      "consumer  buffers  steps/s  frames  stalled steps  sleeps  "
+      "torn frames\n");
+  for (const Consumer& consumer : consumers) {
+    for (uint32_t slotCount : slotCounts) {
+      nbodyCpuLoadParticles(p_Ctx, p_Initial.data());
+      p_Ctx->m_StepCount = 0;
+      TimelinePipeline pipe;
+      pipe.m_Ctx = p_Ctx;
+      pipe.m_ComputeQueue = nbodyQueueCreate();
+      pipe.m_RenderQueue = nbodyQueueCreate();
+      pipe.m_Steps = nbodyTimelineCreate(0);
+      pipe.m_Frames = nbodyTimelineCreate(0);
+      nbodyRingInit(
+          &pipe.m_Ring,
+          slotCount,
+          NBodyPipelineFrames,
+          pipe.m_Steps,
+          pipe.m_Frames);
+      for (uint32_t b = 0; b < slotCount; ++b) {
+        pipe.m_Buffers[b].assign(3 * size_t(count), 0.0f);
+        pipe.m_Stamps[b].store(0);
+      }
+      // Step 0 is the initial state, in buffer 0.
+      NBodyColumns p = nbodyStoreColumns(nbodyCpuGetStore(p_Ctx));
+      for (uint32_t c = 0; c < 3; ++c) {
+        const NBodyAttribute attrib = NBodyAttribute(NBodyAttribPosX + c);
+        for (uint32_t i = 0; i < count; ++i)
+          pipe.m_Buffers[0][size_t(c) * count + i] =
+              nbodyColumnAt(p, attrib, i);
+      }
+      pipe.m_Checksums.assign(size_t(p_StepCount) + 1, 0);
+      pipe.m_Checksums[0] = _bufferChecksum(pipe.m_Buffers[0]);
+      pipe.m_DrawnFrames = 0;
+      for (uint32_t h = 0; h < NBodyPipelineHolds; ++h) {
+        const double steps = h == 0 ? consumer.m_Long : consumer.m_Short;
+        pipe.m_Holds[h] = std::max(0.0, steps * stepSeconds - sleepSlack);
+      }
+      pipe.m_Violations = 0;
+      pipe.m_Stalls = 0;
+
+      start = std::chrono::steady_clock::now();
+      const uint64_t frames = _runPipeline(&pipe, p_StepCount);
+      const double seconds = _secondsSince(start);
+      nbodyQueueDestroy(pipe.m_ComputeQueue);
+      nbodyQueueDestroy(pipe.m_RenderQueue);
+      const uint64_t sleeps = nbodyTimelineGetStats(pipe.m_Steps).m_Sleeps +
+                              nbodyTimelineGetStats(pipe.m_Frames).m_Sleeps;
+      printf(
+          "%-8s  %7u  %7.1f  %6llu  %13llu  %6llu  %11llu\n",
+          consumer.m_Name,
+          slotCount,
+          p_StepCount / seconds,
+          static_cast<unsigned long long>(frames),
+          static_cast<unsigned long long>(pipe.m_Stalls),
+          static_cast<unsigned long long>(sleeps),
+          static_cast<unsigned long long>(pipe.m_Violations));
+      failed |= pipe.m_Violations > 0;
+      nbodyTimelineDestroy(pipe.m_Steps);
+      nbodyTimelineDestroy(pipe.m_Frames);
+    }
+  }
+  printf("timeline: %s\n", failed ? "FAILED" : "ok");
+
+  nbodyCpuSetPool(p_Ctx, nullptr);
+  nbodyPoolDestroy(&pool);
+}
+//---------------------------------------------------------------------------//
+// Virial ratio 2 K / |W| of p_Particles (1 in equilibrium) from an evenly
+// strided sample of at most 4096 of them, in double precision.
+static double _virialRatio(const std::vector<NBodyParticle>& p_Particles) {
+  static constexpr size_t MaxSamples = 4096;
+  const size_t count = p_Particles.size();
+  const size_t samples = std::min(count, MaxSamples);
+  std::vector<NBodyParticle> sample(samples);
+  for (size_t s = 0; s < samples; ++s) {
+    sample[s] = p_Particles[s * count / samples];
+  }
+
+  double kinetic = 0.0;
+  double potential = 0.0;
+  for (size_t i = 0; i < samples; ++i) {
+    const NBodyFloat4& pi = sample[i].m_Position;
+    const NBodyFloat4& vi = sample[i].m_Velocity;
+    kinetic += 0.5 * pi.w *
+               (double(vi.x) * vi.x + double(vi.y) * vi.y +
+                double(vi.z) * vi.z);
+    for (size_t j = i + 1; j < samples; ++j) {
+      const NBodyFloat4& pj = sample[j].m_Position;
+      const double dx = double(pj.x) - pi.x;
+      const double dy = double(pj.y) - pi.y;
+      const double dz = double(pj.z) - pi.z;
+      potential -= double(NBodyG) * pi.w * pj.w /
+                   sqrt(dx * dx + dy * dy + dz * dz +
+                        double(NBodySofteningSquared));
+    }
+  }
+  // K grows with the sample, W with its pairs.
+  const double scale = double(count) / double(samples);
+  return 2.0 * kinetic * scale / (fabs(potential) * scale * scale);
+}
+//---------------------------------------------------------------------------//
+// Generates every model on the pool, again in uneven chunks on the calling
+// thread (which must give the same bits), and checks its virial ratio and
+// the radius holding half of the particles around their mean.
+static void _reportModels(
+    uint32_t p_ParticleCount,
+    float p_Scale,
+    uint32_t p_Seed,
+    uint32_t p_ThreadCount) {
+  NBodyThreadPool pool;
+  nbodyPoolInit(&pool, p_ThreadCount, false);
+  printf(
+      "particles: %u, scale: %.1f, seed: %u, threads: %u\n",
+      p_ParticleCount,
+      p_Scale,
+      p_Seed,
+      pool.m_WorkerCount);
+  printf("model      Mparticles/s  chunked  2K/|W|  half-mass radius\n");
+
+  std::vector<NBodyParticle> particles(p_ParticleCount);
+  std::vector<NBodyParticle> chunked(p_ParticleCount);
+  for (uint32_t m = 0; m < NBodyModelCount; ++m) {
+    NBodyModelParams params = {};
+    params.m_Model = NBodyModel(m);
+    params.m_ParticleCount = p_ParticleCount;
+    params.m_Scale = p_Scale;
+    params.m_Seed = p_Seed;
+
+    auto start = std::chrono::steady_clock::now();
+    nbodyGenerateModel(
+        &params, 0, p_ParticleCount, particles.data(), &pool);
+    const double seconds = _secondsSince(start);
+
+    uint32_t begin = 0;
+    for (uint32_t chunk = 1; begin < p_ParticleCount; ++chunk) {
+      const uint32_t end =
+          std::min(p_ParticleCount, begin + chunk * p_ParticleCount / 16 + 1);
+      nbodyGenerateModel(&params, begin, end, &chunked[begin], nullptr);
+      begin = end;
+    }
+    const bool same = memcmp(
+                          particles.data(),
+                          chunked.data(),
+                          particles.size() * sizeof(NBodyParticle)) == 0;
+
+    double mean[3] = {0.0, 0.0, 0.0};
+    for (const NBodyParticle& particle : particles) {
+      mean[0] += particle.m_Position.x / p_ParticleCount;
+      mean[1] += particle.m_Position.y / p_ParticleCount;
+      mean[2] += particle.m_Position.z / p_ParticleCount;
+    }
+    std::vector<float> radii(p_ParticleCount);
+    for (uint32_t i = 0; i < p_ParticleCount; ++i) {
+      const NBodyFloat4& p = particles[i].m_Position;
+      radii[i] = float(sqrt(
+          (p.x - mean[0]) * (p.x - mean[0]) +
+          (p.y - mean[1]) * (p.y - mean[1]) +
+          (p.z - mean[2]) * (p.z - mean[2])));
+    }
+    std::nth_element(
+        radii.begin(), radii.begin() + p_ParticleCount / 2, radii.end());
+
+    printf(
+        "%-9s  %12.2f  %-7s  %6.3f  %16.1f\n",
+        nbodyModelName(NBodyModel(m)),
+        p_ParticleCount / seconds * 1e-6,
+        same ? "same" : "DIFFER",
+        _virialRatio(particles),
+        radii[p_ParticleCount / 2]);
+  }
+  nbodyPoolDestroy(&pool);
+}
+//---------------------------------------------------------------------------//
+// Applies the positional form [particles] [steps] [mode] [threads].
+static bool
+_applyPositionals(NBodyOptions* p_Options, char* p_Error, size_t p_ErrorSize) {
+  uint32_t* values[4] = {
+      &p_Options->m_ParticleCount,
+      &p_Options->m_StepCount,
+      nullptr,
+      &p_Options->m_ThreadCount};
+  if (p_Options->m_PositionalCount > 4) {
+    snprintf(p_Error, p_ErrorSize, "too many arguments");
+    return false;
+  }
+  for (uint32_t p = 0; p < p_Options->m_PositionalCount; ++p) {
+    const char* arg = p_Options->m_Positionals[p];
+    if (values[p] == nullptr) {
+      p_Options->m_Mode = arg;
+      continue;
+    }
+    char* end = nullptr;
+    *values[p] = static_cast<uint32_t>(strtoul(arg, &end, 10));
+    if (end == arg || *end != '\0') {
+      snprintf(p_Error, p_ErrorSize, "not a number: %s", arg);
+      return false;
+    }
+  }
+  return true;
+}
+//---------------------------------------------------------------------------//
+int main(int p_Argc, char** p_Argv) {
+  // Positionals first, then the named options parsed again on top of them.
+  NBodyOptions options;
+  nbodyOptionsInit(&options);
+  options.m_TileSize = NBodyDefaultBlockSize;
+  options.m_StepCount = 10;
+  options.m_Backend = NBodyBackendCpu;
+  char error[256];
+  bool valid = nbodyParseOptions(&options, p_Argc, p_Argv, error, 256) &&
+               _applyPositionals(&options, error, 256) &&
+               nbodyParseOptions(&options, p_Argc, p_Argv, error, 256);
+  if (valid && options.m_Backend != NBodyBackendCpu) {
+    snprintf(error, 256, "the headless driver only runs --backend cpu");
+    valid = false;
+  }
+  if (!valid) {
+    fprintf(
+        stderr,
+        "%s\nusage: NBodyHeadless [particles] [steps] [mode] [threads] "
+        "[options]\n%s",
+        error,
+        nbodyOptionsHelp());
+    return 1;
+  }
+
+  // A snapshot is mapped first, it sets the particle count.
+  NBodySnapshot snapshot = {};
+  const bool loading = options.m_LoadPath[0] != '\0';
+  double loadSeconds = 0.0;
+  if (loading) {
+    auto start = std::chrono::steady_clock::now();
+    const char* loadError = nbodySnapshotOpen(&snapshot, options.m_LoadPath);
+    if (loadError != nullptr) {
+      fprintf(stderr, "%s: %s\n", options.m_LoadPath, loadError);
+      return 1;
+    }
+    loadSeconds = _secondsSince(start);
+  }
+  // So is a checkpoint to restart from, it sets the settings of the run too
+  // and the stepping time of the earlier runs carries over.
+  NBodyCheckpointData checkpoint = {};
+  const bool restarting = options.m_Restart;
+  double earlierSeconds = 0.0;
+  uint64_t checkpointCount = 0;
+  if (restarting) {
+    const char* readError =
+        nbodyCheckpointRead(&checkpoint, options.m_CheckpointPath);
+    if (readError != nullptr) {
+      fprintf(stderr, "%s: %s\n", options.m_CheckpointPath, readError);
+      return 1;
+    }
+    earlierSeconds = checkpoint.m_Header.m_State.m_StepSeconds;
+    checkpointCount = checkpoint.m_Header.m_Sequence + 1;
+  }
+
+  const uint32_t particleCount =
+      loading      ? snapshot.m_Header->m_ParticleCount
+      : restarting ? checkpoint.m_Header.m_ParticleCount
+                   : options.m_ParticleCount;
+  const uint32_t stepCount = options.m_StepCount;
+  const float particleSpread = options.m_Spread;
+  const char* mode = options.m_Mode;
+  const bool bench = strcmp(mode, "bench") == 0;
+  const bool scaling = strcmp(mode, "scaling") == 0;
+  const bool symmetric = strcmp(mode, "symmetric") == 0;
+  const bool treeReport = strcmp(mode, "tree") == 0;
+  const bool fmmReport = strcmp(mode, "fmm") == 0;
+  const bool reorderReport = strcmp(mode, "reorder") == 0;
+  const bool integrators = strcmp(mode, "integrators") == 0;
+  const bool blockReport = strcmp(mode, "blocks") == 0;
+  const bool massReport = strcmp(mode, "masses") == 0;
+  const bool dispatchReport = strcmp(mode, "dispatch") == 0;
+  const bool determinismReport = strcmp(mode, "deterministic") == 0;
+  const bool modelReport = strcmp(mode, "models") == 0;
+  const bool trajectoryReport = strcmp(mode, "trajectory") == 0;
+  const bool timelineReport = strcmp(mode, "timeline") == 0;
+  const uint32_t threadCount = options.m_ThreadCount > 0
+                                   ? options.m_ThreadCount
+                                   : nbodyHardwareThreadCount();
+
+  if (modelReport) {
+    _reportModels(particleCount, particleSpread, options.m_Seed, threadCount);
+    return 0;
+  }
+
+  // Same parameters as the GPU demo (see _loadAssets).
+  NBodyParams params = {};
+  params.m_ParticleCount = particleCount;
+  params.m_DeltaTime = 0.1f;
+  params.m_Damping = 1.0f;
+
+  NBodyCpuCtx ctx;
+  nbodyCpuInit(&ctx, params);
+  ctx.m_BlockSize = options.m_TileSize;
+  nbodyCpuSetPrecision(&ctx, options.m_Accumulation, options.m_PosFormat);
+  nbodyCpuSetDeterministic(&ctx, options.m_Deterministic);
+  std::vector<NBodyParticle> particles(particleCount);
+  NBodyThreadPool loadPool;
+  nbodyPoolInit(&loadPool, threadCount, false);
+  if (loading) {
+    auto start = std::chrono::steady_clock::now();
+    nbodyCpuLoadSnapshot(&ctx, &snapshot, &loadPool);
+    loadSeconds += _secondsSince(start);
+    printf(
+        "loaded %s: %u particles at step %llu, %.3f s, %.2f GB/s\n",
+        options.m_LoadPath,
+        particleCount,
+        static_cast<unsigned long long>(ctx.m_StepCount),
+        loadSeconds,
+        snapshot.m_Size / loadSeconds * 1e-9);
+    // The reports restart from these (in the slot order of the snapshot).
+    nbodyCopyColumns(
+        nbodyAosColumns(particles.data()),
+        nbodySnapshotColumns(&snapshot),
+        0,
+        particleCount);
+    nbodySnapshotClose(&snapshot);
+  } else if (restarting) {
+    nbodyCpuRestoreCheckpoint(&ctx, &checkpoint);
+    printf(
+        "restarted from %s%s: %u particles at step %llu, checkpoint %llu\n",
+        options.m_CheckpointPath,
+        checkpoint.m_FromDelta ? ".delta" : "",
+        particleCount,
+        static_cast<unsigned long long>(ctx.m_StepCount),
+        static_cast<unsigned long long>(checkpoint.m_Header.m_Sequence));
+    nbodyCopyColumns(
+        nbodyAosColumns(particles.data()),
+        nbodyStoreColumns(nbodyCpuGetStore(&ctx)),
+        0,
+        particleCount);
+    nbodyCheckpointFree(&checkpoint);
+  } else {
+    // Generated in parallel, the same particles for any pool
+    // (NBodyRandom.hpp).
+    NBodyModelParams model = {};
+    model.m_Model = options.m_Model;
+    model.m_ParticleCount = particleCount;
+    model.m_Scale = particleSpread;
+    model.m_Seed = options.m_Seed;
+    nbodyGenerateModel(&model, 0, particleCount, particles.data(), &loadPool);
+    nbodyCpuLoadParticles(&ctx, particles.data());
+  }
+  nbodyPoolDestroy(&loadPool);
+
+  // A checkpoint restores its solver and deterministic flag. The hashes of the
+  // tree codes would differ across cpus, so refuse rather than print them.
+  const NBodySolver solver = treeReport ? NBodySolverBarnesHut
+                             : fmmReport ? NBodySolverFmm
+                                         : ctx.m_Solver;
+  if (ctx.m_Deterministic && !nbodySolverDeterministic(solver)) {
+    fprintf(
+        stderr,
+        "--deterministic needs the direct or symmetric solver, not %s\n",
+        nbodySolverName(solver));
+    nbodyCpuDestroy(&ctx);
+    return 1;
+  }
+
+  if (dispatchReport) {
+    _reportDispatch(particleCount);
+    return 0;
+  }
+  if (bench) {
+    _benchKernels(nbodyCpuGetStore(&ctx), stepCount);
+    nbodyCpuDestroy(&ctx);
+    return 0;
+  }
+
+  // Every other mode runs on the fastest force variant of this cpu, timed
+  // once and then read back from the cache.
+  NBodyTuneResult tune;
+  if (!nbodyTuneForceKernel(ctx.m_Isa, NBodyDefaultTuneCache, &tune)) {
+    fprintf(stderr, "warning: could not write %s\n", NBodyDefaultTuneCache);
+  }
+  printf(
+      "force kernel: %s %ux%u (%s), %s sums, %s positions%s\n",
+      nbodyIsaName(tune.m_Isa),
+      NBodyForceVariants[tune.m_Variant].m_Targets,
+      NBodyForceVariants[tune.m_Variant].m_Unroll,
+      tune.m_FromCache ? "cached" : "tuned",
+      nbodyAccumulationName(ctx.m_Accumulation),
+      nbodyPosFormatName(ctx.m_PosFormat),
+      ctx.m_Deterministic ? ", deterministic" : "");
+  if (scaling) {
+    _reportScaling(&ctx, particles, stepCount, threadCount);
+    nbodyCpuDestroy(&ctx);
+    return 0;
+  }
+  if (symmetric) {
+    _reportSymmetric(&ctx, particles, stepCount, threadCount);
+    nbodyCpuDestroy(&ctx);
+    return 0;
+  }
+  if (integrators) {
+    _reportIntegrators(&ctx, particles, stepCount, threadCount);
+    nbodyCpuDestroy(&ctx);
+    return 0;
+  }
+  if (blockReport) {
+    _reportBlocks(&ctx, particles, stepCount, threadCount);
+    nbodyCpuDestroy(&ctx);
+    return 0;
+  }
+  if (reorderReport) {
+    _reportReorder(&ctx, particles, stepCount, threadCount);
+    nbodyCpuDestroy(&ctx);
+    return 0;
+  }
+  if (determinismReport) {
+    _reportDeterministic(&ctx, particles, stepCount, threadCount);
+    nbodyCpuDestroy(&ctx);
+    return 0;
+  }
+  if (trajectoryReport) {
+    _reportTrajectory(
+        &ctx, particles, stepCount, threadCount, options.m_ErrorBound);
+    nbodyCpuDestroy(&ctx);
+    return 0;
+  }
+  if (timelineReport) {
+    _reportTimeline(&ctx, particles, stepCount, threadCount);
+    nbodyCpuDestroy(&ctx);
+    return 0;
+  }
+
+  NBodyThreadPool pool;
+  nbodyPoolInit(&pool, threadCount, false);
+  nbodyCpuSetPool(&ctx, &pool);
+
+  if (treeReport || fmmReport || massReport) {
+    if (treeReport) {
+      _reportTree(&ctx);
+    } else if (fmmReport) {
+      _reportFmm(&ctx);
+      NBodyModelParams model = {};
+      model.m_Model = options.m_Model;
+      model.m_Scale = particleSpread;
+      model.m_Seed = options.m_Seed;
+      _reportFmmScaling(&ctx, model, &pool);
+    } else {
+      _reportMasses(&ctx, particles, options.m_Seed);
+    }
+    nbodyPoolDestroy(&pool);
+    nbodyCpuDestroy(&ctx);
+    return 0;
+  }
+
+  // Deterministic runs hash the positions after every step, to be compared
+  // with another run (the hash is O(N), the steps O(N^2)).
+  std::vector<uint64_t> checksums;
+  const uint64_t firstStep = ctx.m_StepCount;
+  // A restarted run only takes the steps it had left.
+  const uint32_t runSteps =
+      !restarting            ? stepCount
+      : stepCount > firstStep ? uint32_t(stepCount - firstStep)
+                              : 0;
+  // Checkpoints are copied between two steps and written by another
+  // thread.
+  NBodyCheckpoint checkpointer = {};
+  if (options.m_CheckpointPath[0] != '\0') {
+    nbodyCheckpointOpen(
+        &checkpointer,
+        options.m_CheckpointPath,
+        particleCount,
+        options.m_Seed,
+        options.m_CheckpointInterval,
+        options.m_CheckpointSeconds,
+        checkpointCount);
+  }
+  // Frames are handed to a writer thread, the steps never wait for the disk.
+  NBodyTrajectory trajectory = {};
+  if (options.m_TrajectoryPath[0] != '\0' &&
+      !nbodyTrajectoryOpen(
+          &trajectory,
+          options.m_TrajectoryPath,
+          particleCount,
+          options.m_TrajectoryInterval,
+          NBodyDefaultTrajectoryBuffers,
+          options.m_Codec,
+          options.m_ErrorBound)) {
+    fprintf(stderr, "could not create %s\n", options.m_TrajectoryPath);
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t step = 0; step < runSteps; ++step) {
+    nbodyCpuStep(&ctx);
+    if (ctx.m_Deterministic)
+      checksums.push_back(nbodyCpuChecksum(&ctx));
+    if (trajectory.m_Impl != nullptr)
+      nbodyTrajectoryCapture(&trajectory, &ctx);
+    if (checkpointer.m_Impl != nullptr)
+      nbodyCheckpointCapture(
+          &checkpointer, &ctx, earlierSeconds + _secondsSince(start), false);
+  }
+  double seconds = _secondsSince(start);
+  if (checkpointer.m_Impl != nullptr)
+    nbodyCheckpointCapture(
+        &checkpointer, &ctx, earlierSeconds + seconds, true);
+
+  double interactions =
+      static_cast<double>(particleCount) * particleCount * runSteps;
+  printf(
+      "particles: %u, steps: %u, kernel: %s, threads: %u, time: %.3f s, "
+      "steps/s: %.2f, GFLOP/s: %.2f\n",
+      particleCount,
+      runSteps,
+      nbodyIsaName(ctx.m_Isa),
+      pool.m_WorkerCount,
+      seconds,
+      runSteps / seconds,
+      interactions * NBodyFlopsPerInteraction / seconds * 1e-9);
+
+  // Looked up by id, the store may have been reordered since the load.
+  NBodyColumns p = nbodyStoreColumns(nbodyCpuGetStore(&ctx));
+  const uint32_t slot = nbodyCpuSlotOf(&ctx, 0);
+  printf(
+      "particle[0]: pos (%f, %f, %f) vel (%f, %f, %f)\n",
+      nbodyColumnAt(p, NBodyAttribPosX, slot),
+      nbodyColumnAt(p, NBodyAttribPosY, slot),
+      nbodyColumnAt(p, NBodyAttribPosZ, slot),
+      nbodyColumnAt(p, NBodyAttribVelX, slot),
+      nbodyColumnAt(p, NBodyAttribVelY, slot),
+      nbodyColumnAt(p, NBodyAttribVelZ, slot));
+  for (uint32_t step = 0; step < checksums.size(); ++step) {
+    printf(
+        "step %llu checksum: %016llx\n",
+        static_cast<unsigned long long>(firstStep + step + 1),
+        static_cast<unsigned long long>(checksums[step]));
+  }
+
+  if (restarting)
+    printf(
+        "resumed at step %llu, %.3f s of steps in all\n",
+        static_cast<unsigned long long>(firstStep),
+        earlierSeconds + seconds);
+
+  bool saved = true;
+  if (checkpointer.m_Impl != nullptr) {
+    NBodyCheckpointStats stats;
+    if (!nbodyCheckpointClose(&checkpointer, &stats)) {
+      fprintf(stderr, "could not write %s\n", options.m_CheckpointPath);
+      saved = false;
+    }
+    _printCheckpointStats(stats);
+  }
+  if (trajectory.m_Impl != nullptr) {
+    NBodyTrajectoryStats stats;
+    if (!nbodyTrajectoryClose(&trajectory, &stats)) {
+      fprintf(stderr, "could not write %s\n", options.m_TrajectoryPath);
+      saved = false;
+    }
+    _printTrajectoryStats(stats);
+  }
+  if (options.m_SavePath[0] != '\0') {
+    saved = nbodyCpuSaveSnapshot(&ctx, options.m_SavePath);
+    if (saved)
+      printf("saved %s\n", options.m_SavePath);
+    else
+      fprintf(stderr, "could not write %s\n", options.m_SavePath);
+  }
+
+  nbodyPoolDestroy(&pool);
+  nbodyCpuDestroy(&ctx);
+  return saved ? 0 : 1;
+}
+//---------------------------------------------------------------------------//
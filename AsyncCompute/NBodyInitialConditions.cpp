@@ -0,0 +1,453 @@
+#include "NBodyInitialConditions.hpp"
+#include "NBodyCpu.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Particles per pool block
+static constexpr uint32_t NBodyModelGrain = 4096;
+// Log spaced radii of the NFW dispersion table, from 1e-4 r_s to c r_s.
+static constexpr uint32_t NBodyNfwTableSize = 512;
+static constexpr double NBodyNfwTableMin = 1e-4;
+// Speeds are redrawn above this fraction of the local escape speed.
+static constexpr float NBodyMaxEscapeFraction = 0.95f;
+static constexpr double NBodyPi = 3.14159265358979323846;
+
+namespace {
+struct ZeldovichMode {
+  float m_K[3];            // Wave vector
+  float m_Displacement[3]; // Amplitude along the unit wave vector
+  float m_Phase;
+};
+
+struct ModelJob {
+  const NBodyModelParams* m_Params;
+  uint32_t m_Begin; // Index of p_Particles[0]
+  NBodyParticle* m_Particles;
+  float m_GM; // G times the total mass
+
+  // NBodyModelNfw: isotropic dispersion squared at the table radii, in
+  // units of G M / r_s.
+  std::vector<float> m_NfwSigma2;
+  // NBodyModelZeldovich
+  uint32_t m_LatticeSide;
+  float m_Hubble;
+  ZeldovichMode m_Modes[NBodyZeldovichModes];
+};
+} // namespace
+
+//---------------------------------------------------------------------------//
+/// Local functions:
+//---------------------------------------------------------------------------//
+static void _isotropic(uint32_t p_Bits0, uint32_t p_Bits1, float* p_Dir) {
+  const float z = nbodyRandomSigned(p_Bits0);
+  const float phi = float(2.0 * NBodyPi) * nbodyRandomUnit(p_Bits1);
+  const float s = sqrtf(std::max(0.0f, 1.0f - z * z));
+  p_Dir[0] = s * cosf(phi);
+  p_Dir[1] = s * sinf(phi);
+  p_Dir[2] = z;
+}
+//---------------------------------------------------------------------------//
+static void _setParticle(
+    NBodyParticle* p_Particle, const float* p_Pos, const float* p_Vel) {
+  p_Particle->m_Position = {p_Pos[0], p_Pos[1], p_Pos[2], NBodyDefaultMass};
+  p_Particle->m_Velocity = {p_Vel[0], p_Vel[1], p_Vel[2], 0.0f};
+}
+//---------------------------------------------------------------------------//
+// Position at radius p_Radius in a random direction (draw 0 of the position
+// stream holds the radius in word 0, the direction in words 1 and 2).
+static void _sphericalPosition(
+    const uint32_t* p_Bits, float p_Radius, float* p_Pos) {
+  float dir[3];
+  _isotropic(p_Bits[1], p_Bits[2], dir);
+  for (int c = 0; c < 3; ++c) {
+    p_Pos[c] = p_Radius * dir[c];
+  }
+}
+//---------------------------------------------------------------------------//
+// Isotropic Gaussian velocity of dispersion sqrt(p_Sigma2) per axis, redrawn
+// above NBodyMaxEscapeFraction of the escape speed sqrt(p_Escape2).
+static void _jeansVelocity(
+    const NBodyModelParams* p_Params,
+    uint32_t p_Index,
+    float p_Sigma2,
+    float p_Escape2,
+    float* p_Vel) {
+  const float sigma = sqrtf(std::max(p_Sigma2, 0.0f));
+  const float maxSpeed2 =
+      NBodyMaxEscapeFraction * NBodyMaxEscapeFraction * p_Escape2;
+  for (uint32_t draw = 0;; ++draw) {
+    uint32_t bits[4];
+    nbodyRandomBits(p_Params->m_Seed, p_Index, NBodyStreamVelocity, draw, bits);
+    float normal[4];
+    nbodyRandomGaussians(bits[0], bits[1], normal);
+    nbodyRandomGaussians(bits[2], bits[3], normal + 2);
+    for (int c = 0; c < 3; ++c) {
+      p_Vel[c] = sigma * normal[c];
+    }
+    if (p_Vel[0] * p_Vel[0] + p_Vel[1] * p_Vel[1] + p_Vel[2] * p_Vel[2] <=
+        maxSpeed2)
+      return;
+  }
+}
+//---------------------------------------------------------------------------//
+// Aarseth, Henon & Wielen (1974): radius from the cumulative mass, speed by
+// rejection from the exact distribution function q^2 (1 - q^2)^3.5.
+static void
+_plummer(const ModelJob* p_Job, uint32_t p_Index, NBodyParticle* p_Out) {
+  const NBodyModelParams* params = p_Job->m_Params;
+  const float a = params->m_Scale;
+  uint32_t bits[4];
+  nbodyRandomBits(params->m_Seed, p_Index, NBodyStreamPosition, 0, bits);
+  const float mass = NBodyModelMassFraction * nbodyRandomOpenUnit(bits[0]);
+  const float r = a / sqrtf(powf(mass, -2.0f / 3.0f) - 1.0f);
+  float pos[3];
+  _sphericalPosition(bits, r, pos);
+
+  float q = 0.0f;
+  for (uint32_t draw = 0;; ++draw) {
+    nbodyRandomBits(params->m_Seed, p_Index, NBodyStreamVelocity, draw, bits);
+    q = nbodyRandomUnit(bits[0]);
+    const float g = 0.1f * nbodyRandomUnit(bits[1]);
+    if (g < q * q * powf(1.0f - q * q, 3.5f))
+      break;
+  }
+  const float escape = sqrtf(2.0f * p_Job->m_GM) * powf(r * r + a * a, -0.25f);
+  float vel[3];
+  _isotropic(bits[2], bits[3], vel);
+  for (int c = 0; c < 3; ++c) {
+    vel[c] *= q * escape;
+  }
+  _setParticle(p_Out, pos, vel);
+}
+//---------------------------------------------------------------------------//
+// Hernquist (1990): inverse of M(r) = M r^2 / (r + a)^2 and a Gaussian with
+// the isotropic Jeans dispersion of his eq. 10.
+static void
+_hernquist(const ModelJob* p_Job, uint32_t p_Index, NBodyParticle* p_Out) {
+  const NBodyModelParams* params = p_Job->m_Params;
+  const double a = params->m_Scale;
+  uint32_t bits[4];
+  nbodyRandomBits(params->m_Seed, p_Index, NBodyStreamPosition, 0, bits);
+  const double s =
+      sqrt(double(NBodyModelMassFraction) * nbodyRandomOpenUnit(bits[0]));
+  const double r = a * s / (1.0 - s);
+  float pos[3];
+  _sphericalPosition(bits, float(r), pos);
+
+  const double x = r / a;
+  const double sigma2 =
+      p_Job->m_GM / (12.0 * a) *
+      (12.0 * x * pow(1.0 + x, 3.0) * log((1.0 + x) / x) -
+       x / (1.0 + x) * (25.0 + 52.0 * x + 42.0 * x * x + 12.0 * x * x * x));
+  float vel[3];
+  _jeansVelocity(
+      params,
+      p_Index,
+      float(sigma2),
+      float(2.0 * p_Job->m_GM / (r + a)),
+      vel);
+  _setParticle(p_Out, pos, vel);
+}
+//---------------------------------------------------------------------------//
+// NFW cumulative mass in units of 4 pi rho_s r_s^3.
+static double _nfwMass(double p_X) { return log1p(p_X) - p_X / (1.0 + p_X); }
+//---------------------------------------------------------------------------//
+// sigma^2 (r) = 1 / rho(r) * int_r^(c r_s) rho G M / r'^2 dr' on the table
+// radii, by the trapezoid rule in log r from the truncation inwards.
+static void _nfwSigmaTable(std::vector<float>* p_Table) {
+  const double c = NBodyNfwConcentration;
+  const double step = log(c / NBodyNfwTableMin) / (NBodyNfwTableSize - 1);
+  // rho G M / r^2 dr = integrand dlnr, units of G M / r_s, rho without rho_s
+  auto integrand = [c](double p_X) {
+    const double rho = 1.0 / (p_X * (1.0 + p_X) * (1.0 + p_X));
+    return rho * _nfwMass(p_X) / _nfwMass(c) / p_X;
+  };
+
+  p_Table->resize(NBodyNfwTableSize);
+  double integral = 0.0;
+  (*p_Table)[NBodyNfwTableSize - 1] = 0.0f;
+  for (uint32_t t = NBodyNfwTableSize - 1; t > 0; --t) {
+    const double x1 = NBodyNfwTableMin * exp(step * t);
+    const double x0 = NBodyNfwTableMin * exp(step * (t - 1));
+    integral += 0.5 * step * (integrand(x0) + integrand(x1));
+    (*p_Table)[t - 1] = float(integral * x0 * (1.0 + x0) * (1.0 + x0));
+  }
+}
+//---------------------------------------------------------------------------//
+static void
+_nfw(const ModelJob* p_Job, uint32_t p_Index, NBodyParticle* p_Out) {
+  const NBodyModelParams* params = p_Job->m_Params;
+  const double c = NBodyNfwConcentration;
+  uint32_t bits[4];
+  nbodyRandomBits(params->m_Seed, p_Index, NBodyStreamPosition, 0, bits);
+
+  // M(x) is increasing, bisection converges to float precision in 40 steps.
+  const double target = nbodyRandomOpenUnit(bits[0]) * _nfwMass(c);
+  double low = 0.0;
+  double high = c;
+  for (int i = 0; i < 40; ++i) {
+    const double mid = 0.5 * (low + high);
+    if (_nfwMass(mid) < target)
+      low = mid;
+    else
+      high = mid;
+  }
+  const double x = 0.5 * (low + high);
+  float pos[3];
+  _sphericalPosition(bits, float(x * params->m_Scale), pos);
+
+  const double step = log(c / NBodyNfwTableMin) / (NBodyNfwTableSize - 1);
+  const double t = std::max(0.0, log(x / NBodyNfwTableMin) / step);
+  const uint32_t t0 = std::min(uint32_t(t), NBodyNfwTableSize - 2);
+  const double w = std::min(t - t0, 1.0);
+  const double sigma2 = (1.0 - w) * p_Job->m_NfwSigma2[t0] +
+                        w * p_Job->m_NfwSigma2[t0 + 1];
+  // Potential of the truncated halo, -G M / r outside.
+  const double potential = (log1p(x) / x - 1.0 / (1.0 + c)) / _nfwMass(c);
+  const double units = p_Job->m_GM / params->m_Scale;
+  float vel[3];
+  _jeansVelocity(
+      params,
+      p_Index,
+      float(sigma2 * units),
+      float(2.0 * potential * units),
+      vel);
+  _setParticle(p_Out, pos, vel);
+}
+//---------------------------------------------------------------------------//
+// Surface density exp(-R / R_d) with a sech^2(z / h) profile, rotating on the
+// curve of the razor thin disk (Freeman 1970) with the vertical dispersion of
+// an isothermal sheet, the same in the plane.
+static void
+_disk(const ModelJob* p_Job, uint32_t p_Index, NBodyParticle* p_Out) {
+  const NBodyModelParams* params = p_Job->m_Params;
+  const double scale = params->m_Scale;
+  const double height = NBodyDiskHeight * scale;
+  uint32_t bits[4];
+  nbodyRandomBits(params->m_Seed, p_Index, NBodyStreamPosition, 0, bits);
+
+  // Cumulative mass 1 - (1 + x) exp(-x) of x = R / R_d, by bisection.
+  const double target =
+      NBodyModelMassFraction * double(nbodyRandomOpenUnit(bits[0]));
+  double low = 0.0;
+  double high = 2.0 * -log(1.0 - NBodyModelMassFraction) + 2.0;
+  for (int i = 0; i < 40; ++i) {
+    const double mid = 0.5 * (low + high);
+    if (1.0 - (1.0 + mid) * exp(-mid) < target)
+      low = mid;
+    else
+      high = mid;
+  }
+  const double x = 0.5 * (low + high);
+  const double phi = 2.0 * NBodyPi * nbodyRandomUnit(bits[1]);
+  const double z = height * atanh(2.0 * nbodyRandomOpenUnit(bits[2]) - 1.0);
+  const float pos[3] = {
+      float(x * scale * cos(phi)), float(x * scale * sin(phi)), float(z)};
+
+  const double y = 0.5 * x;
+  const double bessel =
+      std::cyl_bessel_i(0.0, y) * std::cyl_bessel_k(0.0, y) -
+      std::cyl_bessel_i(1.0, y) * std::cyl_bessel_k(1.0, y);
+  const double vc2 = 2.0 * p_Job->m_GM / scale * y * y * bessel;
+  const double vc = sqrt(std::max(vc2, 0.0));
+  const double sigma0 = p_Job->m_GM / (2.0 * NBodyPi * scale * scale);
+  const double sigma2 = NBodyPi * sigma0 * exp(-x) * height;
+  float vel[3];
+  _jeansVelocity(params, p_Index, float(sigma2), INFINITY, vel);
+  vel[0] += float(-vc * sin(phi));
+  vel[1] += float(vc * cos(phi));
+  _setParticle(p_Out, pos, vel);
+}
+//---------------------------------------------------------------------------//
+// Lattice site q of the particle, moved by the displacement field Psi(q) (a
+// gradient, sum of the modes' plane waves) and moving with the Hubble flow
+// plus the growing mode: x = q + Psi, v = H x + H Psi.
+static void
+_zeldovich(const ModelJob* p_Job, uint32_t p_Index, NBodyParticle* p_Out) {
+  const uint32_t side = p_Job->m_LatticeSide;
+  const float spacing = 2.0f * p_Job->m_Params->m_Scale / side;
+  const uint32_t site[3] = {
+      p_Index % side, p_Index / side % side, p_Index / side / side};
+  float q[3];
+  for (int c = 0; c < 3; ++c) {
+    q[c] = (float(site[c]) + 0.5f) * spacing - p_Job->m_Params->m_Scale;
+  }
+
+  float psi[3] = {0.0f, 0.0f, 0.0f};
+  for (const ZeldovichMode& mode : p_Job->m_Modes) {
+    const float wave = cosf(
+        mode.m_K[0] * q[0] + mode.m_K[1] * q[1] + mode.m_K[2] * q[2] +
+        mode.m_Phase);
+    for (int c = 0; c < 3; ++c) {
+      psi[c] += mode.m_Displacement[c] * wave;
+    }
+  }
+
+  float pos[3];
+  float vel[3];
+  for (int c = 0; c < 3; ++c) {
+    pos[c] = q[c] + psi[c];
+    vel[c] = p_Job->m_Hubble * (pos[c] + psi[c]);
+  }
+  _setParticle(p_Out, pos, vel);
+}
+//---------------------------------------------------------------------------//
+// Random modes with integer wave numbers up to 4 per axis of the box, scaled
+// to an rms displacement of NBodyZeldovichAmplitude spacings. Draw 0 of mode
+// m holds its amplitude and phase, the next ones its wave vector.
+static void _zeldovichModes(ModelJob* p_Job) {
+  const NBodyModelParams* params = p_Job->m_Params;
+  const float fundamental = float(NBodyPi) / params->m_Scale;
+  double variance = 0.0;
+  for (uint32_t m = 0; m < NBodyZeldovichModes; ++m) {
+    ZeldovichMode* mode = &p_Job->m_Modes[m];
+    uint32_t bits[4];
+    nbodyRandomBits(params->m_Seed, m, NBodyStreamModel, 0, bits);
+    float normal[2];
+    nbodyRandomGaussians(bits[0], bits[1], normal);
+    mode->m_Phase = float(2.0 * NBodyPi) * nbodyRandomUnit(bits[2]);
+
+    int32_t n[3] = {0, 0, 0};
+    for (uint32_t draw = 1; n[0] == 0 && n[1] == 0 && n[2] == 0; ++draw) {
+      nbodyRandomBits(params->m_Seed, m, NBodyStreamModel, draw, bits);
+      for (int c = 0; c < 3; ++c) {
+        n[c] = int32_t(bits[c] % 9) - 4;
+      }
+    }
+    const float length =
+        sqrtf(float(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]));
+    const float amplitude = normal[0] / (length * length);
+    for (int c = 0; c < 3; ++c) {
+      mode->m_K[c] = fundamental * n[c];
+      mode->m_Displacement[c] = amplitude * n[c] / length;
+    }
+    // A cosine averages 1/2 of its square.
+    variance += 0.5 * double(amplitude) * amplitude;
+  }
+
+  const double spacing = 2.0 * params->m_Scale / p_Job->m_LatticeSide;
+  const float norm =
+      float(NBodyZeldovichAmplitude * spacing / sqrt(variance));
+  for (ZeldovichMode& mode : p_Job->m_Modes) {
+    for (float& d : mode.m_Displacement) {
+      d *= norm;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Particles [p_Begin, p_End) of the job's range (NBodyRangeFunc).
+static void
+_modelBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  const ModelJob* job = static_cast<const ModelJob*>(p_User);
+  void (*particle)(const ModelJob*, uint32_t, NBodyParticle*) = nullptr;
+  switch (job->m_Params->m_Model) {
+  case NBodyModelPlummer:
+    particle = _plummer;
+    break;
+  case NBodyModelHernquist:
+    particle = _hernquist;
+    break;
+  case NBodyModelNfw:
+    particle = _nfw;
+    break;
+  case NBodyModelDisk:
+    particle = _disk;
+    break;
+  default:
+    particle = _zeldovich;
+    break;
+  }
+  for (uint32_t i = p_Begin; i < p_End; ++i) {
+    particle(job, job->m_Begin + i, &job->m_Particles[i]);
+  }
+}
+//---------------------------------------------------------------------------//
+// Core functions:
+//---------------------------------------------------------------------------//
+const char* nbodyModelName(NBodyModel p_Model) {
+  static const char* s_Names[NBodyModelCount] = {
+      "clusters",
+      "plummer",
+      "hernquist",
+      "nfw",
+      "disk",
+      "collapse",
+      "zeldovich"};
+  NBODY_ASSERT(p_Model < NBodyModelCount);
+  return s_Names[p_Model];
+}
+//---------------------------------------------------------------------------//
+void nbodyGenerateModel(
+    const NBodyModelParams* p_Params,
+    uint32_t p_Begin,
+    uint32_t p_End,
+    NBodyParticle* p_Particles,
+    NBodyThreadPool* p_Pool) {
+  NBODY_ASSERT(p_Begin <= p_End && p_End <= p_Params->m_ParticleCount);
+  const uint32_t count = p_Params->m_ParticleCount;
+  const float scale = p_Params->m_Scale;
+
+  if (p_Params->m_Model == NBodyModelClusters) {
+    // Same split as nbodyLoadTwoClusters, an odd last particle stays empty.
+    const uint32_t half = count / 2;
+    const float centers[2][3] = {{0.5f * scale, 0, 0}, {-0.5f * scale, 0, 0}};
+    const NBodyFloat4 velocities[2] = {
+        {0, 0, -20, 1 / 100000000.0f}, {0, 0, 20, 1 / 100000000.0f}};
+    for (uint32_t cluster = 0; cluster < 2; ++cluster) {
+      const uint32_t begin = std::max(p_Begin, cluster * half);
+      const uint32_t end = std::min(p_End, (cluster + 1) * half);
+      if (begin < end)
+        nbodyLoadParticles(
+            p_Particles + (begin - p_Begin),
+            centers[cluster],
+            velocities[cluster],
+            scale,
+            end - begin,
+            p_Params->m_Seed,
+            begin,
+            p_Pool);
+    }
+    if (count % 2 == 1 && p_Begin < p_End && p_End == count)
+      p_Particles[count - 1 - p_Begin] = NBodyParticle{};
+    return;
+  }
+  if (p_Params->m_Model == NBodyModelCollapse) {
+    const float center[3] = {0.0f, 0.0f, 0.0f};
+    nbodyLoadParticles(
+        p_Particles,
+        center,
+        {0.0f, 0.0f, 0.0f, 0.0f},
+        scale,
+        p_End - p_Begin,
+        p_Params->m_Seed,
+        p_Begin,
+        p_Pool);
+    return;
+  }
+
+  ModelJob job;
+  job.m_Params = p_Params;
+  job.m_Begin = p_Begin;
+  job.m_Particles = p_Particles;
+  job.m_GM = NBodyG * NBodyDefaultMass * float(count);
+  if (p_Params->m_Model == NBodyModelNfw)
+    _nfwSigmaTable(&job.m_NfwSigma2);
+  if (p_Params->m_Model == NBodyModelZeldovich) {
+    // Smallest cube holding every particle, the top layer may be partial.
+    job.m_LatticeSide = 1;
+    while (uint64_t(job.m_LatticeSide) * job.m_LatticeSide *
+               job.m_LatticeSide <
+           count) {
+      job.m_LatticeSide++;
+    }
+    // H^2 = 8 pi G rho / 3, the density of the full cube.
+    const double side = 2.0 * scale;
+    job.m_Hubble =
+        float(sqrt(8.0 * NBodyPi * job.m_GM / (3.0 * side * side * side)));
+    _zeldovichModes(&job);
+  }
+  nbodyPoolParallelFor(
+      p_Pool, p_End - p_Begin, NBodyModelGrain, _modelBlock, &job);
+}
+//---------------------------------------------------------------------------//
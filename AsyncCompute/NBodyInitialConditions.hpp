@@ -0,0 +1,66 @@
+#pragma once
+
+/******************************************************************************
+ * \astrophysical initial conditions for the CPU engine and the demo
+ * \equilibrium spheres (Plummer, Hernquist, NFW), an exponential disk on its
+ * \rotation curve, a cold collapse and a lattice with Zel'dovich
+ * \displacements. Every particle depends on the model, the particle count,
+ * \the seed and its own index only (NBodyRandom.hpp), so blocks run on the
+ * \pool and any range is generated on its own (streaming to a file or to a
+ * \GPU upload buffer chunk by chunk).
+ ******************************************************************************/
+
+#include "NBodyCommon.hpp"
+#include "NBodyRandom.hpp"
+#include "NBodyThreadPool.hpp"
+
+//---------------------------------------------------------------------------//
+// Models, m_Scale is the length given in the comment:
+//---------------------------------------------------------------------------//
+enum NBodyModel : uint32_t {
+  NBodyModelClusters = 0, // The demo's two opposing spheres, their radius
+  NBodyModelPlummer,      // Plummer sphere, scale radius a
+  NBodyModelHernquist,    // Hernquist halo, scale radius a
+  NBodyModelNfw,          // NFW halo, scale radius r_s
+  NBodyModelDisk,         // Exponential disk in the xy plane, scale length
+  NBodyModelCollapse,     // Cold uniform sphere at rest, its radius
+  NBodyModelZeldovich,    // Expanding lattice, half side of the cube
+  NBodyModelCount
+};
+
+// Mass fraction the spheres are truncated at (the Plummer and Hernquist tails
+// would otherwise put a few particles thousands of scale radii away).
+static constexpr float NBodyModelMassFraction = 0.99f;
+// NBodyModelNfw is truncated at its virial radius c r_s.
+static constexpr float NBodyNfwConcentration = 10.0f;
+// sech^2 scale height of NBodyModelDisk, in scale lengths.
+static constexpr float NBodyDiskHeight = 0.1f;
+// NBodyModelZeldovich: plane waves of the displacement field (amplitudes ~
+// 1 / k^2, the box scale dominates) and their total rms in lattice spacings.
+static constexpr uint32_t NBodyZeldovichModes = 64;
+static constexpr float NBodyZeldovichAmplitude = 0.25f;
+
+//---------------------------------------------------------------------------//
+struct NBodyModelParams {
+  NBodyModel m_Model;
+  uint32_t m_ParticleCount; // Of the whole realization
+  float m_Scale;
+  uint32_t m_Seed;
+};
+
+//---------------------------------------------------------------------------//
+const char* nbodyModelName(NBodyModel p_Model);
+//---------------------------------------------------------------------------//
+// Particles [p_Begin, p_End) of the realization into p_Particles[0, p_End -
+// p_Begin), on p_Pool (nullptr = calling thread). Every particle weighs
+// NBodyDefaultMass and the velocities are in equilibrium with the total mass
+// (the disk rotates on the rotation curve of its own mass, the lattice
+// expands at the critical Hubble rate of its density plus the growing mode).
+// NBodyModelClusters gives the particles of nbodyLoadTwoClusters.
+void nbodyGenerateModel(
+    const NBodyModelParams* p_Params,
+    uint32_t p_Begin,
+    uint32_t p_End,
+    NBodyParticle* p_Particles,
+    NBodyThreadPool* p_Pool);
+//---------------------------------------------------------------------------//
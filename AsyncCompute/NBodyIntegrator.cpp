@@ -0,0 +1,533 @@
+#include "NBodyIntegrator.hpp"
+#include "NBodyCpu.hpp"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+// Runge-Kutta stage weights and the offset of the next stage (fraction of
+// the step).
+static const float s_Rk4Weights[4] = {1.0f, 2.0f, 2.0f, 1.0f};
+static const float s_Rk4Offsets[3] = {0.5f, 0.5f, 1.0f};
+
+namespace {
+// Arrays touched by the integration blocks, indexed by axis.
+struct State {
+  float* m_Pos[3];
+  float* m_Vel[3];
+  float* m_Accel[3];
+  float* m_Jerk[3];
+  float* m_AccelMag;
+};
+
+struct IntegrateJob {
+  NBodyCpuCtx* m_Ctx;
+  uint32_t m_Stage;
+};
+
+// Block steps: the substep being reached, in ticks.
+struct BlockJob {
+  NBodyCpuCtx* m_Ctx;
+  uint32_t m_Tick;
+};
+} // namespace
+
+//---------------------------------------------------------------------------//
+/// Local functions:
+//---------------------------------------------------------------------------//
+static State _state(NBodyCpuCtx* p_Ctx) {
+  NBodyParticleStore* store = &p_Ctx->m_Store;
+  State state;
+  for (uint32_t c = 0; c < 3; ++c) {
+    state.m_Pos[c] =
+        nbodyStoreAttrib(store, NBodyAttribute(NBodyAttribPosX + c));
+    state.m_Vel[c] =
+        nbodyStoreAttrib(store, NBodyAttribute(NBodyAttribVelX + c));
+  }
+  state.m_Accel[0] = p_Ctx->m_AccelX;
+  state.m_Accel[1] = p_Ctx->m_AccelY;
+  state.m_Accel[2] = p_Ctx->m_AccelZ;
+  state.m_Jerk[0] = p_Ctx->m_JerkX;
+  state.m_Jerk[1] = p_Ctx->m_JerkY;
+  state.m_Jerk[2] = p_Ctx->m_JerkZ;
+  state.m_AccelMag = nbodyStoreAttrib(store, NBodyAttribAccelMag);
+  return state;
+}
+//---------------------------------------------------------------------------//
+static float _accelMag(const State& p_State, uint32_t p_Index) {
+  const float ax = p_State.m_Accel[0][p_Index];
+  const float ay = p_State.m_Accel[1][p_Index];
+  const float az = p_State.m_Accel[2][p_Index];
+  return sqrtf(ax * ax + ay * ay + az * az);
+}
+//---------------------------------------------------------------------------//
+static void _reserveTemp(NBodyCpuCtx* p_Ctx) {
+  if (p_Ctx->m_TempMemory != nullptr)
+    return;
+
+  const size_t paddedCount = p_Ctx->m_Store.m_PaddedCount;
+  const size_t size = NBodyIntegratorTempCount * paddedCount * sizeof(float);
+  p_Ctx->m_TempMemory = nbodyAlignedAlloc(size, NBodyAlignment);
+  NBODY_ASSERT(p_Ctx->m_TempMemory != nullptr);
+  memset(p_Ctx->m_TempMemory, 0, size);
+  for (uint32_t t = 0; t < NBodyIntegratorTempCount; ++t) {
+    p_Ctx->m_Temp[t] = static_cast<float*>(p_Ctx->m_TempMemory) +
+                       t * paddedCount;
+  }
+}
+//---------------------------------------------------------------------------//
+static void _reserveBlocks(NBodyCpuCtx* p_Ctx) {
+  NBodyBlockSteps* blocks = &p_Ctx->m_Blocks;
+  if (blocks->m_Memory != nullptr)
+    return;
+
+  // 3 index arrays then the compact float arrays, all padded like the store
+  const size_t paddedCount = p_Ctx->m_Store.m_PaddedCount;
+  const size_t size = (3 + 12) * paddedCount * sizeof(float);
+  blocks->m_Memory = nbodyAlignedAlloc(size, NBodyAlignment);
+  NBODY_ASSERT(blocks->m_Memory != nullptr);
+  memset(blocks->m_Memory, 0, size);
+  uint32_t* indices = static_cast<uint32_t*>(blocks->m_Memory);
+  blocks->m_Levels = indices;
+  blocks->m_Ticks = indices + paddedCount;
+  blocks->m_Active = indices + 2 * paddedCount;
+  float* compact = reinterpret_cast<float*>(indices + 3 * paddedCount);
+  for (uint32_t a = 0; a < 12; ++a) {
+    blocks->m_Compact[a] = compact + a * paddedCount;
+  }
+}
+//---------------------------------------------------------------------------//
+// Level of the particle p_Index from its current acceleration and jerk:
+// smallest k with m_DeltaTime / 2^k <= eta |a| / |jerk|.
+static uint32_t _blockLevel(
+    const NBodyCpuCtx* p_Ctx, const State& p_State, uint32_t p_Index) {
+  float jerk2 = 0.0f;
+  for (uint32_t c = 0; c < 3; ++c) {
+    jerk2 += p_State.m_Jerk[c][p_Index] * p_State.m_Jerk[c][p_Index];
+  }
+  const float limit = p_Ctx->m_Blocks.m_Eta * _accelMag(p_State, p_Index);
+  float step = p_Ctx->m_Params.m_DeltaTime;
+  uint32_t level = 0;
+  while (level < NBodyMaxBlockLevel && step * step * jerk2 > limit * limit) {
+    step *= 0.5f;
+    ++level;
+  }
+  return level;
+}
+//---------------------------------------------------------------------------//
+static uint32_t _blockTicks(uint32_t p_Level) {
+  return 1u << (NBodyMaxBlockLevel - p_Level);
+}
+//---------------------------------------------------------------------------//
+static void
+_parallel(NBodyCpuCtx* p_Ctx, NBodyRangeFunc p_Func, uint32_t p_Stage) {
+  IntegrateJob job = {p_Ctx, p_Stage};
+  nbodyPoolParallelFor(
+      p_Ctx->m_Pool, p_Ctx->m_Store.m_Count, p_Ctx->m_BlockSize, p_Func, &job);
+}
+//---------------------------------------------------------------------------//
+// Integration blocks over the particles [p_Begin, p_End) (NBodyRangeFunc):
+//---------------------------------------------------------------------------//
+// Same as the tail of CSMain.
+static void
+_eulerBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  NBodyCpuCtx* ctx = static_cast<IntegrateJob*>(p_User)->m_Ctx;
+  const NBodyParams& params = ctx->m_Params;
+  const State state = _state(ctx);
+
+  for (uint32_t i = p_Begin; i < p_End; ++i) {
+    for (uint32_t c = 0; c < 3; ++c) {
+      state.m_Vel[c][i] += state.m_Accel[c][i] * params.m_DeltaTime;
+      state.m_Vel[c][i] *= params.m_Damping;
+      state.m_Pos[c][i] += state.m_Vel[c][i] * params.m_DeltaTime;
+    }
+    state.m_AccelMag[i] = _accelMag(state, i);
+  }
+}
+//---------------------------------------------------------------------------//
+// Stage 0: half kick and drift, stage 1: half kick with the new forces.
+static void
+_leapfrogBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  const IntegrateJob* job = static_cast<IntegrateJob*>(p_User);
+  const NBodyParams& params = job->m_Ctx->m_Params;
+  const State state = _state(job->m_Ctx);
+  const float halfDt = 0.5f * params.m_DeltaTime;
+
+  for (uint32_t i = p_Begin; i < p_End; ++i) {
+    for (uint32_t c = 0; c < 3; ++c) {
+      state.m_Vel[c][i] += state.m_Accel[c][i] * halfDt;
+      if (job->m_Stage == 0)
+        state.m_Pos[c][i] += state.m_Vel[c][i] * params.m_DeltaTime;
+      else
+        state.m_Vel[c][i] *= params.m_Damping;
+    }
+    if (job->m_Stage == 1)
+      state.m_AccelMag[i] = _accelMag(state, i);
+  }
+}
+//---------------------------------------------------------------------------//
+// Stage 0: keeps the old forces (m_Temp[0..2]) and moves the positions,
+// stage 1: velocities from the mean of the old and new forces.
+static void
+_verletBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  const IntegrateJob* job = static_cast<IntegrateJob*>(p_User);
+  const NBodyParams& params = job->m_Ctx->m_Params;
+  const State state = _state(job->m_Ctx);
+  float* const* oldAccel = job->m_Ctx->m_Temp;
+  const float dt = params.m_DeltaTime;
+
+  for (uint32_t i = p_Begin; i < p_End; ++i) {
+    for (uint32_t c = 0; c < 3; ++c) {
+      const float accel = state.m_Accel[c][i];
+      if (job->m_Stage == 0) {
+        oldAccel[c][i] = accel;
+        state.m_Pos[c][i] += (state.m_Vel[c][i] + 0.5f * accel * dt) * dt;
+      } else {
+        state.m_Vel[c][i] += 0.5f * (oldAccel[c][i] + accel) * dt;
+        state.m_Vel[c][i] *= params.m_Damping;
+      }
+    }
+    if (job->m_Stage == 1)
+      state.m_AccelMag[i] = _accelMag(state, i);
+  }
+}
+//---------------------------------------------------------------------------//
+// m_Temp: start positions [0..2] and velocities [3..5], weighted sums of the
+// stage velocities [6..8] and accelerations [9..11]. The store holds the
+// trial state of the current stage, whose forces have just been computed.
+static void
+_rk4Block(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  const IntegrateJob* job = static_cast<IntegrateJob*>(p_User);
+  const NBodyParams& params = job->m_Ctx->m_Params;
+  const State state = _state(job->m_Ctx);
+  float* const* temp = job->m_Ctx->m_Temp;
+  const uint32_t stage = job->m_Stage;
+  const float weight = s_Rk4Weights[stage];
+
+  for (uint32_t i = p_Begin; i < p_End; ++i) {
+    if (stage == 0)
+      state.m_AccelMag[i] = _accelMag(state, i);
+
+    for (uint32_t c = 0; c < 3; ++c) {
+      float* pos0 = temp[c];
+      float* vel0 = temp[3 + c];
+      float* sumVel = temp[6 + c];
+      float* sumAccel = temp[9 + c];
+      const float vel = state.m_Vel[c][i];
+      const float accel = state.m_Accel[c][i];
+      if (stage == 0) {
+        pos0[i] = state.m_Pos[c][i];
+        vel0[i] = vel;
+        sumVel[i] = 0.0f;
+        sumAccel[i] = 0.0f;
+      }
+      sumVel[i] += weight * vel;
+      sumAccel[i] += weight * accel;
+
+      if (stage < 3) {
+        const float h = s_Rk4Offsets[stage] * params.m_DeltaTime;
+        state.m_Pos[c][i] = pos0[i] + h * vel;
+        state.m_Vel[c][i] = vel0[i] + h * accel;
+      } else {
+        const float h = params.m_DeltaTime / 6.0f;
+        state.m_Pos[c][i] = pos0[i] + h * sumVel[i];
+        state.m_Vel[c][i] = (vel0[i] + h * sumAccel[i]) * params.m_Damping;
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// m_Temp: start positions [0..2], velocities [3..5], accelerations [6..8]
+// and jerks [9..11]. Stage 0 predicts positions and velocities from the
+// Taylor series, stage 1 corrects them with the forces at the prediction.
+static void
+_hermiteBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  const IntegrateJob* job = static_cast<IntegrateJob*>(p_User);
+  const NBodyParams& params = job->m_Ctx->m_Params;
+  const State state = _state(job->m_Ctx);
+  float* const* temp = job->m_Ctx->m_Temp;
+  const float dt = params.m_DeltaTime;
+  const float dt2 = dt * dt;
+
+  for (uint32_t i = p_Begin; i < p_End; ++i) {
+    for (uint32_t c = 0; c < 3; ++c) {
+      float* pos0 = temp[c];
+      float* vel0 = temp[3 + c];
+      float* accel0 = temp[6 + c];
+      float* jerk0 = temp[9 + c];
+      const float accel = state.m_Accel[c][i];
+      const float jerk = state.m_Jerk[c][i];
+
+      if (job->m_Stage == 0) {
+        pos0[i] = state.m_Pos[c][i];
+        vel0[i] = state.m_Vel[c][i];
+        accel0[i] = accel;
+        jerk0[i] = jerk;
+        state.m_Pos[c][i] +=
+            (vel0[i] + (0.5f * accel + jerk * dt / 6.0f) * dt) * dt;
+        state.m_Vel[c][i] += (accel + 0.5f * jerk * dt) * dt;
+      } else {
+        const float vel = vel0[i] + 0.5f * (accel0[i] + accel) * dt +
+                          (jerk0[i] - jerk) * dt2 / 12.0f;
+        state.m_Pos[c][i] = pos0[i] + 0.5f * (vel0[i] + vel) * dt +
+                            (accel0[i] - accel) * dt2 / 12.0f;
+        state.m_Vel[c][i] = vel * params.m_Damping;
+      }
+    }
+    if (job->m_Stage == 1)
+      state.m_AccelMag[i] = _accelMag(state, i);
+  }
+}
+//---------------------------------------------------------------------------//
+// Block steps, m_Temp: positions [0..2] and velocities [3..5] at the last
+// correction of every particle, whose acceleration and jerk stay in the
+// force arrays until the next one.
+//---------------------------------------------------------------------------//
+static void
+_blockStartBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  NBodyCpuCtx* ctx = static_cast<BlockJob*>(p_User)->m_Ctx;
+  const State state = _state(ctx);
+  float* const* temp = ctx->m_Temp;
+
+  for (uint32_t i = p_Begin; i < p_End; ++i) {
+    for (uint32_t c = 0; c < 3; ++c) {
+      temp[c][i] = state.m_Pos[c][i];
+      temp[3 + c][i] = state.m_Vel[c][i];
+    }
+    ctx->m_Blocks.m_Levels[i] = _blockLevel(ctx, state, i);
+    ctx->m_Blocks.m_Ticks[i] = 0;
+  }
+}
+//---------------------------------------------------------------------------//
+// Predicts every particle to m_Tick from its last correction, the sources
+// of the active particles need their current positions and velocities.
+static void
+_blockPredictBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  const BlockJob* job = static_cast<BlockJob*>(p_User);
+  NBodyCpuCtx* ctx = job->m_Ctx;
+  const State state = _state(ctx);
+  float* const* temp = ctx->m_Temp;
+  const float tickTime = ctx->m_Params.m_DeltaTime / float(_blockTicks(0));
+
+  for (uint32_t i = p_Begin; i < p_End; ++i) {
+    const float h = float(job->m_Tick - ctx->m_Blocks.m_Ticks[i]) * tickTime;
+    for (uint32_t c = 0; c < 3; ++c) {
+      const float accel = state.m_Accel[c][i];
+      const float jerk = state.m_Jerk[c][i];
+      state.m_Pos[c][i] =
+          temp[c][i] +
+          (temp[3 + c][i] + (0.5f * accel + jerk * h / 6.0f) * h) * h;
+      state.m_Vel[c][i] = temp[3 + c][i] + (accel + 0.5f * jerk * h) * h;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Accelerations and jerks of the active particles [p_Begin, p_End) into
+// m_Compact[6..11], from all the predicted particles.
+static void
+_blockForceBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  NBodyCpuCtx* ctx = static_cast<BlockJob*>(p_User)->m_Ctx;
+  const NBodyBlockSteps& blocks = ctx->m_Blocks;
+  const State state = _state(ctx);
+
+  NBodyJerkArgs args = {};
+  for (uint32_t c = 0; c < 3; ++c) {
+    for (uint32_t k = p_Begin; k < p_End; ++k) {
+      const uint32_t i = blocks.m_Active[k];
+      blocks.m_Compact[c][k] = state.m_Pos[c][i];
+      blocks.m_Compact[3 + c][k] = state.m_Vel[c][i];
+    }
+    args.m_SrcPos[c] = state.m_Pos[c];
+    args.m_SrcVel[c] = state.m_Vel[c];
+    args.m_DstPos[c] = blocks.m_Compact[c];
+    args.m_DstVel[c] = blocks.m_Compact[3 + c];
+    args.m_Accel[c] = blocks.m_Compact[6 + c];
+    args.m_Jerk[c] = blocks.m_Compact[9 + c];
+  }
+  args.m_SrcMass = nbodyStoreAttrib(&ctx->m_Store, NBodyAttribMass);
+  args.m_SrcCount = ctx->m_Store.m_PaddedCount;
+  args.m_DstBegin = p_Begin;
+  args.m_DstEnd = p_End;
+  args.m_G = NBodyG;
+  if (ctx->m_Deterministic)
+    nbodyGetDeterministicJerkKernel()(&args);
+  else
+    nbodyGetJerkKernel(ctx->m_Isa)(&args);
+}
+//---------------------------------------------------------------------------//
+// Hermite correction of the active particles [p_Begin, p_End) over their own
+// step, then their next level: finer at any tick, one level coarser only
+// where the coarser step stays aligned on the block boundaries.
+static void
+_blockCorrectBlock(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  const BlockJob* job = static_cast<BlockJob*>(p_User);
+  NBodyCpuCtx* ctx = job->m_Ctx;
+  const NBodyParams& params = ctx->m_Params;
+  NBodyBlockSteps& blocks = ctx->m_Blocks;
+  const State state = _state(ctx);
+  float* const* temp = ctx->m_Temp;
+  const float tickTime = params.m_DeltaTime / float(_blockTicks(0));
+
+  for (uint32_t k = p_Begin; k < p_End; ++k) {
+    const uint32_t i = blocks.m_Active[k];
+    const float h = float(job->m_Tick - blocks.m_Ticks[i]) * tickTime;
+    const float h2 = h * h;
+    const float damping = params.m_Damping == 1.0f
+                              ? 1.0f
+                              : powf(params.m_Damping, h / params.m_DeltaTime);
+    for (uint32_t c = 0; c < 3; ++c) {
+      const float accel0 = state.m_Accel[c][i];
+      const float jerk0 = state.m_Jerk[c][i];
+      const float accel = blocks.m_Compact[6 + c][k];
+      const float jerk = blocks.m_Compact[9 + c][k];
+      const float vel0 = temp[3 + c][i];
+      const float vel = vel0 + 0.5f * (accel0 + accel) * h +
+                        (jerk0 - jerk) * h2 / 12.0f;
+      state.m_Pos[c][i] = temp[c][i] + 0.5f * (vel0 + vel) * h +
+                          (accel0 - accel) * h2 / 12.0f;
+      state.m_Vel[c][i] = vel * damping;
+      temp[c][i] = state.m_Pos[c][i];
+      temp[3 + c][i] = state.m_Vel[c][i];
+      state.m_Accel[c][i] = accel;
+      state.m_Jerk[c][i] = jerk;
+    }
+    state.m_AccelMag[i] = _accelMag(state, i);
+
+    const uint32_t level = blocks.m_Levels[i];
+    const uint32_t wanted = _blockLevel(ctx, state, i);
+    if (wanted > level)
+      blocks.m_Levels[i] = wanted;
+    else if (
+        wanted < level && level > 0 &&
+        job->m_Tick % _blockTicks(level - 1) == 0)
+      blocks.m_Levels[i] = level - 1;
+    blocks.m_Ticks[i] = job->m_Tick;
+  }
+}
+//---------------------------------------------------------------------------//
+// Advances every particle by m_DeltaTime in substeps of the finest level
+// present, each one predicting all particles and correcting the due ones.
+static void _blockStep(NBodyCpuCtx* p_Ctx) {
+  NBodyBlockSteps* blocks = &p_Ctx->m_Blocks;
+  const uint32_t count = p_Ctx->m_Store.m_Count;
+  _reserveTemp(p_Ctx);
+  _reserveBlocks(p_Ctx);
+  if (!p_Ctx->m_JerkValid)
+    nbodyCpuComputeForcesAndJerk(p_Ctx);
+
+  BlockJob job = {p_Ctx, 0};
+  nbodyPoolParallelFor(
+      p_Ctx->m_Pool, count, p_Ctx->m_BlockSize, _blockStartBlock, &job);
+  blocks->m_Substeps = 0;
+  blocks->m_Updates = 0;
+  blocks->m_MaxLevel = 0;
+
+  const uint32_t endTick = _blockTicks(0);
+  uint32_t tick = 0;
+  while (tick < endTick) {
+    uint32_t next = endTick;
+    for (uint32_t i = 0; i < count; ++i) {
+      const uint32_t level = blocks->m_Levels[i];
+      next = std::min(next, blocks->m_Ticks[i] + _blockTicks(level));
+      blocks->m_MaxLevel = std::max(blocks->m_MaxLevel, level);
+    }
+    job.m_Tick = next;
+    nbodyPoolParallelFor(
+        p_Ctx->m_Pool, count, p_Ctx->m_BlockSize, _blockPredictBlock, &job);
+
+    uint32_t activeCount = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+      if (blocks->m_Ticks[i] + _blockTicks(blocks->m_Levels[i]) == next)
+        blocks->m_Active[activeCount++] = i;
+    }
+    nbodyPoolParallelFor(
+        p_Ctx->m_Pool,
+        activeCount,
+        p_Ctx->m_BlockSize,
+        _blockForceBlock,
+        &job);
+    // Separate pass: the corrections move particles other blocks still read
+    // as sources.
+    nbodyPoolParallelFor(
+        p_Ctx->m_Pool,
+        activeCount,
+        p_Ctx->m_BlockSize,
+        _blockCorrectBlock,
+        &job);
+
+    blocks->m_Substeps++;
+    blocks->m_Updates += activeCount;
+    p_Ctx->m_ForceEvalCount++;
+    tick = next;
+  }
+  // Every particle is corrected at the end of the step, with the forces of
+  // its prediction like the shared step scheme.
+  p_Ctx->m_ForcesValid = true;
+  p_Ctx->m_JerkValid = true;
+}
+//---------------------------------------------------------------------------//
+// Core functions:
+//---------------------------------------------------------------------------//
+const char* nbodyIntegratorName(NBodyIntegrator p_Integrator) {
+  static const char* s_Names[NBodyIntegratorCount] = {
+      "euler", "leapfrog", "verlet", "rk4", "hermite", "hermite-block"};
+  NBODY_ASSERT(p_Integrator < NBodyIntegratorCount);
+  return s_Names[p_Integrator];
+}
+//---------------------------------------------------------------------------//
+void nbodyIntegratorStep(NBodyCpuCtx* p_Ctx) {
+  switch (p_Ctx->m_Integrator) {
+  case NBodyIntegratorEuler:
+    // All forces must be known before any particle moves, hence two passes.
+    nbodyCpuComputeForces(p_Ctx);
+    _parallel(p_Ctx, _eulerBlock, 0);
+    p_Ctx->m_ForcesValid = false;
+    break;
+
+  case NBodyIntegratorLeapfrog:
+    if (!p_Ctx->m_ForcesValid)
+      nbodyCpuComputeForces(p_Ctx);
+    _parallel(p_Ctx, _leapfrogBlock, 0);
+    nbodyCpuComputeForces(p_Ctx);
+    _parallel(p_Ctx, _leapfrogBlock, 1);
+    break;
+
+  case NBodyIntegratorVerlet:
+    _reserveTemp(p_Ctx);
+    if (!p_Ctx->m_ForcesValid)
+      nbodyCpuComputeForces(p_Ctx);
+    _parallel(p_Ctx, _verletBlock, 0);
+    nbodyCpuComputeForces(p_Ctx);
+    _parallel(p_Ctx, _verletBlock, 1);
+    break;
+
+  case NBodyIntegratorRk4:
+    _reserveTemp(p_Ctx);
+    for (uint32_t stage = 0; stage < 4; ++stage) {
+      // Forces of the start state are reused when still valid.
+      if (stage > 0 || !p_Ctx->m_ForcesValid)
+        nbodyCpuComputeForces(p_Ctx);
+      _parallel(p_Ctx, _rk4Block, stage);
+    }
+    p_Ctx->m_ForcesValid = false;
+    break;
+
+  case NBodyIntegratorHermite:
+    _reserveTemp(p_Ctx);
+    if (!p_Ctx->m_JerkValid)
+      nbodyCpuComputeForcesAndJerk(p_Ctx);
+    _parallel(p_Ctx, _hermiteBlock, 0);
+    nbodyCpuComputeForcesAndJerk(p_Ctx);
+    _parallel(p_Ctx, _hermiteBlock, 1);
+    // The forces of the prediction stand in for those of the corrected state
+    // at the start of the next step (PEC scheme).
+    break;
+
+  case NBodyIntegratorHermiteBlock:
+    _blockStep(p_Ctx);
+    break;
+
+  default:
+    NBODY_ASSERT(false);
+  }
+}
+//---------------------------------------------------------------------------//
@@ -0,0 +1,66 @@
+#pragma once
+
+/******************************************************************************
+ * \time integration schemes of the CPU engine
+ * \Euler is the semi-implicit update of CSMain. The others are symplectic
+ * \(leapfrog, velocity Verlet) or higher order (RK4, Hermite) and stay
+ * \accurate with much larger steps, at one to four force evaluations each.
+ * \Block Hermite gives every particle its own power-of-two fraction of the
+ * \step, so only the particles due at a substep get their forces computed.
+ ******************************************************************************/
+
+#include "NBodyCommon.hpp"
+
+struct NBodyCpuCtx;
+
+//---------------------------------------------------------------------------//
+enum NBodyIntegrator : uint32_t {
+  NBodyIntegratorEuler = 0, // vel += a dt, pos += vel dt (CSMain), 1st order
+  NBodyIntegratorLeapfrog,  // Kick-drift-kick, 2nd order, 1 evaluation
+  NBodyIntegratorVerlet,    // Velocity Verlet, 2nd order, 1 evaluation
+  NBodyIntegratorRk4,       // Classical Runge-Kutta, 4th order, 4 evaluations
+  NBodyIntegratorHermite,   // Predictor-corrector with jerk, 4th order, 1
+                            // evaluation (always direct, see NBodyJerkArgs)
+  NBodyIntegratorHermiteBlock, // Hermite with individual block steps
+  NBodyIntegratorCount
+};
+
+// Scratch arrays of the multi-stage schemes (RK4: start state and weighted
+// sums of the stages, Hermite: start state, acceleration and jerk).
+static constexpr uint32_t NBodyIntegratorTempCount = 12;
+
+// Block steps: a particle at level k advances by m_DeltaTime / 2^k, k being
+// the smallest level whose step is below eta * |a| / |jerk| (Aarseth's
+// simple criterion).
+static constexpr float NBodyDefaultBlockEta = 0.02f;
+static constexpr uint32_t NBodyMaxBlockLevel = 12;
+
+//---------------------------------------------------------------------------//
+struct NBodyBlockSteps {
+  float m_Eta;
+
+  // Per particle, only meaningful during a step: level, last correction
+  // (in ticks of m_DeltaTime / 2^NBodyMaxBlockLevel), and the indices and
+  // gathered position, velocity, acceleration and jerk of the active ones.
+  uint32_t* m_Levels;
+  uint32_t* m_Ticks;
+  uint32_t* m_Active;
+  float* m_Compact[12];
+  void* m_Memory;
+
+  // Last step: substeps, particle updates (one force evaluation each) and
+  // finest level reached.
+  uint32_t m_Substeps;
+  uint64_t m_Updates;
+  uint32_t m_MaxLevel;
+};
+
+//---------------------------------------------------------------------------//
+const char* nbodyIntegratorName(NBodyIntegrator p_Integrator);
+//---------------------------------------------------------------------------//
+// Advances p_Ctx by m_Params.m_DeltaTime with p_Ctx->m_Integrator. The
+// accelerations (and jerks) of the end of a step are kept for the next one
+// when the scheme allows it, so leapfrog, Verlet and Hermite cost a single
+// force evaluation per step.
+void nbodyIntegratorStep(NBodyCpuCtx* p_Ctx);
+//---------------------------------------------------------------------------//
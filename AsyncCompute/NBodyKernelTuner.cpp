@@ -0,0 +1,202 @@
+#include "NBodyKernelTuner.hpp"
+#include "NBodyCpu.hpp"
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+// Synthetic problem: as many sources as a few pool blocks see in a step of the
+// demo, small enough to time all the variants in a fraction of a second.
+static constexpr uint32_t NBodyTuneSources = 4096;
+static constexpr uint32_t NBodyTuneTargets = 1024;
+static constexpr uint32_t NBodyTuneRuns = 5;
+
+//---------------------------------------------------------------------------//
+/// Local functions:
+//---------------------------------------------------------------------------//
+static std::string _cacheKey(NBodyIsa p_Isa) {
+  return std::string(nbodyCpuBrand()) + "\t" + nbodyIsaName(p_Isa) + "\t";
+}
+//---------------------------------------------------------------------------//
+static std::vector<std::string> _readLines(const char* p_Path) {
+  std::vector<std::string> lines;
+  FILE* file = fopen(p_Path, "r");
+  if (file == nullptr)
+    return lines;
+  char line[256];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] != '\0')
+      lines.push_back(line);
+  }
+  fclose(file);
+  return lines;
+}
+//---------------------------------------------------------------------------//
+// Variant recorded for p_Isa on this cpu, NBodyForceVariantCount if none.
+static uint32_t _findCached(NBodyIsa p_Isa, const char* p_Path) {
+  char value[32];
+  uint32_t targets = 0;
+  uint32_t unroll = 0;
+  if (!nbodyTuneCacheFind(p_Path, _cacheKey(p_Isa).c_str(), value, 32) ||
+      sscanf(value, "%ux%u", &targets, &unroll) != 2)
+    return NBodyForceVariantCount;
+  for (uint32_t v = 0; v < nbodyForceVariantCount(p_Isa); ++v) {
+    if (NBodyForceVariants[v].m_Targets == targets &&
+        NBodyForceVariants[v].m_Unroll == unroll)
+      return v;
+  }
+  return NBodyForceVariantCount;
+}
+//---------------------------------------------------------------------------//
+static bool
+_writeCached(NBodyIsa p_Isa, uint32_t p_Variant, const char* p_Path) {
+  char value[32];
+  snprintf(
+      value,
+      sizeof(value),
+      "%ux%u",
+      NBodyForceVariants[p_Variant].m_Targets,
+      NBodyForceVariants[p_Variant].m_Unroll);
+  return nbodyTuneCacheStore(p_Path, _cacheKey(p_Isa).c_str(), value);
+}
+//---------------------------------------------------------------------------//
+static void _timeVariants(NBodyIsa p_Isa, NBodyTuneResult* p_Result) {
+  // Two overlapping clouds (fixed LCG), zero-mass padding is not needed as
+  // the source count is a multiple of NBodySimdWidth.
+  std::vector<float> src[4];
+  for (std::vector<float>& column : src) {
+    column.resize(NBodyTuneSources);
+  }
+  uint32_t seed = 12345u;
+  for (uint32_t j = 0; j < NBodyTuneSources; ++j) {
+    for (int c = 0; c < 3; ++c) {
+      seed = seed * 1664525u + 1013904223u;
+      src[c][j] = (float(seed >> 8) / float(1u << 24) - 0.5f) * 800.0f +
+                  (j % 2 == 0 ? -200.0f : 200.0f);
+    }
+    src[3][j] = NBodyDefaultMass;
+  }
+  std::vector<float> accel[3];
+  for (std::vector<float>& column : accel) {
+    column.resize(NBodyTuneTargets);
+  }
+
+  NBodyForceArgs args = {};
+  args.m_SrcX = src[0].data();
+  args.m_SrcY = src[1].data();
+  args.m_SrcZ = src[2].data();
+  args.m_SrcMass = src[3].data();
+  args.m_SrcCount = NBodyTuneSources;
+  args.m_DstX = src[0].data();
+  args.m_DstY = src[1].data();
+  args.m_DstZ = src[2].data();
+  args.m_DstBegin = 0;
+  args.m_DstEnd = NBodyTuneTargets;
+  args.m_AccelX = accel[0].data();
+  args.m_AccelY = accel[1].data();
+  args.m_AccelZ = accel[2].data();
+  args.m_G = NBodyG;
+
+  for (uint32_t v = 0; v < nbodyForceVariantCount(p_Isa); ++v) {
+    const NBodyForceKernel kernel = nbodyGetForceVariant(p_Isa, v);
+    kernel(&args); // Warm up the caches and the clocks.
+    double best = INFINITY;
+    for (uint32_t r = 0; r < NBodyTuneRuns; ++r) {
+      const auto start = std::chrono::steady_clock::now();
+      kernel(&args);
+      const double seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+      best = seconds < best ? seconds : best;
+    }
+    p_Result->m_Seconds[v] = best;
+    if (best < p_Result->m_Seconds[p_Result->m_Variant])
+      p_Result->m_Variant = v;
+  }
+  p_Result->m_Interactions = uint64_t(NBodyTuneSources) * NBodyTuneTargets;
+}
+//---------------------------------------------------------------------------//
+// Core functions:
+//---------------------------------------------------------------------------//
+bool nbodyTuneCacheFind(
+    const char* p_Path,
+    const char* p_Key,
+    char* p_Value,
+    size_t p_ValueSize) {
+  const size_t keyLength = strlen(p_Key);
+  for (const std::string& line : _readLines(p_Path)) {
+    if (line.compare(0, keyLength, p_Key) == 0) {
+      snprintf(p_Value, p_ValueSize, "%s", line.c_str() + keyLength);
+      return true;
+    }
+  }
+  return false;
+}
+//---------------------------------------------------------------------------//
+bool nbodyTuneCacheStore(
+    const char* p_Path, const char* p_Key, const char* p_Value) {
+  const size_t keyLength = strlen(p_Key);
+  std::vector<std::string> lines = _readLines(p_Path);
+  bool replaced = false;
+  for (std::string& line : lines) {
+    if (line.compare(0, keyLength, p_Key) == 0) {
+      line = std::string(p_Key) + p_Value;
+      replaced = true;
+    }
+  }
+  if (!replaced)
+    lines.push_back(std::string(p_Key) + p_Value);
+
+  const std::string tmpPath = std::string(p_Path) + ".tmp";
+  FILE* file = fopen(tmpPath.c_str(), "w");
+  if (file == nullptr)
+    return false;
+  bool ok = true;
+  for (const std::string& line : lines) {
+    ok = ok && fprintf(file, "%s\n", line.c_str()) > 0;
+  }
+  ok = fclose(file) == 0 && ok;
+  // p_Path is only replaced by a complete file, as in _commitFile
+  // (NBodyCheckpoint.cpp).
+  if (!ok) {
+    remove(tmpPath.c_str());
+    return false;
+  }
+#if defined(_WIN32)
+  // Unlike rename(), replaces an existing file in one step.
+  return MoveFileExA(tmpPath.c_str(), p_Path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return rename(tmpPath.c_str(), p_Path) == 0;
+#endif
+}
+//---------------------------------------------------------------------------//
+bool nbodyTuneForceKernel(
+    NBodyIsa p_Isa, const char* p_CachePath, NBodyTuneResult* p_Result) {
+  memset(p_Result, 0, sizeof(*p_Result));
+  p_Result->m_Isa = p_Isa;
+
+  if (p_CachePath != nullptr) {
+    const uint32_t cached = _findCached(p_Isa, p_CachePath);
+    if (cached < NBodyForceVariantCount) {
+      p_Result->m_Variant = cached;
+      p_Result->m_FromCache = true;
+      nbodySelectForceVariant(p_Isa, cached);
+      return true;
+    }
+  }
+
+  _timeVariants(p_Isa, p_Result);
+  nbodySelectForceVariant(p_Isa, p_Result->m_Variant);
+  return p_CachePath == nullptr ||
+         _writeCached(p_Isa, p_Result->m_Variant, p_CachePath);
+}
+//---------------------------------------------------------------------------//
@@ -0,0 +1,51 @@
+#pragma once
+
+/******************************************************************************
+ * \autotuning of the force kernel variants (see NBodyForceVariants)
+ * \times every variant of an ISA on a synthetic direct sum and selects the
+ * \fastest, the choice is persisted per cpu brand and ISA in a small text
+ * \file so that later runs start on it without timing anything. The text
+ * \cache is shared with the dispatch tuner (NBodyDispatchTuner.hpp).
+ ******************************************************************************/
+
+#include "NBodyKernels.hpp"
+#include <stddef.h>
+
+// Next to the executable's working directory, one line per cpu and ISA:
+// "<cpu brand>\t<isa name>\t<targets>x<unroll>"
+static constexpr const char* NBodyDefaultTuneCache = "NBodyKernels.cache";
+
+//---------------------------------------------------------------------------//
+struct NBodyTuneResult {
+  NBodyIsa m_Isa;
+  uint32_t m_Variant; // Index in NBodyForceVariants
+  bool m_FromCache;
+
+  // Seconds per evaluation of the synthetic problem (best of a few runs),
+  // only filled when the variants were timed.
+  double m_Seconds[NBodyForceVariantCount];
+  uint64_t m_Interactions; // Per evaluation
+};
+
+//---------------------------------------------------------------------------//
+// Tuning caches are text files of one "<key><value>" line per entry, keys end
+// with a tab. Copies the value of p_Key into p_Value, false if p_Path has no
+// such line.
+bool nbodyTuneCacheFind(
+    const char* p_Path,
+    const char* p_Key,
+    char* p_Value,
+    size_t p_ValueSize);
+//---------------------------------------------------------------------------//
+// Replaces (or adds) the line of p_Key, through a temporary file so that an
+// interrupted run never leaves a truncated cache. False when it can't write.
+bool nbodyTuneCacheStore(
+    const char* p_Path, const char* p_Key, const char* p_Value);
+//---------------------------------------------------------------------------//
+// Selects (nbodySelectForceVariant) the fastest force variant of p_Isa: the
+// one p_CachePath records for this cpu if any, otherwise every variant is
+// timed and the winner is written back. A null p_CachePath always times and
+// writes nothing. Returns false when the cache could not be written.
+bool nbodyTuneForceKernel(
+    NBodyIsa p_Isa, const char* p_CachePath, NBodyTuneResult* p_Result);
+//---------------------------------------------------------------------------//
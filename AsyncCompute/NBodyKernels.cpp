@@ -0,0 +1,700 @@
+#include "NBodyCpu.hpp"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if NBODY_X86
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+//---------------------------------------------------------------------------//
+/// Local functions:
+//---------------------------------------------------------------------------//
+#if NBODY_X86
+static void _cpuid(uint32_t p_Leaf, uint32_t p_SubLeaf, uint32_t p_Regs[4]) {
+#if defined(_MSC_VER)
+  int regs[4];
+  __cpuidex(regs, static_cast<int>(p_Leaf), static_cast<int>(p_SubLeaf));
+  for (int i = 0; i < 4; ++i)
+    p_Regs[i] = static_cast<uint32_t>(regs[i]);
+#else
+  __cpuid_count(p_Leaf, p_SubLeaf, p_Regs[0], p_Regs[1], p_Regs[2], p_Regs[3]);
+#endif
+}
+//---------------------------------------------------------------------------//
+// Returns the register state the os saves on context switches (XCR0).
+static uint64_t _xgetbv() {
+#if defined(_MSC_VER)
+  return _xgetbv(0);
+#else
+  uint32_t eax;
+  uint32_t edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+#endif
+//---------------------------------------------------------------------------//
+namespace {
+struct CpuBrand {
+  char m_Name[64];
+};
+struct ForceVariantTable {
+  NBodyForceKernel m_Kernels[NBodyIsaCount][NBodyForceVariantCount];
+};
+
+struct M2LKernelTable {
+  NBodyM2LKernel m_Kernels[NBodyIsaCount][NBodyM2LMaxOrder];
+};
+
+// Doubles of the scalar M2L kernels (NBodyM2LKernel.hpp), one lane at a time.
+struct ScalarDouble {
+  using Type = double;
+  static constexpr uint32_t Width = 1;
+
+  static Type zero() { return 0.0; }
+  static Type set1(double p_Val) { return p_Val; }
+  static Type load(const double* p_Ptr) { return *p_Ptr; }
+  static void store(double* p_Ptr, Type p_A) { *p_Ptr = p_A; }
+  static Type mul(Type p_A, Type p_B) { return p_A * p_B; }
+  static Type div(Type p_A, Type p_B) { return p_A / p_B; }
+  static Type sqrt(Type p_A) { return ::sqrt(p_A); }
+  static Type fmadd(Type p_A, Type p_B, Type p_C) { return p_A * p_B + p_C; }
+};
+} // namespace
+
+#include "NBodyM2LKernel.hpp"
+
+static uint32_t s_SelectedForceVariant[NBodyIsaCount];
+//---------------------------------------------------------------------------//
+// Source position of the scalar kernel in the storage format of p_Args.
+static float
+_srcPosition(const NBodyForceArgs* p_Args, int p_Axis, uint32_t p_J) {
+  const float* src[3] = {p_Args->m_SrcX, p_Args->m_SrcY, p_Args->m_SrcZ};
+  switch (p_Args->m_PosFormat) {
+  case NBodyPosFloat16:
+    return nbodyHalfToFloat(p_Args->m_SrcPacked[p_Axis][p_J]);
+  case NBodyPosBFloat16:
+    return nbodyBf16ToFloat(p_Args->m_SrcPacked[p_Axis][p_J]);
+  default:
+    return src[p_Axis][p_J];
+  }
+}
+//---------------------------------------------------------------------------//
+static CpuBrand _readCpuBrand() {
+  CpuBrand result;
+  snprintf(result.m_Name, sizeof(result.m_Name), "unknown");
+#if NBODY_X86
+  uint32_t regs[4];
+  _cpuid(0x80000000u, 0, regs);
+  if (regs[0] < 0x80000004u)
+    return result;
+  char brand[49] = {};
+  for (uint32_t leaf = 0; leaf < 3; ++leaf) {
+    _cpuid(0x80000002u + leaf, 0, regs);
+    memcpy(brand + 16 * leaf, regs, 16);
+  }
+  // Padded with spaces on some parts.
+  const char* first = brand;
+  while (*first == ' ')
+    ++first;
+  size_t length = strlen(first);
+  while (length > 0 && first[length - 1] == ' ')
+    --length;
+  if (length > 0) {
+    snprintf(
+        result.m_Name,
+        sizeof(result.m_Name),
+        "%.*s",
+        static_cast<int>(length),
+        first);
+  }
+#endif
+  return result;
+}
+//---------------------------------------------------------------------------//
+static const ForceVariantTable& _forceVariants() {
+  static const ForceVariantTable s_Table = [] {
+    ForceVariantTable table = {};
+    for (uint32_t v = 0; v < NBodyForceVariantCount; ++v) {
+      table.m_Kernels[NBodyIsaScalar][v] = nbodyForceKernelScalar;
+    }
+    nbodyForceVariantsSse42(table.m_Kernels[NBodyIsaSse42]);
+    nbodyForceVariantsAvx2(table.m_Kernels[NBodyIsaAvx2]);
+    nbodyForceVariantsAvx512(table.m_Kernels[NBodyIsaAvx512]);
+    return table;
+  }();
+  return s_Table;
+}
+//---------------------------------------------------------------------------//
+static NBodyIsa _detectIsa() {
+#if NBODY_X86
+  uint32_t regs[4];
+  _cpuid(0, 0, regs);
+  const uint32_t maxLeaf = regs[0];
+
+  _cpuid(1, 0, regs);
+  const bool sse42 = (regs[2] & (1u << 20)) != 0;
+  const bool fma = (regs[2] & (1u << 12)) != 0;
+  const bool osxsave = (regs[2] & (1u << 27)) != 0;
+  const bool avx = (regs[2] & (1u << 28)) != 0;
+  if (!sse42)
+    return NBodyIsaScalar;
+
+  // The os has to save the ymm (and zmm) state for the wide paths.
+  const uint64_t xcr0 = osxsave ? _xgetbv() : 0;
+  const bool osYmm = (xcr0 & 0x6) == 0x6;
+  const bool osZmm = (xcr0 & 0xe6) == 0xe6;
+
+  bool avx2 = false;
+  bool avx512f = false;
+  if (maxLeaf >= 7) {
+    _cpuid(7, 0, regs);
+    avx2 = (regs[1] & (1u << 5)) != 0;
+    avx512f = (regs[1] & (1u << 16)) != 0;
+  }
+
+  if (avx512f && osZmm)
+    return NBodyIsaAvx512;
+  if (avx && avx2 && fma && osYmm)
+    return NBodyIsaAvx2;
+  return NBodyIsaSse42;
+#else
+  return NBodyIsaScalar;
+#endif
+}
+//---------------------------------------------------------------------------//
+// Core functions:
+//---------------------------------------------------------------------------//
+NBodyIsa nbodyDetectIsa() {
+  static const NBodyIsa s_Isa = _detectIsa();
+  return s_Isa;
+}
+//---------------------------------------------------------------------------//
+bool nbodyIsaSupported(NBodyIsa p_Isa) { return p_Isa <= nbodyDetectIsa(); }
+//---------------------------------------------------------------------------//
+const char* nbodyIsaName(NBodyIsa p_Isa) {
+  static const char* s_Names[NBodyIsaCount] = {
+      "scalar", "sse4.2", "avx2+fma", "avx512f"};
+  NBODY_ASSERT(p_Isa < NBodyIsaCount);
+  return s_Names[p_Isa];
+}
+//---------------------------------------------------------------------------//
+const char* nbodyCpuBrand() {
+  static const CpuBrand s_Brand = _readCpuBrand();
+  return s_Brand.m_Name;
+}
+//---------------------------------------------------------------------------//
+NBodyForceKernel nbodyGetForceKernel(NBodyIsa p_Isa) {
+  NBODY_ASSERT(nbodyIsaSupported(p_Isa));
+  return _forceVariants().m_Kernels[p_Isa][s_SelectedForceVariant[p_Isa]];
+}
+//---------------------------------------------------------------------------//
+NBodyForceKernel nbodyGetDeterministicKernel(NBodyIsa p_Isa) {
+  static const NBodyForceKernel s_Kernels[NBodyIsaCount] = {
+      nbodyDeterministicKernelScalar,
+      nbodyDeterministicKernelSse42,
+      nbodyDeterministicKernelAvx2,
+      nbodyDeterministicKernelAvx512};
+  NBODY_ASSERT(nbodyIsaSupported(p_Isa));
+  return s_Kernels[p_Isa];
+}
+//---------------------------------------------------------------------------//
+uint32_t nbodyForceVariantCount(NBodyIsa p_Isa) {
+  return p_Isa == NBodyIsaScalar ? 1 : NBodyForceVariantCount;
+}
+//---------------------------------------------------------------------------//
+NBodyForceKernel nbodyGetForceVariant(NBodyIsa p_Isa, uint32_t p_Variant) {
+  NBODY_ASSERT(nbodyIsaSupported(p_Isa));
+  NBODY_ASSERT(p_Variant < nbodyForceVariantCount(p_Isa));
+  return _forceVariants().m_Kernels[p_Isa][p_Variant];
+}
+//---------------------------------------------------------------------------//
+void nbodySelectForceVariant(NBodyIsa p_Isa, uint32_t p_Variant) {
+  NBODY_ASSERT(p_Isa < NBodyIsaCount);
+  NBODY_ASSERT(p_Variant < nbodyForceVariantCount(p_Isa));
+  s_SelectedForceVariant[p_Isa] = p_Variant;
+}
+//---------------------------------------------------------------------------//
+uint32_t nbodySelectedForceVariant(NBodyIsa p_Isa) {
+  NBODY_ASSERT(p_Isa < NBodyIsaCount);
+  return s_SelectedForceVariant[p_Isa];
+}
+//---------------------------------------------------------------------------//
+const char* nbodyAccumulationName(NBodyAccumulation p_Accumulation) {
+  static const char* s_Names[NBodyAccumCount] = {"float", "kahan", "double"};
+  NBODY_ASSERT(p_Accumulation < NBodyAccumCount);
+  return s_Names[p_Accumulation];
+}
+//---------------------------------------------------------------------------//
+const char* nbodyPosFormatName(NBodyPosFormat p_Format) {
+  static const char* s_Names[NBodyPosFormatCount] = {
+      "float32", "float16", "bfloat16"};
+  NBODY_ASSERT(p_Format < NBodyPosFormatCount);
+  return s_Names[p_Format];
+}
+//---------------------------------------------------------------------------//
+void nbodyPackPositions(
+    const float* p_Src,
+    uint16_t* p_Dst,
+    uint32_t p_Count,
+    NBodyPosFormat p_Format) {
+  NBODY_ASSERT(p_Format != NBodyPosFloat32);
+  if (p_Format == NBodyPosFloat16) {
+    for (uint32_t j = 0; j < p_Count; ++j) {
+      p_Dst[j] = nbodyFloatToHalf(p_Src[j]);
+    }
+  } else {
+    for (uint32_t j = 0; j < p_Count; ++j) {
+      p_Dst[j] = nbodyFloatToBf16(p_Src[j]);
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+NBodyCellKernel nbodyGetCellKernel(NBodyIsa p_Isa) {
+  static const NBodyCellKernel s_Kernels[NBodyIsaCount] = {
+      nbodyCellKernelScalar,
+      nbodyCellKernelSse42,
+      nbodyCellKernelAvx2,
+      nbodyCellKernelAvx512};
+  NBODY_ASSERT(nbodyIsaSupported(p_Isa));
+  return s_Kernels[p_Isa];
+}
+//---------------------------------------------------------------------------//
+NBodyPairKernel nbodyGetPairKernel(NBodyIsa p_Isa) {
+  static const NBodyPairKernel s_Kernels[NBodyIsaCount] = {
+      nbodyPairKernelScalar,
+      nbodyPairKernelSse42,
+      nbodyPairKernelAvx2,
+      nbodyPairKernelAvx512};
+  NBODY_ASSERT(nbodyIsaSupported(p_Isa));
+  return s_Kernels[p_Isa];
+}
+//---------------------------------------------------------------------------//
+NBodyJerkKernel nbodyGetJerkKernel(NBodyIsa p_Isa) {
+  static const NBodyJerkKernel s_Kernels[NBodyIsaCount] = {
+      nbodyJerkKernelScalar,
+      nbodyJerkKernelSse42,
+      nbodyJerkKernelAvx2,
+      nbodyJerkKernelAvx512};
+  NBODY_ASSERT(nbodyIsaSupported(p_Isa));
+  return s_Kernels[p_Isa];
+}
+//---------------------------------------------------------------------------//
+NBodyM2LKernel nbodyGetM2LKernel(NBodyIsa p_Isa, uint32_t p_Order) {
+  static const M2LKernelTable s_Table = [] {
+    M2LKernelTable table = {};
+    nbodyM2LKernelsScalar(table.m_Kernels[NBodyIsaScalar]);
+    nbodyM2LKernelsSse42(table.m_Kernels[NBodyIsaSse42]);
+    nbodyM2LKernelsAvx2(table.m_Kernels[NBodyIsaAvx2]);
+    nbodyM2LKernelsAvx512(table.m_Kernels[NBodyIsaAvx512]);
+    return table;
+  }();
+  NBODY_ASSERT(nbodyIsaSupported(p_Isa));
+  NBODY_ASSERT(p_Order >= 1 && p_Order <= NBodyM2LMaxOrder);
+  return s_Table.m_Kernels[p_Isa][p_Order - 1];
+}
+//---------------------------------------------------------------------------//
+NBodyPairKernel nbodyGetDeterministicPairKernel() {
+  return nbodyPairKernelScalar;
+}
+//---------------------------------------------------------------------------//
+NBodyJerkKernel nbodyGetDeterministicJerkKernel() {
+  return nbodyJerkKernelScalar;
+}
+//---------------------------------------------------------------------------//
+NBodyPackKernel nbodyGetPackKernel(NBodyIsa p_Isa) {
+  static const NBodyPackKernel s_Kernels[NBodyIsaCount] = {
+      nbodyPackKernelScalar,
+      nbodyPackKernelSse42,
+      nbodyPackKernelAvx2,
+      nbodyPackKernelAvx512};
+  NBODY_ASSERT(nbodyIsaSupported(p_Isa));
+  return s_Kernels[p_Isa];
+}
+//---------------------------------------------------------------------------//
+NBodyUnpackKernel nbodyGetUnpackKernel(NBodyIsa p_Isa) {
+  static const NBodyUnpackKernel s_Kernels[NBodyIsaCount] = {
+      nbodyUnpackKernelScalar,
+      nbodyUnpackKernelSse42,
+      nbodyUnpackKernelAvx2,
+      nbodyUnpackKernelAvx512};
+  NBODY_ASSERT(nbodyIsaSupported(p_Isa));
+  return s_Kernels[p_Isa];
+}
+//---------------------------------------------------------------------------//
+NBodyQuantizeKernel nbodyGetQuantizeKernel(NBodyIsa p_Isa) {
+  static const NBodyQuantizeKernel s_Kernels[NBodyIsaCount] = {
+      nbodyQuantizeKernelScalar,
+      nbodyQuantizeKernelSse42,
+      nbodyQuantizeKernelAvx2,
+      nbodyQuantizeKernelAvx512};
+  NBODY_ASSERT(nbodyIsaSupported(p_Isa));
+  return s_Kernels[p_Isa];
+}
+//---------------------------------------------------------------------------//
+NBodyPredictKernel nbodyGetPredictKernel(NBodyIsa p_Isa) {
+  static const NBodyPredictKernel s_Kernels[NBodyIsaCount] = {
+      nbodyPredictKernelScalar,
+      nbodyPredictKernelSse42,
+      nbodyPredictKernelAvx2,
+      nbodyPredictKernelAvx512};
+  NBODY_ASSERT(nbodyIsaSupported(p_Isa));
+  return s_Kernels[p_Isa];
+}
+//---------------------------------------------------------------------------//
+NBodyUnpredictKernel nbodyGetUnpredictKernel(NBodyIsa p_Isa) {
+  static const NBodyUnpredictKernel s_Kernels[NBodyIsaCount] = {
+      nbodyUnpredictKernelScalar,
+      nbodyUnpredictKernelSse42,
+      nbodyUnpredictKernelAvx2,
+      nbodyUnpredictKernelAvx512};
+  NBODY_ASSERT(nbodyIsaSupported(p_Isa));
+  return s_Kernels[p_Isa];
+}
+//---------------------------------------------------------------------------//
+NBodyDequantizeKernel nbodyGetDequantizeKernel(NBodyIsa p_Isa) {
+  static const NBodyDequantizeKernel s_Kernels[NBodyIsaCount] = {
+      nbodyDequantizeKernelScalar,
+      nbodyDequantizeKernelSse42,
+      nbodyDequantizeKernelAvx2,
+      nbodyDequantizeKernelAvx512};
+  NBODY_ASSERT(nbodyIsaSupported(p_Isa));
+  return s_Kernels[p_Isa];
+}
+//---------------------------------------------------------------------------//
+// G is applied per interaction (bodyBodyInteraction), the tile sums are
+// folded unscaled.
+void nbodyForceKernelScalar(const NBodyForceArgs* p_Args) {
+  const NBodyAccumulation accumulation = p_Args->m_Accumulation;
+  const NBodyPosFormat format = p_Args->m_PosFormat;
+  const uint32_t srcCount = p_Args->m_SrcCount;
+  const uint32_t tileSize =
+      accumulation == NBodyAccumFloat ? srcCount : NBodyAccumTileSize;
+
+  for (uint32_t i = p_Args->m_DstBegin; i < p_Args->m_DstEnd; ++i) {
+    const NBodyFloat4 pos = {
+        nbodyRoundPosition(p_Args->m_DstX[i], format),
+        nbodyRoundPosition(p_Args->m_DstY[i], format),
+        nbodyRoundPosition(p_Args->m_DstZ[i], format),
+        0.0f};
+    NBodyTileSum sums[3] = {};
+
+    for (uint32_t begin = 0; begin < srcCount; begin += tileSize) {
+      const uint32_t end =
+          srcCount - begin < tileSize ? srcCount : begin + tileSize;
+      float accel[3] = {0.0f, 0.0f, 0.0f};
+      for (uint32_t j = begin; j < end; ++j) {
+        const NBodyFloat4 bj = {
+            _srcPosition(p_Args, 0, j),
+            _srcPosition(p_Args, 1, j),
+            _srcPosition(p_Args, 2, j),
+            p_Args->m_SrcMass[j]};
+        nbodyBodyBodyInteraction(accel, bj, pos, p_Args->m_G, 1);
+      }
+      for (int c = 0; c < 3; ++c) {
+        nbodyTileSumAdd(&sums[c], accumulation, accel[c]);
+      }
+    }
+
+    p_Args->m_AccelX[i] = nbodyTileSumScaled(sums[0], accumulation, 1.0f);
+    p_Args->m_AccelY[i] = nbodyTileSumScaled(sums[1], accumulation, 1.0f);
+    p_Args->m_AccelZ[i] = nbodyTileSumScaled(sums[2], accumulation, 1.0f);
+  }
+}
+//---------------------------------------------------------------------------//
+// Reference of the deterministic kernels: lane l of the vector paths sums the
+// sources j = l (mod NBodyDeterministicLanes) in order, as lanes[l] here.
+NBODY_NO_FP_CONTRACT void
+nbodyDeterministicKernelScalar(const NBodyForceArgs* p_Args) {
+  NBODY_NO_FP_CONTRACT_BODY
+  NBODY_ASSERT(p_Args->m_SrcCount % NBodyDeterministicLanes == 0);
+  const float* src[4] = {
+      p_Args->m_SrcX, p_Args->m_SrcY, p_Args->m_SrcZ, p_Args->m_SrcMass};
+  float* out[3] = {p_Args->m_AccelX, p_Args->m_AccelY, p_Args->m_AccelZ};
+
+  for (uint32_t i = p_Args->m_DstBegin; i < p_Args->m_DstEnd; ++i) {
+    const float pos[3] = {
+        p_Args->m_DstX[i], p_Args->m_DstY[i], p_Args->m_DstZ[i]};
+    float lanes[3][NBodyDeterministicLanes] = {};
+
+    for (uint32_t j = 0; j < p_Args->m_SrcCount; ++j) {
+      const uint32_t l = j % NBodyDeterministicLanes;
+      float r[3];
+      for (int c = 0; c < 3; ++c) {
+        r[c] = src[c][j] - pos[c];
+      }
+      float distSqr =
+          r[0] * r[0] + (r[1] * r[1] + (r[2] * r[2] + NBodySofteningSquared));
+      float invDist = 1.0f / sqrtf(distSqr);
+      float invDistCube = invDist * invDist * invDist;
+      float s = src[3][j] * invDistCube;
+      for (int c = 0; c < 3; ++c) {
+        lanes[c][l] += r[c] * s;
+      }
+    }
+
+    for (int c = 0; c < 3; ++c) {
+      out[c][i] = nbodyDeterministicFold(lanes[c]) * p_Args->m_G;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+void nbodyCellKernelScalar(const NBodyCellArgs* p_Args) {
+  const bool quadrupole = p_Args->m_Quad[0] != nullptr;
+
+  for (uint32_t t = 0; t < p_Args->m_DstCount; ++t) {
+    float ax = 0.0f;
+    float ay = 0.0f;
+    float az = 0.0f;
+
+    for (uint32_t c = 0; c < p_Args->m_CellCount; ++c) {
+      // d = com - target, softened like bodyBodyInteraction
+      const float dx = p_Args->m_ComX[c] - p_Args->m_DstX[t];
+      const float dy = p_Args->m_ComY[c] - p_Args->m_DstY[t];
+      const float dz = p_Args->m_ComZ[c] - p_Args->m_DstZ[t];
+      const float distSqr =
+          dx * dx + dy * dy + dz * dz + NBodySofteningSquared;
+      const float invDist = 1.0f / sqrtf(distSqr);
+      const float invDistCube = invDist * invDist * invDist;
+      float s = p_Args->m_CellMass[c] * invDistCube;
+
+      if (quadrupole) {
+        // a += -Q.d / r^5 + 5/2 (d.Q.d) d / r^7
+        const float q[6] = {
+            p_Args->m_Quad[0][c],
+            p_Args->m_Quad[1][c],
+            p_Args->m_Quad[2][c],
+            p_Args->m_Quad[3][c],
+            p_Args->m_Quad[4][c],
+            p_Args->m_Quad[5][c]};
+        const float invDist5 = invDistCube * invDist * invDist;
+        const float qx = q[0] * dx + q[3] * dy + q[4] * dz;
+        const float qy = q[3] * dx + q[1] * dy + q[5] * dz;
+        const float qz = q[4] * dx + q[5] * dy + q[2] * dz;
+        const float dqd = dx * qx + dy * qy + dz * qz;
+        s += 2.5f * dqd * invDist5 * invDist * invDist;
+        ax -= qx * invDist5;
+        ay -= qy * invDist5;
+        az -= qz * invDist5;
+      }
+
+      ax += dx * s;
+      ay += dy * s;
+      az += dz * s;
+    }
+
+    p_Args->m_AccelX[t] += ax;
+    p_Args->m_AccelY[t] += ay;
+    p_Args->m_AccelZ[t] += az;
+  }
+}
+//---------------------------------------------------------------------------//
+// Sums in order with a correctly rounded 1 / sqrt and no FMA, so it is also
+// the deterministic pair kernel.
+NBODY_NO_FP_CONTRACT void nbodyPairKernelScalar(const NBodyPairArgs* p_Args) {
+  NBODY_NO_FP_CONTRACT_BODY
+  const bool diagonal = p_Args->m_BeginI == p_Args->m_BeginJ;
+
+  for (uint32_t i = p_Args->m_BeginI; i < p_Args->m_EndI; ++i) {
+    const float xi = p_Args->m_PosX[i];
+    const float yi = p_Args->m_PosY[i];
+    const float zi = p_Args->m_PosZ[i];
+    float ax = 0.0f;
+    float ay = 0.0f;
+    float az = 0.0f;
+
+    const float mi = p_Args->m_Mass[i];
+    for (uint32_t j = diagonal ? i + 1 : p_Args->m_BeginJ; j < p_Args->m_EndJ;
+         ++j) {
+      const float rx = p_Args->m_PosX[j] - xi;
+      const float ry = p_Args->m_PosY[j] - yi;
+      const float rz = p_Args->m_PosZ[j] - zi;
+      const float distSqr =
+          rx * rx + ry * ry + rz * rz + NBodySofteningSquared;
+      const float invDist = 1.0f / sqrtf(distSqr);
+      const float invDistCube = invDist * invDist * invDist;
+      const float si = p_Args->m_Mass[j] * invDistCube;
+      const float sj = mi * invDistCube;
+
+      ax += rx * si;
+      ay += ry * si;
+      az += rz * si;
+      p_Args->m_AccelX[j] -= rx * sj;
+      p_Args->m_AccelY[j] -= ry * sj;
+      p_Args->m_AccelZ[j] -= rz * sj;
+    }
+
+    p_Args->m_AccelX[i] += ax;
+    p_Args->m_AccelY[i] += ay;
+    p_Args->m_AccelZ[i] += az;
+  }
+}
+//---------------------------------------------------------------------------//
+// Deterministic jerk kernel as well, see nbodyPairKernelScalar.
+NBODY_NO_FP_CONTRACT void nbodyJerkKernelScalar(const NBodyJerkArgs* p_Args) {
+  NBODY_NO_FP_CONTRACT_BODY
+  for (uint32_t i = p_Args->m_DstBegin; i < p_Args->m_DstEnd; ++i) {
+    float pos[3];
+    float vel[3];
+    for (int c = 0; c < 3; ++c) {
+      pos[c] = p_Args->m_DstPos[c][i];
+      vel[c] = p_Args->m_DstVel[c][i];
+    }
+    float accel[3] = {0.0f, 0.0f, 0.0f};
+    float jerk[3] = {0.0f, 0.0f, 0.0f};
+
+    for (uint32_t j = 0; j < p_Args->m_SrcCount; ++j) {
+      // a += m r / d^3, jerk += m (v / d^3 - 3 (r.v) r / d^5) with
+      // d^2 = r^2 + eps^2
+      float r[3];
+      float v[3];
+      for (int c = 0; c < 3; ++c) {
+        r[c] = p_Args->m_SrcPos[c][j] - pos[c];
+        v[c] = p_Args->m_SrcVel[c][j] - vel[c];
+      }
+      const float distSqr =
+          r[0] * r[0] + r[1] * r[1] + r[2] * r[2] + NBodySofteningSquared;
+      const float invDist = 1.0f / sqrtf(distSqr);
+      const float invDistSqr = invDist * invDist;
+      const float invDistCube = invDistSqr * invDist;
+      const float weight = p_Args->m_SrcMass[j] * invDistCube;
+      const float rv = r[0] * v[0] + r[1] * v[1] + r[2] * v[2];
+      const float s = 3.0f * rv * invDistSqr;
+      for (int c = 0; c < 3; ++c) {
+        accel[c] += r[c] * weight;
+        jerk[c] += (v[c] - s * r[c]) * weight;
+      }
+    }
+
+    for (int c = 0; c < 3; ++c) {
+      p_Args->m_Accel[c][i] = accel[c] * p_Args->m_G;
+      p_Args->m_Jerk[c][i] = jerk[c] * p_Args->m_G;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+void nbodyM2LKernelsScalar(NBodyM2LKernel* p_Kernels) {
+  _m2lKernels<ScalarDouble>(
+      p_Kernels, std::make_index_sequence<NBodyM2LMaxOrder>());
+}
+//---------------------------------------------------------------------------//
+size_t nbodyPackKernelScalar(
+    const uint32_t* p_Values,
+    uint32_t p_BlockCount,
+    uint8_t* p_Widths,
+    uint32_t* p_Words) {
+  uint32_t* words = p_Words;
+  for (uint32_t b = 0; b < p_BlockCount; ++b) {
+    const uint32_t* values = p_Values + size_t(b) * NBodyPackBlock;
+    uint32_t any = 0;
+    for (uint32_t i = 0; i < NBodyPackBlock; ++i) {
+      any |= values[i];
+    }
+    const uint32_t width = nbodyBitWidth(any);
+    p_Widths[b] = uint8_t(width);
+    for (uint32_t bit = 0; bit < width; ++bit) {
+      uint32_t word = 0;
+      for (uint32_t i = 0; i < NBodyPackBlock; ++i) {
+        word |= (values[i] >> bit & 1u) << i;
+      }
+      *words++ = word;
+    }
+  }
+  return size_t(words - p_Words);
+}
+//---------------------------------------------------------------------------//
+size_t nbodyUnpackKernelScalar(
+    const uint8_t* p_Widths,
+    const uint32_t* p_Words,
+    uint32_t p_BlockCount,
+    uint32_t* p_Values) {
+  const uint32_t* words = p_Words;
+  for (uint32_t b = 0; b < p_BlockCount; ++b) {
+    uint32_t* values = p_Values + size_t(b) * NBodyPackBlock;
+    memset(values, 0, NBodyPackBlock * sizeof(uint32_t));
+    for (uint32_t bit = 0; bit < p_Widths[b]; ++bit) {
+      const uint32_t word = *words++;
+      for (uint32_t i = 0; i < NBodyPackBlock; ++i) {
+        values[i] |= (word >> i & 1u) << bit;
+      }
+    }
+  }
+  return size_t(words - p_Words);
+}
+//---------------------------------------------------------------------------//
+// llrint is a libm call (it may set errno), SSE2 rounds to nearest in one
+// instruction and gives INT32_MIN out of the int32 range (NaN included),
+// which the range check catches.
+bool nbodyQuantizeKernelScalar(
+    const float* p_Positions,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_InvSpacing,
+    int32_t p_Limit,
+    int32_t* p_Cells,
+    int32_t* p_Range) {
+  int32_t low = p_Range[0];
+  int32_t high = p_Range[1];
+  for (uint32_t k = 0; k < p_Count; ++k) {
+    const uint32_t id = p_Ids != nullptr ? p_Ids[k] : k;
+    const double cell = (double(p_Positions[id]) - p_Origin) * p_InvSpacing;
+#if NBODY_X86
+    p_Cells[k] = _mm_cvtsd_si32(_mm_set_sd(cell));
+#else
+    p_Cells[k] = fabs(cell) < p_Limit ? int32_t(llrint(cell)) : INT32_MIN;
+#endif
+    low = p_Cells[k] < low ? p_Cells[k] : low;
+    high = p_Cells[k] > high ? p_Cells[k] : high;
+  }
+  p_Range[0] = low;
+  p_Range[1] = high;
+  return low > -p_Limit && high < p_Limit;
+}
+//---------------------------------------------------------------------------//
+void nbodyPredictKernelScalar(
+    const int32_t* p_Cells,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change,
+    uint32_t* p_Values) {
+  for (uint32_t k = 0; k < p_Count; ++k) {
+    const uint32_t cell = uint32_t(p_Cells[k]);
+    const uint32_t residual = cell - p_Previous[k] - p_Change[k];
+    p_Values[k] = residual << 1 ^ (0u - (residual >> 31));
+    p_Change[k] = cell - p_Previous[k];
+    p_Previous[k] = cell;
+  }
+}
+//---------------------------------------------------------------------------//
+void nbodyUnpredictKernelScalar(
+    const uint32_t* p_Values,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change) {
+  for (uint32_t k = 0; k < p_Count; ++k) {
+    const uint32_t residual = p_Values[k] >> 1 ^ (0u - (p_Values[k] & 1u));
+    p_Change[k] += residual;
+    p_Previous[k] += p_Change[k];
+  }
+}
+//---------------------------------------------------------------------------//
+NBODY_NO_FP_CONTRACT void nbodyDequantizeKernelScalar(
+    const int32_t* p_Cells,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_Spacing,
+    float* p_Positions) {
+  NBODY_NO_FP_CONTRACT_BODY
+  for (uint32_t k = 0; k < p_Count; ++k) {
+    p_Positions[p_Ids[k]] = float(p_Origin + double(p_Cells[k]) * p_Spacing);
+  }
+}
+//---------------------------------------------------------------------------//
@@ -0,0 +1,668 @@
+#pragma once
+
+/******************************************************************************
+ * \force kernels for the CPU n-body engine
+ * \the O(N^2) inner loop of CSMain (bodyBodyInteraction over sharedPos),
+ * \hand-vectorized over j-bodies and selected at runtime via CPUID
+ ******************************************************************************/
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||             \
+    defined(_M_IX86)
+#define NBODY_X86 1
+#else
+#define NBODY_X86 0
+#endif
+
+// Functions whose float results must not depend on the target: GCC fuses
+// a * b + c into an FMA by default whenever the ISA has one, intrinsics
+// included. Clang only fuses within one expression and is switched off by
+// NBODY_NO_FP_CONTRACT_BODY, MSVC does not without /fp:contract.
+#if defined(__GNUC__) && !defined(__clang__)
+#define NBODY_NO_FP_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define NBODY_NO_FP_CONTRACT
+#endif
+#if defined(__clang__)
+#define NBODY_NO_FP_CONTRACT_BODY _Pragma("clang fp contract(off)")
+#else
+#define NBODY_NO_FP_CONTRACT_BODY
+#endif
+
+//---------------------------------------------------------------------------//
+// Instruction set paths, ordered from the slowest to the fastest:
+//---------------------------------------------------------------------------//
+enum NBodyIsa : uint32_t {
+  NBodyIsaScalar = 0, // Portable reference (exact 1/sqrt)
+  NBodyIsaSse42,      // 4 j-bodies per instruction
+  NBodyIsaAvx2,       // 8 j-bodies per instruction (AVX2 + FMA)
+  NBodyIsaAvx512,     // 16 j-bodies per instruction (AVX-512F)
+  NBodyIsaCount
+};
+
+// Conventional flop count of one body-body interaction (as used by most
+// published n-body GFLOP/s figures: 3 sub, 3 fma, rsqrt, 3 mul, 3 fma).
+static constexpr double NBodyFlopsPerInteraction = 20.0;
+
+//---------------------------------------------------------------------------//
+// Precision of the direct sum (same choices as the accummode and posformat
+// defines of nBodyGravityCS.hlsl):
+//---------------------------------------------------------------------------//
+enum NBodyAccumulation : uint32_t {
+  NBodyAccumFloat = 0, // float32 throughout, like CSMain
+  NBodyAccumKahan,     // float32 tiles, compensated float32 sum of the tiles
+  NBodyAccumDouble,    // float32 tiles, float64 sum of the tiles
+  NBodyAccumCount
+};
+
+// Storage of the source positions the kernels load (the targets and the
+// masses stay float32). The 16-bit formats are packed once per evaluation
+// (nbodyPackPositions) and halve the position bandwidth of the tiles.
+enum NBodyPosFormat : uint32_t {
+  NBodyPosFloat32 = 0,
+  NBodyPosFloat16,  // IEEE half, 11 significant bits, saturates at 65504
+  NBodyPosBFloat16, // Upper half of a float32, 8 significant bits
+  NBodyPosFormatCount
+};
+
+// Sources per tile of the compensated accumulations: each lane of a vector
+// kernel sums at most 64 terms in float32 before the tile is folded in.
+static constexpr uint32_t NBodyAccumTileSize = 256;
+
+// Partial sums of the deterministic force kernels: source j always goes to
+// lane j % 16 whatever the vector width, and the lanes are folded in a fixed
+// pairwise order (nbodyDeterministicFold).
+static constexpr uint32_t NBodyDeterministicLanes = 16;
+
+//---------------------------------------------------------------------------//
+// Kernel arguments, all arrays are Structure-of-Arrays:
+//---------------------------------------------------------------------------//
+struct NBodyForceArgs {
+  // Source bodies (the "j" loop of CSMain), m_SrcMass is m_Position.w.
+  // m_SrcCount is a multiple of NBodySimdWidth (nbodyPadCount), the bodies
+  // past the real ones having zero mass, so the vector kernels need neither
+  // a remainder loop nor a correction (like the tiles of CSMain).
+  const float* m_SrcX;
+  const float* m_SrcY;
+  const float* m_SrcZ;
+  const float* m_SrcMass;
+  uint32_t m_SrcCount;
+
+  // Target bodies (one CS thread each), [m_DstBegin, m_DstEnd)
+  const float* m_DstX;
+  const float* m_DstY;
+  const float* m_DstZ;
+  uint32_t m_DstBegin;
+  uint32_t m_DstEnd;
+
+  // Output accelerations, indexed like the targets
+  float* m_AccelX;
+  float* m_AccelY;
+  float* m_AccelZ;
+
+  // Applied once to the mass weighted sums: NBodyG, or 1 for partial sums
+  // scaled by the caller.
+  float m_G;
+
+  // Zeroed args are float32 throughout. The 16-bit formats read the source
+  // positions from m_SrcPacked (x, y, z) instead of m_SrcX/Y/Z and round the
+  // targets the same way (nbodyRoundPosition).
+  NBodyAccumulation m_Accumulation;
+  NBodyPosFormat m_PosFormat;
+  const uint16_t* m_SrcPacked[3];
+};
+
+typedef void (*NBodyForceKernel)(const NBodyForceArgs*);
+
+//---------------------------------------------------------------------------//
+// Sum of the float32 tile partials of one acceleration component. With
+// NBodyAccumFloat there is a single tile and the sum is that tile.
+struct NBodyTileSum {
+  float m_Sum;
+  float m_Compensation; // NBodyAccumKahan: low order bits lost by m_Sum
+  double m_Double;      // NBodyAccumDouble
+};
+
+inline void nbodyTileSumAdd(
+    NBodyTileSum* p_Sum, NBodyAccumulation p_Accumulation, float p_Partial) {
+  if (p_Accumulation == NBodyAccumDouble) {
+    p_Sum->m_Double += p_Partial;
+  } else if (p_Accumulation == NBodyAccumKahan) {
+    const float y = p_Partial - p_Sum->m_Compensation;
+    const float t = p_Sum->m_Sum + y;
+    p_Sum->m_Compensation = (t - p_Sum->m_Sum) - y;
+    p_Sum->m_Sum = t;
+  } else {
+    p_Sum->m_Sum += p_Partial;
+  }
+}
+
+inline float nbodyTileSumScaled(
+    const NBodyTileSum& p_Sum, NBodyAccumulation p_Accumulation, float p_G) {
+  return p_Accumulation == NBodyAccumDouble ? float(p_Sum.m_Double * p_G)
+                                            : p_Sum.m_Sum * p_G;
+}
+
+//---------------------------------------------------------------------------//
+// Sum of the NBodyDeterministicLanes partial sums of p_Lanes (overwritten),
+// halving the lanes at each step: the same additions in the same order on
+// every path.
+inline float nbodyDeterministicFold(float* p_Lanes) {
+  for (uint32_t width = NBodyDeterministicLanes / 2; width > 0; width /= 2) {
+    for (uint32_t l = 0; l < width; ++l) {
+      p_Lanes[l] += p_Lanes[l + width];
+    }
+  }
+  return p_Lanes[0];
+}
+//---------------------------------------------------------------------------//
+// 16-bit position formats, rounded to nearest even. Half has no inf or NaN
+// here (saturated), which lets nbodyHalfToFloat skip them: the magnitude
+// bits are moved into a float32 and rescaled by 2^112 (the difference of the
+// exponent biases), which also normalizes the denormals.
+//---------------------------------------------------------------------------//
+inline uint16_t nbodyFloatToHalf(float p_Value) {
+  uint32_t bits;
+  memcpy(&bits, &p_Value, 4);
+  const uint32_t sign = (bits >> 16) & 0x8000u;
+  bits &= 0x7fffffffu;
+  if (bits >= 0x477ff000u) // Rounds past 65504 (or NaN)
+    return uint16_t(sign | 0x7bffu);
+  if (bits < 0x38800000u) { // Below 2^-14: a denormal, in units of 2^-24
+    float magnitude;
+    memcpy(&magnitude, &bits, 4);
+    return uint16_t(sign | uint32_t(lrintf(magnitude * 0x1p24f)));
+  }
+  const uint32_t rounded = bits + 0xfffu + ((bits >> 13) & 1u);
+  return uint16_t(sign | ((rounded - 0x38000000u) >> 13));
+}
+
+inline float nbodyHalfToFloat(uint16_t p_Half) {
+  const uint32_t bits = uint32_t(p_Half & 0x7fffu) << 13;
+  float value;
+  memcpy(&value, &bits, 4);
+  value *= 0x1p112f;
+  return (p_Half & 0x8000u) != 0 ? -value : value;
+}
+
+inline uint16_t nbodyFloatToBf16(float p_Value) {
+  uint32_t bits;
+  memcpy(&bits, &p_Value, 4);
+  return uint16_t((bits + 0x7fffu + ((bits >> 16) & 1u)) >> 16);
+}
+
+inline float nbodyBf16ToFloat(uint16_t p_Bf16) {
+  const uint32_t bits = uint32_t(p_Bf16) << 16;
+  float value;
+  memcpy(&value, &bits, 4);
+  return value;
+}
+
+// Targets are rounded like the sources, so that a body still sees itself at
+// a distance of exactly zero (a rounding residue under the softening length
+// would dominate its acceleration).
+inline float nbodyRoundPosition(float p_Value, NBodyPosFormat p_Format) {
+  switch (p_Format) {
+  case NBodyPosFloat16:
+    return nbodyHalfToFloat(nbodyFloatToHalf(p_Value));
+  case NBodyPosBFloat16:
+    return nbodyBf16ToFloat(nbodyFloatToBf16(p_Value));
+  default:
+    return p_Value;
+  }
+}
+
+// Compile-time variants of the vector force kernel, every ISA instantiates
+// all of them: m_Targets targets share each source load (register blocking)
+// and m_Unroll source vectors per target are in flight (independent
+// accumulators). The first one is the plain loop, the fastest depends on the
+// register count and FMA latency of the cpu (see NBodyKernelTuner.hpp).
+struct NBodyForceVariant {
+  uint32_t m_Targets;
+  uint32_t m_Unroll;
+};
+static constexpr uint32_t NBodyForceVariantCount = 6;
+static constexpr NBodyForceVariant NBodyForceVariants[NBodyForceVariantCount] =
+    {{1, 1}, {2, 1}, {4, 1}, {1, 2}, {2, 2}, {4, 2}};
+
+//---------------------------------------------------------------------------//
+// Far field of a tree solver: accepted cells (multipoles) acting on targets.
+//---------------------------------------------------------------------------//
+struct NBodyCellArgs {
+  // Cells: center of mass, mass (sum of m_Position.w) and traceless
+  // quadrupole (xx, yy, zz, xy, xz, yz). A null m_Quad[0] skips the
+  // quadrupole term.
+  const float* m_ComX;
+  const float* m_ComY;
+  const float* m_ComZ;
+  const float* m_CellMass;
+  const float* m_Quad[6];
+  uint32_t m_CellCount;
+
+  // Targets [0, m_DstCount)
+  const float* m_DstX;
+  const float* m_DstY;
+  const float* m_DstZ;
+  uint32_t m_DstCount;
+
+  // Accumulated (+=) and, unlike NBodyForceArgs, not scaled by NBodyG
+  float* m_AccelX;
+  float* m_AccelY;
+  float* m_AccelZ;
+};
+
+typedef void (*NBodyCellKernel)(const NBodyCellArgs*);
+
+//---------------------------------------------------------------------------//
+// Symmetric direct sum: every pair (i, j) of two tiles is computed once and
+// applied to both bodies with opposite signs (Newton's third law).
+//---------------------------------------------------------------------------//
+struct NBodyPairArgs {
+  // Positions and masses of all the bodies, the tiles index into them.
+  const float* m_PosX;
+  const float* m_PosY;
+  const float* m_PosZ;
+  const float* m_Mass;
+
+  // Tiles [m_BeginI, m_EndI) and [m_BeginJ, m_EndJ), either disjoint or the
+  // same range (diagonal tile, only the pairs i < j are computed).
+  uint32_t m_BeginI;
+  uint32_t m_EndI;
+  uint32_t m_BeginJ;
+  uint32_t m_EndJ;
+
+  // Accumulated (+=) at both i and j, each weighted by the mass of the
+  // other body but, like NBodyCellArgs, not scaled by NBodyG. Indexed like
+  // the positions.
+  float* m_AccelX;
+  float* m_AccelY;
+  float* m_AccelZ;
+};
+
+typedef void (*NBodyPairKernel)(const NBodyPairArgs*);
+
+//---------------------------------------------------------------------------//
+// Direct sum of the acceleration and its time derivative (jerk) for Hermite
+// integration. Arrays are indexed by axis (x, y, z).
+//---------------------------------------------------------------------------//
+struct NBodyJerkArgs {
+  // Source bodies, padded with zero mass bodies like NBodyForceArgs
+  const float* m_SrcPos[3];
+  const float* m_SrcVel[3];
+  const float* m_SrcMass;
+  uint32_t m_SrcCount;
+
+  // Target bodies [m_DstBegin, m_DstEnd)
+  const float* m_DstPos[3];
+  const float* m_DstVel[3];
+  uint32_t m_DstBegin;
+  uint32_t m_DstEnd;
+
+  // Overwritten and scaled by m_G like NBodyForceArgs
+  float* m_Accel[3];
+  float* m_Jerk[3];
+
+  float m_G;
+};
+
+typedef void (*NBodyJerkKernel)(const NBodyJerkArgs*);
+
+//---------------------------------------------------------------------------//
+// Multipole to local translations of the FMM (NBodyFmm.cpp), in double
+// precision over NBodyM2LLanes cell pairs at once, one kernel per expansion
+// order. The arrays hold one row of NBodyM2LLanes values per coefficient:
+// p[i * NBodyM2LLanes + lane].
+//---------------------------------------------------------------------------//
+static constexpr uint32_t NBodyM2LLanes = 8;
+static constexpr uint32_t NBodyM2LMaxOrder = 8;
+
+// Coefficients of an expansion of order p_Order: the multi-indices (x, y, z)
+// with x + y + z <= p_Order.
+constexpr uint32_t nbodyFmmCoefCount(uint32_t p_Order) {
+  return (p_Order + 1) * (p_Order + 2) * (p_Order + 3) / 6;
+}
+// Coefficient of (x, y, z): sorted by degree, then by decreasing x and y, so
+// that the coefficients of an order are a prefix of those of the next ones.
+constexpr uint32_t
+nbodyFmmCoefIndex(uint32_t p_X, uint32_t p_Y, uint32_t p_Z) {
+  const uint32_t degree = p_X + p_Y + p_Z;
+  const uint32_t first = degree > 0 ? nbodyFmmCoefCount(degree - 1) : 0;
+  const uint32_t higherX = (degree - p_X) * (degree - p_X + 1) / 2;
+  return first + higherX + (degree - p_X - p_Y);
+}
+
+struct NBodyM2LArgs {
+  const double* m_R;          // Target minus source centers, rows x, y, z
+  const double* m_Multipoles; // Of the sources, around their centers
+  double* m_Locals;           // Of the targets, accumulated
+};
+
+typedef void (*NBodyM2LKernel)(const NBodyM2LArgs*);
+
+//---------------------------------------------------------------------------//
+// Bit packing of the quantized trajectory codec (NBodyQuantCodec.hpp): the
+// values go in blocks of NBodyPackBlock, each stored as its width w (bits of
+// its largest value) and w words, word b holding bit b of the whole block
+// (bit slices, a vector compare or movemask per word).
+//---------------------------------------------------------------------------//
+static constexpr uint32_t NBodyPackBlock = 32;
+
+// Bits needed for p_Value, 0 for 0.
+inline uint32_t nbodyBitWidth(uint32_t p_Value) {
+#if defined(_MSC_VER)
+  unsigned long index = 0;
+  return _BitScanReverse(&index, p_Value) ? uint32_t(index) + 1 : 0;
+#else
+  return p_Value != 0 ? 32 - uint32_t(__builtin_clz(p_Value)) : 0;
+#endif
+}
+
+// Packs p_BlockCount blocks of p_Values into p_Widths (a byte per block) and
+// p_Words (at most NBodyPackBlock per block), returns the words written.
+typedef size_t (*NBodyPackKernel)(
+    const uint32_t* p_Values,
+    uint32_t p_BlockCount,
+    uint8_t* p_Widths,
+    uint32_t* p_Words);
+// Inverse of NBodyPackKernel, the caller checks that the widths are at most
+// 32 and that their sum of words is there. Returns the words read.
+typedef size_t (*NBodyUnpackKernel)(
+    const uint8_t* p_Widths,
+    const uint32_t* p_Words,
+    uint32_t p_BlockCount,
+    uint32_t* p_Values);
+
+// Grid cells of the quantized trajectories: round((p_Positions[p_Ids[k]] -
+// p_Origin) * p_InvSpacing) in double precision, to nearest even (p_Ids
+// nullptr: p_Positions[k]), and p_Range (low, high) widened to them. False
+// unless the range is within p_Limit in magnitude (a position that is not
+// finite fails too), the cells are undefined then. Same bits on every ISA.
+typedef bool (*NBodyQuantizeKernel)(
+    const float* p_Positions,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_InvSpacing,
+    int32_t p_Limit,
+    int32_t* p_Cells,
+    int32_t* p_Range);
+// Zigzagged residuals of the linear prediction: the cell minus its last
+// value (p_Previous) and its last change (p_Change), both then updated.
+// Wrapping uint32 arithmetic.
+typedef void (*NBodyPredictKernel)(
+    const int32_t* p_Cells,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change,
+    uint32_t* p_Values);
+// Inverse of NBodyPredictKernel, the cells are left in p_Previous.
+typedef void (*NBodyUnpredictKernel)(
+    const uint32_t* p_Values,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change);
+// Inverse of NBodyQuantizeKernel: float(p_Origin + p_Cells[k] * p_Spacing)
+// in double precision, stored at p_Positions[p_Ids[k]].
+typedef void (*NBodyDequantizeKernel)(
+    const int32_t* p_Cells,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_Spacing,
+    float* p_Positions);
+
+//---------------------------------------------------------------------------//
+// Returns the fastest path supported by the cpu and the os.
+NBodyIsa nbodyDetectIsa();
+//---------------------------------------------------------------------------//
+bool nbodyIsaSupported(NBodyIsa p_Isa);
+//---------------------------------------------------------------------------//
+const char* nbodyIsaName(NBodyIsa p_Isa);
+//---------------------------------------------------------------------------//
+// Brand string of the cpu (CPUID), "unknown" on other architectures.
+const char* nbodyCpuBrand();
+//---------------------------------------------------------------------------//
+// The selected variant of the force kernel of p_Isa.
+NBodyForceKernel nbodyGetForceKernel(NBodyIsa p_Isa);
+//---------------------------------------------------------------------------//
+// Force kernel whose results are the same bits on every ISA (hence cpu): only
+// correctly rounded operations (no FMA, 1 / sqrt instead of the estimates)
+// over NBodyDeterministicLanes partial sums. It ignores the precision fields
+// of NBodyForceArgs (float32 throughout).
+NBodyForceKernel nbodyGetDeterministicKernel(NBodyIsa p_Isa);
+//---------------------------------------------------------------------------//
+// Number of distinct variants of p_Isa: NBodyForceVariantCount for the vector
+// paths, 1 for the scalar one.
+uint32_t nbodyForceVariantCount(NBodyIsa p_Isa);
+//---------------------------------------------------------------------------//
+NBodyForceKernel nbodyGetForceVariant(NBodyIsa p_Isa, uint32_t p_Variant);
+//---------------------------------------------------------------------------//
+// Variant returned by nbodyGetForceKernel from now on (0 until then). Not
+// synchronized, to be called before the engine runs.
+void nbodySelectForceVariant(NBodyIsa p_Isa, uint32_t p_Variant);
+//---------------------------------------------------------------------------//
+uint32_t nbodySelectedForceVariant(NBodyIsa p_Isa);
+//---------------------------------------------------------------------------//
+const char* nbodyAccumulationName(NBodyAccumulation p_Accumulation);
+//---------------------------------------------------------------------------//
+const char* nbodyPosFormatName(NBodyPosFormat p_Format);
+//---------------------------------------------------------------------------//
+// Converts p_Count floats of p_Src to the 16-bit p_Format into p_Dst.
+void nbodyPackPositions(
+    const float* p_Src,
+    uint16_t* p_Dst,
+    uint32_t p_Count,
+    NBodyPosFormat p_Format);
+//---------------------------------------------------------------------------//
+NBodyCellKernel nbodyGetCellKernel(NBodyIsa p_Isa);
+//---------------------------------------------------------------------------//
+NBodyPairKernel nbodyGetPairKernel(NBodyIsa p_Isa);
+//---------------------------------------------------------------------------//
+NBodyJerkKernel nbodyGetJerkKernel(NBodyIsa p_Isa);
+//---------------------------------------------------------------------------//
+// p_Order in [1, NBodyM2LMaxOrder]
+NBodyM2LKernel nbodyGetM2LKernel(NBodyIsa p_Isa, uint32_t p_Order);
+//---------------------------------------------------------------------------//
+// Pair and jerk kernels of the deterministic mode: the scalar ones, which sum
+// the sources in order without FMA, so the same bits on every ISA.
+NBodyPairKernel nbodyGetDeterministicPairKernel();
+//---------------------------------------------------------------------------//
+NBodyJerkKernel nbodyGetDeterministicJerkKernel();
+//---------------------------------------------------------------------------//
+NBodyPackKernel nbodyGetPackKernel(NBodyIsa p_Isa);
+//---------------------------------------------------------------------------//
+NBodyUnpackKernel nbodyGetUnpackKernel(NBodyIsa p_Isa);
+//---------------------------------------------------------------------------//
+NBodyQuantizeKernel nbodyGetQuantizeKernel(NBodyIsa p_Isa);
+//---------------------------------------------------------------------------//
+NBodyPredictKernel nbodyGetPredictKernel(NBodyIsa p_Isa);
+//---------------------------------------------------------------------------//
+NBodyUnpredictKernel nbodyGetUnpredictKernel(NBodyIsa p_Isa);
+//---------------------------------------------------------------------------//
+NBodyDequantizeKernel nbodyGetDequantizeKernel(NBodyIsa p_Isa);
+//---------------------------------------------------------------------------//
+// Per-ISA entry points (implemented in NBodyKernels*.cpp):
+void nbodyForceKernelScalar(const NBodyForceArgs* p_Args);
+void nbodyForceKernelSse42(const NBodyForceArgs* p_Args);
+void nbodyForceKernelAvx2(const NBodyForceArgs* p_Args);
+void nbodyForceKernelAvx512(const NBodyForceArgs* p_Args);
+// Fill p_Kernels[NBodyForceVariantCount] in the order of NBodyForceVariants.
+void nbodyForceVariantsSse42(NBodyForceKernel* p_Kernels);
+void nbodyForceVariantsAvx2(NBodyForceKernel* p_Kernels);
+void nbodyForceVariantsAvx512(NBodyForceKernel* p_Kernels);
+void nbodyDeterministicKernelScalar(const NBodyForceArgs* p_Args);
+void nbodyDeterministicKernelSse42(const NBodyForceArgs* p_Args);
+void nbodyDeterministicKernelAvx2(const NBodyForceArgs* p_Args);
+void nbodyDeterministicKernelAvx512(const NBodyForceArgs* p_Args);
+void nbodyCellKernelScalar(const NBodyCellArgs* p_Args);
+void nbodyCellKernelSse42(const NBodyCellArgs* p_Args);
+void nbodyCellKernelAvx2(const NBodyCellArgs* p_Args);
+void nbodyCellKernelAvx512(const NBodyCellArgs* p_Args);
+void nbodyPairKernelScalar(const NBodyPairArgs* p_Args);
+void nbodyPairKernelSse42(const NBodyPairArgs* p_Args);
+void nbodyPairKernelAvx2(const NBodyPairArgs* p_Args);
+void nbodyPairKernelAvx512(const NBodyPairArgs* p_Args);
+void nbodyJerkKernelScalar(const NBodyJerkArgs* p_Args);
+void nbodyJerkKernelSse42(const NBodyJerkArgs* p_Args);
+void nbodyJerkKernelAvx2(const NBodyJerkArgs* p_Args);
+void nbodyJerkKernelAvx512(const NBodyJerkArgs* p_Args);
+// Fill p_Kernels[NBodyM2LMaxOrder], order p at p - 1.
+void nbodyM2LKernelsScalar(NBodyM2LKernel* p_Kernels);
+void nbodyM2LKernelsSse42(NBodyM2LKernel* p_Kernels);
+void nbodyM2LKernelsAvx2(NBodyM2LKernel* p_Kernels);
+void nbodyM2LKernelsAvx512(NBodyM2LKernel* p_Kernels);
+size_t nbodyPackKernelScalar(
+    const uint32_t* p_Values,
+    uint32_t p_BlockCount,
+    uint8_t* p_Widths,
+    uint32_t* p_Words);
+size_t nbodyPackKernelSse42(
+    const uint32_t* p_Values,
+    uint32_t p_BlockCount,
+    uint8_t* p_Widths,
+    uint32_t* p_Words);
+size_t nbodyPackKernelAvx2(
+    const uint32_t* p_Values,
+    uint32_t p_BlockCount,
+    uint8_t* p_Widths,
+    uint32_t* p_Words);
+size_t nbodyPackKernelAvx512(
+    const uint32_t* p_Values,
+    uint32_t p_BlockCount,
+    uint8_t* p_Widths,
+    uint32_t* p_Words);
+size_t nbodyUnpackKernelScalar(
+    const uint8_t* p_Widths,
+    const uint32_t* p_Words,
+    uint32_t p_BlockCount,
+    uint32_t* p_Values);
+size_t nbodyUnpackKernelSse42(
+    const uint8_t* p_Widths,
+    const uint32_t* p_Words,
+    uint32_t p_BlockCount,
+    uint32_t* p_Values);
+size_t nbodyUnpackKernelAvx2(
+    const uint8_t* p_Widths,
+    const uint32_t* p_Words,
+    uint32_t p_BlockCount,
+    uint32_t* p_Values);
+size_t nbodyUnpackKernelAvx512(
+    const uint8_t* p_Widths,
+    const uint32_t* p_Words,
+    uint32_t p_BlockCount,
+    uint32_t* p_Values);
+bool nbodyQuantizeKernelScalar(
+    const float* p_Positions,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_InvSpacing,
+    int32_t p_Limit,
+    int32_t* p_Cells,
+    int32_t* p_Range);
+bool nbodyQuantizeKernelSse42(
+    const float* p_Positions,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_InvSpacing,
+    int32_t p_Limit,
+    int32_t* p_Cells,
+    int32_t* p_Range);
+bool nbodyQuantizeKernelAvx2(
+    const float* p_Positions,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_InvSpacing,
+    int32_t p_Limit,
+    int32_t* p_Cells,
+    int32_t* p_Range);
+bool nbodyQuantizeKernelAvx512(
+    const float* p_Positions,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_InvSpacing,
+    int32_t p_Limit,
+    int32_t* p_Cells,
+    int32_t* p_Range);
+void nbodyPredictKernelScalar(
+    const int32_t* p_Cells,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change,
+    uint32_t* p_Values);
+void nbodyPredictKernelSse42(
+    const int32_t* p_Cells,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change,
+    uint32_t* p_Values);
+void nbodyPredictKernelAvx2(
+    const int32_t* p_Cells,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change,
+    uint32_t* p_Values);
+void nbodyPredictKernelAvx512(
+    const int32_t* p_Cells,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change,
+    uint32_t* p_Values);
+void nbodyUnpredictKernelScalar(
+    const uint32_t* p_Values,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change);
+void nbodyUnpredictKernelSse42(
+    const uint32_t* p_Values,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change);
+void nbodyUnpredictKernelAvx2(
+    const uint32_t* p_Values,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change);
+void nbodyUnpredictKernelAvx512(
+    const uint32_t* p_Values,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change);
+void nbodyDequantizeKernelScalar(
+    const int32_t* p_Cells,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_Spacing,
+    float* p_Positions);
+void nbodyDequantizeKernelSse42(
+    const int32_t* p_Cells,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_Spacing,
+    float* p_Positions);
+void nbodyDequantizeKernelAvx2(
+    const int32_t* p_Cells,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_Spacing,
+    float* p_Positions);
+void nbodyDequantizeKernelAvx512(
+    const int32_t* p_Cells,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_Spacing,
+    float* p_Positions);
+//---------------------------------------------------------------------------//
@@ -0,0 +1,449 @@
+#include "NBodyCpu.hpp"
+#include <math.h>
+#include <utility>
+
+#if NBODY_X86
+#include <immintrin.h>
+
+// Everything below is compiled for AVX2 + FMA, the dispatcher in
+// NBodyKernels.cpp only calls into it after checking CPUID and XGETBV.
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+
+//---------------------------------------------------------------------------//
+namespace {
+struct VecAvx2 {
+  using Type = __m256;
+  static constexpr uint32_t Width = 8;
+
+  static Type zero() { return _mm256_setzero_ps(); }
+  static Type set1(float p_Val) { return _mm256_set1_ps(p_Val); }
+  static Type load(const float* p_Ptr) { return _mm256_loadu_ps(p_Ptr); }
+  static void store(float* p_Ptr, Type p_A) { _mm256_storeu_ps(p_Ptr, p_A); }
+  // Same as VecSse42 (F16C is not part of the checked features).
+  static Type loadHalf(const uint16_t* p_Ptr) {
+    const __m256i h = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p_Ptr)));
+    const __m256i magnitude =
+        _mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(0x7fff)), 13);
+    const __m256i sign =
+        _mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(0x8000)), 16);
+    const Type value = _mm256_mul_ps(
+        _mm256_castsi256_ps(magnitude), _mm256_set1_ps(0x1p112f));
+    return _mm256_or_ps(value, _mm256_castsi256_ps(sign));
+  }
+  static Type loadBf16(const uint16_t* p_Ptr) {
+    const __m256i h = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p_Ptr)));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(h, 16));
+  }
+  static Type add(Type p_A, Type p_B) { return _mm256_add_ps(p_A, p_B); }
+  static Type sub(Type p_A, Type p_B) { return _mm256_sub_ps(p_A, p_B); }
+  static Type mul(Type p_A, Type p_B) { return _mm256_mul_ps(p_A, p_B); }
+  static Type div(Type p_A, Type p_B) { return _mm256_div_ps(p_A, p_B); }
+  static Type sqrt(Type p_A) { return _mm256_sqrt_ps(p_A); }
+  static Type fmadd(Type p_A, Type p_B, Type p_C) {
+    return _mm256_fmadd_ps(p_A, p_B, p_C);
+  }
+  // 12-bit estimate refined with one Newton-Raphson step:
+  // y = y * (1.5 - 0.5 * x * y * y)
+  static Type rsqrt(Type p_X) {
+    Type y = _mm256_rsqrt_ps(p_X);
+    Type halfX = _mm256_mul_ps(p_X, _mm256_set1_ps(0.5f));
+    Type yy = _mm256_mul_ps(y, y);
+    return _mm256_mul_ps(y, _mm256_fnmadd_ps(halfX, yy, _mm256_set1_ps(1.5f)));
+  }
+  static float hsum(Type p_A) {
+    __m128 lo = _mm256_castps256_ps128(p_A);
+    __m128 hi = _mm256_extractf128_ps(p_A, 1);
+    lo = _mm_add_ps(lo, hi);
+    __m128 shuf = _mm_movehdup_ps(lo);
+    __m128 sums = _mm_add_ps(lo, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+  }
+};
+
+// Doubles of the FMM translations.
+struct VecAvx2Double {
+  using Type = __m256d;
+  static constexpr uint32_t Width = 4;
+
+  static Type zero() { return _mm256_setzero_pd(); }
+  static Type set1(double p_Val) { return _mm256_set1_pd(p_Val); }
+  static Type load(const double* p_Ptr) { return _mm256_loadu_pd(p_Ptr); }
+  static void store(double* p_Ptr, Type p_A) { _mm256_storeu_pd(p_Ptr, p_A); }
+  static Type mul(Type p_A, Type p_B) { return _mm256_mul_pd(p_A, p_B); }
+  static Type div(Type p_A, Type p_B) { return _mm256_div_pd(p_A, p_B); }
+  static Type sqrt(Type p_A) { return _mm256_sqrt_pd(p_A); }
+  static Type fmadd(Type p_A, Type p_B, Type p_C) {
+    return _mm256_fmadd_pd(p_A, p_B, p_C);
+  }
+};
+} // namespace
+
+#include "NBodyM2LKernel.hpp"
+#include "NBodySimdKernel.hpp"
+
+//---------------------------------------------------------------------------//
+void nbodyForceKernelAvx2(const NBodyForceArgs* p_Args) {
+  _simdForceKernel<VecAvx2, 1, 1>(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyForceVariantsAvx2(NBodyForceKernel* p_Kernels) {
+  _simdForceVariants<VecAvx2>(
+      p_Kernels, std::make_index_sequence<NBodyForceVariantCount>());
+}
+//---------------------------------------------------------------------------//
+void nbodyDeterministicKernelAvx2(const NBodyForceArgs* p_Args) {
+  _simdDeterministicKernel<VecAvx2>(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyCellKernelAvx2(const NBodyCellArgs* p_Args) {
+  _simdCellKernel<VecAvx2>(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyPairKernelAvx2(const NBodyPairArgs* p_Args) {
+  _simdPairKernel<VecAvx2>(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyJerkKernelAvx2(const NBodyJerkArgs* p_Args) {
+  _simdJerkKernel<VecAvx2>(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyM2LKernelsAvx2(NBodyM2LKernel* p_Kernels) {
+  _m2lKernels<VecAvx2Double>(
+      p_Kernels, std::make_index_sequence<NBodyM2LMaxOrder>());
+}
+//---------------------------------------------------------------------------//
+// Bit b of every lane is shifted into its sign and gathered by movemask.
+size_t nbodyPackKernelAvx2(
+    const uint32_t* p_Values,
+    uint32_t p_BlockCount,
+    uint8_t* p_Widths,
+    uint32_t* p_Words) {
+  uint32_t* words = p_Words;
+  for (uint32_t b = 0; b < p_BlockCount; ++b) {
+    const uint32_t* values = p_Values + size_t(b) * NBodyPackBlock;
+    __m256i v[4];
+    __m256i any = _mm256_setzero_si256();
+    for (uint32_t j = 0; j < 4; ++j) {
+      v[j] = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(values + 8 * j));
+      any = _mm256_or_si256(any, v[j]);
+    }
+    __m128i half = _mm_or_si128(
+        _mm256_castsi256_si128(any), _mm256_extracti128_si256(any, 1));
+    half = _mm_or_si128(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+    half = _mm_or_si128(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+    const uint32_t width = nbodyBitWidth(uint32_t(_mm_cvtsi128_si32(half)));
+    p_Widths[b] = uint8_t(width);
+    for (uint32_t bit = 0; bit < width; ++bit) {
+      const __m128i shift = _mm_cvtsi32_si128(int(31 - bit));
+      uint32_t word = 0;
+      for (uint32_t j = 0; j < 4; ++j) {
+        const __m256 sign = _mm256_castsi256_ps(_mm256_sll_epi32(v[j], shift));
+        word |= uint32_t(_mm256_movemask_ps(sign)) << (8 * j);
+      }
+      *words++ = word;
+    }
+  }
+  return size_t(words - p_Words);
+}
+//---------------------------------------------------------------------------//
+// Each word is broadcast and compared with the bit of every lane.
+size_t nbodyUnpackKernelAvx2(
+    const uint8_t* p_Widths,
+    const uint32_t* p_Words,
+    uint32_t p_BlockCount,
+    uint32_t* p_Values) {
+  __m256i lanes[4];
+  for (uint32_t j = 0; j < 4; ++j) {
+    lanes[j] = _mm256_sll_epi32(
+        _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128),
+        _mm_cvtsi32_si128(int(8 * j)));
+  }
+  const uint32_t* words = p_Words;
+  for (uint32_t b = 0; b < p_BlockCount; ++b) {
+    __m256i v[4];
+    for (uint32_t j = 0; j < 4; ++j) {
+      v[j] = _mm256_setzero_si256();
+    }
+    for (uint32_t bit = 0; bit < p_Widths[b]; ++bit) {
+      const __m256i word = _mm256_set1_epi32(int(*words++));
+      const __m256i value = _mm256_set1_epi32(int(1u << bit));
+      for (uint32_t j = 0; j < 4; ++j) {
+        const __m256i set =
+            _mm256_cmpeq_epi32(_mm256_and_si256(word, lanes[j]), lanes[j]);
+        v[j] = _mm256_or_si256(v[j], _mm256_and_si256(set, value));
+      }
+    }
+    uint32_t* values = p_Values + size_t(b) * NBodyPackBlock;
+    for (uint32_t j = 0; j < 4; ++j) {
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(values + 8 * j), v[j]);
+    }
+  }
+  return size_t(words - p_Words);
+}
+//---------------------------------------------------------------------------//
+// Eight cells per iteration. The positions of p_Ids come from scalar loads,
+// vgatherdps is microcoded on the cpus with the GDS mitigation. The scalar
+// kernel finishes the range and checks it.
+bool nbodyQuantizeKernelAvx2(
+    const float* p_Positions,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_InvSpacing,
+    int32_t p_Limit,
+    int32_t* p_Cells,
+    int32_t* p_Range) {
+  const __m256d origin = _mm256_set1_pd(p_Origin);
+  const __m256d invSpacing = _mm256_set1_pd(p_InvSpacing);
+  __m256i low = _mm256_set1_epi32(p_Range[0]);
+  __m256i high = _mm256_set1_epi32(p_Range[1]);
+  uint32_t k = 0;
+  for (; k + 8 <= p_Count; k += 8) {
+    const __m256 positions = p_Ids != nullptr
+                                 ? _mm256_setr_ps(
+                                       p_Positions[p_Ids[k]],
+                                       p_Positions[p_Ids[k + 1]],
+                                       p_Positions[p_Ids[k + 2]],
+                                       p_Positions[p_Ids[k + 3]],
+                                       p_Positions[p_Ids[k + 4]],
+                                       p_Positions[p_Ids[k + 5]],
+                                       p_Positions[p_Ids[k + 6]],
+                                       p_Positions[p_Ids[k + 7]])
+                                 : _mm256_loadu_ps(p_Positions + k);
+    const __m256d front = _mm256_mul_pd(
+        _mm256_sub_pd(
+            _mm256_cvtps_pd(_mm256_castps256_ps128(positions)), origin),
+        invSpacing);
+    const __m256d back = _mm256_mul_pd(
+        _mm256_sub_pd(
+            _mm256_cvtps_pd(_mm256_extractf128_ps(positions, 1)), origin),
+        invSpacing);
+    const __m256i cells = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm256_cvtpd_epi32(front)),
+        _mm256_cvtpd_epi32(back),
+        1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p_Cells + k), cells);
+    low = _mm256_min_epi32(low, cells);
+    high = _mm256_max_epi32(high, cells);
+  }
+  __m128i lows = _mm_min_epi32(
+      _mm256_castsi256_si128(low), _mm256_extracti128_si256(low, 1));
+  __m128i highs = _mm_max_epi32(
+      _mm256_castsi256_si128(high), _mm256_extracti128_si256(high, 1));
+  lows = _mm_min_epi32(lows, _mm_shuffle_epi32(lows, _MM_SHUFFLE(1, 0, 3, 2)));
+  lows = _mm_min_epi32(lows, _mm_shuffle_epi32(lows, _MM_SHUFFLE(2, 3, 0, 1)));
+  highs =
+      _mm_max_epi32(highs, _mm_shuffle_epi32(highs, _MM_SHUFFLE(1, 0, 3, 2)));
+  highs =
+      _mm_max_epi32(highs, _mm_shuffle_epi32(highs, _MM_SHUFFLE(2, 3, 0, 1)));
+  p_Range[0] = _mm_cvtsi128_si32(lows);
+  p_Range[1] = _mm_cvtsi128_si32(highs);
+  return nbodyQuantizeKernelScalar(
+      p_Ids != nullptr ? p_Positions : p_Positions + k,
+      p_Ids != nullptr ? p_Ids + k : nullptr,
+      p_Count - k,
+      p_Origin,
+      p_InvSpacing,
+      p_Limit,
+      p_Cells + k,
+      p_Range);
+}
+//---------------------------------------------------------------------------//
+void nbodyPredictKernelAvx2(
+    const int32_t* p_Cells,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change,
+    uint32_t* p_Values) {
+  uint32_t k = 0;
+  for (; k + 8 <= p_Count; k += 8) {
+    const __m256i cell =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p_Cells + k));
+    __m256i* previous = reinterpret_cast<__m256i*>(p_Previous + k);
+    __m256i* change = reinterpret_cast<__m256i*>(p_Change + k);
+    const __m256i delta = _mm256_sub_epi32(cell, _mm256_loadu_si256(previous));
+    const __m256i residual =
+        _mm256_sub_epi32(delta, _mm256_loadu_si256(change));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(p_Values + k),
+        _mm256_xor_si256(
+            _mm256_slli_epi32(residual, 1), _mm256_srai_epi32(residual, 31)));
+    _mm256_storeu_si256(change, delta);
+    _mm256_storeu_si256(previous, cell);
+  }
+  nbodyPredictKernelScalar(
+      p_Cells + k, p_Count - k, p_Previous + k, p_Change + k, p_Values + k);
+}
+//---------------------------------------------------------------------------//
+void nbodyUnpredictKernelAvx2(
+    const uint32_t* p_Values,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change) {
+  const __m256i one = _mm256_set1_epi32(1);
+  uint32_t k = 0;
+  for (; k + 8 <= p_Count; k += 8) {
+    const __m256i value =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p_Values + k));
+    __m256i* previous = reinterpret_cast<__m256i*>(p_Previous + k);
+    __m256i* change = reinterpret_cast<__m256i*>(p_Change + k);
+    const __m256i residual = _mm256_xor_si256(
+        _mm256_srli_epi32(value, 1),
+        _mm256_sub_epi32(_mm256_setzero_si256(), _mm256_and_si256(value, one)));
+    const __m256i delta =
+        _mm256_add_epi32(_mm256_loadu_si256(change), residual);
+    _mm256_storeu_si256(change, delta);
+    _mm256_storeu_si256(
+        previous, _mm256_add_epi32(_mm256_loadu_si256(previous), delta));
+  }
+  nbodyUnpredictKernelScalar(
+      p_Values + k, p_Count - k, p_Previous + k, p_Change + k);
+}
+//---------------------------------------------------------------------------//
+// AVX2 has no scatter, the positions are stored one by one.
+NBODY_NO_FP_CONTRACT void nbodyDequantizeKernelAvx2(
+    const int32_t* p_Cells,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_Spacing,
+    float* p_Positions) {
+  NBODY_NO_FP_CONTRACT_BODY
+  const __m256d origin = _mm256_set1_pd(p_Origin);
+  const __m256d spacing = _mm256_set1_pd(p_Spacing);
+  uint32_t k = 0;
+  for (; k + 8 <= p_Count; k += 8) {
+    const __m256i cells =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p_Cells + k));
+    const __m256d low = _mm256_add_pd(
+        origin,
+        _mm256_mul_pd(
+            _mm256_cvtepi32_pd(_mm256_castsi256_si128(cells)), spacing));
+    const __m256d high = _mm256_add_pd(
+        origin,
+        _mm256_mul_pd(
+            _mm256_cvtepi32_pd(_mm256_extracti128_si256(cells, 1)), spacing));
+    alignas(32) float positions[8];
+    _mm_store_ps(positions, _mm256_cvtpd_ps(low));
+    _mm_store_ps(positions + 4, _mm256_cvtpd_ps(high));
+    for (uint32_t j = 0; j < 8; ++j) {
+      p_Positions[p_Ids[k + j]] = positions[j];
+    }
+  }
+  nbodyDequantizeKernelScalar(
+      p_Cells + k, p_Ids + k, p_Count - k, p_Origin, p_Spacing, p_Positions);
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#else
+//---------------------------------------------------------------------------//
+void nbodyForceKernelAvx2(const NBodyForceArgs* p_Args) {
+  nbodyForceKernelScalar(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyForceVariantsAvx2(NBodyForceKernel* p_Kernels) {
+  for (uint32_t v = 0; v < NBodyForceVariantCount; ++v) {
+    p_Kernels[v] = nbodyForceKernelScalar;
+  }
+}
+//---------------------------------------------------------------------------//
+void nbodyDeterministicKernelAvx2(const NBodyForceArgs* p_Args) {
+  nbodyDeterministicKernelScalar(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyCellKernelAvx2(const NBodyCellArgs* p_Args) {
+  nbodyCellKernelScalar(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyPairKernelAvx2(const NBodyPairArgs* p_Args) {
+  nbodyPairKernelScalar(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyJerkKernelAvx2(const NBodyJerkArgs* p_Args) {
+  nbodyJerkKernelScalar(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyM2LKernelsAvx2(NBodyM2LKernel* p_Kernels) {
+  nbodyM2LKernelsScalar(p_Kernels);
+}
+//---------------------------------------------------------------------------//
+size_t nbodyPackKernelAvx2(
+    const uint32_t* p_Values,
+    uint32_t p_BlockCount,
+    uint8_t* p_Widths,
+    uint32_t* p_Words) {
+  return nbodyPackKernelScalar(p_Values, p_BlockCount, p_Widths, p_Words);
+}
+//---------------------------------------------------------------------------//
+size_t nbodyUnpackKernelAvx2(
+    const uint8_t* p_Widths,
+    const uint32_t* p_Words,
+    uint32_t p_BlockCount,
+    uint32_t* p_Values) {
+  return nbodyUnpackKernelScalar(p_Widths, p_Words, p_BlockCount, p_Values);
+}
+//---------------------------------------------------------------------------//
+bool nbodyQuantizeKernelAvx2(
+    const float* p_Positions,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_InvSpacing,
+    int32_t p_Limit,
+    int32_t* p_Cells,
+    int32_t* p_Range) {
+  return nbodyQuantizeKernelScalar(
+      p_Positions,
+      p_Ids,
+      p_Count,
+      p_Origin,
+      p_InvSpacing,
+      p_Limit,
+      p_Cells,
+      p_Range);
+}
+//---------------------------------------------------------------------------//
+void nbodyPredictKernelAvx2(
+    const int32_t* p_Cells,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change,
+    uint32_t* p_Values) {
+  nbodyPredictKernelScalar(p_Cells, p_Count, p_Previous, p_Change, p_Values);
+}
+//---------------------------------------------------------------------------//
+void nbodyUnpredictKernelAvx2(
+    const uint32_t* p_Values,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change) {
+  nbodyUnpredictKernelScalar(p_Values, p_Count, p_Previous, p_Change);
+}
+//---------------------------------------------------------------------------//
+void nbodyDequantizeKernelAvx2(
+    const int32_t* p_Cells,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_Spacing,
+    float* p_Positions) {
+  nbodyDequantizeKernelScalar(
+      p_Cells, p_Ids, p_Count, p_Origin, p_Spacing, p_Positions);
+}
+//---------------------------------------------------------------------------//
+#endif
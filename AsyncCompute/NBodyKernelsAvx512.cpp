@@ -0,0 +1,408 @@
+#include "NBodyCpu.hpp"
+#include <math.h>
+#include <utility>
+
+#if NBODY_X86
+#include <immintrin.h>
+
+// Everything below is compiled for AVX-512F, the dispatcher in
+// NBodyKernels.cpp only calls into it after checking CPUID and XGETBV.
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+// GCC 12 false positive in its own _mm512 headers (_mm512_undefined_ps).
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#endif
+
+//---------------------------------------------------------------------------//
+namespace {
+struct VecAvx512 {
+  using Type = __m512;
+  static constexpr uint32_t Width = 16;
+
+  static Type zero() { return _mm512_setzero_ps(); }
+  static Type set1(float p_Val) { return _mm512_set1_ps(p_Val); }
+  static Type load(const float* p_Ptr) { return _mm512_loadu_ps(p_Ptr); }
+  static void store(float* p_Ptr, Type p_A) { _mm512_storeu_ps(p_Ptr, p_A); }
+  // AVX-512F has the half conversion, bfloat16 is the upper half of a float.
+  static Type loadHalf(const uint16_t* p_Ptr) {
+    return _mm512_cvtph_ps(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p_Ptr)));
+  }
+  static Type loadBf16(const uint16_t* p_Ptr) {
+    const __m512i h = _mm512_cvtepu16_epi32(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p_Ptr)));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(h, 16));
+  }
+  static Type add(Type p_A, Type p_B) { return _mm512_add_ps(p_A, p_B); }
+  static Type sub(Type p_A, Type p_B) { return _mm512_sub_ps(p_A, p_B); }
+  static Type mul(Type p_A, Type p_B) { return _mm512_mul_ps(p_A, p_B); }
+  static Type div(Type p_A, Type p_B) { return _mm512_div_ps(p_A, p_B); }
+  static Type sqrt(Type p_A) { return _mm512_sqrt_ps(p_A); }
+  static Type fmadd(Type p_A, Type p_B, Type p_C) {
+    return _mm512_fmadd_ps(p_A, p_B, p_C);
+  }
+  // 14-bit estimate refined with one Newton-Raphson step:
+  // y = y * (1.5 - 0.5 * x * y * y)
+  static Type rsqrt(Type p_X) {
+    Type y = _mm512_rsqrt14_ps(p_X);
+    Type halfX = _mm512_mul_ps(p_X, _mm512_set1_ps(0.5f));
+    Type yy = _mm512_mul_ps(y, y);
+    return _mm512_mul_ps(y, _mm512_fnmadd_ps(halfX, yy, _mm512_set1_ps(1.5f)));
+  }
+  static float hsum(Type p_A) { return _mm512_reduce_add_ps(p_A); }
+};
+
+// Doubles of the FMM translations.
+struct VecAvx512Double {
+  using Type = __m512d;
+  static constexpr uint32_t Width = 8;
+
+  static Type zero() { return _mm512_setzero_pd(); }
+  static Type set1(double p_Val) { return _mm512_set1_pd(p_Val); }
+  static Type load(const double* p_Ptr) { return _mm512_loadu_pd(p_Ptr); }
+  static void store(double* p_Ptr, Type p_A) { _mm512_storeu_pd(p_Ptr, p_A); }
+  static Type mul(Type p_A, Type p_B) { return _mm512_mul_pd(p_A, p_B); }
+  static Type div(Type p_A, Type p_B) { return _mm512_div_pd(p_A, p_B); }
+  static Type sqrt(Type p_A) { return _mm512_sqrt_pd(p_A); }
+  static Type fmadd(Type p_A, Type p_B, Type p_C) {
+    return _mm512_fmadd_pd(p_A, p_B, p_C);
+  }
+};
+} // namespace
+
+#include "NBodyM2LKernel.hpp"
+#include "NBodySimdKernel.hpp"
+
+//---------------------------------------------------------------------------//
+void nbodyForceKernelAvx512(const NBodyForceArgs* p_Args) {
+  _simdForceKernel<VecAvx512, 1, 1>(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyForceVariantsAvx512(NBodyForceKernel* p_Kernels) {
+  _simdForceVariants<VecAvx512>(
+      p_Kernels, std::make_index_sequence<NBodyForceVariantCount>());
+}
+//---------------------------------------------------------------------------//
+void nbodyDeterministicKernelAvx512(const NBodyForceArgs* p_Args) {
+  _simdDeterministicKernel<VecAvx512>(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyCellKernelAvx512(const NBodyCellArgs* p_Args) {
+  _simdCellKernel<VecAvx512>(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyPairKernelAvx512(const NBodyPairArgs* p_Args) {
+  _simdPairKernel<VecAvx512>(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyJerkKernelAvx512(const NBodyJerkArgs* p_Args) {
+  _simdJerkKernel<VecAvx512>(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyM2LKernelsAvx512(NBodyM2LKernel* p_Kernels) {
+  _m2lKernels<VecAvx512Double>(
+      p_Kernels, std::make_index_sequence<NBodyM2LMaxOrder>());
+}
+//---------------------------------------------------------------------------//
+// Bit b of the 16 lanes is a test mask, and a mask again for the unpacking.
+size_t nbodyPackKernelAvx512(
+    const uint32_t* p_Values,
+    uint32_t p_BlockCount,
+    uint8_t* p_Widths,
+    uint32_t* p_Words) {
+  uint32_t* words = p_Words;
+  for (uint32_t b = 0; b < p_BlockCount; ++b) {
+    const uint32_t* values = p_Values + size_t(b) * NBodyPackBlock;
+    const __m512i low = _mm512_loadu_si512(values);
+    const __m512i high = _mm512_loadu_si512(values + 16);
+    const uint32_t width = nbodyBitWidth(
+        uint32_t(_mm512_reduce_or_epi32(_mm512_or_si512(low, high))));
+    p_Widths[b] = uint8_t(width);
+    for (uint32_t bit = 0; bit < width; ++bit) {
+      const __m512i mask = _mm512_set1_epi32(int(1u << bit));
+      *words++ = uint32_t(_mm512_test_epi32_mask(low, mask)) |
+                 uint32_t(_mm512_test_epi32_mask(high, mask)) << 16;
+    }
+  }
+  return size_t(words - p_Words);
+}
+//---------------------------------------------------------------------------//
+size_t nbodyUnpackKernelAvx512(
+    const uint8_t* p_Widths,
+    const uint32_t* p_Words,
+    uint32_t p_BlockCount,
+    uint32_t* p_Values) {
+  const uint32_t* words = p_Words;
+  for (uint32_t b = 0; b < p_BlockCount; ++b) {
+    __m512i low = _mm512_setzero_si512();
+    __m512i high = _mm512_setzero_si512();
+    for (uint32_t bit = 0; bit < p_Widths[b]; ++bit) {
+      const uint32_t word = *words++;
+      const __m512i value = _mm512_set1_epi32(int(1u << bit));
+      low = _mm512_mask_or_epi32(low, __mmask16(word), low, value);
+      high = _mm512_mask_or_epi32(high, __mmask16(word >> 16), high, value);
+    }
+    uint32_t* values = p_Values + size_t(b) * NBodyPackBlock;
+    _mm512_storeu_si512(values, low);
+    _mm512_storeu_si512(values + 16, high);
+  }
+  return size_t(words - p_Words);
+}
+//---------------------------------------------------------------------------//
+// Sixteen cells per iteration, the positions of p_Ids from scalar loads as
+// in the AVX2 kernel. The scalar kernel finishes the range and checks it.
+bool nbodyQuantizeKernelAvx512(
+    const float* p_Positions,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_InvSpacing,
+    int32_t p_Limit,
+    int32_t* p_Cells,
+    int32_t* p_Range) {
+  const __m512d origin = _mm512_set1_pd(p_Origin);
+  const __m512d invSpacing = _mm512_set1_pd(p_InvSpacing);
+  __m512i low = _mm512_set1_epi32(p_Range[0]);
+  __m512i high = _mm512_set1_epi32(p_Range[1]);
+  uint32_t k = 0;
+  for (; k + 16 <= p_Count; k += 16) {
+    const __m512 positions =
+        p_Ids != nullptr
+            ? _mm512_setr_ps(
+                  p_Positions[p_Ids[k]],
+                  p_Positions[p_Ids[k + 1]],
+                  p_Positions[p_Ids[k + 2]],
+                  p_Positions[p_Ids[k + 3]],
+                  p_Positions[p_Ids[k + 4]],
+                  p_Positions[p_Ids[k + 5]],
+                  p_Positions[p_Ids[k + 6]],
+                  p_Positions[p_Ids[k + 7]],
+                  p_Positions[p_Ids[k + 8]],
+                  p_Positions[p_Ids[k + 9]],
+                  p_Positions[p_Ids[k + 10]],
+                  p_Positions[p_Ids[k + 11]],
+                  p_Positions[p_Ids[k + 12]],
+                  p_Positions[p_Ids[k + 13]],
+                  p_Positions[p_Ids[k + 14]],
+                  p_Positions[p_Ids[k + 15]])
+            : _mm512_loadu_ps(p_Positions + k);
+    const __m512d front = _mm512_mul_pd(
+        _mm512_sub_pd(
+            _mm512_cvtps_pd(_mm512_castps512_ps256(positions)), origin),
+        invSpacing);
+    const __m512d back = _mm512_mul_pd(
+        _mm512_sub_pd(
+            _mm512_cvtps_pd(_mm256_castpd_ps(
+                _mm512_extractf64x4_pd(_mm512_castps_pd(positions), 1))),
+            origin),
+        invSpacing);
+    const __m512i cells = _mm512_inserti64x4(
+        _mm512_castsi256_si512(_mm512_cvtpd_epi32(front)),
+        _mm512_cvtpd_epi32(back),
+        1);
+    _mm512_storeu_si512(p_Cells + k, cells);
+    low = _mm512_min_epi32(low, cells);
+    high = _mm512_max_epi32(high, cells);
+  }
+  p_Range[0] = _mm512_reduce_min_epi32(low);
+  p_Range[1] = _mm512_reduce_max_epi32(high);
+  return nbodyQuantizeKernelScalar(
+      p_Ids != nullptr ? p_Positions : p_Positions + k,
+      p_Ids != nullptr ? p_Ids + k : nullptr,
+      p_Count - k,
+      p_Origin,
+      p_InvSpacing,
+      p_Limit,
+      p_Cells + k,
+      p_Range);
+}
+//---------------------------------------------------------------------------//
+void nbodyPredictKernelAvx512(
+    const int32_t* p_Cells,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change,
+    uint32_t* p_Values) {
+  uint32_t k = 0;
+  for (; k + 16 <= p_Count; k += 16) {
+    const __m512i cell = _mm512_loadu_si512(p_Cells + k);
+    const __m512i previous = _mm512_loadu_si512(p_Previous + k);
+    const __m512i delta = _mm512_sub_epi32(cell, previous);
+    const __m512i residual =
+        _mm512_sub_epi32(delta, _mm512_loadu_si512(p_Change + k));
+    _mm512_storeu_si512(
+        p_Values + k,
+        _mm512_xor_si512(
+            _mm512_slli_epi32(residual, 1), _mm512_srai_epi32(residual, 31)));
+    _mm512_storeu_si512(p_Change + k, delta);
+    _mm512_storeu_si512(p_Previous + k, cell);
+  }
+  nbodyPredictKernelScalar(
+      p_Cells + k, p_Count - k, p_Previous + k, p_Change + k, p_Values + k);
+}
+//---------------------------------------------------------------------------//
+void nbodyUnpredictKernelAvx512(
+    const uint32_t* p_Values,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change) {
+  const __m512i one = _mm512_set1_epi32(1);
+  uint32_t k = 0;
+  for (; k + 16 <= p_Count; k += 16) {
+    const __m512i value = _mm512_loadu_si512(p_Values + k);
+    const __m512i residual = _mm512_xor_si512(
+        _mm512_srli_epi32(value, 1),
+        _mm512_sub_epi32(_mm512_setzero_si512(), _mm512_and_si512(value, one)));
+    const __m512i delta =
+        _mm512_add_epi32(_mm512_loadu_si512(p_Change + k), residual);
+    _mm512_storeu_si512(p_Change + k, delta);
+    _mm512_storeu_si512(
+        p_Previous + k,
+        _mm512_add_epi32(_mm512_loadu_si512(p_Previous + k), delta));
+  }
+  nbodyUnpredictKernelScalar(
+      p_Values + k, p_Count - k, p_Previous + k, p_Change + k);
+}
+//---------------------------------------------------------------------------//
+// The positions are scattered 16 at a time (the ids are distinct).
+NBODY_NO_FP_CONTRACT void nbodyDequantizeKernelAvx512(
+    const int32_t* p_Cells,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_Spacing,
+    float* p_Positions) {
+  NBODY_NO_FP_CONTRACT_BODY
+  const __m512d origin = _mm512_set1_pd(p_Origin);
+  const __m512d spacing = _mm512_set1_pd(p_Spacing);
+  uint32_t k = 0;
+  for (; k + 16 <= p_Count; k += 16) {
+    const __m512i cells = _mm512_loadu_si512(p_Cells + k);
+    const __m512d low = _mm512_add_pd(
+        origin,
+        _mm512_mul_pd(
+            _mm512_cvtepi32_pd(_mm512_castsi512_si256(cells)), spacing));
+    const __m512d high = _mm512_add_pd(
+        origin,
+        _mm512_mul_pd(
+            _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(cells, 1)), spacing));
+    const __m512 positions = _mm512_castpd_ps(_mm512_insertf64x4(
+        _mm512_castpd256_pd512(_mm256_castps_pd(_mm512_cvtpd_ps(low))),
+        _mm256_castps_pd(_mm512_cvtpd_ps(high)),
+        1));
+    _mm512_i32scatter_ps(
+        p_Positions, _mm512_loadu_si512(p_Ids + k), positions, 4);
+  }
+  nbodyDequantizeKernelScalar(
+      p_Cells + k, p_Ids + k, p_Count - k, p_Origin, p_Spacing, p_Positions);
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+#endif
+
+#else
+//---------------------------------------------------------------------------//
+void nbodyForceKernelAvx512(const NBodyForceArgs* p_Args) {
+  nbodyForceKernelScalar(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyForceVariantsAvx512(NBodyForceKernel* p_Kernels) {
+  for (uint32_t v = 0; v < NBodyForceVariantCount; ++v) {
+    p_Kernels[v] = nbodyForceKernelScalar;
+  }
+}
+//---------------------------------------------------------------------------//
+void nbodyDeterministicKernelAvx512(const NBodyForceArgs* p_Args) {
+  nbodyDeterministicKernelScalar(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyCellKernelAvx512(const NBodyCellArgs* p_Args) {
+  nbodyCellKernelScalar(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyPairKernelAvx512(const NBodyPairArgs* p_Args) {
+  nbodyPairKernelScalar(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyJerkKernelAvx512(const NBodyJerkArgs* p_Args) {
+  nbodyJerkKernelScalar(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyM2LKernelsAvx512(NBodyM2LKernel* p_Kernels) {
+  nbodyM2LKernelsScalar(p_Kernels);
+}
+//---------------------------------------------------------------------------//
+size_t nbodyPackKernelAvx512(
+    const uint32_t* p_Values,
+    uint32_t p_BlockCount,
+    uint8_t* p_Widths,
+    uint32_t* p_Words) {
+  return nbodyPackKernelScalar(p_Values, p_BlockCount, p_Widths, p_Words);
+}
+//---------------------------------------------------------------------------//
+size_t nbodyUnpackKernelAvx512(
+    const uint8_t* p_Widths,
+    const uint32_t* p_Words,
+    uint32_t p_BlockCount,
+    uint32_t* p_Values) {
+  return nbodyUnpackKernelScalar(p_Widths, p_Words, p_BlockCount, p_Values);
+}
+//---------------------------------------------------------------------------//
+bool nbodyQuantizeKernelAvx512(
+    const float* p_Positions,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_InvSpacing,
+    int32_t p_Limit,
+    int32_t* p_Cells,
+    int32_t* p_Range) {
+  return nbodyQuantizeKernelScalar(
+      p_Positions,
+      p_Ids,
+      p_Count,
+      p_Origin,
+      p_InvSpacing,
+      p_Limit,
+      p_Cells,
+      p_Range);
+}
+//---------------------------------------------------------------------------//
+void nbodyPredictKernelAvx512(
+    const int32_t* p_Cells,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change,
+    uint32_t* p_Values) {
+  nbodyPredictKernelScalar(p_Cells, p_Count, p_Previous, p_Change, p_Values);
+}
+//---------------------------------------------------------------------------//
+void nbodyUnpredictKernelAvx512(
+    const uint32_t* p_Values,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change) {
+  nbodyUnpredictKernelScalar(p_Values, p_Count, p_Previous, p_Change);
+}
+//---------------------------------------------------------------------------//
+void nbodyDequantizeKernelAvx512(
+    const int32_t* p_Cells,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_Spacing,
+    float* p_Positions) {
+  nbodyDequantizeKernelScalar(
+      p_Cells, p_Ids, p_Count, p_Origin, p_Spacing, p_Positions);
+}
+//---------------------------------------------------------------------------//
+#endif
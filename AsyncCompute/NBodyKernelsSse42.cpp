@@ -0,0 +1,421 @@
+#include "NBodyCpu.hpp"
+#include <math.h>
+#include <utility>
+
+#if NBODY_X86
+#include <immintrin.h>
+
+// Everything below is compiled for SSE4.2, the dispatcher in NBodyKernels.cpp
+// only calls into it after checking CPUID.
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse4.2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+#endif
+
+//---------------------------------------------------------------------------//
+namespace {
+struct VecSse42 {
+  using Type = __m128;
+  static constexpr uint32_t Width = 4;
+
+  static Type zero() { return _mm_setzero_ps(); }
+  static Type set1(float p_Val) { return _mm_set1_ps(p_Val); }
+  static Type load(const float* p_Ptr) { return _mm_loadu_ps(p_Ptr); }
+  static void store(float* p_Ptr, Type p_A) { _mm_storeu_ps(p_Ptr, p_A); }
+  // 16-bit positions, same bit tricks as nbodyHalfToFloat/nbodyBf16ToFloat
+  // (no F16C on this path).
+  static Type loadHalf(const uint16_t* p_Ptr) {
+    const __m128i h = _mm_cvtepu16_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p_Ptr)));
+    const __m128i magnitude =
+        _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x7fff)), 13);
+    const __m128i sign =
+        _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x8000)), 16);
+    const Type value =
+        _mm_mul_ps(_mm_castsi128_ps(magnitude), _mm_set1_ps(0x1p112f));
+    return _mm_or_ps(value, _mm_castsi128_ps(sign));
+  }
+  static Type loadBf16(const uint16_t* p_Ptr) {
+    const __m128i h = _mm_cvtepu16_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p_Ptr)));
+    return _mm_castsi128_ps(_mm_slli_epi32(h, 16));
+  }
+  static Type add(Type p_A, Type p_B) { return _mm_add_ps(p_A, p_B); }
+  static Type sub(Type p_A, Type p_B) { return _mm_sub_ps(p_A, p_B); }
+  static Type mul(Type p_A, Type p_B) { return _mm_mul_ps(p_A, p_B); }
+  static Type div(Type p_A, Type p_B) { return _mm_div_ps(p_A, p_B); }
+  static Type sqrt(Type p_A) { return _mm_sqrt_ps(p_A); }
+  static Type fmadd(Type p_A, Type p_B, Type p_C) {
+    return _mm_add_ps(_mm_mul_ps(p_A, p_B), p_C);
+  }
+  // 12-bit estimate refined with one Newton-Raphson step:
+  // y = y * (1.5 - 0.5 * x * y * y)
+  static Type rsqrt(Type p_X) {
+    Type y = _mm_rsqrt_ps(p_X);
+    Type halfX = _mm_mul_ps(p_X, _mm_set1_ps(0.5f));
+    Type yy = _mm_mul_ps(y, y);
+    return _mm_mul_ps(
+        y, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(halfX, yy)));
+  }
+  static float hsum(Type p_A) {
+    Type shuf = _mm_movehdup_ps(p_A);
+    Type sums = _mm_add_ps(p_A, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+  }
+};
+
+// Doubles of the FMM translations (no FMA on this path).
+struct VecSse42Double {
+  using Type = __m128d;
+  static constexpr uint32_t Width = 2;
+
+  static Type zero() { return _mm_setzero_pd(); }
+  static Type set1(double p_Val) { return _mm_set1_pd(p_Val); }
+  static Type load(const double* p_Ptr) { return _mm_loadu_pd(p_Ptr); }
+  static void store(double* p_Ptr, Type p_A) { _mm_storeu_pd(p_Ptr, p_A); }
+  static Type mul(Type p_A, Type p_B) { return _mm_mul_pd(p_A, p_B); }
+  static Type div(Type p_A, Type p_B) { return _mm_div_pd(p_A, p_B); }
+  static Type sqrt(Type p_A) { return _mm_sqrt_pd(p_A); }
+  static Type fmadd(Type p_A, Type p_B, Type p_C) {
+    return _mm_add_pd(_mm_mul_pd(p_A, p_B), p_C);
+  }
+};
+} // namespace
+
+#include "NBodyM2LKernel.hpp"
+#include "NBodySimdKernel.hpp"
+
+//---------------------------------------------------------------------------//
+void nbodyForceKernelSse42(const NBodyForceArgs* p_Args) {
+  _simdForceKernel<VecSse42, 1, 1>(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyForceVariantsSse42(NBodyForceKernel* p_Kernels) {
+  _simdForceVariants<VecSse42>(
+      p_Kernels, std::make_index_sequence<NBodyForceVariantCount>());
+}
+//---------------------------------------------------------------------------//
+void nbodyDeterministicKernelSse42(const NBodyForceArgs* p_Args) {
+  _simdDeterministicKernel<VecSse42>(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyCellKernelSse42(const NBodyCellArgs* p_Args) {
+  _simdCellKernel<VecSse42>(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyPairKernelSse42(const NBodyPairArgs* p_Args) {
+  _simdPairKernel<VecSse42>(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyJerkKernelSse42(const NBodyJerkArgs* p_Args) {
+  _simdJerkKernel<VecSse42>(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyM2LKernelsSse42(NBodyM2LKernel* p_Kernels) {
+  _m2lKernels<VecSse42Double>(
+      p_Kernels, std::make_index_sequence<NBodyM2LMaxOrder>());
+}
+//---------------------------------------------------------------------------//
+// Bit b of every lane is shifted into its sign and gathered by movemask.
+size_t nbodyPackKernelSse42(
+    const uint32_t* p_Values,
+    uint32_t p_BlockCount,
+    uint8_t* p_Widths,
+    uint32_t* p_Words) {
+  uint32_t* words = p_Words;
+  for (uint32_t b = 0; b < p_BlockCount; ++b) {
+    const uint32_t* values = p_Values + size_t(b) * NBodyPackBlock;
+    __m128i v[8];
+    __m128i any = _mm_setzero_si128();
+    for (uint32_t j = 0; j < 8; ++j) {
+      v[j] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + 4 * j));
+      any = _mm_or_si128(any, v[j]);
+    }
+    any = _mm_or_si128(any, _mm_shuffle_epi32(any, _MM_SHUFFLE(1, 0, 3, 2)));
+    any = _mm_or_si128(any, _mm_shuffle_epi32(any, _MM_SHUFFLE(2, 3, 0, 1)));
+    const uint32_t width = nbodyBitWidth(uint32_t(_mm_cvtsi128_si32(any)));
+    p_Widths[b] = uint8_t(width);
+    for (uint32_t bit = 0; bit < width; ++bit) {
+      const __m128i shift = _mm_cvtsi32_si128(int(31 - bit));
+      uint32_t word = 0;
+      for (uint32_t j = 0; j < 8; ++j) {
+        const __m128 sign = _mm_castsi128_ps(_mm_sll_epi32(v[j], shift));
+        word |= uint32_t(_mm_movemask_ps(sign)) << (4 * j);
+      }
+      *words++ = word;
+    }
+  }
+  return size_t(words - p_Words);
+}
+//---------------------------------------------------------------------------//
+// Each word is broadcast and compared with the bit of every lane.
+size_t nbodyUnpackKernelSse42(
+    const uint8_t* p_Widths,
+    const uint32_t* p_Words,
+    uint32_t p_BlockCount,
+    uint32_t* p_Values) {
+  __m128i lanes[8];
+  for (uint32_t j = 0; j < 8; ++j) {
+    lanes[j] = _mm_sll_epi32(
+        _mm_setr_epi32(1, 2, 4, 8), _mm_cvtsi32_si128(int(4 * j)));
+  }
+  const uint32_t* words = p_Words;
+  for (uint32_t b = 0; b < p_BlockCount; ++b) {
+    __m128i v[8];
+    for (uint32_t j = 0; j < 8; ++j) {
+      v[j] = _mm_setzero_si128();
+    }
+    for (uint32_t bit = 0; bit < p_Widths[b]; ++bit) {
+      const __m128i word = _mm_set1_epi32(int(*words++));
+      const __m128i value = _mm_set1_epi32(int(1u << bit));
+      for (uint32_t j = 0; j < 8; ++j) {
+        const __m128i set =
+            _mm_cmpeq_epi32(_mm_and_si128(word, lanes[j]), lanes[j]);
+        v[j] = _mm_or_si128(v[j], _mm_and_si128(set, value));
+      }
+    }
+    uint32_t* values = p_Values + size_t(b) * NBodyPackBlock;
+    for (uint32_t j = 0; j < 8; ++j) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(values + 4 * j), v[j]);
+    }
+  }
+  return size_t(words - p_Words);
+}
+//---------------------------------------------------------------------------//
+// Two cells per instruction, the positions of p_Ids by scalar loads. The
+// scalar kernel finishes the range and checks it.
+bool nbodyQuantizeKernelSse42(
+    const float* p_Positions,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_InvSpacing,
+    int32_t p_Limit,
+    int32_t* p_Cells,
+    int32_t* p_Range) {
+  const __m128d origin = _mm_set1_pd(p_Origin);
+  const __m128d invSpacing = _mm_set1_pd(p_InvSpacing);
+  __m128i low = _mm_set1_epi32(p_Range[0]);
+  __m128i high = _mm_set1_epi32(p_Range[1]);
+  uint32_t k = 0;
+  for (; k + 4 <= p_Count; k += 4) {
+    const __m128 positions = p_Ids != nullptr ? _mm_setr_ps(
+                                                    p_Positions[p_Ids[k]],
+                                                    p_Positions[p_Ids[k + 1]],
+                                                    p_Positions[p_Ids[k + 2]],
+                                                    p_Positions[p_Ids[k + 3]])
+                                              : _mm_loadu_ps(p_Positions + k);
+    const __m128d front = _mm_mul_pd(
+        _mm_sub_pd(_mm_cvtps_pd(positions), origin), invSpacing);
+    const __m128d back = _mm_mul_pd(
+        _mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(positions, positions)), origin),
+        invSpacing);
+    const __m128i cells =
+        _mm_unpacklo_epi64(_mm_cvtpd_epi32(front), _mm_cvtpd_epi32(back));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p_Cells + k), cells);
+    low = _mm_min_epi32(low, cells);
+    high = _mm_max_epi32(high, cells);
+  }
+  low = _mm_min_epi32(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(1, 0, 3, 2)));
+  low = _mm_min_epi32(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(2, 3, 0, 1)));
+  high = _mm_max_epi32(high, _mm_shuffle_epi32(high, _MM_SHUFFLE(1, 0, 3, 2)));
+  high = _mm_max_epi32(high, _mm_shuffle_epi32(high, _MM_SHUFFLE(2, 3, 0, 1)));
+  p_Range[0] = _mm_cvtsi128_si32(low);
+  p_Range[1] = _mm_cvtsi128_si32(high);
+  return nbodyQuantizeKernelScalar(
+      p_Ids != nullptr ? p_Positions : p_Positions + k,
+      p_Ids != nullptr ? p_Ids + k : nullptr,
+      p_Count - k,
+      p_Origin,
+      p_InvSpacing,
+      p_Limit,
+      p_Cells + k,
+      p_Range);
+}
+//---------------------------------------------------------------------------//
+void nbodyPredictKernelSse42(
+    const int32_t* p_Cells,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change,
+    uint32_t* p_Values) {
+  uint32_t k = 0;
+  for (; k + 4 <= p_Count; k += 4) {
+    const __m128i cell =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p_Cells + k));
+    __m128i* previous = reinterpret_cast<__m128i*>(p_Previous + k);
+    __m128i* change = reinterpret_cast<__m128i*>(p_Change + k);
+    const __m128i delta = _mm_sub_epi32(cell, _mm_loadu_si128(previous));
+    const __m128i residual = _mm_sub_epi32(delta, _mm_loadu_si128(change));
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(p_Values + k),
+        _mm_xor_si128(
+            _mm_slli_epi32(residual, 1), _mm_srai_epi32(residual, 31)));
+    _mm_storeu_si128(change, delta);
+    _mm_storeu_si128(previous, cell);
+  }
+  nbodyPredictKernelScalar(
+      p_Cells + k, p_Count - k, p_Previous + k, p_Change + k, p_Values + k);
+}
+//---------------------------------------------------------------------------//
+void nbodyUnpredictKernelSse42(
+    const uint32_t* p_Values,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change) {
+  const __m128i one = _mm_set1_epi32(1);
+  uint32_t k = 0;
+  for (; k + 4 <= p_Count; k += 4) {
+    const __m128i value =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p_Values + k));
+    __m128i* previous = reinterpret_cast<__m128i*>(p_Previous + k);
+    __m128i* change = reinterpret_cast<__m128i*>(p_Change + k);
+    const __m128i residual = _mm_xor_si128(
+        _mm_srli_epi32(value, 1),
+        _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(value, one)));
+    const __m128i delta = _mm_add_epi32(_mm_loadu_si128(change), residual);
+    _mm_storeu_si128(change, delta);
+    _mm_storeu_si128(previous, _mm_add_epi32(_mm_loadu_si128(previous), delta));
+  }
+  nbodyUnpredictKernelScalar(
+      p_Values + k, p_Count - k, p_Previous + k, p_Change + k);
+}
+//---------------------------------------------------------------------------//
+// The positions are scattered by scalar stores.
+void nbodyDequantizeKernelSse42(
+    const int32_t* p_Cells,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_Spacing,
+    float* p_Positions) {
+  const __m128d origin = _mm_set1_pd(p_Origin);
+  const __m128d spacing = _mm_set1_pd(p_Spacing);
+  uint32_t k = 0;
+  for (; k + 4 <= p_Count; k += 4) {
+    const __m128i cells =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p_Cells + k));
+    const __m128d low =
+        _mm_add_pd(origin, _mm_mul_pd(_mm_cvtepi32_pd(cells), spacing));
+    const __m128d high = _mm_add_pd(
+        origin,
+        _mm_mul_pd(
+            _mm_cvtepi32_pd(_mm_unpackhi_epi64(cells, cells)), spacing));
+    alignas(16) float positions[4];
+    _mm_store_ps(
+        positions, _mm_movelh_ps(_mm_cvtpd_ps(low), _mm_cvtpd_ps(high)));
+    for (uint32_t j = 0; j < 4; ++j) {
+      p_Positions[p_Ids[k + j]] = positions[j];
+    }
+  }
+  nbodyDequantizeKernelScalar(
+      p_Cells + k, p_Ids + k, p_Count - k, p_Origin, p_Spacing, p_Positions);
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#else
+//---------------------------------------------------------------------------//
+void nbodyForceKernelSse42(const NBodyForceArgs* p_Args) {
+  nbodyForceKernelScalar(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyForceVariantsSse42(NBodyForceKernel* p_Kernels) {
+  for (uint32_t v = 0; v < NBodyForceVariantCount; ++v) {
+    p_Kernels[v] = nbodyForceKernelScalar;
+  }
+}
+//---------------------------------------------------------------------------//
+void nbodyDeterministicKernelSse42(const NBodyForceArgs* p_Args) {
+  nbodyDeterministicKernelScalar(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyCellKernelSse42(const NBodyCellArgs* p_Args) {
+  nbodyCellKernelScalar(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyPairKernelSse42(const NBodyPairArgs* p_Args) {
+  nbodyPairKernelScalar(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyJerkKernelSse42(const NBodyJerkArgs* p_Args) {
+  nbodyJerkKernelScalar(p_Args);
+}
+//---------------------------------------------------------------------------//
+void nbodyM2LKernelsSse42(NBodyM2LKernel* p_Kernels) {
+  nbodyM2LKernelsScalar(p_Kernels);
+}
+//---------------------------------------------------------------------------//
+size_t nbodyPackKernelSse42(
+    const uint32_t* p_Values,
+    uint32_t p_BlockCount,
+    uint8_t* p_Widths,
+    uint32_t* p_Words) {
+  return nbodyPackKernelScalar(p_Values, p_BlockCount, p_Widths, p_Words);
+}
+//---------------------------------------------------------------------------//
+size_t nbodyUnpackKernelSse42(
+    const uint8_t* p_Widths,
+    const uint32_t* p_Words,
+    uint32_t p_BlockCount,
+    uint32_t* p_Values) {
+  return nbodyUnpackKernelScalar(p_Widths, p_Words, p_BlockCount, p_Values);
+}
+//---------------------------------------------------------------------------//
+bool nbodyQuantizeKernelSse42(
+    const float* p_Positions,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_InvSpacing,
+    int32_t p_Limit,
+    int32_t* p_Cells,
+    int32_t* p_Range) {
+  return nbodyQuantizeKernelScalar(
+      p_Positions,
+      p_Ids,
+      p_Count,
+      p_Origin,
+      p_InvSpacing,
+      p_Limit,
+      p_Cells,
+      p_Range);
+}
+//---------------------------------------------------------------------------//
+void nbodyPredictKernelSse42(
+    const int32_t* p_Cells,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change,
+    uint32_t* p_Values) {
+  nbodyPredictKernelScalar(p_Cells, p_Count, p_Previous, p_Change, p_Values);
+}
+//---------------------------------------------------------------------------//
+void nbodyUnpredictKernelSse42(
+    const uint32_t* p_Values,
+    uint32_t p_Count,
+    uint32_t* p_Previous,
+    uint32_t* p_Change) {
+  nbodyUnpredictKernelScalar(p_Values, p_Count, p_Previous, p_Change);
+}
+//---------------------------------------------------------------------------//
+void nbodyDequantizeKernelSse42(
+    const int32_t* p_Cells,
+    const uint32_t* p_Ids,
+    uint32_t p_Count,
+    double p_Origin,
+    double p_Spacing,
+    float* p_Positions) {
+  nbodyDequantizeKernelScalar(
+      p_Cells, p_Ids, p_Count, p_Origin, p_Spacing, p_Positions);
+}
+//---------------------------------------------------------------------------//
+#endif
@@ -0,0 +1,227 @@
+#pragma once
+
+/******************************************************************************
+ * \ISA independent body of the FMM multipole to local kernels, unrolled per
+ * \expansion order: the terms are generated at compile time, so a kernel is
+ * \a straight run of vector FMAs on fixed offsets. Included by
+ * \NBodyKernels.cpp and NBodyKernels{Sse42,Avx2,Avx512}.cpp (after the target
+ * \pragma), D is a thin wrapper over the native double vector of one ISA.
+ ******************************************************************************/
+
+#include <utility>
+
+namespace {
+// One term of an unrolled kernel: p_Out[m_Dst] += m_Coef * p_In[m_Src] *
+// p_W[m_W]
+struct M2LTerm {
+  uint16_t m_Dst;
+  uint16_t m_Src;
+  uint16_t m_W;
+  double m_Coef;
+};
+
+constexpr uint32_t _m2lDegree(uint32_t p_Index) {
+  uint32_t degree = 0;
+  while (nbodyFmmCoefCount(degree) <= p_Index) {
+    ++degree;
+  }
+  return degree;
+}
+
+// Multi-index of coefficient p_Index, inverse of nbodyFmmCoefIndex.
+constexpr uint32_t _m2lExponent(uint32_t p_Index, uint32_t p_Axis) {
+  const uint32_t degree = _m2lDegree(p_Index);
+  uint32_t i = degree > 0 ? nbodyFmmCoefCount(degree - 1) : 0;
+  for (uint32_t x = degree + 1; x-- > 0;) {
+    for (uint32_t y = degree - x + 1; y-- > 0; ++i) {
+      if (i == p_Index)
+        return p_Axis == 0 ? x : p_Axis == 1 ? y : degree - x - y;
+    }
+  }
+  return 0;
+}
+
+constexpr double _m2lInvFactorial(uint32_t p_Index) {
+  double factorial = 1.0;
+  for (uint32_t a = 0; a < 3; ++a) {
+    for (uint32_t f = 2; f <= _m2lExponent(p_Index, a); ++f) {
+      factorial *= f;
+    }
+  }
+  return 1.0 / factorial;
+}
+
+// Terms of order P. The derivatives D^m (1 / |r|) follow the recurrence
+// |m| r^2 D^m = -(2|m| - 1) sum_a m_a r_a D^(m-e_a)
+//               - (|m| - 1) sum_a m_a (m_a - 1) D^(m-2e_a)
+// with p_W the rows r_a / r^2 (a < 3) and 1 / r^2 (a = 3). The locals are
+// L_k = sum_n (-1)^|n| M_n D^(n+k) / k!, without the dipoles (they vanish
+// around the center of mass): the kernels sign the multipoles once and
+// scale the sums by 1 / k! at the end, so these terms are plain FMAs.
+template <uint32_t P> struct M2LTable {
+  static constexpr uint32_t CoefCount = nbodyFmmCoefCount(P);
+
+  static constexpr uint32_t recurrenceCount() {
+    uint32_t count = 0;
+    for (uint32_t m = 1; m < CoefCount; ++m) {
+      for (uint32_t a = 0; a < 3; ++a) {
+        const uint32_t e = _m2lExponent(m, a);
+        count += e > 1 ? 2 : e;
+      }
+    }
+    return count;
+  }
+  static constexpr uint32_t termCount() {
+    uint32_t count = 0;
+    for (uint32_t n = 0; n < CoefCount; ++n) {
+      const uint32_t degree = _m2lDegree(n);
+      if (degree != 1)
+        count += nbodyFmmCoefCount(P - degree);
+    }
+    return count;
+  }
+  static constexpr uint32_t RecurrenceCount = recurrenceCount();
+  static constexpr uint32_t TermCount = termCount();
+
+  struct Terms {
+    M2LTerm m_Recurrence[RecurrenceCount];
+    M2LTerm m_Terms[TermCount];
+    double m_Sign[CoefCount]; // (-1)^|n|
+    double m_InvFactorial[CoefCount];
+  };
+  static constexpr Terms build() {
+    Terms ret = {};
+    for (uint32_t m = 0; m < CoefCount; ++m) {
+      ret.m_Sign[m] = _m2lDegree(m) % 2 ? -1.0 : 1.0;
+      ret.m_InvFactorial[m] = _m2lInvFactorial(m);
+    }
+    uint32_t r = 0;
+    for (uint32_t m = 1; m < CoefCount; ++m) {
+      const double degree = _m2lDegree(m);
+      for (uint32_t a = 0; a < 3; ++a) {
+        uint32_t e[3] = {
+            _m2lExponent(m, 0), _m2lExponent(m, 1), _m2lExponent(m, 2)};
+        const uint32_t ea = e[a];
+        if (ea == 0)
+          continue;
+        e[a]--;
+        ret.m_Recurrence[r++] = {
+            uint16_t(m),
+            uint16_t(nbodyFmmCoefIndex(e[0], e[1], e[2])),
+            uint16_t(a),
+            -(2.0 * degree - 1.0) * ea / degree};
+        if (ea < 2)
+          continue;
+        e[a]--;
+        ret.m_Recurrence[r++] = {
+            uint16_t(m),
+            uint16_t(nbodyFmmCoefIndex(e[0], e[1], e[2])),
+            3,
+            -(degree - 1.0) * ea * (ea - 1) / degree};
+      }
+    }
+    // Source major, so consecutive terms go to different locals.
+    uint32_t t = 0;
+    for (uint32_t n = 0; n < CoefCount; ++n) {
+      const uint32_t degree = _m2lDegree(n);
+      if (degree == 1)
+        continue;
+      for (uint32_t k = 0; k < nbodyFmmCoefCount(P - degree); ++k) {
+        ret.m_Terms[t++] = {
+            uint16_t(k),
+            uint16_t(n),
+            uint16_t(nbodyFmmCoefIndex(
+                _m2lExponent(n, 0) + _m2lExponent(k, 0),
+                _m2lExponent(n, 1) + _m2lExponent(k, 1),
+                _m2lExponent(n, 2) + _m2lExponent(k, 2))),
+            1.0};
+      }
+    }
+    return ret;
+  }
+  static constexpr Terms s_Terms = build();
+};
+} // namespace
+
+//---------------------------------------------------------------------------//
+template <typename D, uint32_t P, size_t I>
+static inline void _m2lRecurrenceTerm(
+    const typename D::Type* p_W, typename D::Type* p_Derivatives) {
+  constexpr M2LTerm t = M2LTable<P>::s_Terms.m_Recurrence[I];
+  p_Derivatives[t.m_Dst] = D::fmadd(
+      D::mul(D::set1(t.m_Coef), p_Derivatives[t.m_Src]),
+      p_W[t.m_W],
+      p_Derivatives[t.m_Dst]);
+}
+//---------------------------------------------------------------------------//
+template <typename D, uint32_t P, size_t I>
+static inline void _m2lTerm(
+    const typename D::Type* p_Signed,
+    const typename D::Type* p_Derivatives,
+    typename D::Type* p_Locals) {
+  constexpr M2LTerm t = M2LTable<P>::s_Terms.m_Terms[I];
+  p_Locals[t.m_Dst] =
+      D::fmadd(p_Signed[t.m_Src], p_Derivatives[t.m_W], p_Locals[t.m_Dst]);
+}
+//---------------------------------------------------------------------------//
+// One vector of lanes at a time, everything indexed by constants so that the
+// arrays live in registers (and the stack once they run out).
+template <typename D, uint32_t P, size_t... R, size_t... I>
+static void _m2lKernel(
+    const NBodyM2LArgs* p_Args,
+    std::index_sequence<R...>,
+    std::index_sequence<I...>) {
+  using T = typename D::Type;
+  static constexpr uint32_t CoefCount = M2LTable<P>::CoefCount;
+  static constexpr uint32_t Lanes = NBodyM2LLanes;
+  constexpr const auto& terms = M2LTable<P>::s_Terms;
+
+  for (uint32_t l = 0; l < Lanes; l += D::Width) {
+    const T x = D::load(p_Args->m_R + l);
+    const T y = D::load(p_Args->m_R + Lanes + l);
+    const T z = D::load(p_Args->m_R + 2 * Lanes + l);
+    const T invR2 =
+        D::div(D::set1(1.0), D::fmadd(x, x, D::fmadd(y, y, D::mul(z, z))));
+    const T w[4] = {
+        D::mul(x, invR2), D::mul(y, invR2), D::mul(z, invR2), invR2};
+
+    T derivatives[CoefCount];
+    T signedMultipoles[CoefCount];
+    T locals[CoefCount];
+    derivatives[0] = D::sqrt(invR2);
+    for (uint32_t m = 0; m < CoefCount; ++m) {
+      if (m > 0)
+        derivatives[m] = D::zero();
+      signedMultipoles[m] = D::mul(
+          D::set1(terms.m_Sign[m]),
+          D::load(p_Args->m_Multipoles + m * Lanes + l));
+      locals[m] = D::zero();
+    }
+
+    (_m2lRecurrenceTerm<D, P, R>(w, derivatives), ...);
+    (_m2lTerm<D, P, I>(signedMultipoles, derivatives, locals), ...);
+
+    for (uint32_t k = 0; k < CoefCount; ++k) {
+      double* out = p_Args->m_Locals + k * Lanes + l;
+      D::store(
+          out,
+          D::fmadd(D::set1(terms.m_InvFactorial[k]), locals[k], D::load(out)));
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+template <typename D, uint32_t P>
+static void _m2lKernel(const NBodyM2LArgs* p_Args) {
+  _m2lKernel<D, P>(
+      p_Args,
+      std::make_index_sequence<M2LTable<P>::RecurrenceCount>(),
+      std::make_index_sequence<M2LTable<P>::TermCount>());
+}
+//---------------------------------------------------------------------------//
+// p_Kernels[p - 1] is the kernel of order p.
+template <typename D, size_t... Order>
+static void
+_m2lKernels(NBodyM2LKernel* p_Kernels, std::index_sequence<Order...>) {
+  ((p_Kernels[Order] = _m2lKernel<D, Order + 1>), ...);
+}
+//---------------------------------------------------------------------------//
@@ -0,0 +1,241 @@
+#include "NBodyMorton.hpp"
+#include "NBodySoa.hpp"
+#include <algorithm>
+#include <string.h>
+#include <utility>
+#include <vector>
+
+// Particles per pool block for the bounds, key and radix sort jobs
+static constexpr uint32_t NBodyMortonGrain = 16384;
+static constexpr uint32_t NBodyRadixBits = 8;
+static constexpr uint32_t NBodyRadixBuckets = 1u << NBodyRadixBits;
+
+namespace {
+struct MortonJob {
+  NBodyMortonOrder* m_Morton;
+  const float* m_PosX;
+  const float* m_PosY;
+  const float* m_PosZ;
+  float* m_Bounds; // 6 floats (min xyz, max xyz) per worker
+
+  // Radix sort: one histogram (then scatter offsets) per block
+  uint32_t* m_Counts;
+  uint32_t m_Shift;
+};
+} // namespace
+
+//---------------------------------------------------------------------------//
+/// Local functions:
+//---------------------------------------------------------------------------//
+static uint32_t _quantize(float p_Value, float p_Min, float p_Scale) {
+  const float cell = (p_Value - p_Min) * p_Scale;
+  const float maxCell = float((1u << NBodyMortonLevels) - 1);
+  return static_cast<uint32_t>(cell < maxCell ? cell : maxCell);
+}
+//---------------------------------------------------------------------------//
+static uint32_t _digit(uint64_t p_Key, uint32_t p_Shift) {
+  return static_cast<uint32_t>(p_Key >> p_Shift) & (NBodyRadixBuckets - 1);
+}
+//---------------------------------------------------------------------------//
+// Pool jobs of nbodyMortonSort (NBodyRangeFunc):
+//---------------------------------------------------------------------------//
+static void
+_boundsJob(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t p_Worker) {
+  MortonJob* job = static_cast<MortonJob*>(p_User);
+  float* bounds = job->m_Bounds + 6 * p_Worker;
+  for (uint32_t i = p_Begin; i < p_End; ++i) {
+    bounds[0] = std::min(bounds[0], job->m_PosX[i]);
+    bounds[1] = std::min(bounds[1], job->m_PosY[i]);
+    bounds[2] = std::min(bounds[2], job->m_PosZ[i]);
+    bounds[3] = std::max(bounds[3], job->m_PosX[i]);
+    bounds[4] = std::max(bounds[4], job->m_PosY[i]);
+    bounds[5] = std::max(bounds[5], job->m_PosZ[i]);
+  }
+}
+//---------------------------------------------------------------------------//
+static void _keysJob(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  MortonJob* job = static_cast<MortonJob*>(p_User);
+  NBodyMortonOrder* morton = job->m_Morton;
+  const float scale = float(1u << NBodyMortonLevels) / morton->m_Size;
+  for (uint32_t i = p_Begin; i < p_End; ++i) {
+    morton->m_Keys[i] = nbodyMortonEncode(
+        _quantize(job->m_PosX[i], morton->m_Min[0], scale),
+        _quantize(job->m_PosY[i], morton->m_Min[1], scale),
+        _quantize(job->m_PosZ[i], morton->m_Min[2], scale));
+  }
+}
+//---------------------------------------------------------------------------//
+static void
+_orderJob(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  MortonJob* job = static_cast<MortonJob*>(p_User);
+  for (uint32_t i = p_Begin; i < p_End; ++i) {
+    job->m_Morton->m_Order[i] = i;
+  }
+}
+//---------------------------------------------------------------------------//
+// Digit histograms of the blocks of NBodyMortonGrain keys in the range (the
+// pool may run several blocks in one call).
+static void
+_histogramJob(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  MortonJob* job = static_cast<MortonJob*>(p_User);
+  const uint64_t* keys = job->m_Morton->m_Keys;
+  for (uint32_t first = p_Begin; first < p_End; first += NBodyMortonGrain) {
+    const uint32_t last = std::min(first + NBodyMortonGrain, p_End);
+    uint32_t* counts =
+        job->m_Counts + first / NBodyMortonGrain * NBodyRadixBuckets;
+    memset(counts, 0, NBodyRadixBuckets * sizeof(uint32_t));
+    for (uint32_t i = first; i < last; ++i) {
+      counts[_digit(keys[i], job->m_Shift)]++;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Stable scatter of the blocks in the range to the offsets computed from the
+// histograms.
+static void
+_scatterJob(void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  MortonJob* job = static_cast<MortonJob*>(p_User);
+  NBodyMortonOrder* morton = job->m_Morton;
+  for (uint32_t first = p_Begin; first < p_End; first += NBodyMortonGrain) {
+    const uint32_t last = std::min(first + NBodyMortonGrain, p_End);
+    uint32_t* offsets =
+        job->m_Counts + first / NBodyMortonGrain * NBodyRadixBuckets;
+    for (uint32_t i = first; i < last; ++i) {
+      const uint32_t dst = offsets[_digit(morton->m_Keys[i], job->m_Shift)]++;
+      morton->m_TmpKeys[dst] = morton->m_Keys[i];
+      morton->m_TmpOrder[dst] = morton->m_Order[i];
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Core functions:
+//---------------------------------------------------------------------------//
+void nbodyMortonInit(NBodyMortonOrder* p_Morton) {
+  memset(p_Morton, 0, sizeof(*p_Morton));
+}
+//---------------------------------------------------------------------------//
+void nbodyMortonDestroy(NBodyMortonOrder* p_Morton) {
+  nbodyAlignedFree(p_Morton->m_Keys);
+  nbodyAlignedFree(p_Morton->m_Order);
+  nbodyAlignedFree(p_Morton->m_TmpKeys);
+  nbodyAlignedFree(p_Morton->m_TmpOrder);
+  memset(p_Morton, 0, sizeof(*p_Morton));
+}
+//---------------------------------------------------------------------------//
+void nbodyMortonReserve(NBodyMortonOrder* p_Morton, uint32_t p_Count) {
+  if (p_Count <= p_Morton->m_Capacity)
+    return;
+
+  nbodyMortonDestroy(p_Morton);
+  const size_t capacity = nbodyPadCount(p_Count);
+  p_Morton->m_Capacity = static_cast<uint32_t>(capacity);
+  p_Morton->m_Keys = static_cast<uint64_t*>(
+      nbodyAlignedAlloc(capacity * sizeof(uint64_t), NBodyAlignment));
+  p_Morton->m_Order = static_cast<uint32_t*>(
+      nbodyAlignedAlloc(capacity * sizeof(uint32_t), NBodyAlignment));
+  p_Morton->m_TmpKeys = static_cast<uint64_t*>(
+      nbodyAlignedAlloc(capacity * sizeof(uint64_t), NBodyAlignment));
+  p_Morton->m_TmpOrder = static_cast<uint32_t*>(
+      nbodyAlignedAlloc(capacity * sizeof(uint32_t), NBodyAlignment));
+  NBODY_ASSERT(
+      p_Morton->m_Keys != nullptr && p_Morton->m_Order != nullptr &&
+      p_Morton->m_TmpKeys != nullptr && p_Morton->m_TmpOrder != nullptr);
+}
+//---------------------------------------------------------------------------//
+void nbodyMortonSort(
+    NBodyMortonOrder* p_Morton,
+    const float* p_PosX,
+    const float* p_PosY,
+    const float* p_PosZ,
+    uint32_t p_Count,
+    NBodyThreadPool* p_Pool) {
+  nbodyMortonReserve(p_Morton, p_Count);
+  p_Morton->m_Count = p_Count;
+  if (p_Count == 0)
+    return;
+
+  std::vector<float> bounds(6 * nbodyPoolWorkerCount(p_Pool));
+  for (size_t b = 0; b < bounds.size(); b += 6) {
+    bounds[b + 0] = bounds[b + 1] = bounds[b + 2] = INFINITY;
+    bounds[b + 3] = bounds[b + 4] = bounds[b + 5] = -INFINITY;
+  }
+
+  MortonJob job = {};
+  job.m_Morton = p_Morton;
+  job.m_PosX = p_PosX;
+  job.m_PosY = p_PosY;
+  job.m_PosZ = p_PosZ;
+  job.m_Bounds = bounds.data();
+
+  // Bounding cube, slightly enlarged so that the max corner quantizes inside.
+  nbodyPoolParallelFor(p_Pool, p_Count, NBodyMortonGrain, _boundsJob, &job);
+  float boxMin[3] = {INFINITY, INFINITY, INFINITY};
+  float boxMax[3] = {-INFINITY, -INFINITY, -INFINITY};
+  for (size_t b = 0; b < bounds.size(); b += 6) {
+    for (int a = 0; a < 3; ++a) {
+      boxMin[a] = std::min(boxMin[a], bounds[b + a]);
+      boxMax[a] = std::max(boxMax[a], bounds[b + 3 + a]);
+    }
+  }
+  float size = 0.0f;
+  for (int a = 0; a < 3; ++a) {
+    size = std::max(size, boxMax[a] - boxMin[a]);
+  }
+  size = size > 0.0f ? size * 1.0001f : 1.0f;
+  for (int a = 0; a < 3; ++a) {
+    p_Morton->m_Min[a] = 0.5f * (boxMin[a] + boxMax[a]) - 0.5f * size;
+  }
+  p_Morton->m_Size = size;
+
+  nbodyPoolParallelFor(p_Pool, p_Count, NBodyMortonGrain, _keysJob, &job);
+  nbodyMortonSortKeys(p_Morton, p_Count, 3 * NBodyMortonLevels, p_Pool);
+}
+//---------------------------------------------------------------------------//
+void nbodyMortonSortKeys(
+    NBodyMortonOrder* p_Morton,
+    uint32_t p_Count,
+    uint32_t p_KeyBits,
+    NBodyThreadPool* p_Pool) {
+  NBODY_ASSERT(p_Count <= p_Morton->m_Capacity);
+  p_Morton->m_Count = p_Count;
+  if (p_Count == 0)
+    return;
+
+  const uint32_t blockCount =
+      (p_Count + NBodyMortonGrain - 1) / NBodyMortonGrain;
+  std::vector<uint32_t> counts(size_t(blockCount) * NBodyRadixBuckets);
+  MortonJob job = {};
+  job.m_Morton = p_Morton;
+  job.m_Counts = counts.data();
+  nbodyPoolParallelFor(p_Pool, p_Count, NBodyMortonGrain, _orderJob, &job);
+
+  // LSD radix sort over the key bits
+  for (uint32_t shift = 0; shift < p_KeyBits; shift += NBodyRadixBits) {
+    job.m_Shift = shift;
+    nbodyPoolParallelFor(
+        p_Pool, p_Count, NBodyMortonGrain, _histogramJob, &job);
+
+    // Exclusive scan in (digit, block) order turns the histograms into the
+    // first destination of every digit of every block.
+    uint32_t offset = 0;
+    bool constantDigit = false;
+    for (uint32_t d = 0; d < NBodyRadixBuckets && !constantDigit; ++d) {
+      uint32_t digitCount = 0;
+      for (uint32_t b = 0; b < blockCount; ++b) {
+        uint32_t& count = counts[size_t(b) * NBodyRadixBuckets + d];
+        const uint32_t blockDigitCount = count;
+        count = offset;
+        offset += blockDigitCount;
+        digitCount += blockDigitCount;
+      }
+      constantDigit = digitCount == p_Count;
+    }
+    if (constantDigit)
+      continue;
+
+    nbodyPoolParallelFor(p_Pool, p_Count, NBodyMortonGrain, _scatterJob, &job);
+    std::swap(p_Morton->m_Keys, p_Morton->m_TmpKeys);
+    std::swap(p_Morton->m_Order, p_Morton->m_TmpOrder);
+  }
+}
+//---------------------------------------------------------------------------//
@@ -0,0 +1,100 @@
+#pragma once
+
+/******************************************************************************
+ * \Morton (Z-order) keys and parallel radix sort for the CPU engine
+ * \positions are quantized to 21 bits per axis inside their bounding cube and
+ * \interleaved into 63-bit keys. Sorting by key lays particles out along the
+ * \Z curve, so particles close in space end up close in memory.
+ ******************************************************************************/
+
+#include "NBodyCommon.hpp"
+#include "NBodyThreadPool.hpp"
+
+// 21 bits per axis, also the deepest level of the octree.
+static constexpr uint32_t NBodyMortonLevels = 21;
+
+//---------------------------------------------------------------------------//
+struct NBodyMortonOrder {
+  uint32_t m_Count;
+  uint32_t m_Capacity;
+
+  // Sorted keys, m_Order[k] is the original index of the k-th particle.
+  uint64_t* m_Keys;
+  uint32_t* m_Order;
+
+  // Radix sort ping-pong buffers
+  uint64_t* m_TmpKeys;
+  uint32_t* m_TmpOrder;
+
+  // Bounding cube the keys were quantized in
+  float m_Min[3];
+  float m_Size;
+};
+
+//---------------------------------------------------------------------------//
+// Spreads the 21 low bits of p_Value to every third bit.
+inline uint64_t nbodyMortonExpand(uint64_t p_Value) {
+  p_Value &= 0x1fffff;
+  p_Value = (p_Value | p_Value << 32) & 0x1f00000000ffffull;
+  p_Value = (p_Value | p_Value << 16) & 0x1f0000ff0000ffull;
+  p_Value = (p_Value | p_Value << 8) & 0x100f00f00f00f00full;
+  p_Value = (p_Value | p_Value << 4) & 0x10c30c30c30c30c3ull;
+  p_Value = (p_Value | p_Value << 2) & 0x1249249249249249ull;
+  return p_Value;
+}
+//---------------------------------------------------------------------------//
+// nbodyMortonExpand of the 10 low bits in 32-bit lanes, for loops the
+// compiler vectorizes without 64-bit multiplies or shifts.
+inline uint32_t nbodyMortonExpand10(uint32_t p_Value) {
+  p_Value &= 0x3ff;
+  p_Value = (p_Value | p_Value << 16) & 0x030000ff;
+  p_Value = (p_Value | p_Value << 8) & 0x0300f00f;
+  p_Value = (p_Value | p_Value << 4) & 0x030c30c3;
+  p_Value = (p_Value | p_Value << 2) & 0x09249249;
+  return p_Value;
+}
+//---------------------------------------------------------------------------//
+// Inverse of nbodyMortonExpand.
+inline uint32_t nbodyMortonCompact(uint64_t p_Value) {
+  p_Value &= 0x1249249249249249ull;
+  p_Value = (p_Value | p_Value >> 2) & 0x10c30c30c30c30c3ull;
+  p_Value = (p_Value | p_Value >> 4) & 0x100f00f00f00f00full;
+  p_Value = (p_Value | p_Value >> 8) & 0x1f0000ff0000ffull;
+  p_Value = (p_Value | p_Value >> 16) & 0x1f00000000ffffull;
+  p_Value = (p_Value | p_Value >> 32) & 0x1fffff;
+  return static_cast<uint32_t>(p_Value);
+}
+//---------------------------------------------------------------------------//
+// x in the highest bit of every triplet, z in the lowest.
+inline uint64_t nbodyMortonEncode(uint32_t p_X, uint32_t p_Y, uint32_t p_Z) {
+  return nbodyMortonExpand(p_X) << 2 | nbodyMortonExpand(p_Y) << 1 |
+         nbodyMortonExpand(p_Z);
+}
+//---------------------------------------------------------------------------//
+void nbodyMortonInit(NBodyMortonOrder* p_Morton);
+//---------------------------------------------------------------------------//
+void nbodyMortonDestroy(NBodyMortonOrder* p_Morton);
+//---------------------------------------------------------------------------//
+// Room for p_Count keys and indices, for callers of nbodyMortonSortKeys.
+void nbodyMortonReserve(NBodyMortonOrder* p_Morton, uint32_t p_Count);
+//---------------------------------------------------------------------------//
+// Bounding cube, keys and a stable sort (LSD radix, 8 bits per pass, passes
+// over constant digits are skipped) of p_Count positions, every stage runs on
+// p_Pool (may be nullptr).
+void nbodyMortonSort(
+    NBodyMortonOrder* p_Morton,
+    const float* p_PosX,
+    const float* p_PosY,
+    const float* p_PosZ,
+    uint32_t p_Count,
+    NBodyThreadPool* p_Pool);
+//---------------------------------------------------------------------------//
+// The radix sort of nbodyMortonSort alone, over p_Count keys below
+// 2^p_KeyBits that the caller wrote to m_Keys (m_Min and m_Size are left as
+// they are): the passes over the digits above are not even counted.
+void nbodyMortonSortKeys(
+    NBodyMortonOrder* p_Morton,
+    uint32_t p_Count,
+    uint32_t p_KeyBits,
+    NBodyThreadPool* p_Pool);
+//---------------------------------------------------------------------------//
@@ -0,0 +1,303 @@
+#include "NBodyOptions.hpp"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+enum OptionType : uint32_t {
+  OptionUint,
+  OptionFloat,
+  OptionString,
+  OptionFlag, // No value, sets a bool
+  OptionEnum  // One of the names of m_EnumName, sets a uint32_t enum
+};
+
+struct OptionDesc {
+  const char* m_Name;
+  OptionType m_Type;
+  size_t m_Offset;
+  // OptionEnum only
+  const char* (*m_EnumName)(uint32_t) = nullptr;
+  uint32_t m_EnumCount = 0;
+};
+} // namespace
+
+template <typename E, const char* (*Name)(E)>
+static const char* _enumName(uint32_t p_Value) {
+  return Name(E(p_Value));
+}
+
+static const OptionDesc s_Options[] = {
+    {"particles", OptionUint, offsetof(NBodyOptions, m_ParticleCount)},
+    {"model",
+     OptionEnum,
+     offsetof(NBodyOptions, m_Model),
+     _enumName<NBodyModel, nbodyModelName>,
+     NBodyModelCount},
+    {"spread", OptionFloat, offsetof(NBodyOptions, m_Spread)},
+    {"seed", OptionUint, offsetof(NBodyOptions, m_Seed)},
+    {"load", OptionString, offsetof(NBodyOptions, m_LoadPath)},
+    {"save", OptionString, offsetof(NBodyOptions, m_SavePath)},
+    {"trajectory", OptionString, offsetof(NBodyOptions, m_TrajectoryPath)},
+    {"every", OptionUint, offsetof(NBodyOptions, m_TrajectoryInterval)},
+    {"codec",
+     OptionEnum,
+     offsetof(NBodyOptions, m_Codec),
+     _enumName<NBodyFrameCodec, nbodyCodecName>,
+     NBodyCodecCount},
+    {"error", OptionFloat, offsetof(NBodyOptions, m_ErrorBound)},
+    {"checkpoint", OptionString, offsetof(NBodyOptions, m_CheckpointPath)},
+    {"checkpoint-every",
+     OptionUint,
+     offsetof(NBodyOptions, m_CheckpointInterval)},
+    {"checkpoint-seconds",
+     OptionFloat,
+     offsetof(NBodyOptions, m_CheckpointSeconds)},
+    {"restart", OptionFlag, offsetof(NBodyOptions, m_Restart)},
+    {"tile", OptionUint, offsetof(NBodyOptions, m_TileSize)},
+    {"unroll", OptionUint, offsetof(NBodyOptions, m_Unroll)},
+    {"tune", OptionFlag, offsetof(NBodyOptions, m_Tune)},
+    {"buffers", OptionUint, offsetof(NBodyOptions, m_StateBuffers)},
+    {"accum",
+     OptionEnum,
+     offsetof(NBodyOptions, m_Accumulation),
+     _enumName<NBodyAccumulation, nbodyAccumulationName>,
+     NBodyAccumCount},
+    {"positions",
+     OptionEnum,
+     offsetof(NBodyOptions, m_PosFormat),
+     _enumName<NBodyPosFormat, nbodyPosFormatName>,
+     NBodyPosFormatCount},
+    {"deterministic", OptionFlag, offsetof(NBodyOptions, m_Deterministic)},
+    {"steps", OptionUint, offsetof(NBodyOptions, m_StepCount)},
+    {"threads", OptionUint, offsetof(NBodyOptions, m_ThreadCount)},
+    {"backend",
+     OptionEnum,
+     offsetof(NBodyOptions, m_Backend),
+     _enumName<NBodyBackend, nbodyBackendName>,
+     NBodyBackendCount},
+    {"mode", OptionString, offsetof(NBodyOptions, m_Mode)},
+};
+
+//---------------------------------------------------------------------------//
+/// Local functions:
+//---------------------------------------------------------------------------//
+static bool _parseUint(const char* p_Text, uint32_t* p_Value) {
+  if (p_Text[0] < '0' || p_Text[0] > '9')
+    return false;
+  char* end = nullptr;
+  errno = 0;
+  const unsigned long long value = strtoull(p_Text, &end, 10);
+  if (errno != 0 || *end != '\0' || value > UINT32_MAX)
+    return false;
+  *p_Value = static_cast<uint32_t>(value);
+  return true;
+}
+//---------------------------------------------------------------------------//
+static bool _parseFloat(const char* p_Text, float* p_Value) {
+  char* end = nullptr;
+  errno = 0;
+  const float value = strtof(p_Text, &end);
+  if (errno != 0 || end == p_Text || *end != '\0' || !isfinite(value))
+    return false;
+  *p_Value = value;
+  return true;
+}
+//---------------------------------------------------------------------------//
+// Range checks of the values that the front-ends can't run with.
+static const char* _validate(const NBodyOptions* p_Options) {
+  if (p_Options->m_ParticleCount == 0)
+    return "--particles must be at least 1";
+  if (!(p_Options->m_Spread > 0.0f))
+    return "--spread must be positive";
+  if (p_Options->m_TrajectoryInterval == 0)
+    return "--every must be at least 1";
+  if (!(p_Options->m_ErrorBound >= NBodyMinErrorBound &&
+        p_Options->m_ErrorBound <= NBodyMaxErrorBound))
+    return "--error must be in [1e-8, 0.1]";
+  if (!(p_Options->m_CheckpointSeconds >= 0.0f))
+    return "--checkpoint-seconds must not be negative";
+  if (p_Options->m_Restart && p_Options->m_CheckpointPath[0] == '\0')
+    return "--restart needs --checkpoint";
+  if (p_Options->m_Restart && p_Options->m_LoadPath[0] != '\0')
+    return "--restart and --load both set the particles";
+  if (p_Options->m_TileSize == 0 ||
+      p_Options->m_TileSize % NBodyTileUnroll != 0 ||
+      p_Options->m_TileSize > NBodyMaxTileSize)
+    return "--tile must be a multiple of 8 in [8, 1024]";
+  if (p_Options->m_Unroll > NBodyTileUnroll ||
+      (p_Options->m_Unroll & (p_Options->m_Unroll - 1)) != 0)
+    return "--unroll must be 0 (full), 1, 2, 4 or 8";
+  if (p_Options->m_StateBuffers < 2 ||
+      p_Options->m_StateBuffers > NBodyMaxStateBuffers)
+    return "--buffers must be in [2, 8]";
+  return nullptr;
+}
+//---------------------------------------------------------------------------//
+// Core functions:
+//---------------------------------------------------------------------------//
+void nbodyOptionsInit(NBodyOptions* p_Options) {
+  memset(p_Options, 0, sizeof(*p_Options));
+  p_Options->m_ParticleCount = 10000;
+  p_Options->m_Model = NBodyModelClusters;
+  p_Options->m_Spread = 400.0f;
+  p_Options->m_Seed = NBodyDefaultSeed;
+  p_Options->m_LoadPath = "";
+  p_Options->m_SavePath = "";
+  p_Options->m_TrajectoryPath = "";
+  p_Options->m_TrajectoryInterval = 1;
+  p_Options->m_Codec = NBodyCodecRaw;
+  p_Options->m_ErrorBound = NBodyDefaultErrorBound;
+  p_Options->m_CheckpointPath = "";
+  p_Options->m_CheckpointInterval = 0;
+  p_Options->m_CheckpointSeconds = 0.0f;
+  p_Options->m_Restart = false;
+  p_Options->m_TileSize = NBodyDefaultTileSize;
+  p_Options->m_Unroll = 0;
+  p_Options->m_Tune = false;
+  p_Options->m_StateBuffers = NBodyDefaultStateBuffers;
+  p_Options->m_Accumulation = NBodyAccumFloat;
+  p_Options->m_PosFormat = NBodyPosFloat32;
+  p_Options->m_Deterministic = false;
+  p_Options->m_StepCount = 0;
+  p_Options->m_ThreadCount = 0;
+  p_Options->m_Backend = NBodyBackendGpu;
+  p_Options->m_Mode = "";
+}
+//---------------------------------------------------------------------------//
+bool nbodyParseOptions(
+    NBodyOptions* p_Options,
+    int p_Argc,
+    const char* const* p_Argv,
+    char* p_Error,
+    size_t p_ErrorSize) {
+  p_Options->m_PositionalCount = 0;
+
+  for (int i = 1; i < p_Argc; ++i) {
+    const char* arg = p_Argv[i];
+    if (strncmp(arg, "--", 2) != 0) {
+      if (p_Options->m_PositionalCount == NBodyMaxPositionals) {
+        snprintf(p_Error, p_ErrorSize, "too many arguments: %s", arg);
+        return false;
+      }
+      p_Options->m_Positionals[p_Options->m_PositionalCount++] = arg;
+      continue;
+    }
+
+    // "--name=value" or "--name value"
+    const char* name = arg + 2;
+    const char* equals = strchr(name, '=');
+    const size_t nameLength =
+        equals != nullptr ? size_t(equals - name) : strlen(name);
+    const OptionDesc* option = nullptr;
+    for (const OptionDesc& desc : s_Options) {
+      if (strlen(desc.m_Name) == nameLength &&
+          strncmp(desc.m_Name, name, nameLength) == 0)
+        option = &desc;
+    }
+    if (option == nullptr) {
+      snprintf(p_Error, p_ErrorSize, "unknown option: %s", arg);
+      return false;
+    }
+    const char* value = equals != nullptr ? equals + 1 : nullptr;
+    if (option->m_Type == OptionFlag) {
+      if (value != nullptr) {
+        snprintf(p_Error, p_ErrorSize, "--%s takes no value", option->m_Name);
+        return false;
+      }
+      *reinterpret_cast<bool*>(
+          reinterpret_cast<char*>(p_Options) + option->m_Offset) = true;
+      continue;
+    }
+    if (value == nullptr) {
+      if (i + 1 == p_Argc) {
+        snprintf(
+            p_Error, p_ErrorSize, "missing value for --%s", option->m_Name);
+        return false;
+      }
+      value = p_Argv[++i];
+    }
+
+    char* field = reinterpret_cast<char*>(p_Options) + option->m_Offset;
+    bool valid = true;
+    if (option->m_Type == OptionUint) {
+      valid = _parseUint(value, reinterpret_cast<uint32_t*>(field));
+    } else if (option->m_Type == OptionFloat) {
+      valid = _parseFloat(value, reinterpret_cast<float*>(field));
+    } else if (option->m_Type == OptionEnum) {
+      valid = false;
+      for (uint32_t e = 0; e < option->m_EnumCount; ++e) {
+        if (strcmp(value, option->m_EnumName(e)) == 0) {
+          *reinterpret_cast<uint32_t*>(field) = e;
+          valid = true;
+        }
+      }
+    } else {
+      *reinterpret_cast<const char**>(field) = value;
+    }
+    if (!valid) {
+      snprintf(
+          p_Error,
+          p_ErrorSize,
+          "invalid value for --%s: %s",
+          option->m_Name,
+          value);
+      return false;
+    }
+  }
+
+  const char* error = _validate(p_Options);
+  if (error != nullptr) {
+    snprintf(p_Error, p_ErrorSize, "%s", error);
+    return false;
+  }
+  return true;
+}
+//---------------------------------------------------------------------------//
+const char* nbodyBackendName(NBodyBackend p_Backend) {
+  static const char* s_Names[NBodyBackendCount] = {"gpu", "cpu"};
+  NBODY_ASSERT(p_Backend < NBodyBackendCount);
+  return s_Names[p_Backend];
+}
+//---------------------------------------------------------------------------//
+const char* nbodyOptionsHelp() {
+  return "  --particles N  number of bodies (10000)\n"
+         "  --model M      initial conditions: clusters, plummer, hernquist,\n"
+         "                 nfw, disk, collapse or zeldovich (clusters)\n"
+         "  --spread R     length scale of the model, the cluster radius\n"
+         "                 (400)\n"
+         "  --seed S       of the initial conditions, any particle range can\n"
+         "                 be regenerated from it (0)\n"
+         "  --load F       start from the snapshot F (NBodySnapshot.hpp),\n"
+         "                 its particle count replaces --particles\n"
+         "  --save F       snapshot of the last step to F (headless)\n"
+         "  --trajectory F positions of every --every K-th step (1) to F,\n"
+         "                 written by a background thread (headless)\n"
+         "  --codec C      of the trajectory frames: raw, xor or quant (raw)\n"
+         "  --error E      largest error of quant, relative to the bounding\n"
+         "                 box (1e-5)\n"
+         "  --checkpoint F state of the run to F every --checkpoint-every N\n"
+         "                 steps or --checkpoint-seconds S (0: never) and at\n"
+         "                 the end, atomic and incremental (headless)\n"
+         "  --restart      resume the run of --checkpoint F bitwise, up to\n"
+         "                 --steps in all\n"
+         "  --tile N       CSMain group size (128) / CPU pool block (256),\n"
+         "                 a multiple of 8 in [8, 1024]\n"
+         "  --unroll N     CSMain j loop unroll, 1 to 8 or 0 for full (0)\n"
+         "  --tune         time CSMain's tile and unroll on this adapter,\n"
+         "                 cached in NBodyDispatch.cache (demo)\n"
+         "  --buffers K    particle state buffers in [2, 8], compute runs up\n"
+         "                 to K - 1 steps ahead of the renderer (2, demo)\n"
+         "  --accum A      force accumulation: float, kahan or double (float)\n"
+         "  --positions P  source positions: float32, float16 or bfloat16\n"
+         "                 stored for the tiles (float32)\n"
+         "  --deterministic\n"
+         "                 CPU steps bitwise independent of the threads and\n"
+         "                 ISA, a position checksum per step (headless)\n"
+         "  --steps N      steps to run\n"
+         "  --threads N    CPU pool workers, 0 for all logical cores (0)\n"
+         "  --backend B    gpu (demo) or cpu (headless)\n"
+         "  --mode M       report of the headless driver\n";
+}
+//---------------------------------------------------------------------------//
@@ -0,0 +1,97 @@
+#pragma once
+
+/******************************************************************************
+ * \typed command line options shared by the demo and the headless driver
+ * \--particles, --model, --spread, --seed, --load, --save, --trajectory,
+ * \--every, --codec, --error, --checkpoint, --checkpoint-every,
+ * \--checkpoint-seconds, --restart, --tile, --unroll, --tune, --buffers,
+ * \--accum, --positions, --deterministic, --steps, --threads, --backend and
+ * \--mode, given as "--name value" or "--name=value" (--restart, --tune and
+ * \--deterministic take no value). Arguments that don't start with "--" are
+ * \kept in order as positionals for the caller.
+ ******************************************************************************/
+
+#include "NBodyCommon.hpp"
+#include "NBodyInitialConditions.hpp"
+#include "NBodyKernels.hpp"
+#include "NBodyTimeline.hpp"
+#include "NBodyTrajectory.hpp"
+
+// CSMain's thread group and shared memory tile, a multiple of the largest
+// partial unroll of its j loop, D3D12 caps a group at 1024 threads.
+static constexpr uint32_t NBodyDefaultTileSize = 128;
+static constexpr uint32_t NBodyTileUnroll = 8;
+static constexpr uint32_t NBodyMaxTileSize = 1024;
+static constexpr uint32_t NBodyMaxPositionals = 8;
+
+//---------------------------------------------------------------------------//
+enum NBodyBackend : uint32_t {
+  NBodyBackendGpu = 0, // CSMain on the D3D12 compute queue (the demo)
+  NBodyBackendCpu,     // The portable engine of NBodyCpu.hpp (headless)
+  NBodyBackendCount
+};
+
+//---------------------------------------------------------------------------//
+struct NBodyOptions {
+  uint32_t m_ParticleCount; // --particles, at least 1
+  NBodyModel m_Model;       // --model, of the initial conditions
+  float m_Spread;           // --spread, length scale of the model
+  uint32_t m_Seed;          // --seed of the initial conditions
+  // --load, snapshot to start from instead of the model (and its particle
+  // count), --save, written after the last step (headless), "" for none
+  const char* m_LoadPath;
+  const char* m_SavePath;
+  // --trajectory, file of every --every-th step's positions encoded with
+  // --codec (headless), "" for none, --error the bound of the quant codec
+  const char* m_TrajectoryPath;
+  uint32_t m_TrajectoryInterval;
+  NBodyFrameCodec m_Codec;
+  float m_ErrorBound;
+  // --checkpoint, file of the run's state written every --checkpoint-every
+  // steps or --checkpoint-seconds seconds (0: never) and after the last
+  // step (headless), "" for none. --restart resumes the run from it, up to
+  // --steps steps in all.
+  const char* m_CheckpointPath;
+  uint32_t m_CheckpointInterval;
+  float m_CheckpointSeconds;
+  bool m_Restart;
+  uint32_t m_TileSize;      // --tile, CSMain group size / CPU pool block
+  uint32_t m_Unroll;        // --unroll, of CSMain's j loop, 0 for full
+  bool m_Tune;              // --tune, tile and unroll by NBodyDispatchTuner
+  uint32_t m_StateBuffers;  // --buffers, of the compute/render NBodyStateRing
+  // --accum float|kahan|double, --positions float32|float16|bfloat16
+  NBodyAccumulation m_Accumulation;
+  NBodyPosFormat m_PosFormat;
+  bool m_Deterministic;     // --deterministic, see nbodyCpuSetDeterministic
+  uint32_t m_StepCount;     // --steps, 0 runs until closed (demo only)
+  uint32_t m_ThreadCount;   // --threads, CPU pool, 0 for all logical cores
+  NBodyBackend m_Backend;   // --backend gpu|cpu
+  const char* m_Mode;       // --mode, report of the headless driver
+
+  const char* m_Positionals[NBodyMaxPositionals];
+  uint32_t m_PositionalCount;
+};
+
+//---------------------------------------------------------------------------//
+// Demo defaults (10000 particles in two clusters of radius 400, seed 0, no
+// snapshots, no trajectory (every step, raw, error bound 1e-5 when given),
+// no checkpoints, tile 128 fully unrolled, no tuning, float32 throughout, not
+// deterministic, unbounded steps, all cores, gpu), front-ends override them
+// before parsing.
+void nbodyOptionsInit(NBodyOptions* p_Options);
+//---------------------------------------------------------------------------//
+// Parses p_Argv[1..p_Argc) into p_Options, the positionals are reset first.
+// Stops at the first unknown option or invalid value and returns false with
+// a message in p_Error (strings are not copied, p_Argv must outlive them).
+bool nbodyParseOptions(
+    NBodyOptions* p_Options,
+    int p_Argc,
+    const char* const* p_Argv,
+    char* p_Error,
+    size_t p_ErrorSize);
+//---------------------------------------------------------------------------//
+const char* nbodyBackendName(NBodyBackend p_Backend);
+//---------------------------------------------------------------------------//
+// One line per option, for the usage message of a front-end.
+const char* nbodyOptionsHelp();
+//---------------------------------------------------------------------------//
@@ -0,0 +1,466 @@
+#include "NBodyQuantCodec.hpp"
+#include "NBodyMorton.hpp"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <vector>
+#if NBODY_X86
+#include <emmintrin.h>
+#endif
+
+// Grid cells stay below 2^29 in magnitude, so that the residuals of the
+// linear prediction (3 cells) fit 32 bits.
+static constexpr int32_t NBodyQuantCellLimit = 1 << 29;
+
+// Particles coded together: their x, y and z blocks are packed from the
+// stack, the streams never go through memory.
+static constexpr uint32_t NBodyQuantChunk = 8 * NBodyPackBlock;
+
+// Morton levels of the keyframe order: two more than one cell per particle
+// (64 cells each), enough to keep ties rare, with at most 30-bit keys so
+// that the radix sort skips half its passes (nbodyMortonExpand10).
+static constexpr uint32_t NBodyQuantKeyMaxLevels = 10;
+
+struct NBodyQuantCoder {
+  uint32_t m_Count;
+  uint32_t m_BlockCount;
+  float m_ErrorBound;
+  NBodyPackKernel m_Pack;
+  NBodyUnpackKernel m_Unpack;
+  NBodyQuantizeKernel m_Quantize;
+  NBodyPredictKernel m_Predict;
+  NBodyUnpredictKernel m_Unpredict;
+  NBodyDequantizeKernel m_Dequantize;
+
+  // Current group: grid, frames coded since its keyframe (0 = none) and the
+  // extent its grid was made for.
+  NBodyQuantHeader m_Grid;
+  uint32_t m_GroupFrames;
+  double m_KeyExtent;
+
+  // Ids in coding order (padded to whole blocks) and, in the same order, the
+  // last cells of every particle then their change over the last frame:
+  // rows of x, y, z, dx, dy and dz (two's complement, wrapping arithmetic).
+  std::vector<uint32_t> m_Order;
+  std::vector<uint32_t> m_State;
+
+  NBodyMortonOrder m_Morton;
+  std::vector<bool> m_Seen;
+};
+
+//---------------------------------------------------------------------------//
+/// Local functions:
+//---------------------------------------------------------------------------//
+// Small magnitudes of either sign to small unsigned values.
+static uint32_t _zigzag(int32_t p_Value) {
+  return uint32_t(p_Value) << 1 ^ uint32_t(p_Value >> 31);
+}
+//---------------------------------------------------------------------------//
+static uint32_t _unzigzag(uint32_t p_Value) {
+  return p_Value >> 1 ^ (0u - (p_Value & 1u));
+}
+//---------------------------------------------------------------------------//
+// Width bytes of a stream, the words after them stay 4-byte aligned.
+static size_t _widthBytes(uint32_t p_BlockCount) {
+  return (size_t(p_BlockCount) + 3) & ~size_t(3);
+}
+//---------------------------------------------------------------------------//
+// Words of the p_BlockCount widths at p_Widths, SIZE_MAX if one is invalid.
+static size_t _wordCount(const uint8_t* p_Widths, uint32_t p_BlockCount) {
+  size_t words = 0;
+  for (uint32_t b = 0; b < p_BlockCount; ++b) {
+    if (p_Widths[b] > 32)
+      return SIZE_MAX;
+    words += p_Widths[b];
+  }
+  return words;
+}
+//---------------------------------------------------------------------------//
+// Smallest and largest of p_Count values, NaNs ignored (SSE2 min/max keep
+// the second operand). Without -ffast-math the compiler leaves the loop
+// scalar.
+static void
+_bounds(const float* p_Values, uint32_t p_Count, float* p_Low, float* p_High) {
+  float low = INFINITY;
+  float high = -INFINITY;
+  uint32_t i = 0;
+#if NBODY_X86
+  __m128 lows = _mm_set1_ps(INFINITY);
+  __m128 highs = _mm_set1_ps(-INFINITY);
+  for (; i + 4 <= p_Count; i += 4) {
+    const __m128 values = _mm_loadu_ps(p_Values + i);
+    lows = _mm_min_ps(values, lows);
+    highs = _mm_max_ps(values, highs);
+  }
+  alignas(16) float lanes[8];
+  _mm_store_ps(lanes, lows);
+  _mm_store_ps(lanes + 4, highs);
+  for (uint32_t l = 0; l < 4; ++l) {
+    low = std::min(low, lanes[l]);
+    high = std::max(high, lanes[4 + l]);
+  }
+#endif
+  for (; i < p_Count; ++i) {
+    low = p_Values[i] < low ? p_Values[i] : low;
+    high = p_Values[i] > high ? p_Values[i] : high;
+  }
+  *p_Low = low;
+  *p_High = high;
+}
+//---------------------------------------------------------------------------//
+// Cells of the p_Count particles of p_Ids (nullptr: the ids from p_First)
+// in the current grid, x, y then z rows of NBodyQuantChunk, and the range
+// of every axis widened to them. False if one is out of range (or not
+// finite).
+static bool _quantize(
+    const NBodyQuantCoder* p_Coder,
+    const float* const* p_Positions,
+    const uint32_t* p_Ids,
+    uint32_t p_First,
+    uint32_t p_Count,
+    int32_t (*p_Cells)[NBodyQuantChunk],
+    int32_t (*p_Range)[2]) {
+  const double invSpacing = 1.0 / p_Coder->m_Grid.m_Spacing;
+  for (uint32_t c = 0; c < 3; ++c) {
+    if (!p_Coder->m_Quantize(
+            p_Ids != nullptr ? p_Positions[c] : p_Positions[c] + p_First,
+            p_Ids,
+            p_Count,
+            p_Coder->m_Grid.m_Origin[c],
+            invSpacing,
+            NBodyQuantCellLimit,
+            p_Cells[c],
+            p_Range[c]))
+      return false;
+  }
+  return true;
+}
+//---------------------------------------------------------------------------//
+static void _resetRange(int32_t (*p_Range)[2]) {
+  for (uint32_t c = 0; c < 3; ++c) {
+    p_Range[c][0] = INT32_MAX;
+    p_Range[c][1] = INT32_MIN;
+  }
+}
+//---------------------------------------------------------------------------//
+// Stream of the positions in m_Order, chunk by chunk: a keyframe codes every
+// cell as the difference with the particle before, the other frames with
+// the last cell plus its last change. The differences are taken in uint32,
+// they fit an int32 by the range of the cells. 0 if a particle left the
+// grid's range (m_State is then only fit for a keyframe). p_Extent is the
+// largest extent of the cells, within a spacing of the box's.
+static size_t _encodeCells(
+    NBodyQuantCoder* p_Coder,
+    const float* const* p_Positions,
+    bool p_Keyframe,
+    uint8_t* p_Dst,
+    double* p_Extent) {
+  const uint32_t count = p_Coder->m_Count;
+  const size_t widthBytes = _widthBytes(3 * p_Coder->m_BlockCount);
+  memset(p_Dst, 0, widthBytes);
+  uint8_t* widths = p_Dst;
+  uint32_t* const firstWord = reinterpret_cast<uint32_t*>(p_Dst + widthBytes);
+  uint32_t* words = firstWord;
+
+  uint32_t last[3] = {0, 0, 0};
+  int32_t range[3][2];
+  _resetRange(range);
+  alignas(64) int32_t cells[3][NBodyQuantChunk];
+  alignas(64) uint32_t values[NBodyQuantChunk];
+  for (uint32_t first = 0; first < count; first += NBodyQuantChunk) {
+    const uint32_t chunk = std::min(NBodyQuantChunk, count - first);
+    const uint32_t blocks = (chunk + NBodyPackBlock - 1) / NBodyPackBlock;
+    if (!_quantize(
+            p_Coder,
+            p_Positions,
+            &p_Coder->m_Order[first],
+            first,
+            chunk,
+            cells,
+            range))
+      return 0;
+    for (uint32_t c = 0; c < 3; ++c) {
+      const uint32_t* cell = reinterpret_cast<const uint32_t*>(cells[c]);
+      uint32_t* previous = &p_Coder->m_State[c * size_t(count) + first];
+      uint32_t* change = previous + 3 * size_t(count);
+      if (p_Keyframe) {
+        // Differences with the previous particle, without a loop-carried
+        // dependency so that the loop vectorizes.
+        values[0] = _zigzag(int32_t(cell[0] - last[c]));
+        for (uint32_t k = 1; k < chunk; ++k) {
+          values[k] = _zigzag(int32_t(cell[k] - cell[k - 1]));
+        }
+        last[c] = cell[chunk - 1];
+        memcpy(previous, cell, chunk * sizeof(uint32_t));
+        memset(change, 0, chunk * sizeof(uint32_t));
+      } else {
+        p_Coder->m_Predict(cells[c], chunk, previous, change, values);
+      }
+      memset(
+          values + chunk,
+          0,
+          (blocks * NBodyPackBlock - chunk) * sizeof(uint32_t));
+      words += p_Coder->m_Pack(values, blocks, widths, words);
+      widths += blocks;
+    }
+  }
+  *p_Extent = 0.0;
+  for (uint32_t c = 0; c < 3; ++c) {
+    const double cellExtent = double(range[c][1]) - double(range[c][0]);
+    *p_Extent = std::max(*p_Extent, cellExtent * p_Coder->m_Grid.m_Spacing);
+  }
+  return widthBytes + size_t(words - firstWord) * sizeof(uint32_t);
+}
+//---------------------------------------------------------------------------//
+// Inverse of _encodeCells into p_Positions (in id order), false if the
+// stream doesn't fit p_Size.
+static bool _decodeCells(
+    NBodyQuantCoder* p_Coder,
+    const NBodyQuantHeader& p_Header,
+    const uint8_t* p_Src,
+    size_t p_Size,
+    float* const* p_Positions,
+    size_t* p_Used) {
+  const uint32_t count = p_Coder->m_Count;
+  const bool keyframe = p_Header.m_Keyframe != 0;
+  const size_t widthBytes = _widthBytes(3 * p_Coder->m_BlockCount);
+  if (p_Size < widthBytes)
+    return false;
+  const size_t wordCount = _wordCount(p_Src, 3 * p_Coder->m_BlockCount);
+  if (wordCount > (p_Size - widthBytes) / sizeof(uint32_t))
+    return false;
+  const uint8_t* widths = p_Src;
+  const uint32_t* words = reinterpret_cast<const uint32_t*>(p_Src + widthBytes);
+
+  uint32_t last[3] = {0, 0, 0};
+  alignas(64) uint32_t values[NBodyQuantChunk];
+  for (uint32_t first = 0; first < count; first += NBodyQuantChunk) {
+    const uint32_t chunk = std::min(NBodyQuantChunk, count - first);
+    const uint32_t blocks = (chunk + NBodyPackBlock - 1) / NBodyPackBlock;
+    const uint32_t* ids = &p_Coder->m_Order[first];
+    for (uint32_t c = 0; c < 3; ++c) {
+      words += p_Coder->m_Unpack(widths, words, blocks, values);
+      widths += blocks;
+      uint32_t* previous = &p_Coder->m_State[c * size_t(count) + first];
+      uint32_t* change = previous + 3 * size_t(count);
+      if (keyframe) {
+        for (uint32_t k = 0; k < chunk; ++k) {
+          last[c] += _unzigzag(values[k]);
+          previous[k] = last[c];
+          change[k] = 0;
+        }
+      } else {
+        p_Coder->m_Unpredict(values, chunk, previous, change);
+      }
+      p_Coder->m_Dequantize(
+          reinterpret_cast<const int32_t*>(previous),
+          ids,
+          chunk,
+          p_Header.m_Origin[c],
+          p_Header.m_Spacing,
+          p_Positions[c]);
+    }
+  }
+  *p_Used = widthBytes + wordCount * sizeof(uint32_t);
+  return true;
+}
+//---------------------------------------------------------------------------//
+// New grid over the current bounding box and the Morton order of its cells,
+// stored as the ids in that order before the positions.
+static size_t _encodeKeyframe(
+    NBodyQuantCoder* p_Coder,
+    const float* const* p_Positions,
+    const double* p_BoxMin,
+    double p_Extent,
+    uint8_t* p_Dst) {
+  const uint32_t count = p_Coder->m_Count;
+  NBodyQuantHeader& grid = p_Coder->m_Grid;
+  grid.m_Keyframe = 1;
+  for (uint32_t c = 0; c < 3; ++c) {
+    grid.m_Origin[c] = p_BoxMin[c];
+  }
+  const double extent = p_Extent > 0.0 ? p_Extent : 1.0;
+  grid.m_Spacing = double(p_Coder->m_ErrorBound) * extent;
+  p_Coder->m_KeyExtent = p_Extent;
+
+  // Cells span 1 / m_ErrorBound, the keys drop the bits beyond the levels.
+  const uint32_t bits =
+      nbodyBitWidth(uint32_t(1.0 / p_Coder->m_ErrorBound) + 1);
+  const uint32_t levels = std::min(
+      (nbodyBitWidth(count) + 2) / 3 + 2, NBodyQuantKeyMaxLevels);
+  const uint32_t shift = bits > levels ? bits - levels : 0;
+  NBodyMortonOrder* morton = &p_Coder->m_Morton;
+  int32_t range[3][2];
+  _resetRange(range);
+  alignas(64) int32_t cells[3][NBodyQuantChunk];
+  for (uint32_t first = 0; first < count; first += NBodyQuantChunk) {
+    const uint32_t chunk = std::min(NBodyQuantChunk, count - first);
+    if (!_quantize(p_Coder, p_Positions, nullptr, first, chunk, cells, range))
+      return 0;
+    uint64_t* keys = morton->m_Keys + first;
+    for (uint32_t k = 0; k < chunk; ++k) {
+      keys[k] = nbodyMortonExpand10(uint32_t(cells[0][k]) >> shift) << 2 |
+                nbodyMortonExpand10(uint32_t(cells[1][k]) >> shift) << 1 |
+                nbodyMortonExpand10(uint32_t(cells[2][k]) >> shift);
+    }
+  }
+  nbodyMortonSortKeys(morton, count, 3 * levels, nullptr);
+  memcpy(p_Coder->m_Order.data(), morton->m_Order, count * sizeof(uint32_t));
+
+  memcpy(p_Dst, &grid, sizeof(grid));
+  size_t size = sizeof(grid);
+  const size_t widthBytes = _widthBytes(p_Coder->m_BlockCount);
+  memset(p_Dst + size, 0, widthBytes);
+  size += widthBytes + sizeof(uint32_t) * p_Coder->m_Pack(
+                                              p_Coder->m_Order.data(),
+                                              p_Coder->m_BlockCount,
+                                              p_Dst + size,
+                                              reinterpret_cast<uint32_t*>(
+                                                  p_Dst + size + widthBytes));
+  double cellExtent = 0.0;
+  const size_t stream =
+      _encodeCells(p_Coder, p_Positions, true, p_Dst + size, &cellExtent);
+  return stream > 0 ? size + stream : 0;
+}
+//---------------------------------------------------------------------------//
+// Ids of a keyframe into m_Order, false unless they are a permutation.
+static bool _decodeOrder(
+    NBodyQuantCoder* p_Coder,
+    const uint8_t* p_Src,
+    size_t p_Size,
+    size_t* p_Used) {
+  const uint32_t count = p_Coder->m_Count;
+  const size_t widthBytes = _widthBytes(p_Coder->m_BlockCount);
+  if (p_Size < widthBytes)
+    return false;
+  const size_t wordCount = _wordCount(p_Src, p_Coder->m_BlockCount);
+  if (wordCount > (p_Size - widthBytes) / sizeof(uint32_t))
+    return false;
+  uint32_t* order = p_Coder->m_Order.data();
+  p_Coder->m_Unpack(
+      p_Src,
+      reinterpret_cast<const uint32_t*>(p_Src + widthBytes),
+      p_Coder->m_BlockCount,
+      order);
+  p_Coder->m_Seen.assign(count, false);
+  for (uint32_t k = 0; k < count; ++k) {
+    if (order[k] >= count || p_Coder->m_Seen[order[k]])
+      return false;
+    p_Coder->m_Seen[order[k]] = true;
+  }
+  *p_Used = widthBytes + wordCount * sizeof(uint32_t);
+  return true;
+}
+//---------------------------------------------------------------------------//
+// Core functions:
+//---------------------------------------------------------------------------//
+NBodyQuantCoder* nbodyQuantCreate(
+    uint32_t p_ParticleCount, float p_ErrorBound, NBodyIsa p_Isa) {
+  NBODY_ASSERT(
+      p_ErrorBound >= NBodyMinErrorBound && p_ErrorBound <= NBodyMaxErrorBound);
+  NBodyQuantCoder* coder = new NBodyQuantCoder();
+  coder->m_Count = p_ParticleCount;
+  coder->m_BlockCount =
+      (p_ParticleCount + NBodyPackBlock - 1) / NBodyPackBlock;
+  coder->m_ErrorBound = p_ErrorBound;
+  coder->m_Pack = nbodyGetPackKernel(p_Isa);
+  coder->m_Unpack = nbodyGetUnpackKernel(p_Isa);
+  coder->m_Quantize = nbodyGetQuantizeKernel(p_Isa);
+  coder->m_Predict = nbodyGetPredictKernel(p_Isa);
+  coder->m_Unpredict = nbodyGetUnpredictKernel(p_Isa);
+  coder->m_Dequantize = nbodyGetDequantizeKernel(p_Isa);
+
+  coder->m_Order.assign(size_t(coder->m_BlockCount) * NBodyPackBlock, 0);
+  coder->m_State.resize(6 * size_t(p_ParticleCount));
+  nbodyMortonInit(&coder->m_Morton);
+  nbodyMortonReserve(&coder->m_Morton, p_ParticleCount);
+  return coder;
+}
+//---------------------------------------------------------------------------//
+void nbodyQuantDestroy(NBodyQuantCoder* p_Coder) {
+  nbodyMortonDestroy(&p_Coder->m_Morton);
+  delete p_Coder;
+}
+//---------------------------------------------------------------------------//
+size_t nbodyQuantMaxSize(uint32_t p_ParticleCount) {
+  const uint32_t blockCount =
+      (p_ParticleCount + NBodyPackBlock - 1) / NBodyPackBlock;
+  const size_t words = size_t(blockCount) * NBodyPackBlock;
+  return sizeof(NBodyQuantHeader) + _widthBytes(blockCount) +
+         _widthBytes(3 * blockCount) + 4 * words * sizeof(uint32_t);
+}
+//---------------------------------------------------------------------------//
+// The cells round to the nearest grid point, so the error is at most half a
+// spacing: the error bound times half the keyframe's extent. A new group
+// starts when the box shrank below that half (measured on the cells, the
+// positions are read once per frame), or when a particle left the grid's
+// range.
+size_t nbodyQuantEncode(
+    NBodyQuantCoder* p_Coder, const float* const* p_Positions, uint8_t* p_Dst) {
+  const uint32_t count = p_Coder->m_Count;
+  size_t size = 0;
+  if (p_Coder->m_GroupFrames > 0 &&
+      p_Coder->m_GroupFrames < NBodyQuantGroupSize) {
+    NBodyQuantHeader header = p_Coder->m_Grid;
+    header.m_Keyframe = 0;
+    memcpy(p_Dst, &header, sizeof(header));
+    double cellExtent = 0.0;
+    const size_t cells = _encodeCells(
+        p_Coder, p_Positions, false, p_Dst + sizeof(header), &cellExtent);
+    if (cells > 0 && cellExtent >= 0.5 * p_Coder->m_KeyExtent)
+      size = sizeof(header) + cells;
+  }
+  const bool keyframe = size == 0;
+  if (keyframe) {
+    double boxMin[3] = {};
+    double extent = 0.0;
+    for (uint32_t c = 0; c < 3; ++c) {
+      float low;
+      float high;
+      _bounds(p_Positions[c], count, &low, &high);
+      boxMin[c] = low;
+      extent = std::max(extent, double(high) - low);
+    }
+    if (isfinite(extent))
+      size = _encodeKeyframe(p_Coder, p_Positions, boxMin, extent, p_Dst);
+  }
+  p_Coder->m_GroupFrames =
+      size == 0 ? 0 : keyframe ? 1 : p_Coder->m_GroupFrames + 1;
+  return size;
+}
+//---------------------------------------------------------------------------//
+bool nbodyQuantDecode(
+    NBodyQuantCoder* p_Coder,
+    const uint8_t* p_Src,
+    size_t p_Size,
+    float* const* p_Positions) {
+  NBodyQuantHeader header;
+  if (p_Size < sizeof(header))
+    return false;
+  memcpy(&header, p_Src, sizeof(header));
+  const bool keyframe = header.m_Keyframe != 0;
+  if (!(header.m_Spacing > 0.0) || !isfinite(header.m_Spacing) ||
+      (!keyframe && p_Coder->m_GroupFrames == 0))
+    return false;
+  size_t offset = sizeof(header);
+  size_t used = 0;
+
+  if (keyframe) {
+    if (!_decodeOrder(p_Coder, p_Src + offset, p_Size - offset, &used))
+      return false;
+    offset += used;
+  }
+  if (!_decodeCells(
+          p_Coder,
+          header,
+          p_Src + offset,
+          p_Size - offset,
+          p_Positions,
+          &used) ||
+      offset + used != p_Size)
+    return false;
+  p_Coder->m_Grid = header;
+  p_Coder->m_GroupFrames = keyframe ? 1 : p_Coder->m_GroupFrames + 1;
+  return true;
+}
+//---------------------------------------------------------------------------//
@@ -0,0 +1,63 @@
+#pragma once
+
+/******************************************************************************
+ * \lossy trajectory codec with a guaranteed error bound
+ * \positions are rounded to a grid whose spacing is the error bound times the
+ * \bounding box of a keyframe, then coded as integers: a keyframe stores the
+ * \particles in the Morton order of their grid cells (neighbours differ by a
+ * \few cells) and the frames after it only the difference with a linear
+ * \prediction from the two before, particles in the keyframe's order. The
+ * \zigzagged residuals are bit-packed in blocks by the SIMD kernels of
+ * \NBodyKernels.hpp.
+ ******************************************************************************/
+
+#include "NBodyKernels.hpp"
+#include <stddef.h>
+
+struct NBodyQuantCoder;
+
+// Error bound relative to the largest side of the bounding box
+static constexpr float NBodyDefaultErrorBound = 1e-5f;
+static constexpr float NBodyMinErrorBound = 1e-8f;
+static constexpr float NBodyMaxErrorBound = 0.1f;
+// Frames of a group: a keyframe and the predicted frames after it
+static constexpr uint32_t NBodyQuantGroupSize = 64;
+
+//---------------------------------------------------------------------------//
+// Payload of a frame: this header, the ids in coding order if it is a
+// keyframe, then the positions. Both are packed streams: a width byte per
+// block of NBodyPackBlock (padded to 4 bytes), then the words. Positions go
+// by 256 particles, their x blocks, y blocks then z blocks.
+//---------------------------------------------------------------------------//
+struct NBodyQuantHeader {
+  uint32_t m_Keyframe; // 1: new grid and order, 0: predicted
+  uint32_t m_Reserved;
+  double m_Origin[3];  // Position of grid cell 0
+  double m_Spacing;    // Grid step, twice the largest error
+};
+static_assert(sizeof(NBodyQuantHeader) == 40, "Fixed size header");
+
+//---------------------------------------------------------------------------//
+// A coder is used in one direction only: its state is the current group.
+NBodyQuantCoder* nbodyQuantCreate(
+    uint32_t p_ParticleCount, float p_ErrorBound, NBodyIsa p_Isa);
+//---------------------------------------------------------------------------//
+void nbodyQuantDestroy(NBodyQuantCoder* p_Coder);
+//---------------------------------------------------------------------------//
+// Largest payload of a frame.
+size_t nbodyQuantMaxSize(uint32_t p_ParticleCount);
+//---------------------------------------------------------------------------//
+// Encodes the x, y and z arrays of p_Positions (in id order) into p_Dst and
+// returns the payload size, 0 if a position is not finite (the group is
+// then closed, the next frame is a keyframe).
+size_t nbodyQuantEncode(
+    NBodyQuantCoder* p_Coder, const float* const* p_Positions, uint8_t* p_Dst);
+//---------------------------------------------------------------------------//
+// Decodes a payload of nbodyQuantEncode into p_Positions, frames in the
+// order they were encoded. False if it is invalid.
+bool nbodyQuantDecode(
+    NBodyQuantCoder* p_Coder,
+    const uint8_t* p_Src,
+    size_t p_Size,
+    float* const* p_Positions);
+//---------------------------------------------------------------------------//
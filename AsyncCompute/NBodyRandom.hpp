@@ -0,0 +1,86 @@
+#pragma once
+
+/******************************************************************************
+ * \counter-based random numbers for the initial conditions
+ * \Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+ * \3", SC'11): every draw is a pure function of (seed, particle index,
+ * \stream, draw), so particles can be generated by any number of threads in
+ * \any order, any sub-range regenerated alone, with the same bits on every
+ * \platform (unlike rand(), whose sequence depends on the C runtime).
+ ******************************************************************************/
+
+#include "NBodyCommon.hpp"
+
+static constexpr uint32_t NBodyDefaultSeed = 0;
+
+//---------------------------------------------------------------------------//
+// Independent sequences of one particle, one per kind of quantity drawn.
+//---------------------------------------------------------------------------//
+enum NBodyRandomStream : uint32_t {
+  NBodyStreamPosition = 0,
+  NBodyStreamVelocity,
+  NBodyStreamMass,
+  NBodyStreamModel, // Tables of a model (NBodyInitialConditions.hpp)
+  NBodyStreamCount
+};
+
+//---------------------------------------------------------------------------//
+// Philox4x32 with 10 rounds, p_Counter and p_Out hold 4 words. Matches the
+// known answer tests of Random123 (e.g. counter and key 0 give 6627e8d5
+// e169c58d bc57ac4c 9b00dbd8).
+inline void nbodyPhilox(
+    const uint32_t* p_Counter, uint64_t p_Key, uint32_t* p_Out) {
+  uint32_t key[2] = {uint32_t(p_Key), uint32_t(p_Key >> 32)};
+  uint32_t ctr[4] = {p_Counter[0], p_Counter[1], p_Counter[2], p_Counter[3]};
+  for (uint32_t round = 0; round < 10; ++round) {
+    const uint64_t product0 = uint64_t(0xD2511F53u) * ctr[0];
+    const uint64_t product1 = uint64_t(0xCD9E8D57u) * ctr[2];
+    ctr[0] = uint32_t(product1 >> 32) ^ ctr[1] ^ key[0];
+    ctr[1] = uint32_t(product1);
+    ctr[2] = uint32_t(product0 >> 32) ^ ctr[3] ^ key[1];
+    ctr[3] = uint32_t(product0);
+    key[0] += 0x9E3779B9u;
+    key[1] += 0xBB67AE85u;
+  }
+  for (uint32_t w = 0; w < 4; ++w) {
+    p_Out[w] = ctr[w];
+  }
+}
+//---------------------------------------------------------------------------//
+// Four random words, draw p_Draw of the stream p_Stream of particle p_Index.
+inline void nbodyRandomBits(
+    uint32_t p_Seed,
+    uint32_t p_Index,
+    NBodyRandomStream p_Stream,
+    uint32_t p_Draw,
+    uint32_t* p_Out) {
+  const uint32_t counter[4] = {p_Index, p_Draw, p_Stream, 0};
+  nbodyPhilox(counter, p_Seed, p_Out);
+}
+//---------------------------------------------------------------------------//
+// Uniform in [0, 1) from the 24 high bits of p_Bits (every float is exact).
+inline float nbodyRandomUnit(uint32_t p_Bits) {
+  return float(p_Bits >> 8) * (1.0f / 16777216.0f);
+}
+//---------------------------------------------------------------------------//
+// Uniform in [-1, 1).
+inline float nbodyRandomSigned(uint32_t p_Bits) {
+  return 2.0f * nbodyRandomUnit(p_Bits) - 1.0f;
+}
+//---------------------------------------------------------------------------//
+// Uniform in (0, 1), for the inverse distributions that diverge at 0 or 1
+// (23 bits so that the half step stays exact).
+inline float nbodyRandomOpenUnit(uint32_t p_Bits) {
+  return (float(p_Bits >> 9) + 0.5f) * (1.0f / 8388608.0f);
+}
+//---------------------------------------------------------------------------//
+// Two independent standard normal values from two words (Box-Muller). Unlike
+// the uniforms their last bits depend on the math library.
+inline void
+nbodyRandomGaussians(uint32_t p_Bits0, uint32_t p_Bits1, float* p_Out) {
+  const float radius = sqrtf(-2.0f * logf(nbodyRandomOpenUnit(p_Bits0)));
+  const float angle = 6.28318531f * nbodyRandomUnit(p_Bits1);
+  p_Out[0] = radius * cosf(angle);
+  p_Out[1] = radius * sinf(angle);
+}
+//---------------------------------------------------------------------------//
@@ -0,0 +1,508 @@
+#pragma once
+
+/******************************************************************************
+ * \ISA independent body of the vectorized force kernels (direct and cells)
+ * \included by NBodyKernels{Sse42,Avx2,Avx512}.cpp after the target pragma,
+ * \so every instantiation is compiled for the instruction set of its TU.
+ * \V is a thin wrapper over the native vector type of one ISA.
+ ******************************************************************************/
+
+//---------------------------------------------------------------------------//
+// Same math as bodyBodyInteraction for V::Width j-bodies (x, y, z, mass in
+// p_Src) acting on one target. 1/sqrt uses the hardware estimate plus one
+// Newton-Raphson step (see V::rsqrt).
+template <typename V>
+static inline void _simdForceAccumulate(
+    const typename V::Type* p_Src,
+    const typename V::Type* p_Pos,
+    typename V::Type p_Eps2,
+    typename V::Type* p_Accel) {
+  using T = typename V::Type;
+  T rx = V::sub(p_Src[0], p_Pos[0]);
+  T ry = V::sub(p_Src[1], p_Pos[1]);
+  T rz = V::sub(p_Src[2], p_Pos[2]);
+
+  T distSqr = V::fmadd(rx, rx, V::fmadd(ry, ry, V::fmadd(rz, rz, p_Eps2)));
+  T invDist = V::rsqrt(distSqr);
+  T invDistCube = V::mul(V::mul(invDist, invDist), invDist);
+  T s = V::mul(p_Src[3], invDistCube);
+
+  p_Accel[0] = V::fmadd(rx, s, p_Accel[0]);
+  p_Accel[1] = V::fmadd(ry, s, p_Accel[1]);
+  p_Accel[2] = V::fmadd(rz, s, p_Accel[2]);
+}
+//---------------------------------------------------------------------------//
+// Loads the sources [p_J, p_J + V::Width): positions in the storage Format,
+// masses always float32.
+template <typename V, NBodyPosFormat Format>
+static inline void _simdLoadSources(
+    const NBodyForceArgs* p_Args, uint32_t p_J, typename V::Type* p_Src) {
+  if (Format == NBodyPosFloat16) {
+    p_Src[0] = V::loadHalf(p_Args->m_SrcPacked[0] + p_J);
+    p_Src[1] = V::loadHalf(p_Args->m_SrcPacked[1] + p_J);
+    p_Src[2] = V::loadHalf(p_Args->m_SrcPacked[2] + p_J);
+  } else if (Format == NBodyPosBFloat16) {
+    p_Src[0] = V::loadBf16(p_Args->m_SrcPacked[0] + p_J);
+    p_Src[1] = V::loadBf16(p_Args->m_SrcPacked[1] + p_J);
+    p_Src[2] = V::loadBf16(p_Args->m_SrcPacked[2] + p_J);
+  } else {
+    p_Src[0] = V::load(p_Args->m_SrcX + p_J);
+    p_Src[1] = V::load(p_Args->m_SrcY + p_J);
+    p_Src[2] = V::load(p_Args->m_SrcZ + p_J);
+  }
+  p_Src[3] = V::load(p_Args->m_SrcMass + p_J);
+}
+//---------------------------------------------------------------------------//
+// Sources [p_Begin, p_End) on Targets targets: every source load is shared
+// by the Targets targets (register blocking) and each target keeps Unroll
+// independent accumulators, so that Unroll vectors of sources are in flight
+// (hides the FMA latency). <V, 1, 1> is the plain loop.
+template <
+    typename V,
+    uint32_t Targets,
+    uint32_t Unroll,
+    NBodyPosFormat Format>
+static inline void _simdForceRange(
+    const NBodyForceArgs* p_Args,
+    const typename V::Type (*p_Pos)[3],
+    uint32_t p_Begin,
+    uint32_t p_End,
+    typename V::Type (*p_Accel)[Unroll][3]) {
+  using T = typename V::Type;
+  const T eps2 = V::set1(NBodySofteningSquared);
+  const uint32_t unrolledEnd =
+      p_End - (p_End - p_Begin) % (Unroll * V::Width);
+  uint32_t j = p_Begin;
+  for (; j < unrolledEnd; j += Unroll * V::Width) {
+    for (uint32_t u = 0; u < Unroll; ++u) {
+      T s[4];
+      _simdLoadSources<V, Format>(p_Args, j + u * V::Width, s);
+      for (uint32_t t = 0; t < Targets; ++t) {
+        _simdForceAccumulate<V>(s, p_Pos[t], eps2, p_Accel[t][u]);
+      }
+    }
+  }
+  // Whole vectors left over by the unrolling.
+  for (; j < p_End; j += V::Width) {
+    T s[4];
+    _simdLoadSources<V, Format>(p_Args, j, s);
+    for (uint32_t t = 0; t < Targets; ++t) {
+      _simdForceAccumulate<V>(s, p_Pos[t], eps2, p_Accel[t][0]);
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Targets [p_First, p_First + Targets) over all the sources. The compensated
+// accumulations run the sources in tiles of NBodyAccumTileSize and fold the
+// float32 sum of each tile with nbodyTileSumAdd, NBodyAccumFloat is a single
+// tile (the original loop).
+template <
+    typename V,
+    uint32_t Targets,
+    uint32_t Unroll,
+    NBodyAccumulation Accum,
+    NBodyPosFormat Format>
+static void _simdForceTargets(const NBodyForceArgs* p_Args, uint32_t p_First) {
+  using T = typename V::Type;
+  T pos[Targets][3];
+  for (uint32_t t = 0; t < Targets; ++t) {
+    const uint32_t i = p_First + t;
+    pos[t][0] = V::set1(nbodyRoundPosition(p_Args->m_DstX[i], Format));
+    pos[t][1] = V::set1(nbodyRoundPosition(p_Args->m_DstY[i], Format));
+    pos[t][2] = V::set1(nbodyRoundPosition(p_Args->m_DstZ[i], Format));
+  }
+
+  const uint32_t srcCount = p_Args->m_SrcCount;
+  const uint32_t tileSize =
+      Accum == NBodyAccumFloat ? srcCount : NBodyAccumTileSize;
+  NBodyTileSum sums[Targets][3] = {};
+  for (uint32_t begin = 0; begin < srcCount; begin += tileSize) {
+    const uint32_t end =
+        srcCount - begin < tileSize ? srcCount : begin + tileSize;
+    T accel[Targets][Unroll][3];
+    for (uint32_t t = 0; t < Targets; ++t) {
+      for (uint32_t u = 0; u < Unroll; ++u) {
+        accel[t][u][0] = accel[t][u][1] = accel[t][u][2] = V::zero();
+      }
+    }
+    _simdForceRange<V, Targets, Unroll, Format>(
+        p_Args, pos, begin, end, accel);
+    for (uint32_t t = 0; t < Targets; ++t) {
+      for (int c = 0; c < 3; ++c) {
+        T sum = accel[t][0][c];
+        for (uint32_t u = 1; u < Unroll; ++u) {
+          sum = V::add(sum, accel[t][u][c]);
+        }
+        nbodyTileSumAdd(&sums[t][c], Accum, V::hsum(sum));
+      }
+    }
+  }
+
+  float* out[3] = {p_Args->m_AccelX, p_Args->m_AccelY, p_Args->m_AccelZ};
+  for (uint32_t t = 0; t < Targets; ++t) {
+    for (int c = 0; c < 3; ++c) {
+      out[c][p_First + t] = nbodyTileSumScaled(sums[t][c], Accum, p_Args->m_G);
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+template <
+    typename V,
+    uint32_t Targets,
+    uint32_t Unroll,
+    NBodyAccumulation Accum,
+    NBodyPosFormat Format>
+static void _simdForceLoop(const NBodyForceArgs* p_Args) {
+  uint32_t i = p_Args->m_DstBegin;
+  for (; i + Targets <= p_Args->m_DstEnd; i += Targets) {
+    _simdForceTargets<V, Targets, Unroll, Accum, Format>(p_Args, i);
+  }
+  for (; i < p_Args->m_DstEnd; ++i) {
+    _simdForceTargets<V, 1, Unroll, Accum, Format>(p_Args, i);
+  }
+}
+//---------------------------------------------------------------------------//
+template <
+    typename V,
+    uint32_t Targets,
+    uint32_t Unroll,
+    NBodyAccumulation Accum>
+static void _simdForceFormat(const NBodyForceArgs* p_Args) {
+  switch (p_Args->m_PosFormat) {
+  case NBodyPosFloat16:
+    _simdForceLoop<V, Targets, Unroll, Accum, NBodyPosFloat16>(p_Args);
+    break;
+  case NBodyPosBFloat16:
+    _simdForceLoop<V, Targets, Unroll, Accum, NBodyPosBFloat16>(p_Args);
+    break;
+  default:
+    _simdForceLoop<V, Targets, Unroll, Accum, NBodyPosFloat32>(p_Args);
+    break;
+  }
+}
+//---------------------------------------------------------------------------//
+// Direct sum, G is applied once per target. The sources are padded to whole
+// vectors with zero mass bodies, which add exactly nothing. The variants
+// (see NBodyForceVariants) only differ in rounding when Unroll > 1. The
+// precision of p_Args picks one of the instantiations at run time.
+template <typename V, uint32_t Targets, uint32_t Unroll>
+static void _simdForceKernel(const NBodyForceArgs* p_Args) {
+  NBODY_ASSERT(p_Args->m_SrcCount % V::Width == 0);
+  static_assert(
+      NBodyAccumTileSize % (Unroll * V::Width) == 0,
+      "Tiles must hold whole unrolled iterations");
+  switch (p_Args->m_Accumulation) {
+  case NBodyAccumKahan:
+    _simdForceFormat<V, Targets, Unroll, NBodyAccumKahan>(p_Args);
+    break;
+  case NBodyAccumDouble:
+    _simdForceFormat<V, Targets, Unroll, NBodyAccumDouble>(p_Args);
+    break;
+  default:
+    _simdForceFormat<V, Targets, Unroll, NBodyAccumFloat>(p_Args);
+    break;
+  }
+}
+//---------------------------------------------------------------------------//
+// Same operations as nbodyDeterministicKernelScalar, NBodyDeterministicLanes
+// / V::Width vectors of sources per iteration so that every lane sums the
+// same sources in the same order on every ISA. Only V::add and V::mul (never
+// V::fmadd) on the sums, and a correctly rounded 1 / sqrt.
+template <typename V>
+NBODY_NO_FP_CONTRACT static void
+_simdDeterministicKernel(const NBodyForceArgs* p_Args) {
+  NBODY_NO_FP_CONTRACT_BODY
+  using T = typename V::Type;
+  static constexpr uint32_t Vectors = NBodyDeterministicLanes / V::Width;
+  NBODY_ASSERT(p_Args->m_SrcCount % NBodyDeterministicLanes == 0);
+  const T eps2 = V::set1(NBodySofteningSquared);
+  const T one = V::set1(1.0f);
+  const float* src[4] = {
+      p_Args->m_SrcX, p_Args->m_SrcY, p_Args->m_SrcZ, p_Args->m_SrcMass};
+  float* out[3] = {p_Args->m_AccelX, p_Args->m_AccelY, p_Args->m_AccelZ};
+
+  for (uint32_t i = p_Args->m_DstBegin; i < p_Args->m_DstEnd; ++i) {
+    const T pos[3] = {
+        V::set1(p_Args->m_DstX[i]),
+        V::set1(p_Args->m_DstY[i]),
+        V::set1(p_Args->m_DstZ[i])};
+    T accel[Vectors][3];
+    for (uint32_t v = 0; v < Vectors; ++v) {
+      accel[v][0] = accel[v][1] = accel[v][2] = V::zero();
+    }
+
+    for (uint32_t j = 0; j < p_Args->m_SrcCount;
+         j += NBodyDeterministicLanes) {
+      for (uint32_t v = 0; v < Vectors; ++v) {
+        const uint32_t k = j + v * V::Width;
+        T r[3];
+        for (int c = 0; c < 3; ++c) {
+          r[c] = V::sub(V::load(src[c] + k), pos[c]);
+        }
+        T distSqr = V::add(
+            V::mul(r[0], r[0]),
+            V::add(V::mul(r[1], r[1]), V::add(V::mul(r[2], r[2]), eps2)));
+        T invDist = V::div(one, V::sqrt(distSqr));
+        T invDistCube = V::mul(V::mul(invDist, invDist), invDist);
+        T s = V::mul(V::load(src[3] + k), invDistCube);
+        for (int c = 0; c < 3; ++c) {
+          accel[v][c] = V::add(accel[v][c], V::mul(r[c], s));
+        }
+      }
+    }
+
+    for (int c = 0; c < 3; ++c) {
+      float lanes[NBodyDeterministicLanes];
+      for (uint32_t v = 0; v < Vectors; ++v) {
+        V::store(lanes + v * V::Width, accel[v][c]);
+      }
+      out[c][i] = nbodyDeterministicFold(lanes) * p_Args->m_G;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+template <typename V, size_t Index>
+static void _simdForceVariant(const NBodyForceArgs* p_Args) {
+  constexpr NBodyForceVariant variant = NBodyForceVariants[Index];
+  _simdForceKernel<V, variant.m_Targets, variant.m_Unroll>(p_Args);
+}
+//---------------------------------------------------------------------------//
+// Instantiates every entry of NBodyForceVariants for V.
+template <typename V, size_t... Index>
+static void _simdForceVariants(
+    NBodyForceKernel* p_Kernels, std::index_sequence<Index...>) {
+  ((p_Kernels[Index] = _simdForceVariant<V, Index>), ...);
+}
+//---------------------------------------------------------------------------//
+// Same math as nbodyCellKernelScalar for V::Width targets starting at p_Dst*
+// and p_Accel*, the cells are broadcast so the accumulators stay in registers
+// for the whole cell list.
+template <typename V, bool Quadrupole>
+static void _simdCellLoop(
+    const NBodyCellArgs* p_Args,
+    const float* p_DstX,
+    const float* p_DstY,
+    const float* p_DstZ,
+    float* p_AccelX,
+    float* p_AccelY,
+    float* p_AccelZ) {
+  using T = typename V::Type;
+  const T eps2 = V::set1(NBodySofteningSquared);
+  const T fiveHalves = V::set1(2.5f);
+  const T posX = V::load(p_DstX);
+  const T posY = V::load(p_DstY);
+  const T posZ = V::load(p_DstZ);
+  T accelX = V::load(p_AccelX);
+  T accelY = V::load(p_AccelY);
+  T accelZ = V::load(p_AccelZ);
+
+  for (uint32_t c = 0; c < p_Args->m_CellCount; ++c) {
+    T dx = V::sub(V::set1(p_Args->m_ComX[c]), posX);
+    T dy = V::sub(V::set1(p_Args->m_ComY[c]), posY);
+    T dz = V::sub(V::set1(p_Args->m_ComZ[c]), posZ);
+
+    T distSqr = V::fmadd(dx, dx, V::fmadd(dy, dy, V::fmadd(dz, dz, eps2)));
+    T invDist = V::rsqrt(distSqr);
+    T invDistSqr = V::mul(invDist, invDist);
+    T invDistCube = V::mul(invDistSqr, invDist);
+    T s = V::mul(V::set1(p_Args->m_CellMass[c]), invDistCube);
+
+    if (Quadrupole) {
+      const T q0 = V::set1(p_Args->m_Quad[0][c]);
+      const T q1 = V::set1(p_Args->m_Quad[1][c]);
+      const T q2 = V::set1(p_Args->m_Quad[2][c]);
+      const T q3 = V::set1(p_Args->m_Quad[3][c]);
+      const T q4 = V::set1(p_Args->m_Quad[4][c]);
+      const T q5 = V::set1(p_Args->m_Quad[5][c]);
+      T invDist5 = V::mul(invDistCube, invDistSqr);
+      T qx = V::fmadd(q0, dx, V::fmadd(q3, dy, V::mul(q4, dz)));
+      T qy = V::fmadd(q3, dx, V::fmadd(q1, dy, V::mul(q5, dz)));
+      T qz = V::fmadd(q4, dx, V::fmadd(q5, dy, V::mul(q2, dz)));
+      T dqd = V::fmadd(dx, qx, V::fmadd(dy, qy, V::mul(dz, qz)));
+      s = V::fmadd(V::mul(fiveHalves, dqd), V::mul(invDist5, invDistSqr), s);
+      accelX = V::sub(accelX, V::mul(qx, invDist5));
+      accelY = V::sub(accelY, V::mul(qy, invDist5));
+      accelZ = V::sub(accelZ, V::mul(qz, invDist5));
+    }
+
+    accelX = V::fmadd(dx, s, accelX);
+    accelY = V::fmadd(dy, s, accelY);
+    accelZ = V::fmadd(dz, s, accelZ);
+  }
+
+  V::store(p_AccelX, accelX);
+  V::store(p_AccelY, accelY);
+  V::store(p_AccelZ, accelZ);
+}
+//---------------------------------------------------------------------------//
+// Cell lists are long and target groups short, so the remaining targets are
+// padded to a whole vector (repeating the last one) rather than run scalar.
+template <typename V, bool Quadrupole>
+static void _simdCellTargets(const NBodyCellArgs* p_Args) {
+  const uint32_t dstCount = p_Args->m_DstCount;
+  const uint32_t dstVecCount = dstCount - dstCount % V::Width;
+
+  for (uint32_t t = 0; t < dstVecCount; t += V::Width) {
+    _simdCellLoop<V, Quadrupole>(
+        p_Args,
+        p_Args->m_DstX + t,
+        p_Args->m_DstY + t,
+        p_Args->m_DstZ + t,
+        p_Args->m_AccelX + t,
+        p_Args->m_AccelY + t,
+        p_Args->m_AccelZ + t);
+  }
+
+  if (dstVecCount < dstCount) {
+    float pos[3][V::Width];
+    float accel[3][V::Width];
+    for (uint32_t l = 0; l < V::Width; ++l) {
+      const uint32_t t =
+          dstVecCount + l < dstCount ? dstVecCount + l : dstCount - 1;
+      pos[0][l] = p_Args->m_DstX[t];
+      pos[1][l] = p_Args->m_DstY[t];
+      pos[2][l] = p_Args->m_DstZ[t];
+      accel[0][l] = p_Args->m_AccelX[t];
+      accel[1][l] = p_Args->m_AccelY[t];
+      accel[2][l] = p_Args->m_AccelZ[t];
+    }
+    _simdCellLoop<V, Quadrupole>(
+        p_Args, pos[0], pos[1], pos[2], accel[0], accel[1], accel[2]);
+    for (uint32_t t = dstVecCount; t < dstCount; ++t) {
+      p_Args->m_AccelX[t] = accel[0][t - dstVecCount];
+      p_Args->m_AccelY[t] = accel[1][t - dstVecCount];
+      p_Args->m_AccelZ[t] = accel[2][t - dstVecCount];
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+template <typename V> static void _simdCellKernel(const NBodyCellArgs* p_Args) {
+  if (p_Args->m_Quad[0] != nullptr)
+    _simdCellTargets<V, true>(p_Args);
+  else
+    _simdCellTargets<V, false>(p_Args);
+}
+//---------------------------------------------------------------------------//
+// Same math as nbodyPairKernelScalar, V::Width j-bodies per instruction. The
+// i accumulators stay in registers, the j ones are read-modify-written in the
+// (L1 resident) tile of the output.
+template <typename V> static void _simdPairKernel(const NBodyPairArgs* p_Args) {
+  using T = typename V::Type;
+  const bool diagonal = p_Args->m_BeginI == p_Args->m_BeginJ;
+  const float* posX = p_Args->m_PosX;
+  const float* posY = p_Args->m_PosY;
+  const float* posZ = p_Args->m_PosZ;
+  const float* mass = p_Args->m_Mass;
+  float* outX = p_Args->m_AccelX;
+  float* outY = p_Args->m_AccelY;
+  float* outZ = p_Args->m_AccelZ;
+  const T eps2 = V::set1(NBodySofteningSquared);
+
+  for (uint32_t i = p_Args->m_BeginI; i < p_Args->m_EndI; ++i) {
+    const float xi = posX[i];
+    const float yi = posY[i];
+    const float zi = posZ[i];
+    const T pi[3] = {V::set1(xi), V::set1(yi), V::set1(zi)};
+    const float mi = mass[i];
+    const T massI = V::set1(mi);
+    T accelX = V::zero();
+    T accelY = V::zero();
+    T accelZ = V::zero();
+
+    uint32_t j = diagonal ? i + 1 : p_Args->m_BeginJ;
+    for (; j + V::Width <= p_Args->m_EndJ; j += V::Width) {
+      T rx = V::sub(V::load(posX + j), pi[0]);
+      T ry = V::sub(V::load(posY + j), pi[1]);
+      T rz = V::sub(V::load(posZ + j), pi[2]);
+
+      T distSqr = V::fmadd(rx, rx, V::fmadd(ry, ry, V::fmadd(rz, rz, eps2)));
+      T invDist = V::rsqrt(distSqr);
+      T invDistCube = V::mul(V::mul(invDist, invDist), invDist);
+      T si = V::mul(V::load(mass + j), invDistCube);
+      T sj = V::mul(massI, invDistCube);
+
+      accelX = V::fmadd(rx, si, accelX);
+      accelY = V::fmadd(ry, si, accelY);
+      accelZ = V::fmadd(rz, si, accelZ);
+      V::store(outX + j, V::sub(V::load(outX + j), V::mul(rx, sj)));
+      V::store(outY + j, V::sub(V::load(outY + j), V::mul(ry, sj)));
+      V::store(outZ + j, V::sub(V::load(outZ + j), V::mul(rz, sj)));
+    }
+
+    float ax = V::hsum(accelX);
+    float ay = V::hsum(accelY);
+    float az = V::hsum(accelZ);
+
+    // Remaining j-bodies that don't fill a whole vector.
+    for (; j < p_Args->m_EndJ; ++j) {
+      float rx = posX[j] - xi;
+      float ry = posY[j] - yi;
+      float rz = posZ[j] - zi;
+      float distSqr = rx * rx + ry * ry + rz * rz + NBodySofteningSquared;
+      float invDist = 1.0f / sqrtf(distSqr);
+      float invDistCube = invDist * invDist * invDist;
+      float si = mass[j] * invDistCube;
+      float sj = mi * invDistCube;
+      ax += rx * si;
+      ay += ry * si;
+      az += rz * si;
+      outX[j] -= rx * sj;
+      outY[j] -= ry * sj;
+      outZ[j] -= rz * sj;
+    }
+
+    outX[i] += ax;
+    outY[i] += ay;
+    outZ[i] += az;
+  }
+}
+//---------------------------------------------------------------------------//
+// Same math as nbodyJerkKernelScalar, V::Width j-bodies per instruction
+// (zero mass padding as in _simdForceKernel).
+template <typename V> static void _simdJerkKernel(const NBodyJerkArgs* p_Args) {
+  using T = typename V::Type;
+  const uint32_t srcCount = p_Args->m_SrcCount;
+  NBODY_ASSERT(srcCount % V::Width == 0);
+  const T eps2 = V::set1(NBodySofteningSquared);
+  const T three = V::set1(3.0f);
+
+  for (uint32_t i = p_Args->m_DstBegin; i < p_Args->m_DstEnd; ++i) {
+    T posI[3];
+    T velI[3];
+    T accel[3];
+    T jerk[3];
+    for (int c = 0; c < 3; ++c) {
+      posI[c] = V::set1(p_Args->m_DstPos[c][i]);
+      velI[c] = V::set1(p_Args->m_DstVel[c][i]);
+      accel[c] = V::zero();
+      jerk[c] = V::zero();
+    }
+
+    for (uint32_t j = 0; j < srcCount; j += V::Width) {
+      T r[3];
+      T v[3];
+      for (int c = 0; c < 3; ++c) {
+        r[c] = V::sub(V::load(p_Args->m_SrcPos[c] + j), posI[c]);
+        v[c] = V::sub(V::load(p_Args->m_SrcVel[c] + j), velI[c]);
+      }
+      T distSqr = V::fmadd(
+          r[0], r[0], V::fmadd(r[1], r[1], V::fmadd(r[2], r[2], eps2)));
+      T invDist = V::rsqrt(distSqr);
+      T invDistSqr = V::mul(invDist, invDist);
+      T weight = V::mul(
+          V::load(p_Args->m_SrcMass + j), V::mul(invDistSqr, invDist));
+      T rv = V::fmadd(r[0], v[0], V::fmadd(r[1], v[1], V::mul(r[2], v[2])));
+      T s = V::mul(V::mul(three, rv), invDistSqr);
+      for (int c = 0; c < 3; ++c) {
+        accel[c] = V::fmadd(r[c], weight, accel[c]);
+        jerk[c] = V::fmadd(V::sub(v[c], V::mul(s, r[c])), weight, jerk[c]);
+      }
+    }
+
+    for (int c = 0; c < 3; ++c) {
+      p_Args->m_Accel[c][i] = V::hsum(accel[c]) * p_Args->m_G;
+      p_Args->m_Jerk[c][i] = V::hsum(jerk[c]) * p_Args->m_G;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
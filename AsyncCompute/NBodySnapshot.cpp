@@ -0,0 +1,238 @@
+#include "NBodySnapshot.hpp"
+#include "NBodyCpu.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char s_SnapshotMagic[8] = {'N', 'B', 'O', 'D', 'Y', 'S', 'N', 'P'};
+// Particles per pool block of the loads, whole cache lines of every array.
+static constexpr uint32_t NBodySnapshotGrain = 16384;
+
+namespace {
+struct LoadJob {
+  NBodyCpuCtx* m_Ctx;
+  const NBodySnapshot* m_Snapshot;
+};
+} // namespace
+
+//---------------------------------------------------------------------------//
+/// Local functions:
+//---------------------------------------------------------------------------//
+// The blocks are stored in the host's byte order, which the format fixes to
+// little-endian (every platform of the demo).
+static bool _isLittleEndian() {
+  const uint32_t one = 1;
+  uint8_t first = 0;
+  memcpy(&first, &one, 1);
+  return first == 1;
+}
+//---------------------------------------------------------------------------//
+static size_t _snapshotSize(uint32_t p_PaddedCount) {
+  return sizeof(NBodySnapshotHeader) +
+         NBodySnapshotBlockCount * size_t(p_PaddedCount) * sizeof(float);
+}
+//---------------------------------------------------------------------------//
+// Maps the whole of p_Path read-only into p_Snapshot->m_View.
+static bool _map(NBodySnapshot* p_Snapshot, const char* p_Path) {
+#if defined(_WIN32)
+  HANDLE file = CreateFileA(
+      p_Path,
+      GENERIC_READ,
+      FILE_SHARE_READ,
+      nullptr,
+      OPEN_EXISTING,
+      FILE_FLAG_SEQUENTIAL_SCAN,
+      nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER size = {};
+  HANDLE mapping = nullptr;
+  if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  // The mapping keeps the file open.
+  CloseHandle(file);
+  if (mapping == nullptr)
+    return false;
+  p_Snapshot->m_View = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (p_Snapshot->m_View == nullptr) {
+    CloseHandle(mapping);
+    return false;
+  }
+  p_Snapshot->m_Mapping = mapping;
+  p_Snapshot->m_Size = size_t(size.QuadPart);
+#else
+  const int file = open(p_Path, O_RDONLY);
+  if (file < 0)
+    return false;
+  struct stat status;
+  void* view = MAP_FAILED;
+  if (fstat(file, &status) == 0 && status.st_size > 0)
+    view = mmap(
+        nullptr, size_t(status.st_size), PROT_READ, MAP_SHARED, file, 0);
+  close(file);
+  if (view == MAP_FAILED)
+    return false;
+  // Start reading ahead of the copy.
+  posix_madvise(view, size_t(status.st_size), POSIX_MADV_WILLNEED);
+  p_Snapshot->m_View = view;
+  p_Snapshot->m_Size = size_t(status.st_size);
+#endif
+  return true;
+}
+//---------------------------------------------------------------------------//
+// Checks the mapped header and ids, then points the blocks into the view.
+static const char* _validate(NBodySnapshot* p_Snapshot) {
+  if (p_Snapshot->m_Size < sizeof(NBodySnapshotHeader))
+    return "not a snapshot (too short)";
+  const NBodySnapshotHeader* header =
+      static_cast<const NBodySnapshotHeader*>(p_Snapshot->m_View);
+  if (memcmp(header->m_Magic, s_SnapshotMagic, sizeof(s_SnapshotMagic)) != 0)
+    return "not a snapshot";
+  if (header->m_Version != NBodySnapshotVersion)
+    return "unsupported snapshot version";
+  if (header->m_HeaderSize != sizeof(NBodySnapshotHeader) ||
+      header->m_BlockCount != NBodySnapshotBlockCount ||
+      header->m_ParticleCount == 0 ||
+      header->m_PaddedCount != nbodyPadCount(header->m_ParticleCount))
+    return "invalid snapshot header";
+  if (p_Snapshot->m_Size < _snapshotSize(header->m_PaddedCount))
+    return "truncated snapshot";
+
+  const float* blocks = reinterpret_cast<const float*>(header + 1);
+  for (uint32_t a = 0; a < NBodyAttribCount; ++a) {
+    p_Snapshot->m_Attribs[a] = blocks + size_t(a) * header->m_PaddedCount;
+  }
+  p_Snapshot->m_Ids = reinterpret_cast<const uint32_t*>(
+      blocks + size_t(NBodySnapshotIds) * header->m_PaddedCount);
+  p_Snapshot->m_Header = header;
+
+  // The ids must be a permutation, nbodyCpuLoadSnapshot inverts them.
+  std::vector<bool> seen(header->m_ParticleCount, false);
+  for (uint32_t slot = 0; slot < header->m_ParticleCount; ++slot) {
+    const uint32_t id = p_Snapshot->m_Ids[slot];
+    if (id >= header->m_ParticleCount || seen[id])
+      return "invalid snapshot ids";
+    seen[id] = true;
+  }
+  return nullptr;
+}
+//---------------------------------------------------------------------------//
+static void
+_loadBlock(void* p_Job, uint32_t p_Begin, uint32_t p_End, uint32_t) {
+  const LoadJob* job = static_cast<const LoadJob*>(p_Job);
+  NBodyParticleStore* store = &job->m_Ctx->m_Store;
+  const NBodySnapshot* snapshot = job->m_Snapshot;
+
+  // Blocks cover the padding too, the last one ends at m_PaddedCount.
+  const size_t begin = p_Begin;
+  const size_t end = p_End == store->m_Count ? store->m_PaddedCount : p_End;
+  const size_t count = end - begin;
+  for (uint32_t a = 0; a < NBodyAttribCount; ++a) {
+    memcpy(
+        store->m_Attribs[a] + begin,
+        snapshot->m_Attribs[a] + begin,
+        count * sizeof(float));
+  }
+  for (uint32_t slot = p_Begin; slot < p_End; ++slot) {
+    const uint32_t id = snapshot->m_Ids[slot];
+    job->m_Ctx->m_Ids[slot] = id;
+    job->m_Ctx->m_Slots[id] = slot;
+  }
+}
+//---------------------------------------------------------------------------//
+// Core functions:
+//---------------------------------------------------------------------------//
+const char* nbodySnapshotOpen(NBodySnapshot* p_Snapshot, const char* p_Path) {
+  memset(p_Snapshot, 0, sizeof(*p_Snapshot));
+  if (!_isLittleEndian())
+    return "snapshots need a little-endian host";
+  if (!_map(p_Snapshot, p_Path))
+    return "can't map the file";
+  const char* error = _validate(p_Snapshot);
+  if (error != nullptr)
+    nbodySnapshotClose(p_Snapshot);
+  return error;
+}
+//---------------------------------------------------------------------------//
+void nbodySnapshotClose(NBodySnapshot* p_Snapshot) {
+  if (p_Snapshot->m_View != nullptr) {
+#if defined(_WIN32)
+    UnmapViewOfFile(p_Snapshot->m_View);
+    CloseHandle(p_Snapshot->m_Mapping);
+#else
+    munmap(p_Snapshot->m_View, p_Snapshot->m_Size);
+#endif
+  }
+  memset(p_Snapshot, 0, sizeof(*p_Snapshot));
+}
+//---------------------------------------------------------------------------//
+NBodyColumns nbodySnapshotColumns(const NBodySnapshot* p_Snapshot) {
+  NBodyColumns columns = {};
+  for (uint32_t a = 0; a < NBodyAttribCount; ++a) {
+    columns.m_Data[a] = const_cast<float*>(p_Snapshot->m_Attribs[a]);
+  }
+  columns.m_Stride = 1;
+  return columns;
+}
+//---------------------------------------------------------------------------//
+bool nbodyCpuSaveSnapshot(NBodyCpuCtx* p_Ctx, const char* p_Path) {
+  if (!_isLittleEndian())
+    return false;
+  const NBodyParticleStore& store = p_Ctx->m_Store;
+
+  NBodySnapshotHeader header = {};
+  memcpy(header.m_Magic, s_SnapshotMagic, sizeof(s_SnapshotMagic));
+  header.m_Version = NBodySnapshotVersion;
+  header.m_HeaderSize = sizeof(NBodySnapshotHeader);
+  header.m_ParticleCount = store.m_Count;
+  header.m_PaddedCount = store.m_PaddedCount;
+  header.m_BlockCount = NBodySnapshotBlockCount;
+  header.m_StepCount = p_Ctx->m_StepCount;
+
+  FILE* file = fopen(p_Path, "wb");
+  if (file == nullptr)
+    return false;
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  for (uint32_t a = 0; a < NBodyAttribCount; ++a) {
+    ok = ok && fwrite(
+                   store.m_Attribs[a],
+                   sizeof(float),
+                   store.m_PaddedCount,
+                   file) == store.m_PaddedCount;
+  }
+  // The ids of the padding slots are not maintained, written as 0.
+  const uint32_t padding[NBodySimdWidth] = {};
+  const size_t paddingCount = store.m_PaddedCount - store.m_Count;
+  ok = ok &&
+       fwrite(p_Ctx->m_Ids, sizeof(uint32_t), store.m_Count, file) ==
+           store.m_Count &&
+       fwrite(padding, sizeof(uint32_t), paddingCount, file) == paddingCount;
+  return fclose(file) == 0 && ok;
+}
+//---------------------------------------------------------------------------//
+void nbodyCpuLoadSnapshot(
+    NBodyCpuCtx* p_Ctx,
+    const NBodySnapshot* p_Snapshot,
+    NBodyThreadPool* p_Pool) {
+  NBODY_ASSERT(
+      p_Snapshot->m_Header->m_ParticleCount == p_Ctx->m_Store.m_Count);
+  LoadJob job = {p_Ctx, p_Snapshot};
+  nbodyPoolParallelFor(
+      p_Pool, p_Ctx->m_Store.m_Count, NBodySnapshotGrain, _loadBlock, &job);
+  p_Ctx->m_StepCount = p_Snapshot->m_Header->m_StepCount;
+  p_Ctx->m_ForcesValid = false;
+  p_Ctx->m_JerkValid = false;
+}
+//---------------------------------------------------------------------------//
@@ -0,0 +1,76 @@
+#pragma once
+
+/******************************************************************************
+ * \binary snapshots of the particles
+ * \a 64-byte header followed by one block per attribute of the SoA store
+ * \(NBodySoa.hpp) and one of particle ids, little-endian and padded like the
+ * \store so that every block starts on a cache line. Snapshots are mapped
+ * \rather than read: the blocks are used in place as NBodyColumns and copied
+ * \once, straight into the CPU store or a GPU upload buffer.
+ ******************************************************************************/
+
+#include "NBodySoa.hpp"
+#include "NBodyThreadPool.hpp"
+
+struct NBodyCpuCtx;
+
+static constexpr uint32_t NBodySnapshotVersion = 1;
+
+//---------------------------------------------------------------------------//
+// Blocks, in file order: the NBodyAttribute arrays then the ids
+//---------------------------------------------------------------------------//
+static constexpr uint32_t NBodySnapshotIds = NBodyAttribCount;
+static constexpr uint32_t NBodySnapshotBlockCount = NBodyAttribCount + 1;
+
+//---------------------------------------------------------------------------//
+struct NBodySnapshotHeader {
+  char m_Magic[8];          // "NBODYSNP"
+  uint32_t m_Version;       // NBodySnapshotVersion
+  uint32_t m_HeaderSize;    // sizeof(NBodySnapshotHeader), blocks follow it
+  uint32_t m_ParticleCount;
+  uint32_t m_PaddedCount;   // nbodyPadCount(m_ParticleCount), per block
+  uint32_t m_BlockCount;    // NBodySnapshotBlockCount
+  uint32_t m_Reserved0;
+  uint64_t m_StepCount;     // Steps the CPU engine had run
+  uint32_t m_Reserved[6];
+};
+static_assert(
+    sizeof(NBodySnapshotHeader) == NBodyAlignment,
+    "The blocks must start on a cache line");
+
+//---------------------------------------------------------------------------//
+// A mapped snapshot, read-only.
+//---------------------------------------------------------------------------//
+struct NBodySnapshot {
+  const NBodySnapshotHeader* m_Header;
+  const float* m_Attribs[NBodyAttribCount]; // m_PaddedCount floats each
+  const uint32_t* m_Ids; // External id of the particle in each slot
+
+  void* m_View;
+  size_t m_Size;
+  void* m_Mapping; // File mapping object (Windows only)
+};
+
+//---------------------------------------------------------------------------//
+// Maps p_Path and checks its header and ids. Returns nullptr on success,
+// otherwise why it can't be used (and p_Snapshot is left closed).
+const char* nbodySnapshotOpen(NBodySnapshot* p_Snapshot, const char* p_Path);
+//---------------------------------------------------------------------------//
+void nbodySnapshotClose(NBodySnapshot* p_Snapshot);
+//---------------------------------------------------------------------------//
+// View over the mapped blocks (m_Stride 1), only to be read from.
+NBodyColumns nbodySnapshotColumns(const NBodySnapshot* p_Snapshot);
+//---------------------------------------------------------------------------//
+// Writes the store, the ids and the step count of p_Ctx to p_Path. False
+// when the file can't be written.
+bool nbodyCpuSaveSnapshot(NBodyCpuCtx* p_Ctx, const char* p_Path);
+//---------------------------------------------------------------------------//
+// Copies a snapshot of p_Ctx's particle count into its store on p_Pool
+// (nullptr = calling thread), the pages of the mapping are faulted in by
+// all the workers. The ids and the step count are restored too, so the run
+// continues as if it had never stopped.
+void nbodyCpuLoadSnapshot(
+    NBodyCpuCtx* p_Ctx,
+    const NBodySnapshot* p_Snapshot,
+    NBodyThreadPool* p_Pool);
+//---------------------------------------------------------------------------//
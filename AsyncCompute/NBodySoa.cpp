@@ -0,0 +1,104 @@
+#include "NBodySoa.hpp"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+
+//---------------------------------------------------------------------------//
+// Core functions:
+//---------------------------------------------------------------------------//
+void* nbodyAlignedAlloc(size_t p_Size, size_t p_Alignment) {
+#if defined(_MSC_VER)
+  return _aligned_malloc(p_Size, p_Alignment);
+#else
+  // aligned_alloc requires the size to be a multiple of the alignment.
+  return aligned_alloc(
+      p_Alignment, (p_Size + p_Alignment - 1) / p_Alignment * p_Alignment);
+#endif
+}
+//---------------------------------------------------------------------------//
+void nbodyAlignedFree(void* p_Ptr) {
+#if defined(_MSC_VER)
+  _aligned_free(p_Ptr);
+#else
+  free(p_Ptr);
+#endif
+}
+//---------------------------------------------------------------------------//
+void nbodyStoreInit(NBodyParticleStore* p_Store, uint32_t p_Count) {
+  memset(p_Store, 0, sizeof(*p_Store));
+  p_Store->m_Count = p_Count;
+  p_Store->m_PaddedCount = nbodyPadCount(p_Count);
+
+  // m_PaddedCount floats is always a multiple of 64 bytes, so every array
+  // stays aligned when packed back to back.
+  const size_t arraySize = size_t(p_Store->m_PaddedCount) * sizeof(float);
+  const size_t totalSize = arraySize * NBodyAttribCount;
+  p_Store->m_Memory = nbodyAlignedAlloc(totalSize, NBodyAlignment);
+  NBODY_ASSERT(p_Store->m_Memory != nullptr);
+  memset(p_Store->m_Memory, 0, totalSize);
+
+  for (uint32_t a = 0; a < NBodyAttribCount; ++a) {
+    p_Store->m_Attribs[a] = reinterpret_cast<float*>(
+        static_cast<uint8_t*>(p_Store->m_Memory) + a * arraySize);
+  }
+}
+//---------------------------------------------------------------------------//
+void nbodyStoreDestroy(NBodyParticleStore* p_Store) {
+  nbodyAlignedFree(p_Store->m_Memory);
+  memset(p_Store, 0, sizeof(*p_Store));
+}
+//---------------------------------------------------------------------------//
+NBodyColumns nbodyStoreColumns(NBodyParticleStore* p_Store) {
+  NBodyColumns columns;
+  for (uint32_t a = 0; a < NBodyAttribCount; ++a) {
+    columns.m_Data[a] = p_Store->m_Attribs[a];
+  }
+  columns.m_Stride = 1;
+  return columns;
+}
+//---------------------------------------------------------------------------//
+NBodyColumns nbodyAosColumns(NBodyParticle* p_Particles) {
+  NBodyColumns columns;
+  float* base = &p_Particles->m_Position.x;
+  for (uint32_t a = 0; a < NBodyAttribCount; ++a) {
+    columns.m_Data[a] = base + a;
+  }
+  columns.m_Stride = sizeof(NBodyParticle) / sizeof(float);
+  return columns;
+}
+//---------------------------------------------------------------------------//
+void nbodyCopyColumns(
+    const NBodyColumns& p_Dst,
+    const NBodyColumns& p_Src,
+    uint32_t p_First,
+    uint32_t p_Count) {
+  // Particle-major so both sides are streamed once, whatever their layout.
+  for (uint32_t i = p_First; i < p_First + p_Count; ++i) {
+    const size_t dst = size_t(i) * p_Dst.m_Stride;
+    const size_t src = size_t(i) * p_Src.m_Stride;
+    for (uint32_t a = 0; a < NBodyAttribCount; ++a) {
+      p_Dst.m_Data[a][dst] = p_Src.m_Data[a][src];
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+void nbodyStoreLoadAos(
+    NBodyParticleStore* p_Store, const NBodyParticle* p_Particles) {
+  nbodyCopyColumns(
+      nbodyStoreColumns(p_Store),
+      nbodyAosColumns(const_cast<NBodyParticle*>(p_Particles)),
+      0,
+      p_Store->m_Count);
+}
+//---------------------------------------------------------------------------//
+void nbodyStoreWriteAos(NBodyParticleStore* p_Store, NBodyParticle* p_Particles) {
+  nbodyCopyColumns(
+      nbodyAosColumns(p_Particles),
+      nbodyStoreColumns(p_Store),
+      0,
+      p_Store->m_Count);
+}
+//---------------------------------------------------------------------------//
@@ -0,0 +1,96 @@
+#pragma once
+
+/******************************************************************************
+ * \Structure-of-Arrays particle store for the CPU engine
+ * \every attribute of ParticleSimCtx::ParticleMotion lives in its own 64-byte
+ * \aligned array, padded to the widest SIMD width, so kernels only stream the
+ * \attributes they read (e.g. positions without velocities).
+ ******************************************************************************/
+
+#include "NBodyCommon.hpp"
+
+// Widest force kernel (AVX-512, 16 floats), arrays are padded to it.
+static constexpr uint32_t NBodySimdWidth = 16;
+// Cache line size, every array starts on its own line.
+static constexpr size_t NBodyAlignment = 64;
+
+//---------------------------------------------------------------------------//
+// Attributes in the same order as the floats of ParticleMotion:
+//---------------------------------------------------------------------------//
+enum NBodyAttribute : uint32_t {
+  NBodyAttribPosX = 0,
+  NBodyAttribPosY,
+  NBodyAttribPosZ,
+  NBodyAttribMass,     // m_Position.w
+  NBodyAttribVelX,
+  NBodyAttribVelY,
+  NBodyAttribVelZ,
+  NBodyAttribAccelMag, // m_Velocity.w, used for coloring by ParticleDraw.hlsl
+  NBodyAttribCount
+};
+
+//---------------------------------------------------------------------------//
+struct NBodyParticleStore {
+  uint32_t m_Count;       // Number of real particles
+  uint32_t m_PaddedCount; // m_Count rounded up to NBodySimdWidth
+
+  // One array per attribute, indexed by NBodyAttribute. The padding past
+  // m_Count stays zero (massless, at rest at the origin): the kernels read
+  // it as sources, so only [0, m_Count) is ever integrated or loaded.
+  float* m_Attribs[NBodyAttribCount];
+
+  void* m_Memory; // Single allocation backing all the arrays
+};
+
+//---------------------------------------------------------------------------//
+// Strided view over particle attributes, no data is copied:
+// - SoA store: m_Stride == 1
+// - AoS ParticleMotion buffers (e.g. a mapped upload heap): m_Stride == 8
+//---------------------------------------------------------------------------//
+struct NBodyColumns {
+  float* m_Data[NBodyAttribCount];
+  uint32_t m_Stride; // Distance in floats between two consecutive particles
+};
+
+//---------------------------------------------------------------------------//
+void* nbodyAlignedAlloc(size_t p_Size, size_t p_Alignment);
+//---------------------------------------------------------------------------//
+void nbodyAlignedFree(void* p_Ptr);
+//---------------------------------------------------------------------------//
+inline uint32_t nbodyPadCount(uint32_t p_Count) {
+  return (p_Count + NBodySimdWidth - 1) / NBodySimdWidth * NBodySimdWidth;
+}
+//---------------------------------------------------------------------------//
+// Allocates the arrays, all of them (padding included) are zeroed.
+void nbodyStoreInit(NBodyParticleStore* p_Store, uint32_t p_Count);
+//---------------------------------------------------------------------------//
+void nbodyStoreDestroy(NBodyParticleStore* p_Store);
+//---------------------------------------------------------------------------//
+inline float*
+nbodyStoreAttrib(NBodyParticleStore* p_Store, NBodyAttribute p_Attrib) {
+  return p_Store->m_Attribs[p_Attrib];
+}
+//---------------------------------------------------------------------------//
+NBodyColumns nbodyStoreColumns(NBodyParticleStore* p_Store);
+//---------------------------------------------------------------------------//
+NBodyColumns nbodyAosColumns(NBodyParticle* p_Particles);
+//---------------------------------------------------------------------------//
+inline float& nbodyColumnAt(
+    const NBodyColumns& p_Columns, NBodyAttribute p_Attrib, uint32_t p_Index) {
+  return p_Columns.m_Data[p_Attrib][size_t(p_Index) * p_Columns.m_Stride];
+}
+//---------------------------------------------------------------------------//
+// Copies particles [p_First, p_First + p_Count) between any two layouts in a
+// single streaming pass, e.g. straight from the store into a mapped upload
+// buffer with no intermediate AoS copy.
+void nbodyCopyColumns(
+    const NBodyColumns& p_Dst,
+    const NBodyColumns& p_Src,
+    uint32_t p_First,
+    uint32_t p_Count);
+//---------------------------------------------------------------------------//
+// Convenience wrappers for whole AoS buffers of p_Store->m_Count particles:
+void nbodyStoreLoadAos(
+    NBodyParticleStore* p_Store, const NBodyParticle* p_Particles);
+void nbodyStoreWriteAos(NBodyParticleStore* p_Store, NBodyParticle* p_Particles);
+//---------------------------------------------------------------------------//
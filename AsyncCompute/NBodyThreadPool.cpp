@@ -0,0 +1,283 @@
+#include "NBodyThreadPool.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+//---------------------------------------------------------------------------//
+// Per-worker deque. The blocks dealt to one worker are contiguous, so the
+// deque is just a [head, tail) range of block indices packed into one 64-bit
+// word: the owner pops from the tail, thieves take from the head, and both
+// sides update it with a single CAS.
+//---------------------------------------------------------------------------//
+struct alignas(64) NBodyWorkerDeque {
+  std::atomic<uint64_t> m_Range;
+  uint64_t m_Blocks;
+  uint64_t m_Steals;
+};
+
+struct NBodyPoolImpl {
+  NBodyWorkerDeque* m_Deques;
+  std::thread* m_Threads;
+
+  // Current job, written by the caller before the deques are filled.
+  NBodyRangeFunc m_Func;
+  void* m_User;
+  uint32_t m_Count;
+  uint32_t m_Grain;
+  std::atomic<uint32_t> m_Remaining;
+
+  std::mutex m_WakeLock;
+  std::condition_variable m_WakeCv;
+  uint64_t m_Generation;
+  bool m_Terminating;
+};
+
+//---------------------------------------------------------------------------//
+/// Local functions:
+//---------------------------------------------------------------------------//
+static uint64_t _packRange(uint32_t p_Head, uint32_t p_Tail) {
+  return (static_cast<uint64_t>(p_Head) << 32) | p_Tail;
+}
+//---------------------------------------------------------------------------//
+static bool _popBlock(NBodyWorkerDeque* p_Deque, uint32_t* p_Block) {
+  uint64_t range = p_Deque->m_Range.load(std::memory_order_acquire);
+  for (;;) {
+    const uint32_t head = static_cast<uint32_t>(range >> 32);
+    const uint32_t tail = static_cast<uint32_t>(range);
+    if (head >= tail)
+      return false;
+    if (p_Deque->m_Range.compare_exchange_weak(
+            range, _packRange(head, tail - 1), std::memory_order_acq_rel)) {
+      *p_Block = tail - 1;
+      return true;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+static bool _stealBlock(NBodyWorkerDeque* p_Deque, uint32_t* p_Block) {
+  uint64_t range = p_Deque->m_Range.load(std::memory_order_acquire);
+  for (;;) {
+    const uint32_t head = static_cast<uint32_t>(range >> 32);
+    const uint32_t tail = static_cast<uint32_t>(range);
+    if (head >= tail)
+      return false;
+    if (p_Deque->m_Range.compare_exchange_weak(
+            range, _packRange(head + 1, tail), std::memory_order_acq_rel)) {
+      *p_Block = head;
+      return true;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+static void _runBlock(NBodyPoolImpl* p_Impl, uint32_t p_Block, uint32_t p_Worker) {
+  const uint32_t begin = p_Block * p_Impl->m_Grain;
+  uint32_t end = begin + p_Impl->m_Grain;
+  end = end < p_Impl->m_Count ? end : p_Impl->m_Count;
+  p_Impl->m_Func(p_Impl->m_User, begin, end, p_Worker);
+  p_Impl->m_Deques[p_Worker].m_Blocks++;
+  p_Impl->m_Remaining.fetch_sub(1, std::memory_order_release);
+}
+//---------------------------------------------------------------------------//
+// Drains the own deque, then steals until every deque is empty.
+static void
+_runJob(NBodyPoolImpl* p_Impl, uint32_t p_WorkerCount, uint32_t p_Worker) {
+  NBodyWorkerDeque* own = &p_Impl->m_Deques[p_Worker];
+  uint32_t block;
+  for (;;) {
+    while (_popBlock(own, &block)) {
+      _runBlock(p_Impl, block, p_Worker);
+    }
+
+    bool stole = false;
+    for (uint32_t n = 1; n < p_WorkerCount && !stole; ++n) {
+      NBodyWorkerDeque* victim =
+          &p_Impl->m_Deques[(p_Worker + n) % p_WorkerCount];
+      if (_stealBlock(victim, &block)) {
+        own->m_Steals++;
+        _runBlock(p_Impl, block, p_Worker);
+        stole = true;
+      }
+    }
+    if (!stole)
+      return;
+  }
+}
+//---------------------------------------------------------------------------//
+static void _pinThread(void* p_NativeHandle, uint32_t p_Core) {
+#if defined(_WIN32)
+  // NOTE: without processor groups only the first 64 cores are addressable.
+  if (p_Core < 64) {
+    SetThreadAffinityMask(
+        static_cast<HANDLE>(p_NativeHandle), DWORD_PTR(1) << p_Core);
+  }
+#elif defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(p_Core % CPU_SETSIZE, &set);
+  pthread_setaffinity_np(
+      *static_cast<pthread_t*>(p_NativeHandle), sizeof(set), &set);
+#else
+  (void)p_NativeHandle;
+  (void)p_Core;
+#endif
+}
+//---------------------------------------------------------------------------//
+static void _workerProc(NBodyThreadPool* p_Pool, uint32_t p_Worker) {
+  NBodyPoolImpl* impl = p_Pool->m_Impl;
+  uint64_t seenGeneration = 0;
+
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(impl->m_WakeLock);
+      impl->m_WakeCv.wait(lock, [&] {
+        return impl->m_Terminating || impl->m_Generation != seenGeneration;
+      });
+      if (impl->m_Terminating)
+        return;
+      seenGeneration = impl->m_Generation;
+    }
+    _runJob(impl, p_Pool->m_WorkerCount, p_Worker);
+  }
+}
+//---------------------------------------------------------------------------//
+// Core functions:
+//---------------------------------------------------------------------------//
+uint32_t nbodyHardwareThreadCount() {
+  uint32_t count = std::thread::hardware_concurrency();
+  return count > 0 ? count : 1;
+}
+//---------------------------------------------------------------------------//
+void nbodyPoolInit(
+    NBodyThreadPool* p_Pool, uint32_t p_WorkerCount, bool p_PinThreads) {
+  p_Pool->m_WorkerCount =
+      p_WorkerCount > 0 ? p_WorkerCount : nbodyHardwareThreadCount();
+  p_Pool->m_PinThreads = p_PinThreads;
+
+  NBodyPoolImpl* impl = new NBodyPoolImpl();
+  p_Pool->m_Impl = impl;
+  impl->m_Deques = new NBodyWorkerDeque[p_Pool->m_WorkerCount];
+  for (uint32_t w = 0; w < p_Pool->m_WorkerCount; ++w) {
+    impl->m_Deques[w].m_Range.store(0);
+    impl->m_Deques[w].m_Blocks = 0;
+    impl->m_Deques[w].m_Steals = 0;
+  }
+  impl->m_Generation = 0;
+  impl->m_Terminating = false;
+
+  // Worker 0 is the calling thread.
+  impl->m_Threads = new std::thread[p_Pool->m_WorkerCount];
+  for (uint32_t w = 1; w < p_Pool->m_WorkerCount; ++w) {
+    impl->m_Threads[w] = std::thread(_workerProc, p_Pool, w);
+  }
+
+  if (p_PinThreads) {
+#if defined(_WIN32)
+    _pinThread(GetCurrentThread(), 0);
+#elif defined(__linux__)
+    pthread_t self = pthread_self();
+    _pinThread(&self, 0);
+#endif
+    for (uint32_t w = 1; w < p_Pool->m_WorkerCount; ++w) {
+#if defined(_WIN32)
+      _pinThread(impl->m_Threads[w].native_handle(), w);
+#elif defined(__linux__)
+      pthread_t handle = impl->m_Threads[w].native_handle();
+      _pinThread(&handle, w);
+#endif
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+void nbodyPoolDestroy(NBodyThreadPool* p_Pool) {
+  NBodyPoolImpl* impl = p_Pool->m_Impl;
+  {
+    std::lock_guard<std::mutex> lock(impl->m_WakeLock);
+    impl->m_Terminating = true;
+  }
+  impl->m_WakeCv.notify_all();
+  for (uint32_t w = 1; w < p_Pool->m_WorkerCount; ++w) {
+    impl->m_Threads[w].join();
+  }
+
+  delete[] impl->m_Threads;
+  delete[] impl->m_Deques;
+  delete impl;
+  p_Pool->m_Impl = nullptr;
+}
+//---------------------------------------------------------------------------//
+void nbodyPoolParallelFor(
+    NBodyThreadPool* p_Pool,
+    uint32_t p_Count,
+    uint32_t p_Grain,
+    NBodyRangeFunc p_Func,
+    void* p_User) {
+  if (p_Count == 0)
+    return;
+
+  p_Grain = p_Grain > 0 ? p_Grain : 1;
+  const uint32_t blockCount = (p_Count + p_Grain - 1) / p_Grain;
+  const uint32_t workerCount = nbodyPoolWorkerCount(p_Pool);
+
+  if (workerCount == 1 || blockCount == 1) {
+    p_Func(p_User, 0, p_Count, 0);
+    return;
+  }
+
+  NBodyPoolImpl* impl = p_Pool->m_Impl;
+  impl->m_Func = p_Func;
+  impl->m_User = p_User;
+  impl->m_Count = p_Count;
+  impl->m_Grain = p_Grain;
+  impl->m_Remaining.store(blockCount, std::memory_order_relaxed);
+
+  // Deal contiguous runs of blocks so every worker starts on its own
+  // neighbourhood of particles.
+  for (uint32_t w = 0; w < workerCount; ++w) {
+    const uint32_t head = uint32_t(uint64_t(blockCount) * w / workerCount);
+    const uint32_t tail =
+        uint32_t(uint64_t(blockCount) * (w + 1) / workerCount);
+    impl->m_Deques[w].m_Range.store(
+        _packRange(head, tail), std::memory_order_release);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(impl->m_WakeLock);
+    impl->m_Generation++;
+  }
+  impl->m_WakeCv.notify_all();
+
+  _runJob(impl, workerCount, 0);
+
+  // Wait for the blocks still running on other workers.
+  while (impl->m_Remaining.load(std::memory_order_acquire) != 0) {
+    std::this_thread::yield();
+  }
+}
+//---------------------------------------------------------------------------//
+NBodyPoolStats nbodyPoolGetStats(NBodyThreadPool* p_Pool) {
+  NBodyPoolStats stats = {};
+  for (uint32_t w = 0; w < p_Pool->m_WorkerCount; ++w) {
+    stats.m_Blocks += p_Pool->m_Impl->m_Deques[w].m_Blocks;
+    stats.m_Steals += p_Pool->m_Impl->m_Deques[w].m_Steals;
+  }
+  return stats;
+}
+//---------------------------------------------------------------------------//
+void nbodyPoolResetStats(NBodyThreadPool* p_Pool) {
+  for (uint32_t w = 0; w < p_Pool->m_WorkerCount; ++w) {
+    p_Pool->m_Impl->m_Deques[w].m_Blocks = 0;
+    p_Pool->m_Impl->m_Deques[w].m_Steals = 0;
+  }
+}
+//---------------------------------------------------------------------------//
@@ -0,0 +1,63 @@
+#pragma once
+
+/******************************************************************************
+ * \work-stealing thread pool for the CPU n-body engine
+ * \a parallel-for splits [0, count) into blocks which are dealt to per-worker
+ * \deques; workers pop their own blocks (LIFO) and steal from the front of
+ * \other workers' deques (FIFO) once they run dry.
+ ******************************************************************************/
+
+#include "NBodyCommon.hpp"
+
+// Processes the items [p_Begin, p_End), p_Worker is in [0, worker count).
+typedef void (*NBodyRangeFunc)(
+    void* p_User, uint32_t p_Begin, uint32_t p_End, uint32_t p_Worker);
+
+struct NBodyPoolImpl;
+
+//---------------------------------------------------------------------------//
+struct NBodyThreadPool {
+  // Number of workers, including the thread calling nbodyPoolParallelFor
+  // (worker 0), so a pool of 1 runs everything inline.
+  uint32_t m_WorkerCount;
+  bool m_PinThreads; // Worker n is pinned to logical core n
+
+  NBodyPoolImpl* m_Impl;
+};
+
+//---------------------------------------------------------------------------//
+struct NBodyPoolStats {
+  uint64_t m_Blocks; // Blocks executed
+  uint64_t m_Steals; // Blocks taken from another worker's deque
+};
+
+//---------------------------------------------------------------------------//
+// Number of logical cores, at least 1.
+uint32_t nbodyHardwareThreadCount();
+//---------------------------------------------------------------------------//
+// p_WorkerCount == 0 selects nbodyHardwareThreadCount().
+void nbodyPoolInit(
+    NBodyThreadPool* p_Pool, uint32_t p_WorkerCount, bool p_PinThreads);
+//---------------------------------------------------------------------------//
+void nbodyPoolDestroy(NBodyThreadPool* p_Pool);
+//---------------------------------------------------------------------------//
+// Runs p_Func over [0, p_Count) in blocks of p_Grain items and returns once
+// all of them are done. The calling thread participates as worker 0, a null
+// p_Pool runs the whole range inline.
+void nbodyPoolParallelFor(
+    NBodyThreadPool* p_Pool,
+    uint32_t p_Count,
+    uint32_t p_Grain,
+    NBodyRangeFunc p_Func,
+    void* p_User);
+//---------------------------------------------------------------------------//
+// Upper bound for the p_Worker argument of a NBodyRangeFunc.
+inline uint32_t nbodyPoolWorkerCount(const NBodyThreadPool* p_Pool) {
+  return p_Pool != nullptr ? p_Pool->m_WorkerCount : 1;
+}
+//---------------------------------------------------------------------------//
+// Totals since init (or the last reset), summed over all workers.
+NBodyPoolStats nbodyPoolGetStats(NBodyThreadPool* p_Pool);
+//---------------------------------------------------------------------------//
+void nbodyPoolResetStats(NBodyThreadPool* p_Pool);
+//---------------------------------------------------------------------------//
@@ -0,0 +1,429 @@
+#include "NBodyTimeline.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <d3d12.h>
+#elif defined(__linux__)
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#define NBODY_TIMELINE_FUTEX 1
+#else
+#define NBODY_TIMELINE_FUTEX 0
+#endif
+
+//---------------------------------------------------------------------------//
+// Waiters sleep on m_Epoch, which every signal that advances the value
+// bumps: a waiter reads it before checking the value, so a signal between
+// the check and the sleep changes it and the sleep returns at once (the
+// condition variable gets the same from its mutex). The signaller only
+// makes the wake-up call when m_Sleepers says someone might sleep.
+//---------------------------------------------------------------------------//
+struct NBodyTimeline {
+  alignas(64) std::atomic<uint64_t> m_Value;
+  std::atomic<uint32_t> m_Sleepers;
+#if NBODY_TIMELINE_FUTEX
+  std::atomic<uint32_t> m_Epoch;
+#else
+  std::mutex m_Mutex;
+  std::condition_variable m_WakeUp;
+#endif
+#if defined(_WIN32)
+  ID3D12Fence* m_Fence; // Holds the value instead when not null
+#endif
+
+  alignas(64) std::atomic<uint64_t> m_Signals;
+  std::atomic<uint64_t> m_Sleeps;
+  std::atomic<uint64_t> m_Timeouts;
+};
+
+namespace {
+//---------------------------------------------------------------------------//
+enum CommandKind { CommandExecute, CommandSignal, CommandWait, CommandStop };
+
+struct Command {
+  CommandKind m_Kind;
+  NBodyQueueFunc m_Func;
+  void* m_User;
+  NBodyTimeline* m_Timeline;
+  uint64_t m_Value;
+};
+} // namespace
+
+struct NBodyQueue {
+  std::thread m_Thread;
+  std::mutex m_Mutex;
+  std::condition_variable m_WakeUp;
+  std::deque<Command> m_Commands;
+};
+
+//---------------------------------------------------------------------------//
+/// Local functions:
+//---------------------------------------------------------------------------//
+#if NBODY_TIMELINE_FUTEX
+static_assert(
+    sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) &&
+        std::atomic<uint32_t>::is_always_lock_free,
+    "The futex word is the atomic itself");
+
+// p_Timeout null: no timeout. Returns at once if *p_Word != p_Expected,
+// spurious wake-ups are possible.
+static void _futexWait(
+    std::atomic<uint32_t>* p_Word,
+    uint32_t p_Expected,
+    const struct timespec* p_Timeout) {
+  syscall(
+      SYS_futex,
+      reinterpret_cast<uint32_t*>(p_Word),
+      FUTEX_WAIT_PRIVATE,
+      p_Expected,
+      p_Timeout,
+      nullptr,
+      0);
+}
+//---------------------------------------------------------------------------//
+static void _futexWakeAll(std::atomic<uint32_t>* p_Word) {
+  syscall(
+      SYS_futex,
+      reinterpret_cast<uint32_t*>(p_Word),
+      FUTEX_WAKE_PRIVATE,
+      INT_MAX,
+      nullptr,
+      nullptr,
+      0);
+}
+#endif
+//---------------------------------------------------------------------------//
+#if defined(_WIN32)
+// An event per thread for the host waits on fences, a shared one would need
+// a lock around SetEventOnCompletion and the wait.
+struct FenceEvent {
+  HANDLE m_Event = CreateEventA(nullptr, FALSE, FALSE, nullptr);
+  ~FenceEvent() {
+    if (m_Event != nullptr)
+      CloseHandle(m_Event);
+  }
+};
+//---------------------------------------------------------------------------//
+// A wait that timed out leaves its event armed, so a later wake-up may be
+// stale: the value is checked again after every one.
+static bool _waitFence(
+    NBodyTimeline* p_Timeline, uint64_t p_Value, uint32_t p_TimeoutMs) {
+  static thread_local FenceEvent s_Event;
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(p_TimeoutMs);
+  for (;;) {
+    if (p_Timeline->m_Fence->GetCompletedValue() >= p_Value)
+      return true;
+    DWORD timeout = INFINITE;
+    if (p_TimeoutMs != NBodyTimelineInfinite) {
+      const int64_t left =
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              deadline - std::chrono::steady_clock::now())
+              .count();
+      timeout = left > 0 ? DWORD(left) : 0;
+    }
+    if (timeout == 0 || s_Event.m_Event == nullptr ||
+        FAILED(p_Timeline->m_Fence->SetEventOnCompletion(
+            p_Value, s_Event.m_Event))) {
+      p_Timeline->m_Timeouts.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    p_Timeline->m_Sleeps.fetch_add(1, std::memory_order_relaxed);
+    WaitForSingleObject(s_Event.m_Event, timeout);
+  }
+}
+#endif
+//---------------------------------------------------------------------------//
+static void _runQueue(NBodyQueue* p_Queue) {
+  for (;;) {
+    Command command;
+    {
+      std::unique_lock<std::mutex> lock(p_Queue->m_Mutex);
+      p_Queue->m_WakeUp.wait(
+          lock, [p_Queue] { return !p_Queue->m_Commands.empty(); });
+      command = p_Queue->m_Commands.front();
+      p_Queue->m_Commands.pop_front();
+    }
+    switch (command.m_Kind) {
+    case CommandExecute:
+      command.m_Func(command.m_User);
+      break;
+    case CommandSignal:
+      nbodyTimelineSignal(command.m_Timeline, command.m_Value);
+      break;
+    case CommandWait:
+      nbodyTimelineWait(
+          command.m_Timeline, command.m_Value, NBodyTimelineInfinite);
+      break;
+    case CommandStop:
+      return;
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+static void _submit(NBodyQueue* p_Queue, const Command& p_Command) {
+  {
+    std::lock_guard<std::mutex> lock(p_Queue->m_Mutex);
+    p_Queue->m_Commands.push_back(p_Command);
+  }
+  p_Queue->m_WakeUp.notify_one();
+}
+
+//---------------------------------------------------------------------------//
+/// Timelines:
+//---------------------------------------------------------------------------//
+NBodyTimeline* nbodyTimelineCreate(uint64_t p_InitialValue) {
+  NBodyTimeline* timeline = new NBodyTimeline;
+  timeline->m_Value.store(p_InitialValue);
+  timeline->m_Sleepers.store(0);
+#if NBODY_TIMELINE_FUTEX
+  timeline->m_Epoch.store(0);
+#endif
+#if defined(_WIN32)
+  timeline->m_Fence = nullptr;
+#endif
+  timeline->m_Signals.store(0);
+  timeline->m_Sleeps.store(0);
+  timeline->m_Timeouts.store(0);
+  return timeline;
+}
+//---------------------------------------------------------------------------//
+void nbodyTimelineDestroy(NBodyTimeline* p_Timeline) {
+  if (p_Timeline == nullptr)
+    return;
+#if defined(_WIN32)
+  if (p_Timeline->m_Fence != nullptr)
+    p_Timeline->m_Fence->Release();
+#endif
+  delete p_Timeline;
+}
+//---------------------------------------------------------------------------//
+uint64_t nbodyTimelineValue(const NBodyTimeline* p_Timeline) {
+#if defined(_WIN32)
+  if (p_Timeline->m_Fence != nullptr)
+    return p_Timeline->m_Fence->GetCompletedValue();
+#endif
+  return p_Timeline->m_Value.load(std::memory_order_acquire);
+}
+//---------------------------------------------------------------------------//
+void nbodyTimelineSignal(NBodyTimeline* p_Timeline, uint64_t p_Value) {
+#if defined(_WIN32)
+  if (p_Timeline->m_Fence != nullptr) {
+    if (p_Timeline->m_Fence->GetCompletedValue() < p_Value &&
+        SUCCEEDED(p_Timeline->m_Fence->Signal(p_Value)))
+      p_Timeline->m_Signals.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+#endif
+  // Sequentially consistent with the waiters' m_Sleepers increment and
+  // value check: either they see the new value or it sees them.
+  uint64_t current = p_Timeline->m_Value.load(std::memory_order_relaxed);
+  do {
+    if (current >= p_Value)
+      return;
+  } while (!p_Timeline->m_Value.compare_exchange_weak(current, p_Value));
+  p_Timeline->m_Signals.fetch_add(1, std::memory_order_relaxed);
+#if NBODY_TIMELINE_FUTEX
+  p_Timeline->m_Epoch.fetch_add(1);
+  if (p_Timeline->m_Sleepers.load() > 0)
+    _futexWakeAll(&p_Timeline->m_Epoch);
+#else
+  if (p_Timeline->m_Sleepers.load() > 0) {
+    // No waiter is between its check and its sleep once it has the mutex.
+    { std::lock_guard<std::mutex> lock(p_Timeline->m_Mutex); }
+    p_Timeline->m_WakeUp.notify_all();
+  }
+#endif
+}
+//---------------------------------------------------------------------------//
+bool nbodyTimelineWait(
+    NBodyTimeline* p_Timeline, uint64_t p_Value, uint32_t p_TimeoutMs) {
+#if defined(_WIN32)
+  if (p_Timeline->m_Fence != nullptr)
+    return _waitFence(p_Timeline, p_Value, p_TimeoutMs);
+#endif
+  if (p_Timeline->m_Value.load(std::memory_order_acquire) >= p_Value)
+    return true;
+  const bool infinite = p_TimeoutMs == NBodyTimelineInfinite;
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(p_TimeoutMs);
+#if NBODY_TIMELINE_FUTEX
+  for (;;) {
+    const uint32_t epoch = p_Timeline->m_Epoch.load();
+    p_Timeline->m_Sleepers.fetch_add(1);
+    if (p_Timeline->m_Value.load() >= p_Value) {
+      p_Timeline->m_Sleepers.fetch_sub(1);
+      return true;
+    }
+    struct timespec timeout = {};
+    if (!infinite) {
+      const int64_t left =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              deadline - std::chrono::steady_clock::now())
+              .count();
+      if (left <= 0) {
+        p_Timeline->m_Sleepers.fetch_sub(1);
+        p_Timeline->m_Timeouts.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      timeout.tv_sec = time_t(left / 1000000000);
+      timeout.tv_nsec = long(left % 1000000000);
+    }
+    p_Timeline->m_Sleeps.fetch_add(1, std::memory_order_relaxed);
+    _futexWait(&p_Timeline->m_Epoch, epoch, infinite ? nullptr : &timeout);
+    p_Timeline->m_Sleepers.fetch_sub(1);
+  }
+#else
+  std::unique_lock<std::mutex> lock(p_Timeline->m_Mutex);
+  p_Timeline->m_Sleepers.fetch_add(1);
+  const auto reached = [p_Timeline, p_Value] {
+    return p_Timeline->m_Value.load() >= p_Value;
+  };
+  bool done = reached();
+  if (!done) {
+    p_Timeline->m_Sleeps.fetch_add(1, std::memory_order_relaxed);
+    if (infinite) {
+      p_Timeline->m_WakeUp.wait(lock, reached);
+      done = true;
+    } else {
+      done = p_Timeline->m_WakeUp.wait_until(lock, deadline, reached);
+    }
+  }
+  p_Timeline->m_Sleepers.fetch_sub(1);
+  if (!done)
+    p_Timeline->m_Timeouts.fetch_add(1, std::memory_order_relaxed);
+  return done;
+#endif
+}
+//---------------------------------------------------------------------------//
+NBodyTimelineStats nbodyTimelineGetStats(const NBodyTimeline* p_Timeline) {
+  NBodyTimelineStats stats;
+  stats.m_Signals = p_Timeline->m_Signals.load(std::memory_order_relaxed);
+  stats.m_Sleeps = p_Timeline->m_Sleeps.load(std::memory_order_relaxed);
+  stats.m_Timeouts = p_Timeline->m_Timeouts.load(std::memory_order_relaxed);
+  return stats;
+}
+
+//---------------------------------------------------------------------------//
+/// Queues:
+//---------------------------------------------------------------------------//
+NBodyQueue* nbodyQueueCreate() {
+  NBodyQueue* queue = new NBodyQueue;
+  queue->m_Thread = std::thread(_runQueue, queue);
+  return queue;
+}
+//---------------------------------------------------------------------------//
+void nbodyQueueDestroy(NBodyQueue* p_Queue) {
+  if (p_Queue == nullptr)
+    return;
+  _submit(p_Queue, {CommandStop, nullptr, nullptr, nullptr, 0});
+  p_Queue->m_Thread.join();
+  delete p_Queue;
+}
+//---------------------------------------------------------------------------//
+void nbodyQueueExecute(
+    NBodyQueue* p_Queue, NBodyQueueFunc p_Func, void* p_User) {
+  _submit(p_Queue, {CommandExecute, p_Func, p_User, nullptr, 0});
+}
+//---------------------------------------------------------------------------//
+void nbodyQueueSignal(
+    NBodyQueue* p_Queue, NBodyTimeline* p_Timeline, uint64_t p_Value) {
+  _submit(p_Queue, {CommandSignal, nullptr, nullptr, p_Timeline, p_Value});
+}
+//---------------------------------------------------------------------------//
+void nbodyQueueWait(
+    NBodyQueue* p_Queue, NBodyTimeline* p_Timeline, uint64_t p_Value) {
+  _submit(p_Queue, {CommandWait, nullptr, nullptr, p_Timeline, p_Value});
+}
+
+//---------------------------------------------------------------------------//
+/// State rings:
+//---------------------------------------------------------------------------//
+void nbodyRingInit(
+    NBodyStateRing* p_Ring,
+    uint32_t p_SlotCount,
+    uint32_t p_FramesInFlight,
+    NBodyTimeline* p_Steps,
+    NBodyTimeline* p_Frames) {
+  NBODY_ASSERT(p_SlotCount >= 2 && p_SlotCount <= NBodyMaxStateBuffers);
+  NBODY_ASSERT(p_FramesInFlight >= 1);
+  p_Ring->m_SlotCount = p_SlotCount;
+  p_Ring->m_FrameLimit = std::min(p_FramesInFlight, p_SlotCount - 1);
+  p_Ring->m_Steps = p_Steps;
+  p_Ring->m_Frames = p_Frames;
+  for (uint32_t slot = 0; slot < NBodyMaxStateBuffers; ++slot)
+    p_Ring->m_SlotFrames[slot].store(0);
+}
+//---------------------------------------------------------------------------//
+// The slot is marked before the steps are read again: a producer that
+// missed the mark had not finished step + K - 1 yet, so its next write into
+// the slot is still to come and will wait for p_Frame. Otherwise the slot
+// may be written already and the newer step is picked instead, the slot
+// gets its previous frame back so the producer doesn't wait for this one.
+uint64_t nbodyRingAcquire(NBodyStateRing* p_Ring, uint64_t p_Frame) {
+  uint64_t step = nbodyTimelineValue(p_Ring->m_Steps);
+  for (;;) {
+    std::atomic<uint64_t>& mark =
+        p_Ring->m_SlotFrames[nbodyRingSlot(p_Ring, step)];
+    const uint64_t previous = mark.exchange(p_Frame);
+    // Fence values are read by the driver, not through atomics.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const uint64_t done = nbodyTimelineValue(p_Ring->m_Steps);
+    if (done < step + p_Ring->m_SlotCount - 1)
+      return step;
+    uint64_t expected = p_Frame;
+    mark.compare_exchange_strong(expected, previous);
+    step = done;
+  }
+}
+
+#if defined(_WIN32)
+//---------------------------------------------------------------------------//
+/// D3D12:
+//---------------------------------------------------------------------------//
+NBodyTimeline*
+nbodyTimelineCreateD3D12(ID3D12Device* p_Device, uint64_t p_InitialValue) {
+  ID3D12Fence* fence = nullptr;
+  if (FAILED(p_Device->CreateFence(
+          p_InitialValue, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence))))
+    return nullptr;
+  NBodyTimeline* timeline = nbodyTimelineCreate(p_InitialValue);
+  timeline->m_Fence = fence;
+  return timeline;
+}
+//---------------------------------------------------------------------------//
+bool nbodyTimelineSignalQueue(
+    NBodyTimeline* p_Timeline, ID3D12CommandQueue* p_Queue, uint64_t p_Value) {
+  if (p_Timeline->m_Fence == nullptr ||
+      FAILED(p_Queue->Signal(p_Timeline->m_Fence, p_Value)))
+    return false;
+  p_Timeline->m_Signals.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+//---------------------------------------------------------------------------//
+bool nbodyTimelineWaitQueue(
+    NBodyTimeline* p_Timeline, ID3D12CommandQueue* p_Queue, uint64_t p_Value) {
+  if (p_Timeline->m_Fence == nullptr)
+    return false;
+  // Already reached: don't make the queue look at the fence at all.
+  if (p_Timeline->m_Fence->GetCompletedValue() >= p_Value)
+    return true;
+  return SUCCEEDED(p_Queue->Wait(p_Timeline->m_Fence, p_Value));
+}
+#endif
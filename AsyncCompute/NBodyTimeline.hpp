@@ -0,0 +1,153 @@
+#pragma once
+
+/******************************************************************************
+ * \timeline semaphores: the one synchronization primitive of the pipeline
+ * \a timeline holds a 64-bit value that only grows. Producers signal the
+ * \value they reached, consumers wait for the value they need, on the host
+ * \(a thread) or on the device (a queue, which stalls without blocking the
+ * \thread that submitted the wait). A signal releases everything written
+ * \before it to whoever waited for it.
+ * \The portable timelines are an atomic and a futex (Linux) or a condition
+ * \variable, their device side is NBodyQueue: an in-order queue of work run
+ * \by its own thread, so the whole compute/render pipeline runs and can be
+ * \stress tested without a GPU. On Windows a timeline can wrap an
+ * \ID3D12Fence instead, then D3D12 command queues signal and wait on it.
+ * \A ring of state buffers hands a producer's steps to a consumer's frames
+ * \on top of two timelines.
+ ******************************************************************************/
+
+#include "NBodyCommon.hpp"
+#include <atomic>
+
+struct NBodyTimeline;
+struct NBodyQueue;
+#if defined(_WIN32)
+struct ID3D12Device;
+struct ID3D12CommandQueue;
+#endif
+
+// Timeout of nbodyTimelineWait that never expires
+static constexpr uint32_t NBodyTimelineInfinite = 0xFFFFFFFF;
+// State buffers of a NBodyStateRing, 2 is double buffering.
+static constexpr uint32_t NBodyDefaultStateBuffers = 2;
+static constexpr uint32_t NBodyMaxStateBuffers = 8;
+
+//---------------------------------------------------------------------------//
+struct NBodyTimelineStats {
+  uint64_t m_Signals;  // That advanced the value
+  uint64_t m_Sleeps;   // Host waits that had to block
+  uint64_t m_Timeouts; // Host waits that gave up
+};
+
+//---------------------------------------------------------------------------//
+NBodyTimeline* nbodyTimelineCreate(uint64_t p_InitialValue);
+//---------------------------------------------------------------------------//
+// No thread or queue may still wait on p_Timeline.
+void nbodyTimelineDestroy(NBodyTimeline* p_Timeline);
+//---------------------------------------------------------------------------//
+// The value reached so far.
+uint64_t nbodyTimelineValue(const NBodyTimeline* p_Timeline);
+//---------------------------------------------------------------------------//
+// Host side: sets the value to p_Value and wakes the waiters it satisfies.
+// The value never goes back, a lower p_Value is ignored.
+void nbodyTimelineSignal(NBodyTimeline* p_Timeline, uint64_t p_Value);
+//---------------------------------------------------------------------------//
+// Host side: blocks until the value reaches p_Value or p_TimeoutMs
+// milliseconds passed (NBodyTimelineInfinite: never). False on a timeout.
+bool nbodyTimelineWait(
+    NBodyTimeline* p_Timeline, uint64_t p_Value, uint32_t p_TimeoutMs);
+//---------------------------------------------------------------------------//
+NBodyTimelineStats nbodyTimelineGetStats(const NBodyTimeline* p_Timeline);
+//---------------------------------------------------------------------------//
+
+//---------------------------------------------------------------------------//
+// Device side of the portable timelines (any timeline works with it).
+//---------------------------------------------------------------------------//
+typedef void (*NBodyQueueFunc)(void* p_User);
+
+//---------------------------------------------------------------------------//
+NBodyQueue* nbodyQueueCreate();
+//---------------------------------------------------------------------------//
+// Runs what was submitted first.
+void nbodyQueueDestroy(NBodyQueue* p_Queue);
+//---------------------------------------------------------------------------//
+// The commands run one at a time, in submission order.
+void nbodyQueueExecute(
+    NBodyQueue* p_Queue, NBodyQueueFunc p_Func, void* p_User);
+//---------------------------------------------------------------------------//
+// Signals p_Value once the commands submitted before are done.
+void nbodyQueueSignal(
+    NBodyQueue* p_Queue, NBodyTimeline* p_Timeline, uint64_t p_Value);
+//---------------------------------------------------------------------------//
+// The commands submitted after it wait until p_Timeline reaches p_Value.
+void nbodyQueueWait(
+    NBodyQueue* p_Queue, NBodyTimeline* p_Timeline, uint64_t p_Value);
+//---------------------------------------------------------------------------//
+
+//---------------------------------------------------------------------------//
+// K state buffers between a producer and a consumer: step k is written into
+// slot k % K (step 0, the initial state, is in slot 0). Every slot keeps the
+// last frame that picked it, and the producer only waits for that frame
+// before overwriting it. It runs up to K - 1 steps ahead of the oldest step
+// that a frame still reads. Every frame in flight holds a slot of a newer
+// step, which is that much less lead: the consumer keeps at most K - 1 of
+// them, fewer than it could (nbodyRingFrameToWait), so it never holds the
+// slot the producer writes next unless a frame takes longer than the lead.
+//---------------------------------------------------------------------------//
+struct NBodyStateRing {
+  uint32_t m_SlotCount;
+  uint32_t m_FrameLimit;   // Frames in flight, min(the consumer's, K - 1)
+  NBodyTimeline* m_Steps;  // The producer's, value k once step k is done
+  NBodyTimeline* m_Frames; // The consumer's, value f once frame f is done
+  std::atomic<uint64_t> m_SlotFrames[NBodyMaxStateBuffers];
+};
+
+//---------------------------------------------------------------------------//
+// p_SlotCount in [2, NBodyMaxStateBuffers], p_FramesInFlight (at least 1)
+// the most the consumer could have. The timelines are not owned.
+void nbodyRingInit(
+    NBodyStateRing* p_Ring,
+    uint32_t p_SlotCount,
+    uint32_t p_FramesInFlight,
+    NBodyTimeline* p_Steps,
+    NBodyTimeline* p_Frames);
+//---------------------------------------------------------------------------//
+inline uint32_t nbodyRingSlot(const NBodyStateRing* p_Ring, uint64_t p_Step) {
+  return static_cast<uint32_t>(p_Step % p_Ring->m_SlotCount);
+}
+//---------------------------------------------------------------------------//
+// Producer side, once step p_Step - 1 is done: the value of m_Frames to
+// wait for (on the queue) before writing step p_Step.
+inline uint64_t
+nbodyRingWriteFrame(const NBodyStateRing* p_Ring, uint64_t p_Step) {
+  return p_Ring->m_SlotFrames[nbodyRingSlot(p_Ring, p_Step)].load();
+}
+//---------------------------------------------------------------------------//
+// Consumer side: the value of m_Frames to wait for (on the host) before
+// acquiring a step for frame p_Frame.
+inline uint64_t
+nbodyRingFrameToWait(const NBodyStateRing* p_Ring, uint64_t p_Frame) {
+  return p_Frame > p_Ring->m_FrameLimit ? p_Frame - p_Ring->m_FrameLimit : 0;
+}
+//---------------------------------------------------------------------------//
+// Consumer side: the newest step done, which frame p_Frame may read until
+// it signals m_Frames. Frames are numbered from 1 in submission order.
+uint64_t nbodyRingAcquire(NBodyStateRing* p_Ring, uint64_t p_Frame);
+//---------------------------------------------------------------------------//
+
+#if defined(_WIN32)
+//---------------------------------------------------------------------------//
+// Device side of D3D12: a timeline on a fence of p_Device, which the host
+// functions above also work with.
+//---------------------------------------------------------------------------//
+NBodyTimeline*
+nbodyTimelineCreateD3D12(ID3D12Device* p_Device, uint64_t p_InitialValue);
+//---------------------------------------------------------------------------//
+// Same as nbodyQueueSignal and nbodyQueueWait on a D3D12 command queue.
+// False if p_Timeline has no fence or the call failed.
+bool nbodyTimelineSignalQueue(
+    NBodyTimeline* p_Timeline, ID3D12CommandQueue* p_Queue, uint64_t p_Value);
+bool nbodyTimelineWaitQueue(
+    NBodyTimeline* p_Timeline, ID3D12CommandQueue* p_Queue, uint64_t p_Value);
+//---------------------------------------------------------------------------//
+#endif
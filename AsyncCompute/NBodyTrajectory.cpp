@@ -0,0 +1,495 @@
+#include "NBodyTrajectory.hpp"
+#include "NBodyCpu.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+static const char s_TrajectoryMagic[8] = {
+    'N', 'B', 'O', 'D', 'Y', 'T', 'R', 'J'};
+// Zero runs of 2 to NBodyMaxZeroRun bytes take one control byte, so do
+// literal runs of 1 to NBodyMaxLiteralRun bytes (then followed by them).
+static constexpr uint32_t NBodyMaxLiteralRun = 128;
+static constexpr uint32_t NBodyMaxZeroRun = 129;
+
+namespace {
+//---------------------------------------------------------------------------//
+// Single producer, single consumer ring of frame indices. Never full: it
+// holds at most the NBodyMaxTrajectoryBuffers frames there are.
+//---------------------------------------------------------------------------//
+struct FrameQueue {
+  uint32_t m_Frames[NBodyMaxTrajectoryBuffers];
+  alignas(64) std::atomic<uint32_t> m_Head; // Next to pop, consumer side
+  alignas(64) std::atomic<uint32_t> m_Tail; // Next to push, producer side
+
+  void push(uint32_t p_Frame) {
+    const uint32_t tail = m_Tail.load(std::memory_order_relaxed);
+    m_Frames[tail % NBodyMaxTrajectoryBuffers] = p_Frame;
+    m_Tail.store(tail + 1, std::memory_order_release);
+  }
+  bool pop(uint32_t* p_Frame) {
+    const uint32_t head = m_Head.load(std::memory_order_relaxed);
+    if (head == m_Tail.load(std::memory_order_acquire))
+      return false;
+    *p_Frame = m_Frames[head % NBodyMaxTrajectoryBuffers];
+    m_Head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+  uint32_t depth() const {
+    return m_Tail.load(std::memory_order_acquire) -
+           m_Head.load(std::memory_order_acquire);
+  }
+};
+
+// Positions of a captured step in slot order, and the id of every slot.
+struct Frame {
+  uint64_t m_Step;
+  float* m_Pos[3];
+  uint32_t* m_Ids;
+};
+} // namespace
+
+struct NBodyTrajectoryImpl {
+  FILE* m_File;
+  uint32_t m_Count;
+  NBodyFrameCodec m_Codec;
+
+  std::vector<Frame> m_Frames;
+  void* m_FrameMemory;
+  FrameQueue m_Queued; // Captured, to be written
+  FrameQueue m_Free;   // Written, to be captured into
+
+  // The producer takes the mutex only to wake the writer up.
+  std::thread m_Writer;
+  std::mutex m_Mutex;
+  std::condition_variable m_WakeUp;
+  bool m_Closing;
+
+  // Writer side: the frame in id order, the previous one and the encoding.
+  std::vector<float> m_Ordered;
+  std::vector<float> m_Previous;
+  std::vector<uint8_t> m_Planes;
+  std::vector<uint8_t> m_Encoded;
+  NBodyQuantCoder* m_Quant;
+  std::atomic<uint64_t> m_Written;
+  std::atomic<uint64_t> m_FileBytes;
+  std::atomic<uint64_t> m_WriterNanoseconds;
+  std::atomic<bool> m_Failed;
+
+  // Stepping thread side
+  uint64_t m_Captured;
+  uint64_t m_Dropped;
+  uint32_t m_MaxQueueDepth;
+  double m_CaptureSeconds;
+};
+
+//---------------------------------------------------------------------------//
+/// Local functions:
+//---------------------------------------------------------------------------//
+// Byte planes of p_Frame XOR p_Previous (3 * p_Count floats each), the
+// most significant bytes of every coordinate array first: bits that didn't
+// change since the last frame become runs of zeros.
+static void _splitXorPlanes(
+    const float* p_Frame,
+    const float* p_Previous,
+    uint32_t p_Count,
+    uint8_t* p_Planes) {
+  for (uint32_t c = 0; c < 3; ++c) {
+    const uint32_t* frame =
+        reinterpret_cast<const uint32_t*>(p_Frame) + size_t(c) * p_Count;
+    const uint32_t* previous =
+        reinterpret_cast<const uint32_t*>(p_Previous) + size_t(c) * p_Count;
+    uint8_t* planes = p_Planes + size_t(c) * 4 * p_Count;
+    for (uint32_t i = 0; i < p_Count; ++i) {
+      const uint32_t bits = frame[i] ^ previous[i];
+      planes[i] = uint8_t(bits >> 24);
+      planes[p_Count + i] = uint8_t(bits >> 16);
+      planes[2 * size_t(p_Count) + i] = uint8_t(bits >> 8);
+      planes[3 * size_t(p_Count) + i] = uint8_t(bits);
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+static void _mergeXorPlanes(
+    const uint8_t* p_Planes, uint32_t p_Count, float* p_Frame) {
+  for (uint32_t c = 0; c < 3; ++c) {
+    uint32_t* frame =
+        reinterpret_cast<uint32_t*>(p_Frame) + size_t(c) * p_Count;
+    const uint8_t* planes = p_Planes + size_t(c) * 4 * p_Count;
+    for (uint32_t i = 0; i < p_Count; ++i) {
+      frame[i] ^= uint32_t(planes[i]) << 24 |
+                  uint32_t(planes[p_Count + i]) << 16 |
+                  uint32_t(planes[2 * size_t(p_Count) + i]) << 8 |
+                  uint32_t(planes[3 * size_t(p_Count) + i]);
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Control byte c < NBodyMaxLiteralRun: c + 1 literal bytes follow, otherwise
+// a run of c - 126 zeros. Needs p_Size + p_Size / 128 + 1 bytes of output.
+static uint64_t
+_packZeroRuns(const uint8_t* p_Src, uint64_t p_Size, uint8_t* p_Dst) {
+  uint64_t out = 0;
+  uint64_t i = 0;
+  while (i < p_Size) {
+    uint64_t zeros = 0;
+    while (i + zeros < p_Size && p_Src[i + zeros] == 0 &&
+           zeros < NBodyMaxZeroRun)
+      ++zeros;
+    if (zeros >= 2) {
+      p_Dst[out++] = uint8_t(zeros + 126);
+      i += zeros;
+      continue;
+    }
+    // Literals up to the next pair of zeros
+    uint64_t length = 1;
+    while (i + length < p_Size && length < NBodyMaxLiteralRun &&
+           !(p_Src[i + length] == 0 && i + length + 1 < p_Size &&
+             p_Src[i + length + 1] == 0))
+      ++length;
+    p_Dst[out++] = uint8_t(length - 1);
+    memcpy(p_Dst + out, p_Src + i, length);
+    out += length;
+    i += length;
+  }
+  return out;
+}
+//---------------------------------------------------------------------------//
+// False unless p_Src decodes to exactly p_DstSize bytes.
+static bool _unpackZeroRuns(
+    const uint8_t* p_Src, uint64_t p_Size, uint8_t* p_Dst, uint64_t p_DstSize) {
+  uint64_t out = 0;
+  uint64_t i = 0;
+  while (i < p_Size) {
+    const uint32_t control = p_Src[i++];
+    if (control < NBodyMaxLiteralRun) {
+      const uint64_t length = control + 1;
+      if (i + length > p_Size || out + length > p_DstSize)
+        return false;
+      memcpy(p_Dst + out, p_Src + i, length);
+      i += length;
+      out += length;
+    } else {
+      const uint64_t length = control - 126;
+      if (out + length > p_DstSize)
+        return false;
+      memset(p_Dst + out, 0, length);
+      out += length;
+    }
+  }
+  return out == p_DstSize;
+}
+//---------------------------------------------------------------------------//
+// Puts a captured frame in id order, encodes it and appends it to the file.
+static void _writeFrame(NBodyTrajectoryImpl* p_Impl, const Frame& p_Frame) {
+  const uint32_t count = p_Impl->m_Count;
+  float* ordered = p_Impl->m_Ordered.data();
+  for (uint32_t c = 0; c < 3; ++c) {
+    float* dst = ordered + size_t(c) * count;
+    for (uint32_t slot = 0; slot < count; ++slot) {
+      dst[p_Frame.m_Ids[slot]] = p_Frame.m_Pos[c][slot];
+    }
+  }
+
+  NBodyFrameHeader header = {};
+  header.m_Step = p_Frame.m_Step;
+  header.m_Codec = p_Impl->m_Codec;
+  const void* payload = ordered;
+  header.m_PayloadSize = 3 * size_t(count) * sizeof(float);
+  if (p_Impl->m_Codec == NBodyCodecQuant) {
+    const float* positions[3] = {ordered, ordered + count, ordered + 2 * count};
+    const size_t size =
+        nbodyQuantEncode(p_Impl->m_Quant, positions, p_Impl->m_Encoded.data());
+    if (size > 0) {
+      header.m_PayloadSize = size;
+      payload = p_Impl->m_Encoded.data();
+    } else {
+      header.m_Codec = NBodyCodecRaw; // Positions out of range
+    }
+  } else if (p_Impl->m_Codec == NBodyCodecXor) {
+    _splitXorPlanes(
+        ordered, p_Impl->m_Previous.data(), count, p_Impl->m_Planes.data());
+    header.m_PayloadSize = _packZeroRuns(
+        p_Impl->m_Planes.data(),
+        p_Impl->m_Planes.size(),
+        p_Impl->m_Encoded.data());
+    payload = p_Impl->m_Encoded.data();
+    p_Impl->m_Previous.swap(p_Impl->m_Ordered);
+  }
+
+  const bool ok =
+      fwrite(&header, sizeof(header), 1, p_Impl->m_File) == 1 &&
+      fwrite(payload, 1, header.m_PayloadSize, p_Impl->m_File) ==
+          header.m_PayloadSize;
+  if (!ok)
+    p_Impl->m_Failed.store(true);
+  p_Impl->m_FileBytes += sizeof(header) + header.m_PayloadSize;
+  p_Impl->m_Written++;
+}
+//---------------------------------------------------------------------------//
+static void _writerProc(NBodyTrajectoryImpl* p_Impl) {
+  for (;;) {
+    uint32_t index = 0;
+    if (!p_Impl->m_Queued.pop(&index)) {
+      std::unique_lock<std::mutex> lock(p_Impl->m_Mutex);
+      p_Impl->m_WakeUp.wait(lock, [p_Impl] {
+        return p_Impl->m_Queued.depth() > 0 || p_Impl->m_Closing;
+      });
+      if (p_Impl->m_Queued.depth() == 0)
+        return; // Closing, every frame written
+      continue;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    _writeFrame(p_Impl, p_Impl->m_Frames[index]);
+    p_Impl->m_WriterNanoseconds +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count();
+    p_Impl->m_Free.push(index);
+  }
+}
+//---------------------------------------------------------------------------//
+// Core functions:
+//---------------------------------------------------------------------------//
+const char* nbodyCodecName(NBodyFrameCodec p_Codec) {
+  static const char* s_Names[NBodyCodecCount] = {"raw", "xor", "quant"};
+  NBODY_ASSERT(p_Codec < NBodyCodecCount);
+  return s_Names[p_Codec];
+}
+//---------------------------------------------------------------------------//
+bool nbodyTrajectoryOpen(
+    NBodyTrajectory* p_Trajectory,
+    const char* p_Path,
+    uint32_t p_ParticleCount,
+    uint32_t p_Interval,
+    uint32_t p_BufferCount,
+    NBodyFrameCodec p_Codec,
+    float p_ErrorBound) {
+  NBODY_ASSERT(p_BufferCount > 0 && p_BufferCount <= NBodyMaxTrajectoryBuffers);
+  NBODY_ASSERT(p_Interval > 0);
+  memset(p_Trajectory, 0, sizeof(*p_Trajectory));
+
+  FILE* file = fopen(p_Path, "wb");
+  if (file == nullptr)
+    return false;
+  NBodyTrajectoryHeader header = {};
+  memcpy(header.m_Magic, s_TrajectoryMagic, sizeof(s_TrajectoryMagic));
+  header.m_Version = NBodyTrajectoryVersion;
+  header.m_HeaderSize = sizeof(NBodyTrajectoryHeader);
+  header.m_ParticleCount = p_ParticleCount;
+  header.m_Codec = p_Codec;
+  header.m_Interval = p_Interval;
+  header.m_ErrorBound = p_Codec == NBodyCodecQuant ? p_ErrorBound : 0.0f;
+  if (fwrite(&header, sizeof(header), 1, file) != 1) {
+    fclose(file);
+    return false;
+  }
+
+  NBodyTrajectoryImpl* impl = new NBodyTrajectoryImpl();
+  impl->m_File = file;
+  impl->m_Count = p_ParticleCount;
+  impl->m_Codec = p_Codec;
+  impl->m_FileBytes = sizeof(header);
+
+  // x, y, z and ids per frame, each array on its own cache lines
+  const size_t arraySize = nbodyPadCount(p_ParticleCount) * sizeof(float);
+  impl->m_FrameMemory =
+      nbodyAlignedAlloc(4 * arraySize * p_BufferCount, NBodyAlignment);
+  NBODY_ASSERT(impl->m_FrameMemory != nullptr);
+  uint8_t* memory = static_cast<uint8_t*>(impl->m_FrameMemory);
+  impl->m_Frames.resize(p_BufferCount);
+  for (uint32_t f = 0; f < p_BufferCount; ++f) {
+    Frame& frame = impl->m_Frames[f];
+    for (uint32_t c = 0; c < 3; ++c) {
+      frame.m_Pos[c] = reinterpret_cast<float*>(memory);
+      memory += arraySize;
+    }
+    frame.m_Ids = reinterpret_cast<uint32_t*>(memory);
+    memory += arraySize;
+    impl->m_Free.push(f);
+  }
+
+  const size_t floatCount = 3 * size_t(p_ParticleCount);
+  impl->m_Ordered.resize(floatCount);
+  if (p_Codec == NBodyCodecXor) {
+    // The first frame is XORed with zeros, i.e. stored as is.
+    impl->m_Previous.assign(floatCount, 0.0f);
+    impl->m_Planes.resize(floatCount * sizeof(float));
+    impl->m_Encoded.resize(
+        impl->m_Planes.size() + impl->m_Planes.size() / NBodyMaxLiteralRun + 1);
+  } else if (p_Codec == NBodyCodecQuant) {
+    impl->m_Quant =
+        nbodyQuantCreate(p_ParticleCount, p_ErrorBound, nbodyDetectIsa());
+    impl->m_Encoded.resize(nbodyQuantMaxSize(p_ParticleCount));
+  }
+
+  impl->m_Writer = std::thread(_writerProc, impl);
+  p_Trajectory->m_Interval = p_Interval;
+  p_Trajectory->m_Impl = impl;
+  return true;
+}
+//---------------------------------------------------------------------------//
+void nbodyTrajectoryCapture(NBodyTrajectory* p_Trajectory, NBodyCpuCtx* p_Ctx) {
+  NBodyTrajectoryImpl* impl = p_Trajectory->m_Impl;
+  if (p_Ctx->m_StepCount % p_Trajectory->m_Interval != 0)
+    return;
+  NBODY_ASSERT(p_Ctx->m_Store.m_Count == impl->m_Count);
+
+  const auto start = std::chrono::steady_clock::now();
+  uint32_t index = 0;
+  if (!impl->m_Free.pop(&index)) {
+    impl->m_Dropped++;
+    return;
+  }
+  Frame& frame = impl->m_Frames[index];
+  frame.m_Step = p_Ctx->m_StepCount;
+  for (uint32_t c = 0; c < 3; ++c) {
+    memcpy(
+        frame.m_Pos[c],
+        nbodyStoreAttrib(&p_Ctx->m_Store, NBodyAttribute(NBodyAttribPosX + c)),
+        impl->m_Count * sizeof(float));
+  }
+  memcpy(frame.m_Ids, p_Ctx->m_Ids, impl->m_Count * sizeof(uint32_t));
+
+  impl->m_Queued.push(index);
+  const uint32_t depth = impl->m_Queued.depth();
+  impl->m_MaxQueueDepth =
+      depth > impl->m_MaxQueueDepth ? depth : impl->m_MaxQueueDepth;
+  impl->m_Captured++;
+  // Taking the mutex orders the push before the writer's predicate check.
+  {
+    std::lock_guard<std::mutex> lock(impl->m_Mutex);
+  }
+  impl->m_WakeUp.notify_one();
+  impl->m_CaptureSeconds += std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - start)
+                                .count();
+}
+//---------------------------------------------------------------------------//
+NBodyTrajectoryStats nbodyTrajectoryStats(const NBodyTrajectory* p_Trajectory) {
+  const NBodyTrajectoryImpl* impl = p_Trajectory->m_Impl;
+  NBodyTrajectoryStats stats = {};
+  stats.m_Captured = impl->m_Captured;
+  stats.m_Dropped = impl->m_Dropped;
+  stats.m_Written = impl->m_Written.load();
+  stats.m_MaxQueueDepth = impl->m_MaxQueueDepth;
+  stats.m_RawBytes = stats.m_Written * 3 * sizeof(float) * impl->m_Count;
+  stats.m_FileBytes = impl->m_FileBytes.load();
+  stats.m_CaptureSeconds = impl->m_CaptureSeconds;
+  stats.m_WriterSeconds = impl->m_WriterNanoseconds.load() * 1e-9;
+  return stats;
+}
+//---------------------------------------------------------------------------//
+bool nbodyTrajectoryClose(
+    NBodyTrajectory* p_Trajectory, NBodyTrajectoryStats* p_Stats) {
+  NBodyTrajectoryImpl* impl = p_Trajectory->m_Impl;
+  {
+    std::lock_guard<std::mutex> lock(impl->m_Mutex);
+    impl->m_Closing = true;
+  }
+  impl->m_WakeUp.notify_one();
+  impl->m_Writer.join();
+
+  if (p_Stats != nullptr)
+    *p_Stats = nbodyTrajectoryStats(p_Trajectory);
+  const bool ok = fclose(impl->m_File) == 0 && !impl->m_Failed.load();
+  nbodyAlignedFree(impl->m_FrameMemory);
+  if (impl->m_Quant != nullptr)
+    nbodyQuantDestroy(impl->m_Quant);
+  delete impl;
+  p_Trajectory->m_Impl = nullptr;
+  return ok;
+}
+//---------------------------------------------------------------------------//
+bool nbodyTrajectoryReaderOpen(
+    NBodyTrajectoryReader* p_Reader, const char* p_Path) {
+  memset(p_Reader, 0, sizeof(*p_Reader));
+  p_Reader->m_File = fopen(p_Path, "rb");
+  if (p_Reader->m_File == nullptr)
+    return false;
+  const NBodyTrajectoryHeader& header = p_Reader->m_Header;
+  if (fread(&p_Reader->m_Header, sizeof(header), 1, p_Reader->m_File) != 1 ||
+      memcmp(header.m_Magic, s_TrajectoryMagic, sizeof(s_TrajectoryMagic)) !=
+          0 ||
+      header.m_Version != NBodyTrajectoryVersion ||
+      header.m_HeaderSize != sizeof(NBodyTrajectoryHeader) ||
+      header.m_Codec >= NBodyCodecCount ||
+      (header.m_Codec == NBodyCodecQuant &&
+       !(header.m_ErrorBound >= NBodyMinErrorBound &&
+         header.m_ErrorBound <= NBodyMaxErrorBound))) {
+    nbodyTrajectoryReaderClose(p_Reader);
+    return false;
+  }
+  if (header.m_Codec == NBodyCodecQuant)
+    p_Reader->m_Quant = nbodyQuantCreate(
+        header.m_ParticleCount, header.m_ErrorBound, nbodyDetectIsa());
+
+  // Positions start at zero, the first XOR frame is relative to them.
+  const size_t floatCount = 3 * size_t(header.m_ParticleCount);
+  p_Reader->m_Memory = calloc(floatCount * 2, sizeof(float));
+  NBODY_ASSERT(p_Reader->m_Memory != nullptr);
+  float* positions = static_cast<float*>(p_Reader->m_Memory);
+  for (uint32_t c = 0; c < 3; ++c) {
+    p_Reader->m_Positions[c] = positions + size_t(c) * header.m_ParticleCount;
+  }
+  p_Reader->m_Planes = reinterpret_cast<uint8_t*>(positions + floatCount);
+  return true;
+}
+//---------------------------------------------------------------------------//
+bool nbodyTrajectoryReadFrame(NBodyTrajectoryReader* p_Reader) {
+  NBodyFrameHeader header;
+  if (fread(&header, sizeof(header), 1, p_Reader->m_File) != 1 ||
+      header.m_Codec >= NBodyCodecCount ||
+      (header.m_Codec == NBodyCodecQuant && p_Reader->m_Quant == nullptr))
+    return false;
+  if (header.m_PayloadSize > p_Reader->m_PayloadCapacity) {
+    free(p_Reader->m_Payload);
+    p_Reader->m_Payload = static_cast<uint8_t*>(malloc(header.m_PayloadSize));
+    NBODY_ASSERT(p_Reader->m_Payload != nullptr);
+    p_Reader->m_PayloadCapacity = header.m_PayloadSize;
+  }
+  if (fread(p_Reader->m_Payload, 1, header.m_PayloadSize, p_Reader->m_File) !=
+      header.m_PayloadSize)
+    return false;
+
+  const uint32_t count = p_Reader->m_Header.m_ParticleCount;
+  const uint64_t rawSize = 3 * uint64_t(count) * sizeof(float);
+  if (header.m_Codec == NBodyCodecRaw) {
+    if (header.m_PayloadSize != rawSize)
+      return false;
+    memcpy(p_Reader->m_Positions[0], p_Reader->m_Payload, rawSize);
+  } else if (header.m_Codec == NBodyCodecQuant) {
+    if (!nbodyQuantDecode(
+            p_Reader->m_Quant,
+            p_Reader->m_Payload,
+            header.m_PayloadSize,
+            p_Reader->m_Positions))
+      return false;
+  } else {
+    if (!_unpackZeroRuns(
+            p_Reader->m_Payload,
+            header.m_PayloadSize,
+            p_Reader->m_Planes,
+            rawSize))
+      return false;
+    _mergeXorPlanes(p_Reader->m_Planes, count, p_Reader->m_Positions[0]);
+  }
+  p_Reader->m_Step = header.m_Step;
+  return true;
+}
+//---------------------------------------------------------------------------//
+void nbodyTrajectoryReaderClose(NBodyTrajectoryReader* p_Reader) {
+  if (p_Reader->m_File != nullptr)
+    fclose(p_Reader->m_File);
+  free(p_Reader->m_Payload);
+  if (p_Reader->m_Quant != nullptr)
+    nbodyQuantDestroy(p_Reader->m_Quant);
+  free(p_Reader->m_Memory);
+  memset(p_Reader, 0, sizeof(*p_Reader));
+}
+//---------------------------------------------------------------------------//
@@ -0,0 +1,135 @@
+#pragma once
+
+/******************************************************************************
+ * \trajectory output of the CPU engine
+ * \every k-th step the positions (in slot order, with the ids) are copied
+ * \into one of a few preallocated frame buffers and handed to a writer thread
+ * \through a bounded lock-free queue. The writer puts them back in id order,
+ * \encodes them and appends them to the file, so the stepping thread only
+ * \pays for the copy: when every buffer is still queued the frame is dropped
+ * \(and counted) instead of waiting for the disk.
+ ******************************************************************************/
+
+#include "NBodyCommon.hpp"
+#include "NBodyQuantCodec.hpp"
+#include <stdio.h>
+
+struct NBodyCpuCtx;
+struct NBodyTrajectoryImpl;
+
+static constexpr uint32_t NBodyTrajectoryVersion = 1;
+// Frame buffers of a writer, the queue holds at most NBodyMaxTrajectoryBuffers.
+static constexpr uint32_t NBodyDefaultTrajectoryBuffers = 4;
+static constexpr uint32_t NBodyMaxTrajectoryBuffers = 64;
+
+//---------------------------------------------------------------------------//
+// Encodings of the frames, positions in id order as x, y then z arrays:
+//---------------------------------------------------------------------------//
+enum NBodyFrameCodec : uint32_t {
+  NBodyCodecRaw = 0, // float32
+  NBodyCodecXor,     // Lossless: bits XOR the previous frame's, byte planes
+                     // from the most significant one, runs of zeros packed
+  NBodyCodecQuant,   // Lossy: grid cells, Morton order and linear prediction
+                     // (NBodyQuantCodec.hpp)
+  NBodyCodecCount
+};
+
+//---------------------------------------------------------------------------//
+// File layout: the header, then one NBodyFrameHeader and its payload per
+// frame, little-endian. Frames of NBodyCodecXor need the previous one, those
+// of NBodyCodecQuant the ones since their keyframe. A frame that the codec
+// of the file can't encode is stored as NBodyCodecRaw.
+//---------------------------------------------------------------------------//
+struct NBodyTrajectoryHeader {
+  char m_Magic[8];       // "NBODYTRJ"
+  uint32_t m_Version;    // NBodyTrajectoryVersion
+  uint32_t m_HeaderSize; // sizeof(NBodyTrajectoryHeader)
+  uint32_t m_ParticleCount;
+  uint32_t m_Codec;      // NBodyFrameCodec
+  uint32_t m_Interval;   // Steps between two frames
+  float m_ErrorBound;    // NBodyCodecQuant only
+  uint32_t m_Reserved[8];
+};
+static_assert(sizeof(NBodyTrajectoryHeader) == 64, "Fixed size header");
+
+struct NBodyFrameHeader {
+  uint64_t m_Step;        // NBodyCpuCtx::m_StepCount of the frame
+  uint64_t m_PayloadSize; // Bytes that follow
+  uint32_t m_Codec;       // NBodyFrameCodec
+  uint32_t m_Reserved[3];
+};
+static_assert(sizeof(NBodyFrameHeader) == 32, "Fixed size header");
+
+//---------------------------------------------------------------------------//
+// Back-pressure counters of a writer.
+//---------------------------------------------------------------------------//
+struct NBodyTrajectoryStats {
+  uint64_t m_Captured;      // Frames copied by the stepping thread
+  uint64_t m_Dropped;       // Frames skipped, every buffer was queued
+  uint64_t m_Written;       // Frames appended to the file
+  uint32_t m_MaxQueueDepth; // Most frames waiting for the writer at once
+  uint64_t m_RawBytes;      // Positions written, 12 bytes per particle
+  uint64_t m_FileBytes;     // Encoded frames and their headers
+  double m_CaptureSeconds;  // Spent on the stepping thread
+  double m_WriterSeconds;   // Spent encoding and writing
+};
+
+//---------------------------------------------------------------------------//
+struct NBodyTrajectory {
+  uint32_t m_Interval;
+  NBodyTrajectoryImpl* m_Impl;
+};
+
+//---------------------------------------------------------------------------//
+const char* nbodyCodecName(NBodyFrameCodec p_Codec);
+//---------------------------------------------------------------------------//
+// Creates p_Path and starts the writer thread with p_BufferCount frames of
+// p_ParticleCount positions. p_ErrorBound is that of NBodyCodecQuant. False
+// when the file can't be created.
+bool nbodyTrajectoryOpen(
+    NBodyTrajectory* p_Trajectory,
+    const char* p_Path,
+    uint32_t p_ParticleCount,
+    uint32_t p_Interval,
+    uint32_t p_BufferCount,
+    NBodyFrameCodec p_Codec,
+    float p_ErrorBound);
+//---------------------------------------------------------------------------//
+// Called after every step, captures the steps that are a multiple of
+// m_Interval. Never blocks on the writer.
+void nbodyTrajectoryCapture(NBodyTrajectory* p_Trajectory, NBodyCpuCtx* p_Ctx);
+//---------------------------------------------------------------------------//
+// Current counters, safe to call while the writer runs.
+NBodyTrajectoryStats nbodyTrajectoryStats(const NBodyTrajectory* p_Trajectory);
+//---------------------------------------------------------------------------//
+// Writes the queued frames, stops the writer and closes the file. False if
+// any write failed, p_Stats (optional) receives the final counters.
+bool nbodyTrajectoryClose(
+    NBodyTrajectory* p_Trajectory, NBodyTrajectoryStats* p_Stats);
+//---------------------------------------------------------------------------//
+
+//---------------------------------------------------------------------------//
+// Sequential reader, decodes one frame at a time in place.
+//---------------------------------------------------------------------------//
+struct NBodyTrajectoryReader {
+  NBodyTrajectoryHeader m_Header;
+  uint64_t m_Step;        // Of the last frame read
+  float* m_Positions[3];  // x, y, z in id order
+  FILE* m_File;
+  uint8_t* m_Payload;
+  uint64_t m_PayloadCapacity;
+  uint8_t* m_Planes;      // m_ParticleCount * 12 bytes
+  NBodyQuantCoder* m_Quant; // Files of NBodyCodecQuant
+  void* m_Memory;
+};
+
+//---------------------------------------------------------------------------//
+bool nbodyTrajectoryReaderOpen(
+    NBodyTrajectoryReader* p_Reader, const char* p_Path);
+//---------------------------------------------------------------------------//
+// Reads the next frame into m_Positions, false at the end of the file or on
+// a truncated or invalid frame.
+bool nbodyTrajectoryReadFrame(NBodyTrajectoryReader* p_Reader);
+//---------------------------------------------------------------------------//
+void nbodyTrajectoryReaderClose(NBodyTrajectoryReader* p_Reader);
+//---------------------------------------------------------------------------//
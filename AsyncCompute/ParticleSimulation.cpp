@@ -3,88 +3,31 @@
 
 /// <summary>
 /// Triangle vertices are generated by geometry shader.
-/// Two buffers full of particle data are used, and
-/// compute thread alternates writing to each of them.
-/// Render thread uses the other buffer
+/// A ring of --buffers buffers full of particle data is used, and
+/// compute thread writes to each of them in turn.
+/// Render thread uses the newest finished one
 /// (which is not currently used by the compute shader)
+/// The threads and queues only synchronize through timelines
+/// (NBodyTimeline.hpp).
 /// </summary>
 
-// From MSDN docs:
-// https://docs.microsoft.com/en-us/windows/win32/api/winnt/nf-winnt-interlockedcompareexchange
-//
-// The interlocked functions provide a simple mechanism for synchronizing access
-// to a variable that is shared by multiple threads.
-//
-//  LONG InterlockedCompareExchange(
-//    [in, out] LONG volatile *Destination,
-//    [in]      LONG          ExChange,
-//    [in]      LONG          Comperand
-//  );
-//
-// This function generates a full memory barrier (or fence) to ensure that
-// memory operations are completed in order.
-//
-// The first param, "Destination", is an input as well as an output.
-// We give the input value, "Destination", and it gets compared to the third
-// param, "Comperand" (here we use 0).
-// Then if the "Destination" and "Comperand" values are equal,
-// the "ExChange" value (again we use 0) gets stored in "Destination",
-// Otherwise, nothing happens i.e., the "Destination" value won't change
-//
-//
-// To rephrase it, InterlockedCompareExchange atomically compares
-// the object's value with the "Comperand" value, and
-// if comparison fails nothing happens (NOOP) and object's value remains
-// unchanged and gets returned.
-// Because we are using a value of 0 for "Comperand" and
-// "ExChange", if the object's value is already 0, it'd seem like object's value
-// (i.e., 0) will be returned again (like NOOP). But in fact, the "ExChange"
-// value is stored at object's address location.
-//
-// Either way the end result is the same and object's value is returned
-// But it is an atomic operation so we can safely get the object's value
-// which is used by multiple threads
-//
-// N.B. The InterlockedCompareExchange return value is always the initial
-// value of the "Destination" parameter.
-//
-
-#define InterlockedGetValue(object) InterlockedCompareExchange(object, 0, 0)
-
-// As mentioned above, we're using "InterlockedCompareExchange" as our atomic
-// "getter" of an input object'value.
-// Reminder: working with 0 as the "ExChange" and "Comperand" there seem to be
-// NOOP so just fetching the value.
-// Our corresponding atomic "setter" would be InterlockedExchange:
-//
-//  LONG InterlockedExchange(
-//    [in, out] LONG volatile *Target,
-//    [in]      LONG          Value
-//  );
-//
-// The "Target" parameter is an input as well as an output and will be set to
-// the "Value" parameter in an atomic manner. In other words "Value" param is
-// just like the "ExChange" param and "Target" is similar to "Destination"
-// parameters used for getter function.
-//
-// N.B. Once again, regardless of the internal atomic operations, the
-// InterlockedExchange" return value is always the initial value of the
-// "Target" parameter.
-//
-// This function also generates a full memory barrier (or fence) to ensure that
-// memory operations are completed in order.
-
-#define InterlockedSetValue(object, value) InterlockedExchange(object, value)
-
-// Another related atomic function is "InterlockedIncrement"
-// which simply increments a variable,
-// and besides returns the resulting incremented value.
-
-//#define InterlockedIncrement(addend) InterlockedIncrement(addend)
-
 //---------------------------------------------------------------------------//
 /// Local functions:
 //---------------------------------------------------------------------------//
+static void _setAdapterName(IDXGIAdapter* p_Adapter) {
+  DXGI_ADAPTER_DESC desc;
+  D3D_EXEC_CHECKED(p_Adapter->GetDesc(&desc));
+  WideCharToMultiByte(
+      CP_UTF8,
+      0,
+      desc.Description,
+      -1,
+      g_Ctx->m_AdapterName,
+      sizeof(g_Ctx->m_AdapterName),
+      nullptr,
+      nullptr);
+}
+//---------------------------------------------------------------------------//
 static void _loadPipeline() {
   UINT dxgiFactoryFlags = 0;
 
@@ -110,6 +53,7 @@ static void _loadPipeline() {
   if (g_DemoInfo->m_UseWarpDevice) {
     IDXGIAdapterPtr warpAdapter;
     D3D_EXEC_CHECKED(factory->EnumWarpAdapter(IID_PPV_ARGS(&warpAdapter)));
+    _setAdapterName(warpAdapter.GetInterfacePtr());
 
     D3D_EXEC_CHECKED(D3D12CreateDevice(
         warpAdapter.GetInterfacePtr(),
@@ -118,6 +62,7 @@ static void _loadPipeline() {
   } else {
     IDXGIAdapter1Ptr hardwareAdapter;
     getHardwareAdapter(factory.GetInterfacePtr(), &hardwareAdapter, true);
+    _setAdapterName(hardwareAdapter.GetInterfacePtr());
 
     D3D_EXEC_CHECKED(D3D12CreateDevice(
         hardwareAdapter.GetInterfacePtr(),
@@ -213,40 +158,39 @@ static void _loadPipeline() {
   }
 }
 //---------------------------------------------------------------------------//
+// The timelines only say whether a call failed, the device says why.
+static void _checkTimeline(bool p_Succeeded) {
+  if (!p_Succeeded) {
+    const HRESULT reason = g_Ctx->m_Dev->GetDeviceRemovedReason();
+    D3D_EXEC_CHECKED(FAILED(reason) ? reason : E_FAIL);
+  }
+}
+//---------------------------------------------------------------------------//
 static void _waitForRenderContext() {
-  // Add a signal command to the queue.
-  D3D_EXEC_CHECKED(g_Ctx->m_CmdQue->Signal(
-      g_Ctx->m_RenderContextFence.GetInterfacePtr(),
-      g_Ctx->m_RenderContextFenceValue));
-
-  // Instruct the fence to set the event obj when the signal command completes.
-  D3D_EXEC_CHECKED(g_Ctx->m_RenderContextFence->SetEventOnCompletion(
-      g_Ctx->m_RenderContextFenceValue, g_Ctx->m_RenderContextFenceEvent));
-  g_Ctx->m_RenderContextFenceValue++;
-
-  // Wait until the signal command has been processed.
-  WaitForSingleObject(g_Ctx->m_RenderContextFenceEvent, INFINITE);
+  // Signal the next value on the queue and wait until it is processed.
+  const UINT64 value = g_Ctx->m_RenderTimelineValue++;
+  _checkTimeline(nbodyTimelineSignalQueue(
+      g_Ctx->m_RenderTimeline, g_Ctx->m_CmdQue.GetInterfacePtr(), value));
+  _checkTimeline(nbodyTimelineWait(
+      g_Ctx->m_RenderTimeline, value, NBodyTimelineInfinite));
 }
 //---------------------------------------------------------------------------//
-static void _simulate(UINT p_ThreadIndex) {
+// Records step p_Step (from 1) of a thread: the buffer of step p_Step - 1 is
+// the SRV, the one of step p_Step the UAV.
+static void _simulate(UINT p_ThreadIndex, UINT64 p_Step) {
   ID3D12GraphicsCommandList* cmdList =
       g_Ctx->m_CompCmdLists[p_ThreadIndex].GetInterfacePtr();
-
-  UINT srvIndex;
-  UINT uavIndex;
-  ID3D12Resource* pUavResource;
-  // First check to see if SrvIndex of the thread is 0,
-  // if so, use first resource as SRV and second one as UAV
-  // otherwise second tex would be UAV and first one is SRV
-  if (g_Ctx->m_SrvIndex[p_ThreadIndex] == 0) {
-    srvIndex = ParticleSimCtx::SrvParticlePosVel0;
-    uavIndex = ParticleSimCtx::UavParticlePosVel1;
-    pUavResource = g_Ctx->m_ParticleBuffer1[p_ThreadIndex].GetInterfacePtr();
-  } else {
-    srvIndex = ParticleSimCtx::SrvParticlePosVel1;
-    uavIndex = ParticleSimCtx::UavParticlePosVel0;
-    pUavResource = g_Ctx->m_ParticleBuffer0[p_ThreadIndex].GetInterfacePtr();
-  }
+  const NBodyStateRing* ring = &g_Ctx->m_StateRings[p_ThreadIndex];
+
+  const UINT srvIndex = ParticleSimCtx::particleDescriptor(
+      ParticleSimCtx::SrvParticlePosVel,
+      p_ThreadIndex,
+      nbodyRingSlot(ring, p_Step - 1));
+  const UINT uavSlot = nbodyRingSlot(ring, p_Step);
+  const UINT uavIndex = ParticleSimCtx::particleDescriptor(
+      ParticleSimCtx::UavParticlePosVel, p_ThreadIndex, uavSlot);
+  ID3D12Resource* pUavResource =
+      g_Ctx->m_ParticleBuffers[p_ThreadIndex][uavSlot].GetInterfacePtr();
 
   cmdList->ResourceBarrier(
       1,
@@ -263,11 +207,11 @@ static void _simulate(UINT p_ThreadIndex) {
 
   CD3DX12_GPU_DESCRIPTOR_HANDLE srvHandle(
       g_Ctx->m_SrvUavHeap->GetGPUDescriptorHandleForHeapStart(),
-      srvIndex + p_ThreadIndex,
+      srvIndex,
       g_Ctx->m_SrvUavDescriptorSize);
   CD3DX12_GPU_DESCRIPTOR_HANDLE uavHandle(
       g_Ctx->m_SrvUavHeap->GetGPUDescriptorHandleForHeapStart(),
-      uavIndex + p_ThreadIndex,
+      uavIndex,
       g_Ctx->m_SrvUavDescriptorSize);
 
   cmdList->SetComputeRootConstantBufferView(
@@ -278,8 +222,7 @@ static void _simulate(UINT p_ThreadIndex) {
   cmdList->SetComputeRootDescriptorTable(
       ParticleSimCtx::ComputeRootUAVTable, uavHandle);
 
-  cmdList->Dispatch(
-      static_cast<int>(ceil(g_Ctx->m_ParticleCount / 128.0f)), 1, 1);
+  cmdList->Dispatch(g_Ctx->m_PaddedParticleCount / g_Ctx->m_TileSize, 1, 1);
 
   cmdList->ResourceBarrier(
       1,
@@ -289,6 +232,81 @@ static void _simulate(UINT p_ThreadIndex) {
           D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
 }
 //---------------------------------------------------------------------------//
+// Every m_ReorderInterval steps, after _simulate recorded step p_Step: runs
+// it with a copy to the readback buffer, sorts the particles into Morton
+// order on the host (m_ParticleIds along) and records their upload back into
+// the buffer of the step. The step is published only after that upload, so
+// the renderer never sees the buffer half sorted. The padding stays last.
+static void _reorderStep(UINT p_ThreadIndex, UINT64 p_Step) {
+  ID3D12CommandQueue* commandQueue =
+      g_Ctx->m_CompCmdQues[p_ThreadIndex].GetInterfacePtr();
+  ID3D12CommandAllocator* commandAllocator =
+      g_Ctx->m_CompAllocs[p_ThreadIndex].GetInterfacePtr();
+  ID3D12GraphicsCommandList* cmdList =
+      g_Ctx->m_CompCmdLists[p_ThreadIndex].GetInterfacePtr();
+  const UINT slot = nbodyRingSlot(&g_Ctx->m_StateRings[p_ThreadIndex], p_Step);
+  ID3D12Resource* pBuffer =
+      g_Ctx->m_ParticleBuffers[p_ThreadIndex][slot].GetInterfacePtr();
+  ID3D12Resource* pReadback =
+      g_Ctx->m_ParticleBufferReadback[p_ThreadIndex].GetInterfacePtr();
+  ID3D12Resource* pUpload =
+      g_Ctx->m_ParticleBufferUpload[p_ThreadIndex].GetInterfacePtr();
+  const UINT dataSize =
+      g_Ctx->m_ParticleCount * sizeof(ParticleSimCtx::ParticleMotion);
+
+  cmdList->ResourceBarrier(
+      1,
+      &CD3DX12_RESOURCE_BARRIER::Transition(
+          pBuffer,
+          D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
+          D3D12_RESOURCE_STATE_COPY_SOURCE));
+  cmdList->CopyBufferRegion(pReadback, 0, pBuffer, 0, dataSize);
+  cmdList->ResourceBarrier(
+      1,
+      &CD3DX12_RESOURCE_BARRIER::Transition(
+          pBuffer,
+          D3D12_RESOURCE_STATE_COPY_SOURCE,
+          D3D12_RESOURCE_STATE_COPY_DEST));
+  D3D_EXEC_CHECKED(cmdList->Close());
+  ID3D12CommandList* ppCommandLists[] = {cmdList};
+  commandQueue->ExecuteCommandLists(1, ppCommandLists);
+
+  NBodyTimeline* reorders = g_Ctx->m_ReorderTimelines[p_ThreadIndex];
+  const UINT64 reorder = p_Step / g_Ctx->m_ReorderInterval;
+  _checkTimeline(nbodyTimelineSignalQueue(reorders, commandQueue, reorder));
+  _checkTimeline(nbodyTimelineWait(reorders, reorder, NBodyTimelineInfinite));
+  D3D_EXEC_CHECKED(commandAllocator->Reset());
+  D3D_EXEC_CHECKED(
+      cmdList->Reset(commandAllocator, g_Ctx->m_CompPso.GetInterfacePtr()));
+
+  // Sorted in the readback memory (cached), then written to the upload
+  // buffer (write-combined) in one pass.
+  NBodyParticle* particles = nullptr;
+  CD3DX12_RANGE readRange(0, dataSize);
+  D3D_EXEC_CHECKED(
+      pReadback->Map(0, &readRange, reinterpret_cast<void**>(&particles)));
+  nbodySortParticles(
+      particles,
+      g_Ctx->m_ParticleIds[p_ThreadIndex].data(),
+      g_Ctx->m_ParticleCount,
+      nullptr);
+  void* upload = nullptr;
+  CD3DX12_RANGE noRead(0, 0);
+  D3D_EXEC_CHECKED(pUpload->Map(0, &noRead, &upload));
+  memcpy(upload, particles, dataSize);
+  pUpload->Unmap(0, nullptr);
+  CD3DX12_RANGE noWrite(0, 0);
+  pReadback->Unmap(0, &noWrite);
+
+  cmdList->CopyBufferRegion(pBuffer, 0, pUpload, 0, dataSize);
+  cmdList->ResourceBarrier(
+      1,
+      &CD3DX12_RESOURCE_BARRIER::Transition(
+          pBuffer,
+          D3D12_RESOURCE_STATE_COPY_DEST,
+          D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
+}
+//---------------------------------------------------------------------------//
 DWORD
 _asyncComputeThreadProc(ParticleSimCtx* p_Context, int p_ThreadIndex) {
   ID3D12CommandQueue* commandQueue =
@@ -297,12 +315,31 @@ _asyncComputeThreadProc(ParticleSimCtx* p_Context, int p_ThreadIndex) {
       p_Context->m_CompAllocs[p_ThreadIndex].GetInterfacePtr();
   ID3D12GraphicsCommandList* commandList =
       p_Context->m_CompCmdLists[p_ThreadIndex].GetInterfacePtr();
-  ID3D12Fence* fence =
-      p_Context->m_ThreadFences[p_ThreadIndex].GetInterfacePtr();
+  NBodyTimeline* steps = p_Context->m_ComputeTimelines[p_ThreadIndex];
+  const NBodyStateRing* ring = &p_Context->m_StateRings[p_ThreadIndex];
+
+  UINT step = 0;
+  while (!p_Context->m_Terminating.load()) {
+    // With --steps the particles freeze after the last step.
+    if (p_Context->m_StepCount != 0 && step == p_Context->m_StepCount)
+      break;
+    step++;
+
+    // The UAV of this step was last drawn K - 1 steps ago, by the frame the
+    // ring keeps for it: the queue waits for the render timeline to get
+    // there, not this thread. With more buffers the older frames are more
+    // likely done, the simulation stalls only on a renderer K - 1 steps
+    // behind.
+    _checkTimeline(nbodyTimelineWaitQueue(
+        p_Context->m_RenderTimeline,
+        commandQueue,
+        nbodyRingWriteFrame(ring, step)));
 
-  while (0 == InterlockedGetValue(&p_Context->m_Terminating)) {
     // Run the particle simulation.
-    _simulate(p_ThreadIndex);
+    _simulate(p_ThreadIndex, step);
+    if (p_Context->m_ReorderInterval != 0 &&
+        step % p_Context->m_ReorderInterval == 0)
+      _reorderStep(p_ThreadIndex, step);
 
     // Close and execute the command list.
     D3D_EXEC_CHECKED(commandList->Close());
@@ -316,31 +353,10 @@ _asyncComputeThreadProc(ParticleSimCtx* p_Context, int p_ThreadIndex) {
     commandQueue->ExecuteCommandLists(1, ppCommandLists);
     PIXEndEvent(commandQueue);
 
-    // Wait for the compute shader to complete the simulation.
-    UINT64 threadFenceValue =
-        InterlockedIncrement(&p_Context->m_ThreadFenceValues[p_ThreadIndex]);
-    D3D_EXEC_CHECKED(commandQueue->Signal(fence, threadFenceValue));
-    D3D_EXEC_CHECKED(fence->SetEventOnCompletion(
-        threadFenceValue, p_Context->m_ThreadFenceEvents[p_ThreadIndex]));
-    WaitForSingleObject(
-        p_Context->m_ThreadFenceEvents[p_ThreadIndex], INFINITE);
-
-    // Wait for the render thread to be done with the SRV so that
-    // the next frame in the simulation can run.
-    UINT64 renderContextFenceValue = InterlockedGetValue(
-        &p_Context->m_RenderContextFenceValues[p_ThreadIndex]);
-    if (p_Context->m_RenderContextFence->GetCompletedValue() <
-        renderContextFenceValue) {
-      D3D_EXEC_CHECKED(commandQueue->Wait(
-          p_Context->m_RenderContextFence.GetInterfacePtr(),
-          renderContextFenceValue));
-      InterlockedSetValue(
-          &p_Context->m_RenderContextFenceValues[p_ThreadIndex], 0);
-    }
-
-    // Swap the indices to the SRV and UAV.
-    p_Context->m_SrvIndex[p_ThreadIndex] =
-        1 - p_Context->m_SrvIndex[p_ThreadIndex];
+    // Publish the step, then wait for the compute shader to complete it
+    // before the allocator is reused.
+    _checkTimeline(nbodyTimelineSignalQueue(steps, commandQueue, step));
+    _checkTimeline(nbodyTimelineWait(steps, step, NBodyTimelineInfinite));
 
     // Prepare for the next frame.
     D3D_EXEC_CHECKED(commandAllocator->Reset());
@@ -355,36 +371,6 @@ static DWORD WINAPI _threadProc(ParticleSimCtx::ThreadData* p_Data) {
   return _asyncComputeThreadProc(p_Data->m_Context, p_Data->m_ThreadIndex);
 }
 //---------------------------------------------------------------------------//
-static float _randomPercent() {
-  float ret = static_cast<float>((rand() % 10000) - 5000);
-  return ret / 5000.0f;
-}
-//---------------------------------------------------------------------------//
-static void _loadParticles(
-    _Out_writes_(p_ParticleCount) ParticleSimCtx::ParticleMotion* p_Particles,
-    const XMFLOAT3& p_Center,
-    const XMFLOAT4& p_Velocity,
-    float p_Spread,
-    UINT p_ParticleCount) {
-  srand(0);
-  for (UINT i = 0; i < p_ParticleCount; i++) {
-    XMFLOAT3 delta(p_Spread, p_Spread, p_Spread);
-
-    while (XMVectorGetX(XMVector3LengthSq(XMLoadFloat3(&delta))) >
-           p_Spread * p_Spread) {
-      delta.x = _randomPercent() * p_Spread;
-      delta.y = _randomPercent() * p_Spread;
-      delta.z = _randomPercent() * p_Spread;
-    }
-
-    p_Particles[i].m_Position.x = p_Center.x + delta.x;
-    p_Particles[i].m_Position.y = p_Center.y + delta.y;
-    p_Particles[i].m_Position.z = p_Center.z + delta.z;
-    p_Particles[i].m_Position.w = 10000.0f * 10000.0f;
-
-    p_Particles[i].m_Velocity = p_Velocity;
-  }
-}
 //---------------------------------------------------------------------------//
 static void _createVertexBuffer() {
   using Vertex = ParticleSimCtx::ParticleVertex;
@@ -441,29 +427,50 @@ static void _createVertexBuffer() {
   g_Ctx->m_VtxBufferView.StrideInBytes = sizeof(Vertex);
 }
 //---------------------------------------------------------------------------//
+// The --model initial conditions, two clusters by default (shared with the
+// CPU engine so both backends start from the same particles), and the ids of
+// their slots.
+static void _generateParticles(NBodyParticle* p_Particles, UINT* p_Ids) {
+  NBodyModelParams model = {};
+  model.m_Model = static_cast<NBodyModel>(g_Ctx->m_Model);
+  model.m_ParticleCount = g_Ctx->m_ParticleCount;
+  model.m_Scale = g_Ctx->m_ParticleSpread;
+  model.m_Seed = g_Ctx->m_Seed;
+  nbodyGenerateModel(&model, 0, g_Ctx->m_ParticleCount, p_Particles, nullptr);
+  for (UINT i = 0; i < g_Ctx->m_ParticleCount; i++) {
+    p_Ids[i] = i;
+  }
+
+  // Generation order is spatially random, Morton order makes the tiles of
+  // CSMain and the vertices of a draw coherent in space (and _reorderStep
+  // keeps it so). The vertex colors are all the same (see
+  // _createVertexBuffer) so they need no permutation.
+  nbodySortParticles(p_Particles, p_Ids, g_Ctx->m_ParticleCount, nullptr);
+}
+//---------------------------------------------------------------------------//
 static void _createParticleBuffers() {
   using Data = ParticleSimCtx::ParticleMotion;
 
-  // Initialize the data in the buffers.
-  Data* data = (Data*)::calloc(g_Ctx->m_ParticleCount, sizeof(Data));
-  DEFER(free_data_mem) { ::free(data); };
-
-  const UINT dataSize = g_Ctx->m_ParticleCount * sizeof(Data);
-
-  // Split the particles into two groups.
-  float centerSpread = g_Ctx->m_ParticleSpread * 0.50f;
-  _loadParticles(
-      &data[0],
-      XMFLOAT3(centerSpread, 0, 0),
-      XMFLOAT4(0, 0, -20, 1 / 100000000.0f),
-      g_Ctx->m_ParticleSpread,
-      g_Ctx->m_ParticleCount / 2);
-  _loadParticles(
-      &data[g_Ctx->m_ParticleCount / 2],
-      XMFLOAT3(-centerSpread, 0, 0),
-      XMFLOAT4(0, 0, 20, 1 / 100000000.0f),
-      g_Ctx->m_ParticleSpread,
-      g_Ctx->m_ParticleCount / 2);
+  const UINT dataSize = g_Ctx->m_PaddedParticleCount * sizeof(Data);
+
+  // A --load snapshot is copied straight from its mapping into the upload
+  // buffers, it is already in the Morton order of the CPU engine's last
+  // reorder. Generated particles are sorted in memory first.
+  std::vector<UINT> ids(g_Ctx->m_ParticleCount);
+  std::vector<NBodyParticle> generated;
+  NBodyColumns source = {};
+  if (g_Ctx->m_Snapshot.m_View != nullptr) {
+    source = nbodySnapshotColumns(&g_Ctx->m_Snapshot);
+    std::copy(
+        g_Ctx->m_Snapshot.m_Ids,
+        g_Ctx->m_Snapshot.m_Ids + g_Ctx->m_ParticleCount,
+        ids.begin());
+  } else {
+    generated.resize(g_Ctx->m_ParticleCount);
+    _generateParticles(generated.data(), ids.data());
+    source = nbodyAosColumns(generated.data());
+  }
+  DEFER(close_snapshot) { nbodySnapshotClose(&g_Ctx->m_Snapshot); };
 
   D3D12_HEAP_PROPERTIES defaultHeapProperties =
       CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
@@ -474,135 +481,194 @@ static void _createParticleBuffers() {
   D3D12_RESOURCE_DESC uploadBufferDesc =
       CD3DX12_RESOURCE_DESC::Buffer(dataSize);
 
-  for (UINT index = 0; index < THREAD_COUNT; index++) {
-    // Create two buffers in the GPU, each with a copy of the particles data.
-    // The compute shader will update one of them while the rendering thread
-    // renders the other. When rendering completes, the threads will swap
-    // which buffer they work on.
-
-    D3D_EXEC_CHECKED(g_Ctx->m_Dev->CreateCommittedResource(
-        &defaultHeapProperties,
-        D3D12_HEAP_FLAG_NONE,
-        &bufferDesc,
-        D3D12_RESOURCE_STATE_COPY_DEST,
-        nullptr,
-        IID_PPV_ARGS(&g_Ctx->m_ParticleBuffer0[index])));
-
-    D3D_EXEC_CHECKED(g_Ctx->m_Dev->CreateCommittedResource(
-        &defaultHeapProperties,
-        D3D12_HEAP_FLAG_NONE,
-        &bufferDesc,
-        D3D12_RESOURCE_STATE_COPY_DEST,
-        nullptr,
-        IID_PPV_ARGS(&g_Ctx->m_ParticleBuffer1[index])));
+  D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+  srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+  srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+  srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+  srvDesc.Buffer.FirstElement = 0;
+  srvDesc.Buffer.NumElements = g_Ctx->m_PaddedParticleCount;
+  srvDesc.Buffer.StructureByteStride = sizeof(Data);
+  srvDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
+
+  D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+  uavDesc.Format = DXGI_FORMAT_UNKNOWN;
+  uavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+  uavDesc.Buffer.FirstElement = 0;
+  uavDesc.Buffer.NumElements = g_Ctx->m_PaddedParticleCount;
+  uavDesc.Buffer.StructureByteStride = sizeof(Data);
+  uavDesc.Buffer.CounterOffsetInBytes = 0;
+  uavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
 
+  for (UINT index = 0; index < THREAD_COUNT; index++) {
+    // Create the ring of buffers in the GPU, each with a copy of the
+    // particles data. The compute shader updates one of them while the
+    // rendering thread renders an older one (see NBodyStateRing).
     D3D_EXEC_CHECKED(g_Ctx->m_Dev->CreateCommittedResource(
         &uploadHeapProperties,
         D3D12_HEAP_FLAG_NONE,
         &uploadBufferDesc,
         D3D12_RESOURCE_STATE_GENERIC_READ,
         nullptr,
-        IID_PPV_ARGS(&g_Ctx->m_ParticleBuffer0Upload[index])));
-
+        IID_PPV_ARGS(&g_Ctx->m_ParticleBufferUpload[index])));
+    ID3D12Resource* pUpload =
+        g_Ctx->m_ParticleBufferUpload[index].GetInterfacePtr();
+    // Written in one pass, the padding up to a whole tile is zeroed (no mass)
+    // so CSMain needs no bound checks.
+    void* upload = nullptr;
+    CD3DX12_RANGE noRead(0, 0);
+    D3D_EXEC_CHECKED(pUpload->Map(0, &noRead, &upload));
+    Data* data = static_cast<Data*>(upload);
+    nbodyCopyColumns(
+        nbodyAosColumns(reinterpret_cast<NBodyParticle*>(data)),
+        source,
+        0,
+        g_Ctx->m_ParticleCount);
+    memset(
+        data + g_Ctx->m_ParticleCount,
+        0,
+        (g_Ctx->m_PaddedParticleCount - g_Ctx->m_ParticleCount) *
+            sizeof(Data));
+    pUpload->Unmap(0, nullptr);
+    // The upload buffer is reused by _reorderStep, with this one.
     D3D_EXEC_CHECKED(g_Ctx->m_Dev->CreateCommittedResource(
-        &uploadHeapProperties,
+        &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK),
         D3D12_HEAP_FLAG_NONE,
         &uploadBufferDesc,
-        D3D12_RESOURCE_STATE_GENERIC_READ,
+        D3D12_RESOURCE_STATE_COPY_DEST,
         nullptr,
-        IID_PPV_ARGS(&g_Ctx->m_ParticleBuffer1Upload[index])));
+        IID_PPV_ARGS(&g_Ctx->m_ParticleBufferReadback[index])));
+    g_Ctx->m_ParticleIds[index] = ids;
+
+    for (UINT slot = 0; slot < g_Ctx->m_StateBufferCount; slot++) {
+      D3D_EXEC_CHECKED(g_Ctx->m_Dev->CreateCommittedResource(
+          &defaultHeapProperties,
+          D3D12_HEAP_FLAG_NONE,
+          &bufferDesc,
+          D3D12_RESOURCE_STATE_COPY_DEST,
+          nullptr,
+          IID_PPV_ARGS(&g_Ctx->m_ParticleBuffers[index][slot])));
+      D3D_NAME_OBJECT_INDEXED(g_Ctx->m_ParticleBuffers[index], slot);
+      ID3D12Resource* pBuffer =
+          g_Ctx->m_ParticleBuffers[index][slot].GetInterfacePtr();
 
-    D3D_NAME_OBJECT_INDEXED(g_Ctx->m_ParticleBuffer0, index);
-    D3D_NAME_OBJECT_INDEXED(g_Ctx->m_ParticleBuffer1, index);
+      g_Ctx->m_CmdList->CopyBufferRegion(pBuffer, 0, pUpload, 0, dataSize);
+      g_Ctx->m_CmdList->ResourceBarrier(
+          1,
+          &CD3DX12_RESOURCE_BARRIER::Transition(
+              pBuffer,
+              D3D12_RESOURCE_STATE_COPY_DEST,
+              D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
+
+      CD3DX12_CPU_DESCRIPTOR_HANDLE srvHandle(
+          g_Ctx->m_SrvUavHeap->GetCPUDescriptorHandleForHeapStart(),
+          ParticleSimCtx::particleDescriptor(
+              ParticleSimCtx::SrvParticlePosVel, index, slot),
+          g_Ctx->m_SrvUavDescriptorSize);
+      g_Ctx->m_Dev->CreateShaderResourceView(pBuffer, &srvDesc, srvHandle);
+
+      CD3DX12_CPU_DESCRIPTOR_HANDLE uavHandle(
+          g_Ctx->m_SrvUavHeap->GetCPUDescriptorHandleForHeapStart(),
+          ParticleSimCtx::particleDescriptor(
+              ParticleSimCtx::UavParticlePosVel, index, slot),
+          g_Ctx->m_SrvUavDescriptorSize);
+      g_Ctx->m_Dev->CreateUnorderedAccessView(
+          pBuffer, nullptr, &uavDesc, uavHandle);
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// CSMain compiled with the blocksize and unrollcount of p_Config and the
+// precision of the command line, false when it doesn't compile (e.g. a group
+// too large for the device's shader model).
+static bool _createComputePso(
+    NBodyDispatchConfig p_Config, ID3D12PipelineStatePtr* p_Pso) {
+#if defined(_DEBUG)
+  UINT compileFlags = D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
+#else
+  UINT compileFlags = 0;
+#endif
 
-    D3D12_SUBRESOURCE_DATA particleData = {};
-    particleData.pData = reinterpret_cast<UINT8*>(&data[0]);
-    particleData.RowPitch = dataSize;
-    particleData.SlicePitch = particleData.RowPitch;
+  const std::string blockSize = std::to_string(p_Config.m_BlockSize);
+  const std::string unroll = std::to_string(p_Config.m_Unroll);
+  const std::string accumMode = std::to_string(g_Ctx->m_AccumMode);
+  const std::string posFormat = std::to_string(g_Ctx->m_PosFormat);
+  const D3D_SHADER_MACRO defines[] = {
+      {"blocksize", blockSize.c_str()},
+      {"unrollcount", unroll.c_str()},
+      {"accummode", accumMode.c_str()},
+      {"posformat", posFormat.c_str()},
+      {nullptr, nullptr}};
+  ID3D12PipelineStatePtr& pso = *p_Pso;
+  ID3DBlobPtr computeShader;
+  if (FAILED(D3DCompileFromFile(
+          demoGetAssetPath(g_DemoInfo, L"NBodyGravityCS.hlsl").c_str(),
+          defines,
+          nullptr,
+          "CSMain",
+          "cs_5_0",
+          compileFlags,
+          0,
+          &computeShader,
+          nullptr)))
+    return false;
+
+  D3D12_COMPUTE_PIPELINE_STATE_DESC computePsoDesc = {};
+  computePsoDesc.pRootSignature = g_Ctx->m_CompRootSig.GetInterfacePtr();
+  computePsoDesc.CS = CD3DX12_SHADER_BYTECODE(computeShader.GetInterfacePtr());
+  return SUCCEEDED(g_Ctx->m_Dev->CreateComputePipelineState(
+      &computePsoDesc, IID_PPV_ARGS(&pso)));
+}
+//---------------------------------------------------------------------------//
+// Creates the compute shader's constant buffer for the current tile size,
+// the upload is recorded in m_CmdList and p_Upload must stay alive until it
+// has executed.
+static void _createCbufferCS(ID3D12ResourcePtr* p_Upload) {
+  ID3D12ResourcePtr& upload = *p_Upload;
+  const UINT bufferSize = sizeof(ParticleSimCtx::CbufferCS);
 
-    UpdateSubresources<1>(
-        g_Ctx->m_CmdList.GetInterfacePtr(),
-        g_Ctx->m_ParticleBuffer0[index].GetInterfacePtr(),
-        g_Ctx->m_ParticleBuffer0Upload[index].GetInterfacePtr(),
-        0,
-        0,
-        1,
-        &particleData);
-    UpdateSubresources<1>(
-        g_Ctx->m_CmdList.GetInterfacePtr(),
-        g_Ctx->m_ParticleBuffer1[index].GetInterfacePtr(),
-        g_Ctx->m_ParticleBuffer1Upload[index].GetInterfacePtr(),
-        0,
-        0,
-        1,
-        &particleData);
-    g_Ctx->m_CmdList->ResourceBarrier(
-        1,
-        &CD3DX12_RESOURCE_BARRIER::Transition(
-            g_Ctx->m_ParticleBuffer0[index].GetInterfacePtr(),
-            D3D12_RESOURCE_STATE_COPY_DEST,
-            D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
-    g_Ctx->m_CmdList->ResourceBarrier(
-        1,
-        &CD3DX12_RESOURCE_BARRIER::Transition(
-            g_Ctx->m_ParticleBuffer1[index].GetInterfacePtr(),
-            D3D12_RESOURCE_STATE_COPY_DEST,
-            D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
-
-    D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-    srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-    srvDesc.Format = DXGI_FORMAT_UNKNOWN;
-    srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
-    srvDesc.Buffer.FirstElement = 0;
-    srvDesc.Buffer.NumElements = g_Ctx->m_ParticleCount;
-    srvDesc.Buffer.StructureByteStride = sizeof(Data);
-    srvDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
-
-    CD3DX12_CPU_DESCRIPTOR_HANDLE srvHandle0(
-        g_Ctx->m_SrvUavHeap->GetCPUDescriptorHandleForHeapStart(),
-        ParticleSimCtx::SrvParticlePosVel0 + index,
-        g_Ctx->m_SrvUavDescriptorSize);
-    CD3DX12_CPU_DESCRIPTOR_HANDLE srvHandle1(
-        g_Ctx->m_SrvUavHeap->GetCPUDescriptorHandleForHeapStart(),
-        ParticleSimCtx::SrvParticlePosVel1 + index,
-        g_Ctx->m_SrvUavDescriptorSize);
-    g_Ctx->m_Dev->CreateShaderResourceView(
-        g_Ctx->m_ParticleBuffer0[index].GetInterfacePtr(),
-        &srvDesc,
-        srvHandle0);
-    g_Ctx->m_Dev->CreateShaderResourceView(
-        g_Ctx->m_ParticleBuffer1[index].GetInterfacePtr(),
-        &srvDesc,
-        srvHandle1);
-
-    D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
-    uavDesc.Format = DXGI_FORMAT_UNKNOWN;
-    uavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
-    uavDesc.Buffer.FirstElement = 0;
-    uavDesc.Buffer.NumElements = g_Ctx->m_ParticleCount;
-    uavDesc.Buffer.StructureByteStride = sizeof(Data);
-    uavDesc.Buffer.CounterOffsetInBytes = 0;
-    uavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
-
-    CD3DX12_CPU_DESCRIPTOR_HANDLE uavHandle0(
-        g_Ctx->m_SrvUavHeap->GetCPUDescriptorHandleForHeapStart(),
-        ParticleSimCtx::UavParticlePosVel0 + index,
-        g_Ctx->m_SrvUavDescriptorSize);
-    CD3DX12_CPU_DESCRIPTOR_HANDLE uavHandle1(
-        g_Ctx->m_SrvUavHeap->GetCPUDescriptorHandleForHeapStart(),
-        ParticleSimCtx::UavParticlePosVel1 + index,
-        g_Ctx->m_SrvUavDescriptorSize);
-    g_Ctx->m_Dev->CreateUnorderedAccessView(
-        g_Ctx->m_ParticleBuffer0[index].GetInterfacePtr(),
-        nullptr,
-        &uavDesc,
-        uavHandle0);
-    g_Ctx->m_Dev->CreateUnorderedAccessView(
-        g_Ctx->m_ParticleBuffer1[index].GetInterfacePtr(),
-        nullptr,
-        &uavDesc,
-        uavHandle1);
-  }
+  D3D_EXEC_CHECKED(g_Ctx->m_Dev->CreateCommittedResource(
+      &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+      D3D12_HEAP_FLAG_NONE,
+      &CD3DX12_RESOURCE_DESC::Buffer(bufferSize),
+      D3D12_RESOURCE_STATE_COPY_DEST,
+      nullptr,
+      IID_PPV_ARGS(&g_Ctx->m_CbufferCS)));
+
+  D3D_EXEC_CHECKED(g_Ctx->m_Dev->CreateCommittedResource(
+      &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+      D3D12_HEAP_FLAG_NONE,
+      &CD3DX12_RESOURCE_DESC::Buffer(bufferSize),
+      D3D12_RESOURCE_STATE_GENERIC_READ,
+      nullptr,
+      IID_PPV_ARGS(&upload)));
+
+  D3D_NAME_OBJECT(g_Ctx->m_CbufferCS);
+
+  ParticleSimCtx::CbufferCS cbufferCS = {};
+  cbufferCS.m_Params[0] = g_Ctx->m_ParticleCount;
+  cbufferCS.m_Params[1] = g_Ctx->m_PaddedParticleCount / g_Ctx->m_TileSize;
+  cbufferCS.m_ParamsFloat[0] = 0.1f;
+  cbufferCS.m_ParamsFloat[1] = 1.0f;
+
+  D3D12_SUBRESOURCE_DATA computeCBData = {};
+  computeCBData.pData = reinterpret_cast<UINT8*>(&cbufferCS);
+  computeCBData.RowPitch = bufferSize;
+  computeCBData.SlicePitch = computeCBData.RowPitch;
+
+  UpdateSubresources<1>(
+      g_Ctx->m_CmdList.GetInterfacePtr(),
+      g_Ctx->m_CbufferCS.GetInterfacePtr(),
+      upload.GetInterfacePtr(),
+      0,
+      0,
+      1,
+      &computeCBData);
+  g_Ctx->m_CmdList->ResourceBarrier(
+      1,
+      &CD3DX12_RESOURCE_BARRIER::Transition(
+          g_Ctx->m_CbufferCS.GetInterfacePtr(),
+          D3D12_RESOURCE_STATE_COPY_DEST,
+          D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER));
 }
 //---------------------------------------------------------------------------//
 static void _loadAssets() {
@@ -712,7 +778,6 @@ static void _loadAssets() {
     ID3DBlobPtr vertexShader;
     ID3DBlobPtr geometryShader;
     ID3DBlobPtr pixelShader;
-    ID3DBlobPtr computeShader;
 
 #if defined(_DEBUG)
     // Enable better shader debugging with the graphics debugging tools.
@@ -752,16 +817,6 @@ static void _loadAssets() {
         0,
         &pixelShader,
         nullptr));
-    D3D_EXEC_CHECKED(D3DCompileFromFile(
-        demoGetAssetPath(g_DemoInfo, L"NBodyGravityCS.hlsl").c_str(),
-        nullptr,
-        nullptr,
-        "CSMain",
-        "cs_5_0",
-        compileFlags,
-        0,
-        &computeShader,
-        nullptr));
 
     D3D12_INPUT_ELEMENT_DESC inputElementDescs[] = {
         {"COLOR",
@@ -806,14 +861,20 @@ static void _loadAssets() {
         &psoDesc, IID_PPV_ARGS(&g_Ctx->m_Pso)));
     D3D_NAME_OBJECT(g_Ctx->m_Pso);
 
-    // Describe and create the compute pipeline state object (PSO).
-    D3D12_COMPUTE_PIPELINE_STATE_DESC computePsoDesc = {};
-    computePsoDesc.pRootSignature = g_Ctx->m_CompRootSig.GetInterfacePtr();
-    computePsoDesc.CS =
-        CD3DX12_SHADER_BYTECODE(computeShader.GetInterfacePtr());
+    // Doubles are optional in shader model 5, --accum double falls back to
+    // the compensated float sum without them.
+    D3D12_FEATURE_DATA_D3D12_OPTIONS options = {};
+    if (g_Ctx->m_AccumMode == NBodyAccumDouble &&
+        (FAILED(g_Ctx->m_Dev->CheckFeatureSupport(
+             D3D12_FEATURE_D3D12_OPTIONS, &options, sizeof(options))) ||
+         !options.DoublePrecisionFloatShaderOps)) {
+      OutputDebugStringA("CSMain: no double precision, using --accum kahan\n");
+      g_Ctx->m_AccumMode = NBodyAccumKahan;
+    }
 
-    D3D_EXEC_CHECKED(g_Ctx->m_Dev->CreateComputePipelineState(
-        &computePsoDesc, IID_PPV_ARGS(&g_Ctx->m_CompPso)));
+    // CSMain is compiled for the tile size and unroll of the command line.
+    DEBUG_BREAK(_createComputePso(
+        {g_Ctx->m_TileSize, g_Ctx->m_Unroll}, &g_Ctx->m_CompPso));
     D3D_NAME_OBJECT(g_Ctx->m_CompPso);
   }
 
@@ -834,55 +895,7 @@ static void _loadAssets() {
   // GPU. We will flush the GPU at the end of this method to ensure the resource
   // is not prematurely destroyed.
   ID3D12ResourcePtr cbufferCSUpload;
-
-  // Create the compute shader's constant buffer.
-  {
-    const UINT bufferSize = sizeof(ParticleSimCtx::CbufferCS);
-
-    D3D_EXEC_CHECKED(g_Ctx->m_Dev->CreateCommittedResource(
-        &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
-        D3D12_HEAP_FLAG_NONE,
-        &CD3DX12_RESOURCE_DESC::Buffer(bufferSize),
-        D3D12_RESOURCE_STATE_COPY_DEST,
-        nullptr,
-        IID_PPV_ARGS(&g_Ctx->m_CbufferCS)));
-
-    D3D_EXEC_CHECKED(g_Ctx->m_Dev->CreateCommittedResource(
-        &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
-        D3D12_HEAP_FLAG_NONE,
-        &CD3DX12_RESOURCE_DESC::Buffer(bufferSize),
-        D3D12_RESOURCE_STATE_GENERIC_READ,
-        nullptr,
-        IID_PPV_ARGS(&cbufferCSUpload)));
-
-    D3D_NAME_OBJECT(g_Ctx->m_CbufferCS);
-
-    ParticleSimCtx::CbufferCS cbufferCS = {};
-    cbufferCS.m_Params[0] = g_Ctx->m_ParticleCount;
-    cbufferCS.m_Params[1] = int(ceil(g_Ctx->m_ParticleCount / 128.0f));
-    cbufferCS.m_ParamsFloat[0] = 0.1f;
-    cbufferCS.m_ParamsFloat[1] = 1.0f;
-
-    D3D12_SUBRESOURCE_DATA computeCBData = {};
-    computeCBData.pData = reinterpret_cast<UINT8*>(&cbufferCS);
-    computeCBData.RowPitch = bufferSize;
-    computeCBData.SlicePitch = computeCBData.RowPitch;
-
-    UpdateSubresources<1>(
-        g_Ctx->m_CmdList.GetInterfacePtr(),
-        g_Ctx->m_CbufferCS.GetInterfacePtr(),
-        cbufferCSUpload.GetInterfacePtr(),
-        0,
-        0,
-        1,
-        &computeCBData);
-    g_Ctx->m_CmdList->ResourceBarrier(
-        1,
-        &CD3DX12_RESOURCE_BARRIER::Transition(
-            g_Ctx->m_CbufferCS.GetInterfacePtr(),
-            D3D12_RESOURCE_STATE_COPY_DEST,
-            D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER));
-  }
+  _createCbufferCS(&cbufferCSUpload);
 
   // Create the geometry shader's constant buffer.
   {
@@ -914,54 +927,236 @@ static void _loadAssets() {
   // Create synchronization objects and wait until assets have been uploaded to
   // the GPU.
   {
-    D3D_EXEC_CHECKED(g_Ctx->m_Dev->CreateFence(
-        g_Ctx->m_RenderContextFenceValue,
-        D3D12_FENCE_FLAG_NONE,
-        IID_PPV_ARGS(&g_Ctx->m_RenderContextFence)));
-    g_Ctx->m_RenderContextFenceValue++;
-
-    g_Ctx->m_RenderContextFenceEvent =
-        CreateEvent(nullptr, FALSE, FALSE, nullptr);
-    if (g_Ctx->m_RenderContextFenceEvent == nullptr) {
-      D3D_EXEC_CHECKED(HRESULT_FROM_WIN32(GetLastError()));
-    }
+    g_Ctx->m_RenderTimeline =
+        nbodyTimelineCreateD3D12(g_Ctx->m_Dev.GetInterfacePtr(), 0);
+    _checkTimeline(g_Ctx->m_RenderTimeline != nullptr);
+    g_Ctx->m_RenderTimelineValue = 1;
 
     _waitForRenderContext();
   }
 }
 //---------------------------------------------------------------------------//
+// NBodyDispatchTimer of the demo: GPU timestamps around a few dispatches of
+// CSMain compiled for p_Config, on the direct queue before the compute
+// threads start. It reads buffer 0 and writes buffer 1 of the first context,
+// which that context overwrites with its first step anyway.
+static bool
+_timeDispatch(void* p_User, NBodyDispatchConfig p_Config, double* p_Seconds) {
+  (void)p_User;
+  const UINT runCount = 4;
+
+  ID3D12PipelineStatePtr pso;
+  if (!_createComputePso(p_Config, &pso))
+    return false;
+
+  // The tile count of this config, in an upload constant buffer of its own.
+  ID3D12ResourcePtr cbuffer;
+  D3D_EXEC_CHECKED(g_Ctx->m_Dev->CreateCommittedResource(
+      &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+      D3D12_HEAP_FLAG_NONE,
+      &CD3DX12_RESOURCE_DESC::Buffer(sizeof(ParticleSimCtx::CbufferCS)),
+      D3D12_RESOURCE_STATE_GENERIC_READ,
+      nullptr,
+      IID_PPV_ARGS(&cbuffer)));
+  ParticleSimCtx::CbufferCS* cbufferCS = nullptr;
+  CD3DX12_RANGE readRange(0, 0);
+  D3D_EXEC_CHECKED(
+      cbuffer->Map(0, &readRange, reinterpret_cast<void**>(&cbufferCS)));
+  cbufferCS->m_Params[0] = g_Ctx->m_ParticleCount;
+  cbufferCS->m_Params[1] = g_Ctx->m_PaddedParticleCount / p_Config.m_BlockSize;
+  cbufferCS->m_ParamsFloat[0] = 0.1f;
+  cbufferCS->m_ParamsFloat[1] = 1.0f;
+  cbuffer->Unmap(0, nullptr);
+
+  D3D12_QUERY_HEAP_DESC queryHeapDesc = {};
+  queryHeapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+  queryHeapDesc.Count = 2;
+  ID3D12QueryHeapPtr queryHeap;
+  D3D_EXEC_CHECKED(g_Ctx->m_Dev->CreateQueryHeap(
+      &queryHeapDesc, IID_PPV_ARGS(&queryHeap)));
+  ID3D12ResourcePtr readback;
+  D3D_EXEC_CHECKED(g_Ctx->m_Dev->CreateCommittedResource(
+      &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK),
+      D3D12_HEAP_FLAG_NONE,
+      &CD3DX12_RESOURCE_DESC::Buffer(2 * sizeof(UINT64)),
+      D3D12_RESOURCE_STATE_COPY_DEST,
+      nullptr,
+      IID_PPV_ARGS(&readback)));
+
+  ID3D12CommandAllocator* allocator =
+      g_Ctx->m_CmdAllocs[g_Ctx->m_FrameIndex].GetInterfacePtr();
+  ID3D12GraphicsCommandList* cmdList = g_Ctx->m_CmdList.GetInterfacePtr();
+  D3D_EXEC_CHECKED(allocator->Reset());
+  D3D_EXEC_CHECKED(cmdList->Reset(allocator, pso.GetInterfacePtr()));
+
+  // Step 1 of the first thread, which overwrites the UAV anyway.
+  ID3D12Resource* pUavResource =
+      g_Ctx->m_ParticleBuffers[0][1].GetInterfacePtr();
+  cmdList->ResourceBarrier(
+      1,
+      &CD3DX12_RESOURCE_BARRIER::Transition(
+          pUavResource,
+          D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
+          D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+
+  cmdList->SetComputeRootSignature(g_Ctx->m_CompRootSig.GetInterfacePtr());
+  ID3D12DescriptorHeap* ppHeaps[] = {g_Ctx->m_SrvUavHeap.GetInterfacePtr()};
+  cmdList->SetDescriptorHeaps(arrayCount32(ppHeaps), ppHeaps);
+  CD3DX12_GPU_DESCRIPTOR_HANDLE srvHandle(
+      g_Ctx->m_SrvUavHeap->GetGPUDescriptorHandleForHeapStart(),
+      ParticleSimCtx::particleDescriptor(
+          ParticleSimCtx::SrvParticlePosVel, 0, 0),
+      g_Ctx->m_SrvUavDescriptorSize);
+  CD3DX12_GPU_DESCRIPTOR_HANDLE uavHandle(
+      g_Ctx->m_SrvUavHeap->GetGPUDescriptorHandleForHeapStart(),
+      ParticleSimCtx::particleDescriptor(
+          ParticleSimCtx::UavParticlePosVel, 0, 1),
+      g_Ctx->m_SrvUavDescriptorSize);
+  cmdList->SetComputeRootConstantBufferView(
+      ParticleSimCtx::ComputeRootCBV, cbuffer->GetGPUVirtualAddress());
+  cmdList->SetComputeRootDescriptorTable(
+      ParticleSimCtx::ComputeRootSRVTable, srvHandle);
+  cmdList->SetComputeRootDescriptorTable(
+      ParticleSimCtx::ComputeRootUAVTable, uavHandle);
+
+  // A warm-up dispatch, then runCount timed ones.
+  for (UINT run = 0; run <= runCount; ++run) {
+    if (run == 1)
+      cmdList->EndQuery(
+          queryHeap.GetInterfacePtr(), D3D12_QUERY_TYPE_TIMESTAMP, 0);
+    cmdList->Dispatch(
+        g_Ctx->m_PaddedParticleCount / p_Config.m_BlockSize, 1, 1);
+    cmdList->ResourceBarrier(
+        1, &CD3DX12_RESOURCE_BARRIER::UAV(pUavResource));
+  }
+  cmdList->EndQuery(queryHeap.GetInterfacePtr(), D3D12_QUERY_TYPE_TIMESTAMP, 1);
+  cmdList->ResolveQueryData(
+      queryHeap.GetInterfacePtr(),
+      D3D12_QUERY_TYPE_TIMESTAMP,
+      0,
+      2,
+      readback.GetInterfacePtr(),
+      0);
+
+  cmdList->ResourceBarrier(
+      1,
+      &CD3DX12_RESOURCE_BARRIER::Transition(
+          pUavResource,
+          D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+          D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
+  D3D_EXEC_CHECKED(cmdList->Close());
+  ID3D12CommandList* ppCommandLists[] = {cmdList};
+  g_Ctx->m_CmdQue->ExecuteCommandLists(
+      arrayCount32(ppCommandLists), ppCommandLists);
+  _waitForRenderContext();
+
+  UINT64 frequency = 0;
+  D3D_EXEC_CHECKED(g_Ctx->m_CmdQue->GetTimestampFrequency(&frequency));
+  const UINT64* timestamps = nullptr;
+  CD3DX12_RANGE timestampRange(0, 2 * sizeof(UINT64));
+  D3D_EXEC_CHECKED(readback->Map(
+      0, &timestampRange, reinterpret_cast<void**>(&timestamps)));
+  *p_Seconds = static_cast<double>(timestamps[1] - timestamps[0]) /
+               static_cast<double>(frequency) / runCount;
+  CD3DX12_RANGE writeRange(0, 0);
+  readback->Unmap(0, &writeRange);
+  return true;
+}
+//---------------------------------------------------------------------------//
+// --tune: CSMain's tile and unroll for this adapter and particle count, timed
+// the first time and then read from NBodyDispatch.cache. The compute PSO and
+// constant buffer are rebuilt when the winner isn't what _loadAssets used.
+static void _tuneDispatch() {
+  NBodyDispatchTuneResult tune;
+  const bool stored = nbodyTuneDispatch(
+      g_Ctx->m_AdapterName,
+      g_Ctx->m_ParticleCount,
+      _timeDispatch,
+      nullptr,
+      NBodyDefaultDispatchCache,
+      &tune);
+
+  char name[32];
+  nbodyDispatchConfigName(tune.m_Config, name, 32);
+  char message[256];
+  snprintf(
+      message,
+      256,
+      "CSMain on %s: %s (%s)%s\n",
+      g_Ctx->m_AdapterName,
+      name,
+      tune.m_FromCache ? "cached" : "tuned",
+      stored ? "" : ", could not write NBodyDispatch.cache");
+  OutputDebugStringA(message);
+
+  if (tune.m_Config.m_BlockSize == g_Ctx->m_TileSize &&
+      tune.m_Config.m_Unroll == g_Ctx->m_Unroll)
+    return;
+  g_Ctx->m_TileSize = tune.m_Config.m_BlockSize;
+  g_Ctx->m_Unroll = tune.m_Config.m_Unroll;
+  DEBUG_BREAK(_createComputePso(tune.m_Config, &g_Ctx->m_CompPso));
+  D3D_NAME_OBJECT(g_Ctx->m_CompPso);
+
+  ID3D12ResourcePtr cbufferCSUpload;
+  D3D_EXEC_CHECKED(g_Ctx->m_CmdAllocs[g_Ctx->m_FrameIndex]->Reset());
+  D3D_EXEC_CHECKED(g_Ctx->m_CmdList->Reset(
+      g_Ctx->m_CmdAllocs[g_Ctx->m_FrameIndex].GetInterfacePtr(),
+      g_Ctx->m_Pso.GetInterfacePtr()));
+  _createCbufferCS(&cbufferCSUpload);
+  D3D_EXEC_CHECKED(g_Ctx->m_CmdList->Close());
+  ID3D12CommandList* ppCommandLists[] = {g_Ctx->m_CmdList.GetInterfacePtr()};
+  g_Ctx->m_CmdQue->ExecuteCommandLists(
+      arrayCount32(ppCommandLists), ppCommandLists);
+  _waitForRenderContext();
+}
+//---------------------------------------------------------------------------//
+// Joins the compute threads, which wait on the timelines every step: they
+// must be gone before a timeline is destroyed.
+static void _stopAsyncContexts() {
+  // Notify the compute threads that the app is shutting down.
+  g_Ctx->m_Terminating.store(true);
+  WaitForMultipleObjects(THREAD_COUNT, g_Ctx->m_ThreadHandles, TRUE, INFINITE);
+  for (int n = 0; n < THREAD_COUNT; n++) {
+    CloseHandle(g_Ctx->m_ThreadHandles[n]);
+    g_Ctx->m_ThreadHandles[n] = nullptr;
+  }
+}
+//---------------------------------------------------------------------------//
+static void _destroyTimelines() {
+  nbodyTimelineDestroy(g_Ctx->m_RenderTimeline);
+  g_Ctx->m_RenderTimeline = nullptr;
+  for (int n = 0; n < THREAD_COUNT; n++) {
+    nbodyTimelineDestroy(g_Ctx->m_ComputeTimelines[n]);
+    g_Ctx->m_ComputeTimelines[n] = nullptr;
+    nbodyTimelineDestroy(g_Ctx->m_ReorderTimelines[n]);
+    g_Ctx->m_ReorderTimelines[n] = nullptr;
+  }
+}
+//---------------------------------------------------------------------------//
+// The compute threads are stopped already (_stopAsyncContexts).
 static void _releaseD3DResources() {
-  g_Ctx->m_RenderContextFence = nullptr;
+  _destroyTimelines();
+  for (int n = 0; n < THREAD_COUNT; n++) {
+    std::vector<UINT>().swap(g_Ctx->m_ParticleIds[n]);
+  }
   resetComPtrArray(&g_Ctx->m_RenderTargets);
   g_Ctx->m_CmdQue = nullptr;
   g_Ctx->m_Swc = nullptr;
   g_Ctx->m_Dev = nullptr;
 }
 //---------------------------------------------------------------------------//
-static void _waitForGpu() {
-  // Schedule a Signal command in the queue.
-  D3D_EXEC_CHECKED(g_Ctx->m_CmdQue->Signal(
-      g_Ctx->m_RenderContextFence.GetInterfacePtr(),
-      g_Ctx->m_RenderContextFenceValues[g_Ctx->m_FrameIndex]));
-
-  // Wait until the fence has been processed.
-  D3D_EXEC_CHECKED(g_Ctx->m_RenderContextFence->SetEventOnCompletion(
-      g_Ctx->m_RenderContextFenceValues[g_Ctx->m_FrameIndex],
-      g_Ctx->m_RenderContextFenceEvent));
-  WaitForSingleObjectEx(g_Ctx->m_RenderContextFenceEvent, INFINITE, FALSE);
-
-  // Increment the fence value for the current frame.
-  g_Ctx->m_RenderContextFenceValues[g_Ctx->m_FrameIndex]++;
-}
-//---------------------------------------------------------------------------//
 static void _restoreD3DResources() {
+  // onInit starts new compute threads on new timelines, in a new context.
+  _stopAsyncContexts();
+
   // Give GPU a chance to finish its execution in progress.
   try {
-    _waitForGpu();
+    _waitForRenderContext();
   } catch (std::exception) {
     // Do nothing, currently attached adapter is unresponsive.
   }
   _releaseD3DResources();
+  _deallocSimData();
   onInit();
 }
 //---------------------------------------------------------------------------//
@@ -984,16 +1179,18 @@ static void _createAsyncContexts() {
         g_Ctx->m_CompAllocs[threadIndex].GetInterfacePtr(),
         nullptr,
         IID_PPV_ARGS(&g_Ctx->m_CompCmdLists[threadIndex])));
-    D3D_EXEC_CHECKED(g_Ctx->m_Dev->CreateFence(
-        0,
-        D3D12_FENCE_FLAG_SHARED,
-        IID_PPV_ARGS(&g_Ctx->m_ThreadFences[threadIndex])));
-
-    g_Ctx->m_ThreadFenceEvents[threadIndex] =
-        CreateEvent(nullptr, FALSE, FALSE, nullptr);
-    if (g_Ctx->m_ThreadFenceEvents[threadIndex] == nullptr) {
-      D3D_EXEC_CHECKED(HRESULT_FROM_WIN32(GetLastError()));
-    }
+    g_Ctx->m_ComputeTimelines[threadIndex] =
+        nbodyTimelineCreateD3D12(g_Ctx->m_Dev.GetInterfacePtr(), 0);
+    _checkTimeline(g_Ctx->m_ComputeTimelines[threadIndex] != nullptr);
+    g_Ctx->m_ReorderTimelines[threadIndex] =
+        nbodyTimelineCreateD3D12(g_Ctx->m_Dev.GetInterfacePtr(), 0);
+    _checkTimeline(g_Ctx->m_ReorderTimelines[threadIndex] != nullptr);
+    nbodyRingInit(
+        &g_Ctx->m_StateRings[threadIndex],
+        g_Ctx->m_StateBufferCount,
+        FRAME_COUNT,
+        g_Ctx->m_ComputeTimelines[threadIndex],
+        g_Ctx->m_RenderTimeline);
 
     // (OM) TODO! Check if this is working as intended
     g_Ctx->m_ThreadData[threadIndex].m_Context = g_Ctx;
@@ -1066,9 +1263,10 @@ static void _populateCommandList() {
   float viewportWidth = static_cast<float>(
       static_cast<UINT>(g_Ctx->m_Viewport.Width) / g_Ctx->m_WidthInstances);
   for (UINT n = 0; n < THREAD_COUNT; n++) {
-    const UINT srvIndex =
-        n + (g_Ctx->m_SrvIndex[n] == 0 ? ParticleSimCtx::SrvParticlePosVel0
-                                       : ParticleSimCtx::SrvParticlePosVel1);
+    const UINT srvIndex = ParticleSimCtx::particleDescriptor(
+        ParticleSimCtx::SrvParticlePosVel,
+        n,
+        nbodyRingSlot(&g_Ctx->m_StateRings[n], g_Ctx->m_DrawSteps[n]));
 
     CD3DX12_VIEWPORT viewport(
         (n % g_Ctx->m_WidthInstances) * viewportWidth,
@@ -1111,33 +1309,52 @@ static void _populateCommandList() {
 // next frame resource in the queue has not yet had its previous contents
 // processed by the GPU.
 static void _moveToNextFrame() {
-  // Assign the current fence value to the current frame.
-  g_Ctx->m_FrameFenceValues[g_Ctx->m_FrameIndex] =
-      g_Ctx->m_RenderContextFenceValue;
-
-  // Signal and increment the fence value.
-  D3D_EXEC_CHECKED(g_Ctx->m_CmdQue->Signal(
-      g_Ctx->m_RenderContextFence.GetInterfacePtr(),
-      g_Ctx->m_RenderContextFenceValue));
-  g_Ctx->m_RenderContextFenceValue++;
+  // Assign the current timeline value to the current frame and signal it.
+  g_Ctx->m_FrameFenceValues[g_Ctx->m_FrameIndex] = g_Ctx->m_RenderTimelineValue;
+  _checkTimeline(nbodyTimelineSignalQueue(
+      g_Ctx->m_RenderTimeline,
+      g_Ctx->m_CmdQue.GetInterfacePtr(),
+      g_Ctx->m_RenderTimelineValue));
+  g_Ctx->m_RenderTimelineValue++;
 
   // Update the frame index.
   g_Ctx->m_FrameIndex = g_Ctx->m_Swc->GetCurrentBackBufferIndex();
 
   // If the next frame is not ready to be rendered yet, wait until it is ready.
-  if (g_Ctx->m_RenderContextFence->GetCompletedValue() <
-      g_Ctx->m_FrameFenceValues[g_Ctx->m_FrameIndex]) {
-    D3D_EXEC_CHECKED(g_Ctx->m_RenderContextFence->SetEventOnCompletion(
-        g_Ctx->m_FrameFenceValues[g_Ctx->m_FrameIndex],
-        g_Ctx->m_RenderContextFenceEvent));
-    WaitForSingleObject(g_Ctx->m_RenderContextFenceEvent, INFINITE);
+  _checkTimeline(nbodyTimelineWait(
+      g_Ctx->m_RenderTimeline,
+      g_Ctx->m_FrameFenceValues[g_Ctx->m_FrameIndex],
+      NBodyTimelineInfinite));
+}
+//---------------------------------------------------------------------------//
+// Options of the command line (see NBodyOptions.hpp), the defaults when they
+// are invalid.
+static void _parseOptions(NBodyOptions* p_Options) {
+  std::vector<const char*> argv;
+  for (const std::string& arg : g_DemoInfo->m_CmdArgs) {
+    argv.push_back(arg.c_str());
+  }
+
+  nbodyOptionsInit(p_Options);
+  char error[256];
+  bool valid = nbodyParseOptions(
+      p_Options, static_cast<int>(argv.size()), argv.data(), error, 256);
+  if (valid && p_Options->m_Backend != NBodyBackendGpu) {
+    snprintf(error, 256, "the demo only runs --backend gpu");
+    valid = false;
+  }
+  if (!valid) {
+    WIN32_MSG_BOX(error);
+    nbodyOptionsInit(p_Options);
   }
 }
 //---------------------------------------------------------------------------//
+// Value initialized: the plain members start zeroed, the vectors and the
+// atomic are constructed.
 static void _allocSimData() {
   DEBUG_BREAK(nullptr == g_Ctx);
-  g_Ctx = reinterpret_cast<ParticleSimCtx*>(::malloc(sizeof(*g_Ctx)));
-  ::memset(g_Ctx, 0, sizeof(*g_Ctx));
+  void* mem = ::malloc(sizeof(*g_Ctx));
+  g_Ctx = new (mem) ParticleSimCtx();
 }
 //---------------------------------------------------------------------------//
 static void _deallocSimData() {
@@ -1152,10 +1369,41 @@ static void _deallocSimData() {
 void onInit() {
   _allocSimData();
   DEBUG_BREAK(g_DemoInfo->m_IsInitialized);
-  ::memset(g_Ctx, 0, sizeof(*g_Ctx));
 
-  g_Ctx->m_ParticleCount = 10000;
-  g_Ctx->m_ParticleSpread = 400.0f;
+  NBodyOptions options;
+  _parseOptions(&options);
+  g_Ctx->m_ParticleCount = options.m_ParticleCount;
+  // A snapshot replaces the model and brings its own particle count.
+  if (options.m_LoadPath[0] != '\0') {
+    const char* error =
+        nbodySnapshotOpen(&g_Ctx->m_Snapshot, options.m_LoadPath);
+    if (error != nullptr) {
+      WIN32_MSG_BOX(error);
+    } else {
+      g_Ctx->m_ParticleCount = g_Ctx->m_Snapshot.m_Header->m_ParticleCount;
+    }
+  }
+  g_Ctx->m_TileSize = options.m_TileSize;
+  g_Ctx->m_Unroll = options.m_Unroll;
+  g_Ctx->m_AccumMode = options.m_Accumulation;
+  g_Ctx->m_PosFormat = options.m_PosFormat;
+  // --tune starts on the default dispatch and needs buffers of whole tiles
+  // for every candidate.
+  UINT padding = g_Ctx->m_TileSize;
+  if (options.m_Tune) {
+    g_Ctx->m_TileSize =
+        NBodyDispatchConfigs[NBodyDefaultDispatchConfig].m_BlockSize;
+    g_Ctx->m_Unroll = NBodyDispatchConfigs[NBodyDefaultDispatchConfig].m_Unroll;
+    padding = NBodyDispatchMaxBlockSize;
+  }
+  g_Ctx->m_PaddedParticleCount =
+      divideRoundingUp(g_Ctx->m_ParticleCount, padding) * padding;
+  g_Ctx->m_Model = options.m_Model;
+  g_Ctx->m_ParticleSpread = options.m_Spread;
+  g_Ctx->m_Seed = options.m_Seed;
+  g_Ctx->m_StepCount = options.m_StepCount;
+  g_Ctx->m_StateBufferCount = options.m_StateBuffers;
+  g_Ctx->m_ReorderInterval = NBodyDefaultReorderInterval;
 
   UINT width = g_DemoInfo->m_Width;
   UINT height = g_DemoInfo->m_Height;
@@ -1164,13 +1412,8 @@ void onInit() {
   g_Ctx->m_ScissorRect =
       CD3DX12_RECT(0, 0, static_cast<LONG>(width), static_cast<LONG>(height));
   g_Ctx->m_CbufferGSDataPtr = nullptr;
-  setArrayToZero(g_Ctx->m_SrvIndex);
   setArrayToZero(g_Ctx->m_FrameFenceValues);
-
-  for (int i = 0; i < THREAD_COUNT; ++i) {
-    g_Ctx->m_RenderContextFenceValues[i] = 0;
-    g_Ctx->m_ThreadFenceValues[i] = 0;
-  }
+  setArrayToZero(g_Ctx->m_DrawSteps);
 
   float sqRootNumAsyncContexts = sqrt(static_cast<float>(THREAD_COUNT));
   g_Ctx->m_HeightInstances = static_cast<UINT>(ceil(sqRootNumAsyncContexts));
@@ -1190,24 +1433,19 @@ void onInit() {
 
   _loadPipeline();
   _loadAssets();
+  if (options.m_Tune)
+    _tuneDispatch();
   _createAsyncContexts();
 }
 //---------------------------------------------------------------------------//
 void onDestroy() {
-  // Notify the compute threads that the app is shutting down.
-  InterlockedSetValue(&g_Ctx->m_Terminating, 1);
-  WaitForMultipleObjects(THREAD_COUNT, g_Ctx->m_ThreadHandles, TRUE, INFINITE);
+  _stopAsyncContexts();
 
   // Ensure that the GPU is no longer referencing resources that are about to be
   // cleaned up by the destructor.
   _waitForRenderContext();
 
-  // Close handles to fence events and threads.
-  CloseHandle(g_Ctx->m_RenderContextFenceEvent);
-  for (int n = 0; n < THREAD_COUNT; n++) {
-    CloseHandle(g_Ctx->m_ThreadHandles[n]);
-    CloseHandle(g_Ctx->m_ThreadFenceEvents[n]);
-  }
+  _destroyTimelines();
   // Release resources
   _deallocSimData();
 }
@@ -1236,24 +1474,24 @@ void onUpdate() {
 void onRender() {
   if (g_Ctx) {
     try {
-      // Let the compute thread know that a new frame is being rendered.
-      for (int n = 0; n < THREAD_COUNT; n++) {
-        InterlockedSetValue(
-            &g_Ctx->m_RenderContextFenceValues[n],
-            g_Ctx->m_RenderContextFenceValue);
-      }
-
-      // Compute work must be completed before the frame can render or else the
-      // SRV will be in the wrong state.
+      // Draw the newest step of every thread, its buffer marked as read by
+      // this frame so the compute queue doesn't overwrite it meanwhile.
+      // Compute work must be completed before the frame can render or else
+      // the SRV will be in the wrong state: the rendering queue waits on the
+      // compute timeline (a no-op for a step done already).
       for (UINT n = 0; n < THREAD_COUNT; n++) {
-        UINT64 threadFenceValue =
-            InterlockedGetValue(&g_Ctx->m_ThreadFenceValues[n]);
-        if (g_Ctx->m_ThreadFences[n]->GetCompletedValue() < threadFenceValue) {
-          // Instruct the rendering command queue to wait for the current
-          // compute work to complete.
-          D3D_EXEC_CHECKED(g_Ctx->m_CmdQue->Wait(
-              g_Ctx->m_ThreadFences[n].GetInterfacePtr(), threadFenceValue));
-        }
+        // With --buffers up to FRAME_COUNT fewer frames stay in flight,
+        // else they would hold the buffer the compute queue writes next.
+        NBodyStateRing* ring = &g_Ctx->m_StateRings[n];
+        _checkTimeline(nbodyTimelineWait(
+            g_Ctx->m_RenderTimeline,
+            nbodyRingFrameToWait(ring, g_Ctx->m_RenderTimelineValue),
+            NBodyTimelineInfinite));
+        NBodyTimeline* steps = g_Ctx->m_ComputeTimelines[n];
+        g_Ctx->m_DrawSteps[n] =
+            nbodyRingAcquire(ring, g_Ctx->m_RenderTimelineValue);
+        _checkTimeline(nbodyTimelineWaitQueue(
+            steps, g_Ctx->m_CmdQue.GetInterfacePtr(), g_Ctx->m_DrawSteps[n]));
       }
 
       PIXBeginEvent(g_Ctx->m_CmdQue.GetInterfacePtr(), 0, L"Render");
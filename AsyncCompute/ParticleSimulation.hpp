@@ -12,6 +12,13 @@
 #include "Externals/d3dx12.h"
 #include "Camera.hpp"
 #include "Timer.hpp"
+#include "NBodyCpu.hpp"
+#include "NBodyOptions.hpp"
+#include "NBodySnapshot.hpp"
+#include "NBodyDispatchTuner.hpp"
+#include "NBodyTimeline.hpp"
+#include <atomic>
+#include <vector>
 
 using namespace DirectX;
 
@@ -34,8 +41,19 @@ void onKeyUp(UINT8);
 #define THREAD_COUNT 1
 
 struct ParticleSimCtx {
-  float m_ParticleSpread;
+  float m_ParticleSpread;     // Length scale of the model
+  UINT m_Model;               // Initial conditions (NBodyModel)
+  UINT m_Seed;                // Of the initial conditions (NBodyRandom.hpp)
   UINT m_ParticleCount = 10000;
+  UINT m_PaddedParticleCount; // Whole CS tiles, the extra bodies are massless
+  UINT m_TileSize;            // blocksize of nBodyGravityCS.hlsl
+  UINT m_Unroll;              // unrollcount of nBodyGravityCS.hlsl
+  UINT m_AccumMode;           // accummode (NBodyAccumulation)
+  UINT m_PosFormat;           // posformat (NBodyPosFormat)
+  UINT m_StepCount;           // Simulation steps per thread, 0 for no limit
+  UINT m_StateBufferCount;    // Particle buffers per thread (NBodyStateRing)
+  UINT m_ReorderInterval;     // Steps between Morton sorts, 0 for none
+  NBodySnapshot m_Snapshot;   // --load, mapped until the buffers are filled
 
   // Vertex data (color for now)
   struct ParticleVertex {
@@ -47,6 +65,9 @@ struct ParticleSimCtx {
     XMFLOAT4 m_Position;
     XMFLOAT4 m_Velocity;
   };
+  static_assert(
+      sizeof(ParticleMotion) == sizeof(NBodyParticle),
+      "ParticleMotion must stay binary compatible with the CPU engine");
 
   struct CbufferGS {
     XMFLOAT4X4 m_Wvp;
@@ -76,6 +97,7 @@ struct ParticleSimCtx {
   ID3D12DescriptorHeapPtr m_SrvUavHeap;
   UINT m_RtvDescriptorSize;
   UINT m_SrvUavDescriptorSize;
+  char m_AdapterName[128]; // UTF-8, keys the dispatch tuning cache
 
   // Asset objects.
   ID3D12PipelineStatePtr m_Pso;
@@ -84,17 +106,16 @@ struct ParticleSimCtx {
   ID3D12ResourcePtr m_VtxBuffer;
   ID3D12ResourcePtr m_VtxBufferUpload;
   D3D12_VERTEX_BUFFER_VIEW m_VtxBufferView;
-  ID3D12ResourcePtr m_ParticleBuffer0[THREAD_COUNT];
-  ID3D12ResourcePtr m_ParticleBuffer1[THREAD_COUNT];
-  ID3D12ResourcePtr m_ParticleBuffer0Upload[THREAD_COUNT];
-  ID3D12ResourcePtr m_ParticleBuffer1Upload[THREAD_COUNT];
+  ID3D12ResourcePtr m_ParticleBuffers[THREAD_COUNT][NBodyMaxStateBuffers];
+  ID3D12ResourcePtr m_ParticleBufferUpload[THREAD_COUNT];
+  ID3D12ResourcePtr m_ParticleBufferReadback[THREAD_COUNT];
+  // External id (generation or snapshot order) of the particle in each slot
+  // of a thread's buffers, permuted by every Morton sort (_reorderStep).
+  std::vector<UINT> m_ParticleIds[THREAD_COUNT];
   ID3D12ResourcePtr m_CbufferGS;
   UINT8* m_CbufferGSDataPtr;
   ID3D12ResourcePtr m_CbufferCS;
 
-  UINT m_SrvIndex[THREAD_COUNT]; // Denotes which of the particle buffer
-                                 // resource views is the SRV (0 or 1). The UAV
-                                 // is 1 - srvIndex.
   UINT m_HeightInstances;
   UINT m_WidthInstances;
   Camera m_Camera;
@@ -105,20 +126,25 @@ struct ParticleSimCtx {
   ID3D12CommandQueuePtr m_CompCmdQues[THREAD_COUNT];
   ID3D12GraphicsCommandListPtr m_CompCmdLists[THREAD_COUNT];
 
-  // Synchronization objects.
+  // Synchronization objects (NBodyTimeline.hpp). The render timeline counts
+  // the frames done by the direct queue, the compute timeline of a thread
+  // the steps done by its queue: step k reads particle buffer (k - 1) % K
+  // and writes buffer k % K, so the value also says which one is the SRV.
+  // The ring of a thread keeps the last frame that drew each buffer.
   HANDLE m_SwapChainEvent;
-  ID3D12FencePtr m_RenderContextFence;
-  UINT64 m_RenderContextFenceValue;
-  HANDLE m_RenderContextFenceEvent;
+  NBodyTimeline* m_RenderTimeline;
+  UINT64 m_RenderTimelineValue; // Signalled by the next frame
   UINT64 m_FrameFenceValues[FRAME_COUNT];
-
-  ID3D12FencePtr m_ThreadFences[THREAD_COUNT];
-  volatile HANDLE m_ThreadFenceEvents[THREAD_COUNT];
+  NBodyTimeline* m_ComputeTimelines[THREAD_COUNT];
+  NBodyStateRing m_StateRings[THREAD_COUNT];
+  // Readbacks of a thread for its Morton sorts, value n once the n-th is in
+  // the readback buffer. Apart from m_ComputeTimelines, whose values publish
+  // the steps to the renderer.
+  NBodyTimeline* m_ReorderTimelines[THREAD_COUNT];
 
   // Thread state.
-  LONG volatile m_Terminating;
-  UINT64 volatile m_RenderContextFenceValues[THREAD_COUNT];
-  UINT64 volatile m_ThreadFenceValues[THREAD_COUNT];
+  std::atomic<bool> m_Terminating{false}; // Set by _stopAsyncContexts
+  UINT64 m_DrawSteps[THREAD_COUNT]; // Drawn by the frame being recorded
 
   struct ThreadData {
     ParticleSimCtx* m_Context;
@@ -141,14 +167,17 @@ struct ParticleSimCtx {
     ComputeRootParametersCount
   };
 
-  // Indices of shader resources in the descriptor heap.
+  // Indices of shader resources in the descriptor heap, a view per thread
+  // and particle buffer (see particleDescriptor).
   enum DescriptorHeapIndex : UINT32 {
-    UavParticlePosVel0 = 0,
-    UavParticlePosVel1 = UavParticlePosVel0 + THREAD_COUNT,
-    SrvParticlePosVel0 = UavParticlePosVel1 + THREAD_COUNT,
-    SrvParticlePosVel1 = SrvParticlePosVel0 + THREAD_COUNT,
-    DescriptorCount = SrvParticlePosVel1 + THREAD_COUNT
+    UavParticlePosVel = 0,
+    SrvParticlePosVel = UavParticlePosVel + THREAD_COUNT * NBodyMaxStateBuffers,
+    DescriptorCount = SrvParticlePosVel + THREAD_COUNT * NBodyMaxStateBuffers
   };
+  static UINT
+  particleDescriptor(DescriptorHeapIndex p_Base, UINT p_Thread, UINT p_Slot) {
+    return p_Base + p_Thread * NBodyMaxStateBuffers + p_Slot;
+  }
 
   ~ParticleSimCtx(){/* Just release ComPtrs */};
 };
@@ -11,17 +11,63 @@
 
 static float softeningSquared = 0.0012500000f * 0.0012500000f;
 static float g_fG = 6.67300e-11f * 10000.0f;
-static float g_fParticleMass = g_fG * 10000.0f * 10000.0f;
 
+// Tile size and unroll of the j loop (0 unrolls it fully), set by the demo
+// from its command line (--tile, --unroll) or its dispatch tuner
+#ifndef blocksize
 #define blocksize 128
+#endif
+#ifndef unrollcount
+#define unrollcount 0
+#endif
+
+// Precision (--accum, --positions), same values as NBodyAccumulation and
+// NBodyPosFormat. The j loop of a tile always sums in float, accummode 1
+// folds the tiles with a compensated (Kahan) sum, 2 in double. posformat 1
+// keeps the tile positions as halves, 2 as bfloat16 (a third of the shared
+// memory traffic of a float4, the masses stay float).
+#ifndef accummode
+#define accummode 0
+#endif
+#ifndef posformat
+#define posformat 0
+#endif
+
+#if posformat == 0
 groupshared float4 sharedPos[blocksize];
+#else
+groupshared uint2 sharedPacked[blocksize]; // x | y << 16, z
+groupshared float sharedMass[blocksize];
+#endif
+
+#if posformat == 1
+uint2 packPosition(float3 p) {
+  return uint2(f32tof16(p.x) | (f32tof16(p.y) << 16), f32tof16(p.z));
+}
+float3 unpackPosition(uint2 p) {
+  return float3(f16tof32(p.x), f16tof32(p.x >> 16), f16tof32(p.y));
+}
+#elif posformat == 2
+// Round to nearest even, as nbodyFloatToBf16.
+uint toBf16(float v) {
+  uint b = asuint(v);
+  return (b + 0x7fff + ((b >> 16) & 1)) >> 16;
+}
+uint2 packPosition(float3 p) {
+  return uint2(toBf16(p.x) | (toBf16(p.y) << 16), toBf16(p.z));
+}
+float3 unpackPosition(uint2 p) {
+  return float3(
+      asfloat(p.x << 16), asfloat(p.x & 0xffff0000), asfloat(p.y << 16));
+}
+#endif
 
 //
 // Body to body interaction, acceleration of the particle at position
-// bi is updated.
+// bi is updated by bj, whose mass is bj.w.
 //
 void bodyBodyInteraction(
-    inout float3 ai, float4 bj, float4 bi, float mass, int particles) {
+    inout float3 ai, float4 bj, float4 bi, float G, int particles) {
   float3 r = bj.xyz - bi.xyz;
 
   float distSqr = dot(r, r);
@@ -30,7 +76,7 @@ void bodyBodyInteraction(
   float invDist = 1.0f / sqrt(distSqr);
   float invDistCube = invDist * invDist * invDist;
 
-  float s = mass * invDistCube * particles;
+  float s = G * bj.w * invDistCube * particles;
 
   ai += r * s;
 }
@@ -59,37 +105,75 @@ RWStructuredBuffer<PosVelo> newPosVelo : register(u0); // UAV
   float4 pos = oldPosVelo[DTid.x].pos;
   float4 vel = oldPosVelo[DTid.x].velo;
   float3 accel = 0;
-  float mass = g_fParticleMass;
+#if accummode == 1
+  float3 compensation = 0;
+#elif accummode == 2
+  double3 total = 0;
+#endif
+
+  // Rounded like the shared positions, so that the particle still sees
+  // itself at a distance of exactly zero.
+  float4 target = pos;
+#if posformat != 0
+  target.xyz = unpackPosition(packPosition(pos.xyz));
+#endif
 
   // Update current particle using all other particles.
   [loop] for (uint tile = 0; tile < g_param.y; tile++) {
     // Cache a tile of particles unto shared memory to increase IO efficiency.
-    sharedPos[GI] = oldPosVelo[tile * blocksize + GI].pos;
+    // The buffers hold g_param.y whole tiles, the particles past g_param.x
+    // have no mass, so every read is in bounds and adds nothing.
+    float4 source = oldPosVelo[tile * blocksize + GI].pos;
+#if posformat == 0
+    sharedPos[GI] = source;
+#else
+    sharedPacked[GI] = packPosition(source.xyz);
+    sharedMass[GI] = source.w;
+#endif
 
     GroupMemoryBarrierWithGroupSync();
 
-    [unroll] for (uint counter = 0; counter < blocksize; counter += 8) {
-      bodyBodyInteraction(accel, sharedPos[counter], pos, mass, 1);
-      bodyBodyInteraction(accel, sharedPos[counter + 1], pos, mass, 1);
-      bodyBodyInteraction(accel, sharedPos[counter + 2], pos, mass, 1);
-      bodyBodyInteraction(accel, sharedPos[counter + 3], pos, mass, 1);
-      bodyBodyInteraction(accel, sharedPos[counter + 4], pos, mass, 1);
-      bodyBodyInteraction(accel, sharedPos[counter + 5], pos, mass, 1);
-      bodyBodyInteraction(accel, sharedPos[counter + 6], pos, mass, 1);
-      bodyBodyInteraction(accel, sharedPos[counter + 7], pos, mass, 1);
+    // accummode 0 carries the running sum through the tiles (the original
+    // loop), the others sum each tile from zero and fold it below.
+#if accummode == 0
+    float3 tileAccel = accel;
+#else
+    float3 tileAccel = 0;
+#endif
+
+#if unrollcount == 0
+    [unroll]
+#elif unrollcount == 1
+    [loop]
+#else
+    [unroll(unrollcount)]
+#endif
+    for (uint counter = 0; counter < blocksize; counter++) {
+#if posformat == 0
+      float4 bj = sharedPos[counter];
+#else
+      float4 bj =
+          float4(unpackPosition(sharedPacked[counter]), sharedMass[counter]);
+#endif
+      bodyBodyInteraction(tileAccel, bj, target, g_fG, 1);
     }
 
+#if accummode == 0
+    accel = tileAccel;
+#elif accummode == 1
+    precise float3 y = tileAccel - compensation;
+    precise float3 t = accel + y;
+    compensation = (t - accel) - y;
+    accel = t;
+#else
+    total += tileAccel;
+#endif
+
     GroupMemoryBarrierWithGroupSync();
   }
-
-  // g_param.x is the number of our particles, however this number might not
-  // be an exact multiple of the tile size. In such cases, out of bound reads
-  // occur in the process above, which means there will be tooManyParticles
-  // "phantom" particles generating false gravity at position (0, 0, 0), so
-  // we have to subtract them here. NOTE, out of bound reads always return 0 in
-  // CS.
-  const int tooManyParticles = g_param.y * blocksize - g_param.x;
-  bodyBodyInteraction(accel, float4(0, 0, 0, 0), pos, mass, -tooManyParticles);
+#if accummode == 2
+  accel = float3(total);
+#endif
 
   // Update the velocity and position of current particle using the
   // acceleration computed above.
@@ -97,6 +181,9 @@ RWStructuredBuffer<PosVelo> newPosVelo : register(u0); // UAV
   vel.xyz *= g_paramf.y;             // damping;
   pos.xyz += vel.xyz * g_paramf.x;   // deltaTime;
 
+  // The padding keeps the zeroed state of the buffers: moved, it would drift
+  // off and could reach inf or NaN, which its zero mass would not cancel.
+  // Its threads still had to load their share of every tile above.
   if (DTid.x < g_param.x) {
     newPosVelo[DTid.x].pos = pos;
     newPosVelo[DTid.x].velo = float4(vel.xyz, length(accel));